@@ -33,8 +33,12 @@ extern font_t f8x8, f8x16;
 #include "gui/image.h"
 #include "gui/label.h"
 #include "gui/map.h"
+#include "gui/render.h"
 #include "gui/waypoint.h"
 
+/* Position shared by the GPS and GUI tasks */
+#include "gps_position.h"
+
 #define BATLEVEL_IMAGES_DEFAULT
 #include "gui/battery_indicator.h"
 /* SD Card */
@@ -11,26 +11,59 @@
 #include <stdbool.h>
 
 #include "gui.h"
-#ifdef LINUX
+#include "storage.h"
+#include "tile_index.h"
+#include "tile_pack.h"
+
+/*
+ * Priorities of SD card requests, the SD task always serves the most urgent
+ * request first
+ */
+typedef enum {
+    SD_PRIO_INTERACTIVE, // tiles and files the screen waits for
+    SD_PRIO_PREFETCH,    // data that will be needed soon
+    SD_PRIO_LOG,         // GPX track log
+    SD_PRIO_DOWNLOAD,    // map downloader
+    SD_PRIO_MAX,
+} sd_priority_t;
+
+/*
+ * What the screen shows of the GPS, the receiver only sends what is needed
+ */
+typedef enum {
+    GPS_PROFILE_MAP,        // position and time, the satellites in view now and then
+    GPS_PROFILE_SATELLITES, // everything about the satellites
+    GPS_PROFILE_MAX,
+} gps_profile_t;
+
+typedef struct sd_stream sd_stream_t;
+typedef struct sd_request sd_request_t;
+struct sd_request {
+    error_code_t (*run)(void* arg);  /// card access, runs on the SD task
+    void (*done)(sd_request_t* req); /// completion callback, runs on the SD task
+    void* arg;
+    void* context;                   /// free for the owner of the request
+    error_code_t status;             /// result of run, UNAVAILABLE without card
+};
+
 typedef struct
 {
     char* filename;
     char* dest;
     uint8_t loaded;
-    void* file;
+    sd_priority_t priority; /// queue for requests on this file
+    storage_file_t* file;
 } async_file_t;
 
+#ifdef LINUX
 #    define save_sprintf(dest, size, format, ...) sprintf(dest, size, format, ##__VA_ARGS__)
 #    define save_snprintf(dest, size, format, ...) snprintf(dest, size, format, ##__VA_ARGS__)
 #else
 #    include <freertos/semphr.h>
 
-#    include <ff.h>
-
 // Create semphore
 extern SemaphoreHandle_t print_semaphore;
 extern SemaphoreHandle_t gui_semaphore;
-extern SemaphoreHandle_t sd_semaphore;
 
 extern QueueHandle_t eventQueueHandle;
 
@@ -57,13 +90,6 @@ typedef enum {
     TASK_EVENT_STOP_CHARGING,
 } task_events_e;
 
-typedef struct
-{
-    char* filename;
-    char* dest;
-    uint8_t loaded;
-    FIL* file;
-} async_file_t;
 
 #    define save_sprintf(dest, format, ...)                 \
         do {                                                \
@@ -85,8 +111,18 @@ typedef struct
         } while (0);
 #endif
 
-// From sd.c
+// From sd.c, storage of the SD card, only used on the SD task
+extern storage_t* sd_storage;
 error_code_t waitForSDInit();
+error_code_t sd_submit(sd_request_t* req, sd_priority_t priority);
+error_code_t sd_call(sd_priority_t priority, error_code_t (*run)(void* arg), void* arg);
+error_code_t sd_read_at(const char* path, uint32_t offset, void* data, size_t size, size_t* length);
+sd_stream_t* sd_stream_open(const char* filename, sd_priority_t priority, size_t buffer_size, uint32_t preallocate);
+error_code_t sd_stream_write(sd_stream_t* stream, const void* data, size_t length);
+error_code_t sd_stream_sync(sd_stream_t* stream);
+error_code_t sd_stream_close(sd_stream_t* stream);
+error_code_t sd_stream_sync_all();
+void sd_stream_release_unclosed();
 error_code_t loadTile(map_tile_t* tile);
 error_code_t loadFile(async_file_t* file);
 error_code_t fileExists(async_file_t* file);
@@ -99,11 +135,24 @@ error_code_t deleteFile(async_file_t* file);
 char* readline(char* c, char* d);
 void closePhysicalFile(async_file_t* file);
 
+// From storage/tiles.c
+error_code_t map_tiles_index_range(sd_priority_t priority, uint8_t zoom, uint32_t x_min, uint32_t x_max, uint32_t y_min, uint32_t y_max);
+error_code_t map_tiles_index_track(sd_priority_t priority);
+enum TilePresence map_tiles_lookup(const map_tile_t* tile);
+void map_tiles_set(uint8_t zoom, uint32_t x, uint32_t y, uint8_t present);
+void map_tiles_pack_path(char* path, uint8_t zoom, uint32_t x_min, uint32_t x_max, uint32_t y_min, uint32_t y_max, const char* extension);
+error_code_t map_tiles_add_pack(sd_priority_t priority, const char* path);
+uint8_t map_tiles_has_pack(uint8_t zoom, uint32_t x_min, uint32_t x_max, uint32_t y_min, uint32_t y_max);
+error_code_t map_tiles_packed_entry(uint8_t zoom, uint32_t x, uint32_t y, tile_pack_entry_t* entry);
+error_code_t map_tiles_read_packed(const map_tile_t* tile, void* data, size_t size, size_t* length);
+
 // From gps.c
 void gps_screen_element(const display_t* dsp);
 bool gps_is_position_known();
 void gps_stop_parser();
 void gps_enter_standby();
+void gps_export_track();
+void gps_set_profile(gps_profile_t profile);
 
 // From main.c
 error_code_t enter_deep_sleep_if_not_charging();
@@ -112,6 +161,7 @@ void set_long_press_event(void (*event)(void));
 
 // From gui.c
 void trigger_rendering();
+void trigger_update();
 
 // From wifi.c
 bool isConnected();
@@ -0,0 +1,17 @@
+/*
+ * CRC-32 as used by zlib, Ethernet and PNG
+ *
+ * Copyright (c) 2022, Bastian Neumann <info@platinenmacher.tech>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef PLATINENMACHER_CRC32_H
+#define PLATINENMACHER_CRC32_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+uint32_t crc32_update(uint32_t crc, const void* data, size_t length);
+
+#endif // PLATINENMACHER_CRC32_H
@@ -22,10 +22,33 @@ display_t* display_init(uint16_t width, uint16_t height, uint8_t bpp,
     disp->size.height = height;
     disp->bpp = bpp;
     disp->rotation = rotation;
+    display_reset_clip(disp);
 
     return disp;
 }
 
+/**
+ * @brief Restrict drawing to a part of the display
+ *
+ * The clip is limited to the display size.
+ */
+void display_set_clip(display_t* dsp, const rect_t* clip)
+{
+    rect_t full = { 0, 0, dsp->size.width, dsp->size.height };
+    dsp->clip = rect_intersect(&full, clip);
+}
+
+/**
+ * @brief Allow drawing on the whole display again
+ */
+void display_reset_clip(display_t* dsp)
+{
+    dsp->clip.left = 0;
+    dsp->clip.top = 0;
+    dsp->clip.width = dsp->size.width;
+    dsp->clip.height = dsp->size.height;
+}
+
 /*
  * Commit FB content to hardware display
  */
@@ -43,8 +66,8 @@ error_code_t display_commit_fb(const display_t* dsp)
  */
 error_code_t display_fill(const display_t* dsp, color_t color)
 {
-    for (int x = 0; x < dsp->size.width; x++)
-        for (int y = 0; y < dsp->size.height; y++) {
+    for (int x = dsp->clip.left; x < dsp->clip.left + dsp->clip.width; x++)
+        for (int y = dsp->clip.top; y < dsp->clip.top + dsp->clip.height; y++) {
             display_pixel_draw(dsp, x, y, color);
         }
     return PM_OK;
@@ -55,14 +78,16 @@ error_code_t display_fill(const display_t* dsp, color_t color)
  * Draws a pixel with color to position x,y on the framebuffer
  *
  * @return PM_OK if driver is unloaded
- * @return OUT_OF_BOUNDS if one or more pixels where out of bounds
+ * @return OUT_OF_BOUNDS if one or more pixels where out of bounds or clip
  * @return PM_FAIL if write_pixel is NULL
  *
  */
 error_code_t display_pixel_draw(const display_t* dsp, int16_t x, int16_t y,
     color_t color)
 {
-    if (x < 0 || y < 0 || x >= dsp->size.width || y >= dsp->size.height)
+    if (x < dsp->clip.left || y < dsp->clip.top
+        || x >= dsp->clip.left + dsp->clip.width
+        || y >= dsp->clip.top + dsp->clip.height)
         return OUT_OF_BOUNDS;
 
     if (color == TRANSPARENT)
@@ -289,9 +314,11 @@ error_code_t display_circle_draw_segment(const display_t* dsp, int16_t x0,
 error_code_t display_rect_fill(const display_t* dsp, int16_t x0, int16_t y0,
     uint16_t width, uint16_t height, uint8_t color)
 {
-    for (uint16_t x = 0; x < width; x++)
-        for (uint16_t y = 0; y < height; y++) {
-            display_pixel_draw(dsp, x0 + x, y0 + y, color);
+    rect_t box = { x0, y0, width, height };
+    rect_t area = rect_intersect(&box, &dsp->clip);
+    for (int16_t x = area.left; x < area.left + area.width; x++)
+        for (int16_t y = area.top; y < area.top + area.height; y++) {
+            display_pixel_draw(dsp, x, y, color);
         }
     return PM_OK;
 }
@@ -377,9 +404,11 @@ error_code_t display_draw_image(const display_t* dsp, const uint8_t* data, int16
         ret = OUT_OF_BOUNDS;
 
     rect_t box = { x, y, w, h };
+    rect_t area = rect_intersect(&box, &dsp->clip);
 
-    for (int16_t y0 = 0; y0 < h; y0++)
-        for (int16_t x0 = 0; x0 < w; x0++) {
+    /* only decompress the part of the image that can be seen */
+    for (int16_t y0 = area.top - y; y0 < area.top - y + area.height; y0++)
+        for (int16_t x0 = area.left - x; x0 < area.left - x + area.width; x0++) {
             display_pixel_draw(dsp, x0 + x, y0 + y,
                 dsp->decompress(&box, x0, y0, data));
         }
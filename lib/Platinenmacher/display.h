@@ -28,6 +28,7 @@ typedef struct display display_t;
 struct display
 {
 	rect_t size;
+	rect_t clip; // -> drawing outside of clip is discarded, defaults to size
 	uint8_t *fb; // -> Framebuffer (size.width * size.height *bbp / 8) bytes
 	uint32_t fb_size;
 	uint8_t bpp; // -> Bits per pixel
@@ -46,6 +47,8 @@ inline size_t sizeof_fb(rect_t size, uint8_t bpp)
 
 display_t *display_init(uint16_t width, uint16_t height, uint8_t bpp,
 						display_rotation_t rotation);
+void display_set_clip(display_t *dsp, const rect_t *clip);
+void display_reset_clip(display_t *dsp);
 error_code_t display_fill(const display_t *dsp, color_t color);
 error_code_t display_pixel_draw(const display_t *dsp, int16_t x, int16_t y,
 								color_t color);
@@ -0,0 +1,415 @@
+/*
+ * HTTP/1.1 downloader for many small files from one server
+ *
+ * Copyright (c) 2022, Bastian Neumann <info@platinenmacher.tech>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "downloader.h"
+#include "crc32.h"
+#include "memory.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <strings.h>
+
+static const char* TAG = "downloader";
+
+typedef struct {
+    uint16_t status;
+    int64_t length; /// -1 if the body ends with the connection
+    uint8_t chunked;
+    uint8_t close;
+} response_t;
+
+static int64_t now_ms()
+{
+    return RTOS_Micros() / 1000;
+}
+
+/**
+ * Split http://host[:port]/path
+ *
+ * path points into url, other schemes return PM_FAIL
+ */
+error_code_t downloader_parse_url(const char* url, char* host, size_t size, uint16_t* port, const char** path)
+{
+    if (strncasecmp(url, "http://", 7))
+        return PM_FAIL;
+    url += 7;
+    size_t length = strcspn(url, ":/");
+    if (!length || length >= size)
+        return PM_FAIL;
+    memcpy(host, url, length);
+    host[length] = 0;
+    url += length;
+    *port = 80;
+    if (*url == ':') {
+        char* end;
+        unsigned long p = strtoul(url + 1, &end, 10);
+        if (end == url + 1 || !p || p > 65535)
+            return PM_FAIL;
+        *port = p;
+        url = end;
+    }
+    if (*url && *url != '/')
+        return PM_FAIL;
+    *path = url;
+    return PM_OK;
+}
+
+downloader_t* downloader_create(transport_t* transport, const char* host, uint16_t port, const downloader_handler_t* handler)
+{
+    if (strlen(host) >= DOWNLOADER_HOST_LENGTH)
+        return NULL;
+    downloader_t* d = RTOS_Malloc(sizeof(downloader_t));
+    if (!d)
+        return NULL;
+    if (!(d->buffer = RTOS_Malloc(DOWNLOADER_BUFFER_SIZE))) {
+        RTOS_Free(d);
+        return NULL;
+    }
+    d->transport = transport;
+    strcpy(d->host, host);
+    d->port = port;
+    d->handler = *handler;
+    d->max_in_flight = 4;
+    d->max_attempts = 5;
+    d->backoff_ms = 1000;
+    d->backoff_max_ms = 60000;
+    return d;
+}
+
+static void disconnect(downloader_t* d)
+{
+    if (d->connected)
+        d->transport->close(d->transport);
+    d->connected = 0;
+    d->buffer_start = d->buffer_end = 0;
+    /* requests without a response are sent again on the next connection */
+    for (uint8_t i = 0; i < d->sent_count; i++)
+        d->slots[d->sent[i]].state = DOWNLOAD_QUEUED;
+    d->sent_count = 0;
+}
+
+void downloader_free(downloader_t* d)
+{
+    if (!d)
+        return;
+    disconnect(d);
+    RTOS_Free(d->buffer);
+    RTOS_Free(d);
+}
+
+static uint32_t backoff(const downloader_t* d, uint8_t failures)
+{
+    uint32_t delay = d->backoff_ms;
+    while (--failures && delay < d->backoff_max_ms)
+        delay <<= 1;
+    return delay < d->backoff_max_ms ? delay : d->backoff_max_ms;
+}
+
+/* try the file again later or give up on it */
+static void download_failed(downloader_t* d, download_t* dl)
+{
+    if (++dl->attempts >= d->max_attempts) {
+        ESP_LOGE(TAG, "giving up on %s", dl->path);
+        d->stats.failed++;
+        d->handler.finish(d->handler.arg, dl, PM_FAIL);
+        dl->state = DOWNLOAD_FREE;
+        return;
+    }
+    d->stats.retries++;
+    dl->due = now_ms() + backoff(d, dl->attempts);
+    dl->state = DOWNLOAD_QUEUED;
+}
+
+/* the oldest request got its response */
+static download_t* pop_sent(downloader_t* d)
+{
+    download_t* dl = &d->slots[d->sent[0]];
+    d->sent_count--;
+    memmove(d->sent, d->sent + 1, d->sent_count);
+    return dl;
+}
+
+static error_code_t fill(downloader_t* d)
+{
+    size_t length;
+    if (d->buffer_start == d->buffer_end) {
+        d->buffer_start = d->buffer_end = 0;
+    } else if (d->buffer_end == DOWNLOADER_BUFFER_SIZE) {
+        memmove(d->buffer, d->buffer + d->buffer_start, d->buffer_end - d->buffer_start);
+        d->buffer_end -= d->buffer_start;
+        d->buffer_start = 0;
+    }
+    error_code_t ret = d->transport->recv(d->transport, d->buffer + d->buffer_end, DOWNLOADER_BUFFER_SIZE - d->buffer_end, &length);
+    if (ret == PM_OK)
+        d->buffer_end += length;
+    return ret;
+}
+
+/* one line without the line break, longer lines are cut */
+static error_code_t read_line(downloader_t* d, char* line, size_t size)
+{
+    size_t n = 0;
+    while (1) {
+        while (d->buffer_start < d->buffer_end) {
+            char c = d->buffer[d->buffer_start++];
+            if (c == '\n') {
+                if (n && line[n - 1] == '\r')
+                    n--;
+                line[n] = 0;
+                return PM_OK;
+            }
+            if (n + 1 < size)
+                line[n++] = c;
+        }
+        error_code_t ret = fill(d);
+        if (ret != PM_OK)
+            return ret;
+    }
+}
+
+static error_code_t read_header(downloader_t* d, response_t* r)
+{
+    char line[128];
+    error_code_t ret = read_line(d, line, sizeof(line));
+    if (ret != PM_OK)
+        return ret;
+    if (strncmp(line, "HTTP/1.", 7) || strlen(line) < 12)
+        return PM_FAIL;
+    r->status = atoi(line + 9);
+    r->length = -1;
+    r->chunked = 0;
+    r->close = line[7] == '0'; // HTTP/1.0 closes unless told otherwise
+    if (r->status == 204 || r->status == 304)
+        r->length = 0;
+
+    while ((ret = read_line(d, line, sizeof(line))) == PM_OK && line[0]) {
+        char* value = strchr(line, ':');
+        if (!value)
+            continue;
+        *value++ = 0;
+        while (*value == ' ' || *value == '\t')
+            value++;
+        if (!strcasecmp(line, "Content-Length"))
+            r->length = strtoul(value, NULL, 10);
+        else if (!strcasecmp(line, "Transfer-Encoding"))
+            r->chunked = !!strcasecmp(value, "identity");
+        else if (!strcasecmp(line, "Connection") && !strcasecmp(value, "close"))
+            r->close = 1;
+        else if (!strcasecmp(line, "Connection") && !strcasecmp(value, "keep-alive"))
+            r->close = 0;
+    }
+    return ret;
+}
+
+/* pass length bytes of the body to the handler, or all until the connection closes */
+static error_code_t read_data(downloader_t* d, download_t* dl, uint64_t length, uint8_t until_close, error_code_t* stored)
+{
+    while (length || until_close) {
+        if (d->buffer_start == d->buffer_end) {
+            error_code_t ret = fill(d);
+            if (ret == ABORT && until_close)
+                return PM_OK;
+            if (ret != PM_OK)
+                return ret;
+        }
+        size_t chunk = d->buffer_end - d->buffer_start;
+        if (!until_close && chunk > length)
+            chunk = length;
+        if (*stored == PM_OK) {
+            *stored = d->handler.write(d->handler.arg, dl, d->buffer + d->buffer_start, chunk);
+            d->stats.bytes += chunk;
+            if (dl->verify)
+                d->body_crc = crc32_update(d->body_crc, d->buffer + d->buffer_start, chunk);
+            d->body_size += chunk;
+        }
+        d->buffer_start += chunk;
+        if (!until_close)
+            length -= chunk;
+    }
+    return PM_OK;
+}
+
+static error_code_t read_chunked(downloader_t* d, download_t* dl, error_code_t* stored)
+{
+    char line[32];
+    error_code_t ret;
+    while (1) {
+        if ((ret = read_line(d, line, sizeof(line))) != PM_OK)
+            return ret;
+        unsigned long length = strtoul(line, NULL, 16);
+        if (!length)
+            break;
+        if ((ret = read_data(d, dl, length, 0, stored)) != PM_OK)
+            return ret;
+        if ((ret = read_line(d, line, sizeof(line))) != PM_OK)
+            return ret;
+    }
+    /* the trailer ends with an empty line */
+    while ((ret = read_line(d, line, sizeof(line))) == PM_OK && line[0])
+        ;
+    return ret;
+}
+
+/* read the response to the oldest request */
+static error_code_t receive(downloader_t* d)
+{
+    download_t* dl = &d->slots[d->sent[0]];
+    response_t r;
+    error_code_t ret;
+
+    if (d->buffer_start == d->buffer_end) {
+        ret = fill(d);
+        if (ret != PM_OK && ret != TIMEOUT && d->responses) {
+            /* the server closed the idle connection, nothing is lost */
+            disconnect(d);
+            return PM_OK;
+        }
+        if (ret != PM_OK)
+            goto lost;
+    }
+    if ((ret = read_header(d, &r)) != PM_OK)
+        goto lost;
+
+    /* other answers are read as well to keep the connection in sync */
+    error_code_t stored = NOT_NEEDED;
+    d->body_size = d->body_crc = 0;
+    if (r.status == 200)
+        stored = d->handler.open(d->handler.arg, dl, r.length < 0 ? 0 : r.length);
+    if (r.chunked)
+        ret = read_chunked(d, dl, &stored);
+    else
+        ret = read_data(d, dl, r.length < 0 ? 0 : r.length, r.length < 0, &stored);
+    if (ret != PM_OK)
+        goto lost;
+
+    d->responses++;
+    d->connect_failures = 0;
+    pop_sent(d);
+    if (r.status == 200 && stored == PM_OK && dl->verify && (d->body_size != dl->size || d->body_crc != dl->crc)) {
+        ESP_LOGE(TAG, "%s: %lu bytes with crc %08lx, expected %lu with %08lx", dl->path, (unsigned long)d->body_size,
+            (unsigned long)d->body_crc, (unsigned long)dl->size, (unsigned long)dl->crc);
+        d->stats.corrupt++;
+        download_failed(d, dl);
+    } else if (r.status == 200 && stored == PM_OK) {
+        d->stats.files++;
+        d->handler.finish(d->handler.arg, dl, PM_OK);
+        dl->state = DOWNLOAD_FREE;
+    } else if (r.status == 404 || r.status == 410) {
+        d->stats.missing++;
+        d->handler.finish(d->handler.arg, dl, UNAVAILABLE);
+        dl->state = DOWNLOAD_FREE;
+    } else {
+        ESP_LOGE(TAG, "%s: status %u", dl->path, r.status);
+        download_failed(d, dl);
+    }
+    if (r.close || (r.length < 0 && !r.chunked))
+        disconnect(d);
+    return PM_OK;
+
+lost:
+    ESP_LOGE(TAG, "connection lost on %s", dl->path);
+    pop_sent(d);
+    download_failed(d, dl);
+    disconnect(d);
+    return ret;
+}
+
+static error_code_t send_requests(downloader_t* d, int64_t now)
+{
+    char request[DOWNLOADER_PATH_LENGTH + DOWNLOADER_HOST_LENGTH + 64];
+    char port[8] = "";
+    if (d->port != 80)
+        snprintf(port, sizeof(port), ":%u", d->port);
+
+    for (uint8_t i = 0; i < d->max_in_flight && d->sent_count < d->max_in_flight; i++) {
+        download_t* dl = &d->slots[i];
+        if (dl->state != DOWNLOAD_QUEUED || dl->due > now)
+            continue;
+        int length = snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: %s%s\r\nUser-Agent: IndiaNavi\r\n\r\n",
+            dl->path[0] ? dl->path : "/", d->host, port);
+        error_code_t ret = d->transport->send(d->transport, request, length);
+        if (ret != PM_OK)
+            return ret;
+        dl->state = DOWNLOAD_SENT;
+        d->sent[d->sent_count++] = i;
+    }
+    return PM_OK;
+}
+
+/**
+ * Download every file the handler hands out
+ *
+ * Returns PM_OK when the handler has no more files and every file is
+ * finished, or TIMEOUT if the server cannot be reached max_attempts times in
+ * a row. Pending files are kept, call again once the network is back.
+ */
+error_code_t downloader_run(downloader_t* d)
+{
+    if (d->max_in_flight > DOWNLOADER_MAX_IN_FLIGHT)
+        d->max_in_flight = DOWNLOADER_MAX_IN_FLIGHT;
+    if (!d->max_in_flight)
+        d->max_in_flight = 1;
+
+    while (1) {
+        for (uint8_t i = 0; i < d->max_in_flight && !d->exhausted; i++) {
+            download_t* dl = &d->slots[i];
+            if (dl->state != DOWNLOAD_FREE)
+                continue;
+            memset(dl, 0, sizeof(download_t));
+            if (d->handler.next(d->handler.arg, dl) == PM_OK)
+                dl->state = DOWNLOAD_QUEUED;
+            else
+                d->exhausted = 1;
+        }
+
+        int64_t now = now_ms();
+        int64_t wake = INT64_MAX;
+        uint8_t pending = 0, ready = 0;
+        for (uint8_t i = 0; i < d->max_in_flight; i++) {
+            download_t* dl = &d->slots[i];
+            if (dl->state == DOWNLOAD_FREE)
+                continue;
+            pending++;
+            if (dl->state == DOWNLOAD_QUEUED && dl->due <= now)
+                ready++;
+            else if (dl->state == DOWNLOAD_QUEUED && dl->due < wake)
+                wake = dl->due;
+        }
+        if (!pending) {
+            disconnect(d);
+            return PM_OK;
+        }
+
+        if (ready) {
+            error_code_t ret = PM_OK;
+            if (!d->connected && (ret = d->transport->connect(d->transport, d->host, d->port)) == PM_OK) {
+                d->connected = 1;
+                d->responses = 0;
+                d->stats.connections++;
+            }
+            if (ret == PM_OK)
+                ret = send_requests(d, now);
+            if (ret != PM_OK) {
+                disconnect(d);
+                if (++d->connect_failures >= d->max_attempts) {
+                    d->connect_failures = 0;
+                    return TIMEOUT;
+                }
+                RTOS_Delay(backoff(d, d->connect_failures));
+                continue;
+            }
+        }
+
+        if (!d->sent_count) {
+            /* every pending file waits for its backoff */
+            RTOS_Delay(wake - now);
+            continue;
+        }
+        receive(d);
+    }
+}
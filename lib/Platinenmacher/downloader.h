@@ -0,0 +1,97 @@
+/*
+ * HTTP/1.1 downloader for many small files from one server
+ *
+ * All files are fetched over one keep-alive connection. Up to max_in_flight
+ * requests are pipelined, so the next response is already on its way while
+ * the current one is written to the card. A file that fails is retried on
+ * its own with an exponential backoff, the others keep going. Files with a
+ * known size and CRC-32 are checked while they stream in, a corrupt one is
+ * retried like a failed one.
+ *
+ * Copyright (c) 2022, Bastian Neumann <info@platinenmacher.tech>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef PLATINENMACHER_DOWNLOADER_H
+#define PLATINENMACHER_DOWNLOADER_H
+
+#include "transport.h"
+
+#define DOWNLOADER_MAX_IN_FLIGHT 8
+#define DOWNLOADER_HOST_LENGTH 64
+#define DOWNLOADER_PATH_LENGTH 96
+#define DOWNLOADER_BUFFER_SIZE 2048 /// receive buffer, body chunks are handed out of it
+
+enum DownloadState {
+    DOWNLOAD_FREE,
+    DOWNLOAD_QUEUED, /// waiting to be requested, after due
+    DOWNLOAD_SENT,   /// requested, response pending
+};
+
+typedef struct {
+    char path[DOWNLOADER_PATH_LENGTH]; /// request path on the server
+    uint32_t key[3];                   /// identifies the file for the handler, e.g. zoom, x and y
+    uint8_t verify;                    /// check size and crc of the body before it is finished
+    uint32_t size;
+    uint32_t crc; /// CRC-32
+    uint8_t attempts;
+    int64_t due; /// ms, not requested before
+    uint8_t state;
+} download_t;
+
+typedef struct {
+    /* fill path and key of the next file, NOT_NEEDED if there is none left */
+    error_code_t (*next)(void* arg, download_t* d);
+    /* the server answered with the file, called again on a retry */
+    error_code_t (*open)(void* arg, download_t* d, uint32_t length);
+    error_code_t (*write)(void* arg, download_t* d, const uint8_t* data, size_t length);
+    /* PM_OK, UNAVAILABLE if the server has no such file or PM_FAIL after the last attempt */
+    void (*finish)(void* arg, download_t* d, error_code_t result);
+    void* arg;
+} downloader_handler_t;
+
+typedef struct {
+    uint32_t files;
+    uint32_t missing;
+    uint32_t failed;
+    uint32_t retries;
+    uint32_t corrupt;
+    uint32_t connections;
+    uint64_t bytes;
+} downloader_stats_t;
+
+typedef struct {
+    transport_t* transport;
+    char host[DOWNLOADER_HOST_LENGTH];
+    uint16_t port;
+    downloader_handler_t handler;
+
+    uint8_t max_in_flight;
+    uint8_t max_attempts;    /// per file, and connection attempts before downloader_run gives up
+    uint32_t backoff_ms;     /// delay after the first failure, doubled on every further one
+    uint32_t backoff_max_ms;
+    downloader_stats_t stats;
+
+    download_t slots[DOWNLOADER_MAX_IN_FLIGHT];
+    uint8_t sent[DOWNLOADER_MAX_IN_FLIGHT]; /// slots in request order
+    uint8_t sent_count;
+    uint8_t exhausted;
+    uint8_t connected;
+    uint32_t responses; /// completed on the current connection
+    uint8_t connect_failures;
+
+    uint32_t body_size; /// of the current response
+    uint32_t body_crc;
+
+    uint8_t* buffer;
+    size_t buffer_start;
+    size_t buffer_end;
+} downloader_t;
+
+error_code_t downloader_parse_url(const char* url, char* host, size_t size, uint16_t* port, const char** path);
+downloader_t* downloader_create(transport_t* transport, const char* host, uint16_t port, const downloader_handler_t* handler);
+void downloader_free(downloader_t* d);
+error_code_t downloader_run(downloader_t* d);
+
+#endif // PLATINENMACHER_DOWNLOADER_H
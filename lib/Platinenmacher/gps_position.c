@@ -0,0 +1,61 @@
+/*
+ * Position snapshot shared by the GPS and GUI tasks
+ *
+ * Copyright (c) 2022, Bastian Neumann <info@platinenmacher.tech>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "gps_position.h"
+
+void gps_position_init(gps_position_t* p, const map_position_t* position)
+{
+    p->slot[0] = *position;
+    p->slot[1] = *position;
+    __atomic_store_n(&p->sequence, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * Only one task may publish, the readers are sent to the slot that is not
+ * written
+ */
+void gps_position_publish(gps_position_t* p, const map_position_t* position)
+{
+    uint32_t sequence = p->sequence;
+
+    /* release, readers of the odd sequence copy slot[1] of the last position */
+    __atomic_store_n(&p->sequence, sequence + 1, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    p->slot[0] = *position;
+
+    /* readers of the even sequence copy slot[0], which is complete now */
+    __atomic_store_n(&p->sequence, sequence + 2, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    p->slot[1] = *position;
+}
+
+/**
+ * Copy the last position, the copy is taken again only if the writer moved
+ * on to the slot that was copied
+ *
+ * @return generation of the copy
+ */
+uint32_t gps_position_read(const gps_position_t* p, map_position_t* position)
+{
+    uint32_t sequence;
+    do {
+        sequence = __atomic_load_n(&p->sequence, __ATOMIC_ACQUIRE);
+        *position = p->slot[sequence & 1];
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (__atomic_load_n(&p->sequence, __ATOMIC_RELAXED) != sequence);
+    return sequence >> 1;
+}
+
+/**
+ * Changes with every published position, nothing needs to be copied to find
+ * out if there is a new one
+ */
+uint32_t gps_position_generation(const gps_position_t* p)
+{
+    return __atomic_load_n(&p->sequence, __ATOMIC_ACQUIRE) >> 1;
+}
@@ -0,0 +1,36 @@
+/*
+ * Position snapshot shared by the GPS and GUI tasks
+ *
+ * The last position is published by the GPS task and read by the GUI task
+ * without a lock. The position is kept twice: while one copy is written the
+ * readers take the other one, so a reader never waits for the writer and
+ * always gets the fields of one fix. The sequence counts both halves of every
+ * update, half of it is the generation a reader can compare with the one it
+ * rendered.
+ *
+ * Copyright (c) 2022, Bastian Neumann <info@platinenmacher.tech>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef PLATINENMACHER_GPS_POSITION_H
+#define PLATINENMACHER_GPS_POSITION_H
+
+#include "gui/map.h"
+
+#include <stdint.h>
+
+typedef struct {
+    uint32_t sequence; /// odd while slot 0 is written, even while slot 1 is
+    map_position_t slot[2];
+} gps_position_t;
+
+/* both slots hold the same position, the generation is 0 */
+#define GPS_POSITION_INITIALIZER(...) { .slot = { { __VA_ARGS__ }, { __VA_ARGS__ } } }
+
+void gps_position_init(gps_position_t* p, const map_position_t* position);
+void gps_position_publish(gps_position_t* p, const map_position_t* position);
+uint32_t gps_position_read(const gps_position_t* p, map_position_t* position);
+uint32_t gps_position_generation(const gps_position_t* p);
+
+#endif
@@ -0,0 +1,203 @@
+/*
+ * Streaming GPX writer
+ *
+ * Copyright (c) 2022, Bastian Neumann <info@platinenmacher.tech>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "gpx_writer.h"
+
+#include <string.h>
+
+static const char gpx_header[] = "<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"yes\"?>\n"
+                                 "<gpx version=\"1.1\" creator=\"IndiaNavi\" xmlns=\"http://www.topografix.com/GPX/1/1\" xmlns:xsi=\"http://www.w3.org/2001/XMLSchema-instance\" xsi:schemaLocation=\"http://www.topografix.com/GPX/1/1 http://www.topografix.com/GPX/1/1/gpx.xsd\" xmlns:oa=\"http://www.outdooractive.com/GPX/Extensions/1\">\n"
+                                 "<metadata>\n"
+                                 "<name>WanderNavi IndiaNavi</name>\n"
+                                 "<link href=\"https://platinenmacher.tech\"/>\n";
+
+static const char gpx_track[] = "<extensions><oa:oaCategory>hikingTourTrail</oa:oaCategory></extensions>\n"
+                                "</metadata>\n"
+                                "<trk>\n";
+
+static void flush(gpx_writer_t* w)
+{
+    if (w->length && w->error == PM_OK)
+        w->error = w->output(w->arg, w->buffer, w->length);
+    w->length = 0;
+}
+
+static void put(gpx_writer_t* w, const char* data, size_t length)
+{
+    while (length) {
+        if (w->length == GPX_WRITER_BUFFER)
+            flush(w);
+        size_t n = GPX_WRITER_BUFFER - w->length;
+        if (n > length)
+            n = length;
+        memcpy(w->buffer + w->length, data, n);
+        w->length += n;
+        data += n;
+        length -= n;
+    }
+}
+
+static void put_string(gpx_writer_t* w, const char* text)
+{
+    put(w, text, strlen(text));
+}
+
+/* text content, the characters XML reserves are escaped */
+static void put_text(gpx_writer_t* w, const char* text)
+{
+    for (; *text; text++) {
+        switch (*text) {
+        case '<':
+            put_string(w, "&lt;");
+            break;
+        case '>':
+            put_string(w, "&gt;");
+            break;
+        case '&':
+            put_string(w, "&amp;");
+            break;
+        default:
+            put(w, text, 1);
+        }
+    }
+}
+
+/* value / 10^decimals with all decimals */
+static void put_fixed(gpx_writer_t* w, int32_t value, uint8_t decimals)
+{
+    char digits[16];
+    uint8_t i = sizeof(digits);
+    uint32_t v = value < 0 ? -(uint32_t)value : (uint32_t)value;
+    for (uint8_t d = 0; d <= decimals || v; d++) {
+        if (d == decimals && decimals)
+            digits[--i] = '.';
+        digits[--i] = '0' + v % 10;
+        v /= 10;
+    }
+    if (value < 0)
+        digits[--i] = '-';
+    put(w, digits + i, sizeof(digits) - i);
+}
+
+static void put_number(char* dest, uint32_t value, uint8_t width)
+{
+    while (width--) {
+        dest[width] = '0' + value % 10;
+        value /= 10;
+    }
+}
+
+/* ISO 8601 in UTC, the days are converted to a date without gmtime */
+static void put_time(gpx_writer_t* w, uint32_t time)
+{
+    char text[] = "0000-00-00T00:00:00Z";
+    uint32_t days = time / 86400;
+    uint32_t seconds = time % 86400;
+    /* civil from days, the year starts in March */
+    uint32_t z = days + 719468;
+    uint32_t era = z / 146097;
+    uint32_t doe = z - era * 146097;
+    uint32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    uint32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    uint32_t mp = (5 * doy + 2) / 153;
+    uint32_t day = doy - (153 * mp + 2) / 5 + 1;
+    uint32_t month = mp < 10 ? mp + 3 : mp - 9;
+    uint32_t year = yoe + era * 400 + (month <= 2);
+
+    put_number(text, year, 4);
+    put_number(text + 5, month, 2);
+    put_number(text + 8, day, 2);
+    put_number(text + 11, seconds / 3600, 2);
+    put_number(text + 14, seconds / 60 % 60, 2);
+    put_number(text + 17, seconds % 60, 2);
+    put(w, text, sizeof(text) - 1);
+}
+
+/**
+ * Seconds since 1970 of a date and time in UTC
+ */
+uint32_t gpx_time(uint16_t year, uint8_t month, uint8_t day, uint8_t hour, uint8_t minute, uint8_t second)
+{
+    uint32_t y = year - (month <= 2);
+    uint32_t era = y / 400;
+    uint32_t yoe = y - era * 400;
+    uint32_t doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    uint32_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    uint32_t days = era * 146097 + doe - 719468;
+    return days * 86400 + hour * 3600 + minute * 60 + second;
+}
+
+/**
+ * Write the header of a file with one track
+ */
+void gpx_writer_begin(gpx_writer_t* w, gpx_output_t output, void* arg, const char* name, uint32_t time)
+{
+    memset(w, 0, sizeof(gpx_writer_t));
+    w->output = output;
+    w->arg = arg;
+    put_string(w, gpx_header);
+    put_string(w, "<time>");
+    put_time(w, time);
+    put_string(w, "</time>\n");
+    put_string(w, gpx_track);
+    put_string(w, "<name>");
+    put_text(w, name);
+    put_string(w, "</name>\n<type>hikingTourTrail</type>\n");
+}
+
+/**
+ * Continue a file that was written up to its closing tags
+ */
+void gpx_writer_resume(gpx_writer_t* w, gpx_output_t output, void* arg, uint8_t in_segment)
+{
+    memset(w, 0, sizeof(gpx_writer_t));
+    w->output = output;
+    w->arg = arg;
+    w->in_segment = in_segment;
+}
+
+/**
+ * Start a new track segment, the points before and after are not connected
+ */
+void gpx_writer_segment(gpx_writer_t* w)
+{
+    if (w->in_segment)
+        put_string(w, "</trkseg>\n");
+    put_string(w, "<trkseg>\n");
+    w->in_segment = 1;
+}
+
+/**
+ * Add a point, lat and lon in degrees * 1e7, ele in decimeters
+ */
+void gpx_writer_point(gpx_writer_t* w, int32_t lat, int32_t lon, int32_t ele, uint32_t time)
+{
+    if (!w->in_segment)
+        gpx_writer_segment(w);
+    put_string(w, "<trkpt lat=\"");
+    put_fixed(w, lat, 7);
+    put_string(w, "\" lon=\"");
+    put_fixed(w, lon, 7);
+    put_string(w, "\"><ele>");
+    put_fixed(w, ele, 1);
+    put_string(w, "</ele><time>");
+    put_time(w, time);
+    put_string(w, "</time></trkpt>\n");
+}
+
+/**
+ * Close the file, returns the first error of the output
+ */
+error_code_t gpx_writer_end(gpx_writer_t* w)
+{
+    if (w->in_segment)
+        put_string(w, "</trkseg>\n");
+    put_string(w, "</trk>\n</gpx>\n");
+    flush(w);
+    return w->error;
+}
@@ -0,0 +1,43 @@
+/*
+ * Streaming GPX writer
+ *
+ * Writes a track point by point through an output function, numbers and
+ * times are formatted without printf, so no lock is needed and the
+ * output is the same on every platform.
+ *
+ * Copyright (c) 2022, Bastian Neumann <info@platinenmacher.tech>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef PLATINENMACHER_GPX_WRITER_H
+#define PLATINENMACHER_GPX_WRITER_H
+
+#include "error.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define GPX_WRITER_BUFFER 256 /// output is collected up to this size
+
+/* takes the next piece of the file */
+typedef error_code_t (*gpx_output_t)(void* arg, const void* data, size_t length);
+
+typedef struct {
+    gpx_output_t output;
+    void* arg;
+    char buffer[GPX_WRITER_BUFFER];
+    size_t length;
+    uint8_t in_segment;
+    error_code_t error; /// first error of the output, later writes are dropped
+} gpx_writer_t;
+
+void gpx_writer_begin(gpx_writer_t* w, gpx_output_t output, void* arg, const char* name, uint32_t time);
+void gpx_writer_resume(gpx_writer_t* w, gpx_output_t output, void* arg, uint8_t in_segment);
+void gpx_writer_segment(gpx_writer_t* w);
+void gpx_writer_point(gpx_writer_t* w, int32_t lat, int32_t lon, int32_t ele, uint32_t time);
+error_code_t gpx_writer_end(gpx_writer_t* w);
+
+uint32_t gpx_time(uint16_t year, uint8_t month, uint8_t day, uint8_t hour, uint8_t minute, uint8_t second);
+
+#endif // PLATINENMACHER_GPX_WRITER_H
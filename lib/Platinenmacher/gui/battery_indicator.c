@@ -9,8 +9,14 @@
 #include "battery_indicator.h"
 #include "memory.h"
 
+#include <string.h>
+
 void battery_indicator_set_level(battery_indicator_t* battery, uint8_t level)
 {
+    uint8_t* old_image = battery->image.data;
+    char old_text[BATTERY_CHARGE_STRBUF];
+    memcpy(old_text, battery->label_text, BATTERY_CHARGE_STRBUF);
+
     // battery is full if not below thresholds in batlevels
     battery->image.data = battery->batlevel_images[battery->num_levels - 1];
     for (size_t i = 0; i < battery->num_levels; i++) {
@@ -31,6 +37,12 @@ void battery_indicator_set_level(battery_indicator_t* battery, uint8_t level)
     }
 
     label_shrink_to_text(&battery->label);
+
+    // only redraw if something visible changed
+    if (old_image != battery->image.data)
+        battery->image.dirty = 1;
+    if (memcmp(old_text, battery->label_text, BATTERY_CHARGE_STRBUF))
+        battery->label.dirty = 1;
 }
 
 battery_indicator_t* create_battery_indicator(int16_t left, int16_t top, uint8_t level, bool charging, font_t* font, uint8_t* batlevels, uint8_t** batlevel_images, size_t num_levels)
@@ -47,4 +47,47 @@ typedef enum {
 
 #define length(x,x2,y,y2) (sqrt((x*x2)+(y*y2))) 
 
+static inline int rect_is_empty(const rect_t *r)
+{
+	return r->width == 0 || r->height == 0;
+}
+
+/* intersection of a and b, empty if they do not overlap */
+static inline rect_t rect_intersect(const rect_t *a, const rect_t *b)
+{
+	int32_t left = a->left > b->left ? a->left : b->left;
+	int32_t top = a->top > b->top ? a->top : b->top;
+	int32_t right = (a->left + a->width < b->left + b->width) ? a->left + a->width : b->left + b->width;
+	int32_t bottom = (a->top + a->height < b->top + b->height) ? a->top + a->height : b->top + b->height;
+	rect_t r = { left, top, 0, 0 };
+	if (right > left && bottom > top) {
+		r.width = right - left;
+		r.height = bottom - top;
+	}
+	return r;
+}
+
+/* smallest rect containing a and b, empty rects are ignored */
+static inline rect_t rect_union(const rect_t *a, const rect_t *b)
+{
+	if (rect_is_empty(a))
+		return *b;
+	if (rect_is_empty(b))
+		return *a;
+	int32_t left = a->left < b->left ? a->left : b->left;
+	int32_t top = a->top < b->top ? a->top : b->top;
+	int32_t right = (a->left + a->width > b->left + b->width) ? a->left + a->width : b->left + b->width;
+	int32_t bottom = (a->top + a->height > b->top + b->height) ? a->top + a->height : b->top + b->height;
+	rect_t r = { left, top, right - left, bottom - top };
+	return r;
+}
+
+/* true if inner lies completely inside outer */
+static inline int rect_contains(const rect_t *outer, const rect_t *inner)
+{
+	return inner->left >= outer->left && inner->top >= outer->top
+		&& inner->left + inner->width <= outer->left + outer->width
+		&& inner->top + inner->height <= outer->top + outer->height;
+}
+
 #endif /* PLATINENMACHER_DISPLAY_GUI_GEOMETRIC_H_ */
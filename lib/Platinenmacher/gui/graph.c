@@ -25,6 +25,7 @@ graph_t* graph_create(int16_t left, int16_t top, uint16_t width, uint16_t height
     graph->data_len = data_len;
     graph->font = font;
     graph->background_color = WHITE;
+    graph->dirty = 1;
 
     graph->max_label = label_create(max_str, graph->font, left + 2, top + 2, 0, 8);
     graph->min_label = label_create(min_str, graph->font, left + 2, top + height - 2 - 8, 0, 8);
@@ -89,6 +90,7 @@ error_code_t graph_set_range(graph_t* graph, float min, float max)
     // TODO: deuglify this!!!!
     snprintf(min_str, 10, "%um", graph->min);
     snprintf(max_str, 10, "%um", graph->max);
+    graph->dirty = 1;
 
     return PM_OK;
 }
@@ -103,6 +105,7 @@ error_code_t graph_update_data(graph_t* graph, graph_point_t* data, uint16_t len
 
     graph->data = data;
     graph->data_len = len;
+    graph->dirty = 1;
 
     return PM_OK;
 }
\ No newline at end of file
@@ -33,6 +33,7 @@ typedef struct {
     color_t line_color;
     color_t background_color;
     color_t current_position_color;
+    uint8_t dirty;
 } graph_t;
 
 graph_t* graph_create(int16_t left, int16_t top, uint16_t width, uint16_t height, graph_point_t* data, uint16_t data_len, font_t*font);
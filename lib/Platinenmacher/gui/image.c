@@ -7,17 +7,26 @@
 
 #include "gui/image.h"
 #include "display.h"
+#include "pool.h"
 
+POOL_DEFINE(image_pool, image_t, IMAGE_POOL_SIZE);
+
+/*
+ * Create an image, it lives until image_pool_reset is called.
+ */
 image_t *image_create(uint8_t *data, int16_t left, int16_t top,
 					  uint16_t width, uint16_t height)
 {
-	image_t *image = RTOS_Malloc(sizeof(image_t));
+	image_t *image = pool_alloc(&image_pool);
+	if (!image)
+		return NULL;
 	image->data = data;
 	image->box.height = height;
 	image->box.width = width;
 	image->box.top = top;
 	image->box.left = left;
 	image->loaded = 1;
+	image->dirty = 1;
 	image->onBeforeRender = NULL;
 	image->onAfterRender = NULL;
 
@@ -48,3 +57,19 @@ error_code_t image_render(const display_t *dsp, void *component)
 
 	return PM_OK;
 }
+
+/*
+ * Release an image that is not needed before the next pool reset
+ */
+void image_free(image_t *image)
+{
+	pool_free(&image_pool, image);
+}
+
+/*
+ * Release all images at once, e.g. when the screen changes
+ */
+void image_pool_reset()
+{
+	pool_reset(&image_pool);
+}
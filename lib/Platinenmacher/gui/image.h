@@ -12,6 +12,10 @@
 #include "gui/geometric.h"
 #include "display.h"
 
+#ifndef IMAGE_POOL_SIZE
+#define IMAGE_POOL_SIZE 24 /// images available without heap allocation
+#endif
+
 enum LoadStatus
 {
 	NOT_LOADED,
@@ -30,6 +34,7 @@ typedef struct
 	void *child;  /// Pointer to child element.
 	void *parent; /// Pointer to parent element.
 	enum LoadStatus loaded;
+	uint8_t dirty; /// Set when the image has to be drawn again.
 
 	error_code_t (*onBeforeRender)(const display_t *dsp, void *image);
 	error_code_t (*onAfterRender)(const display_t *dsp, void *image);
@@ -38,5 +43,7 @@ typedef struct
 image_t *image_create(uint8_t *data, int16_t left, int16_t top,
 					  uint16_t width, uint16_t height);
 error_code_t image_render(const display_t *dsp, void *image);
+void image_free(image_t *image);
+void image_pool_reset();
 
 #endif /* PLATINENMACHER_DISPLAY_GUI_IMAGE_H_ */
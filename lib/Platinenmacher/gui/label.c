@@ -11,14 +11,23 @@
 #include "image.h"
 
 #include "helper.h"
+#include "pool.h"
+
+#include <string.h>
+
+POOL_DEFINE(label_pool, label_t, LABEL_POOL_SIZE);
 
 /*
  * Create a label and returns a pointer to the label_t
+ *
+ * Labels live until label_pool_reset is called.
  */
 label_t* label_create(char* text, font_t* font, int16_t left, int16_t top,
     uint16_t width, uint16_t height)
 {
-    label_t* label = RTOS_Malloc(sizeof(label_t));
+    label_t* label = pool_alloc(&label_pool);
+    if (!label)
+        return NULL;
     label->onBeforeRender = NULL;
     label->onAfterRender = NULL;
     label->text = text;
@@ -36,39 +45,51 @@ label_t* label_create(char* text, font_t* font, int16_t left, int16_t top,
     label->textPosition.top = 0;
     label->roundedCorners = 0;
     label->roundedRadius = 0;
+    label->dirty = 1;
 
     return label;
 }
 
-error_code_t label_render(const display_t* dsp, void* component)
+/*
+ * Position of the text inside the label box according to the alignment
+ */
+static point_t label_text_position(const label_t* label)
 {
-    label_t* label = (label_t*)component;
-    if (label->onBeforeRender)
-        if (label->onBeforeRender(dsp, label) != PM_OK) {
-            return ABORT;
-        }
-
-    if (label->backgroundColor != TRANSPARENT)
-        display_rect_fill(dsp, label->box.left, label->box.top,
-            label->box.width, label->box.height, label->backgroundColor);
+    point_t pos = label->textPosition;
 
     if (label->alignHorizontal == LEFT)
-        label->textPosition.left = 1;
+        pos.left = 1;
     if (label->alignHorizontal == CENTER) {
-        label->textPosition.left = 1 + (label->box.width - font_text_pixel_width(label->font, label->text)) / 2;
+        pos.left = 1 + (label->box.width - font_text_pixel_width(label->font, label->text)) / 2;
     }
     if (label->alignHorizontal == RIGHT) {
-        label->textPosition.left = label->box.width - font_text_pixel_width(label->font, label->text) - 1;
+        pos.left = label->box.width - font_text_pixel_width(label->font, label->text) - 1;
     }
 
     if (label->alignVertical == TOP)
-        label->textPosition.top = 1;
+        pos.top = 1;
     if (label->alignVertical == MIDDLE) {
-        label->textPosition.top = 1 + (label->box.height - font_text_pixel_height(label->font, label->text)) / 2;
+        pos.top = 1 + (label->box.height - font_text_pixel_height(label->font, label->text)) / 2;
     }
     if (label->alignVertical == BOTTOM) {
-        label->textPosition.top = (label->box.height - font_text_pixel_height(label->font, label->text)) - 1;
+        pos.top = (label->box.height - font_text_pixel_height(label->font, label->text)) - 1;
     }
+    return pos;
+}
+
+error_code_t label_render(const display_t* dsp, void* component)
+{
+    label_t* label = (label_t*)component;
+    if (label->onBeforeRender)
+        if (label->onBeforeRender(dsp, label) != PM_OK) {
+            return ABORT;
+        }
+
+    if (label->backgroundColor != TRANSPARENT)
+        display_rect_fill(dsp, label->box.left, label->box.top,
+            label->box.width, label->box.height, label->backgroundColor);
+
+    label->textPosition = label_text_position(label);
 
     if (label->text && font_strlen(label->text)){
         convert_umlauts_inplace(label->text);
@@ -188,3 +209,44 @@ error_code_t label_shrink_to_text(label_t* label)
     }
     return PM_OK;
 }
+
+/*
+ * Area the label draws to. A label without background, border and render
+ * callback only touches the pixels of its text.
+ */
+void label_get_bounds(const label_t* label, rect_t* bounds)
+{
+    *bounds = label->box;
+    if (label->backgroundColor != TRANSPARENT || label->borderWidth || label->onBeforeRender)
+        return;
+
+    if (!label->text || !font_strlen(label->text)) {
+        bounds->width = 0;
+        bounds->height = 0;
+        return;
+    }
+    if (strchr(label->text, '\n'))
+        return;
+
+    point_t pos = label_text_position(label);
+    bounds->left = label->box.left + pos.left;
+    bounds->top = label->box.top + pos.top;
+    bounds->width = font_text_pixel_width(label->font, label->text);
+    bounds->height = font_text_pixel_height(label->font, label->text);
+}
+
+/*
+ * Release a label that is not needed before the next pool reset
+ */
+void label_free(label_t* label)
+{
+    pool_free(&label_pool, label);
+}
+
+/*
+ * Release all labels at once, e.g. when the screen changes
+ */
+void label_pool_reset()
+{
+    pool_reset(&label_pool);
+}
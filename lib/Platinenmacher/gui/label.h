@@ -13,6 +13,10 @@
 #include "colors.h"
 #include "font.h"
 
+#ifndef LABEL_POOL_SIZE
+#define LABEL_POOL_SIZE 40 /// labels available without heap allocation
+#endif
+
 typedef struct label {
 	char *text;
 	point_t textPosition;
@@ -28,6 +32,7 @@ typedef struct label {
 	corner_t roundedCorners;
 	uint8_t roundedRadius;
 	void *child;			/// Pointer to child element.
+	uint8_t dirty;			/// Set when the label has to be drawn again.
 
 	error_code_t (*onBeforeRender)(const display_t *dsp, void *label);
 	error_code_t (*onAfterRender)(const display_t *dsp, void *label);
@@ -37,5 +42,8 @@ label_t* label_create(char *text, font_t *font, int16_t left, int16_t top,
 		uint16_t width, uint16_t height);
 error_code_t label_render(const display_t *dsp, void *component);
 error_code_t label_shrink_to_text(label_t *label);
+void label_get_bounds(const label_t *label, rect_t *bounds);
+void label_free(label_t *label);
+void label_pool_reset();
 
 #endif /* PLATINENMACHER_DISPLAY_GUI_LABEL_H_ */
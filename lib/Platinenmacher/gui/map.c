@@ -6,6 +6,7 @@
  * SPDX-License-Identifier: MIT
  */
 #include "map.h"
+#include "tile_pipeline.h"
 #include "waypoint.h"
 #include <math.h>
 
@@ -52,6 +53,7 @@ map_t* map_create(int16_t left, int16_t top, uint8_t width, uint8_t height, uint
     map->box.width = width * tile_size;
     map->tile_count = width * height;
     map->tiles = RTOS_Malloc(sizeof(map_tile_t*) * map->tile_count);
+    map->dirty = 1;
     map_font = font;
     for (uint32_t x = 0; x < width; x++)
         for (uint32_t y = 0; y < height; y++) {
@@ -68,8 +70,10 @@ map_t* map_create(int16_t left, int16_t top, uint8_t width, uint8_t height, uint
 
 error_code_t map_update_zoom_level(map_t* map, uint8_t level)
 {
-    if (map)
+    if (map && map->tile_zoom != level) {
         map->tile_zoom = level;
+        map->dirty = 1;
+    }
     return PM_OK;
 }
 
@@ -86,8 +90,10 @@ map_tile_t* map_get_tile(map_t* map, uint8_t x, uint8_t y)
     return map->tiles[x * map->height + y];
 }
 
-static inline void update_map_tile_if_coords_change(map_tile_t* t, uint32_t x, uint32_t y, uint32_t z)
+static inline void update_map_tile_if_coords_change(map_t* map, map_tile_t* t, uint32_t x, uint32_t y, uint32_t z)
 {
+    if (t->x != x || t->y != y || t->z != z)
+        map->dirty = 1;
     if (t->x != x) {
         t->image->loaded = NOT_LOADED;
         t->x = x;
@@ -117,13 +123,17 @@ error_code_t map_update_position(map_t* map, map_position_t* pos)
         y = (uint16_t)floor(yf);
     }
     // get offset to tile corner of tile with position
-    map->pos_x = floor((xf - x) * 256); // offset to tile
-    map->pos_y = floor((yf - y) * 256); // offset to tile
+    uint16_t pos_x = floor((xf - x) * 256); // offset to tile
+    uint16_t pos_y = floor((yf - y) * 256); // offset to tile
+    if (pos_x != map->pos_x || pos_y != map->pos_y)
+        map->dirty = 1;
+    map->pos_x = pos_x;
+    map->pos_y = pos_y;
 
     for (uint8_t i = 0; i < map->width; i++) {
         for (uint8_t j = 0; j < map->height; j++) {
             uint16_t idx = i * map->height + j;
-            update_map_tile_if_coords_change(map->tiles[idx], x - 1 + i, y - 1 + j, map->tile_zoom);
+            update_map_tile_if_coords_change(map, map->tiles[idx], x - 1 + i, y - 1 + j, map->tile_zoom);
             map->tiles[idx]->image->box.left = (i * 256) + map->box.left;
             map->tiles[idx]->image->box.top = (j * 256) + map->box.top;
             map->tiles[idx]->label->box.left = (i * 256) + map->box.left;
@@ -160,16 +170,23 @@ void map_attach_onAfterRender_callback(map_t* map, error_code_t (*cb)(const disp
     map->onAfterRender = cb;
 }
 
+void map_attach_tile_pipeline(map_t* map, tile_pipeline_t* pipeline)
+{
+    map->pipeline = pipeline;
+}
+
+/*
+ * Render a tile like image_render followed by label_render
+ */
 error_code_t map_tile_render(const display_t* dsp, void* component)
 {
     map_tile_t* tile = (map_tile_t*)component;
-    if (tile->image && image_render(dsp, tile->image) == PM_OK) {
-        if(tile->label)
-            label_render(dsp, tile->label);
-        return PM_OK;
-    }
+    if (tile->image)
+        image_render(dsp, tile->image);
 
-    return label_render(dsp, tile->label);
+    if (tile->label)
+        return label_render(dsp, tile->label);
+    return PM_OK;
 }
 
 error_code_t map_render(const display_t* dsp, void* component)
@@ -178,8 +195,15 @@ error_code_t map_render(const display_t* dsp, void* component)
     map_t* map = (map_t*)component;
     if (map->onBeforeRender)
         map->onBeforeRender(dsp, map);
-    for (uint32_t i = 0; i < map->tile_count; i++) {
-        map_tile_render(dsp, map->tiles[i]);
+    if (!map->pipeline || tile_pipeline_render(map->pipeline, dsp, map) != PM_OK) {
+        uint8_t clipped = dsp->clip.width != dsp->size.width || dsp->clip.height != dsp->size.height;
+        for (uint32_t i = 0; i < map->tile_count; i++) {
+            /* on partial redraws do not load tiles that are clipped away */
+            rect_t visible = rect_intersect(&map->tiles[i]->image->box, &dsp->clip);
+            if (clipped && rect_is_empty(&visible))
+                continue;
+            map_tile_render(dsp, map->tiles[i]);
+        }
     }
     if (map->onAfterRender)
         map->onAfterRender(dsp, map);
@@ -254,6 +278,18 @@ error_code_t map_run_on_waypoints(void (*function)(waypoint_t* wp))
     return PM_OK;
 }
 
+/**
+ * Render the path through all active waypoints
+ *
+ * Add to RL_PATH without a component.
+ */
+error_code_t map_render_waypoints(const display_t* dsp, void* component)
+{
+    for (waypoint_t* wp_ = waypoints; wp_; wp_ = wp_->next)
+        waypoint_render_marker(dsp, wp_);
+    return PM_OK;
+}
+
 error_code_t map_update_waypoint_path(map_t* map)
 {
     waypoint_t* wp_ = waypoints;
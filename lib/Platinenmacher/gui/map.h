@@ -34,8 +34,11 @@ typedef struct {
     uint8_t fix;
     uint8_t satellites_in_view;
     uint8_t satellites_in_use;
+    uint32_t time; /// of the fix, seconds since 1970, UTC
 } map_position_t;
 
+typedef struct tile_pipeline tile_pipeline_t;
+
 typedef struct
 {
     rect_t box;
@@ -47,6 +50,8 @@ typedef struct
     uint32_t tile_count;
     uint16_t pos_x;
     uint16_t pos_y;
+    uint8_t dirty;
+    tile_pipeline_t* pipeline; /// loads the tile data while tiles are drawn
 
     error_code_t (*onBeforeRender)(const display_t* dsp, void* map_t);
     error_code_t (*onAfterRender)(const display_t* dsp, void* map_t);
@@ -64,6 +69,7 @@ void map_set_first_waypoint(waypoint_t* wp);
 error_code_t map_free_waypoints();
 error_code_t map_update_waypoint_path(map_t *map);
 error_code_t map_run_on_waypoints(void (*function)(waypoint_t *wp));
+error_code_t map_render_waypoints(const display_t* dsp, void* component);
 
 error_code_t map_render(const display_t* dsp, void* component);
 error_code_t map_tile_render(const display_t* dsp, void* component);
@@ -72,5 +78,6 @@ void map_tile_attach_onBeforeRender_callback(map_t* map, error_code_t (*cb)(cons
 void map_tile_attach_onAfterRender_callback(map_t* map, error_code_t (*cb)(const display_t* dsp, void* component));
 void map_attach_onBeforeRender_callback(map_t* map, error_code_t (*cb)(const display_t* dsp, void* component));
 void map_attach_onAfterRender_callback(map_t* map, error_code_t (*cb)(const display_t* dsp, void* component));
+void map_attach_tile_pipeline(map_t* map, tile_pipeline_t* pipeline);
 
 #endif /* PLATINENMACHER_GUI_MAP_H */
\ No newline at end of file
@@ -0,0 +1,449 @@
+/*
+ * Render pipeline with damage tracking
+ *
+ * Copyright (c) 2022, Bastian Neumann <info@platinenmacher.tech>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "render.h"
+#include "graph.h"
+#include "image.h"
+#include "label.h"
+#include "map.h"
+#include "memory.h"
+
+#include <stddef.h>
+
+static const char* TAG = "render";
+
+struct render_component {
+    error_code_t (*render)(const display_t* dsp, void* component);
+    void (*bounds)(const void* component, rect_t* bounds);
+    uint8_t (*opaque)(const void* component);
+    size_t dirty_offset;
+};
+
+/*
+ * Nodes of a layer are kept in one array in render order. The arrays start
+ * out in static storage and move to the heap only if a layer outgrows it,
+ * freeing a layer keeps the memory for the next screen.
+ */
+typedef struct {
+    render_t* nodes;
+    uint16_t count;
+    uint16_t capacity;
+} render_layer_t;
+
+static render_t node_storage[RL_MAX][RENDER_LAYER_CAPACITY];
+static render_layer_t render_pipeline[RL_MAX];
+
+/*
+ * Position of the frame that is currently drawn. A frame that gets
+ * interrupted continues here instead of starting over.
+ */
+static struct {
+    uint8_t active;       // a frame is partly drawn
+    uint8_t layer;        // layer the cursor is in
+    int32_t index;        // next node, -1 if the layer was rebuilt
+    uint32_t generation;  // generation of the current or last frame
+    rect_t area;          // area the frame draws to
+    uint8_t start_layer;  // node drawing starts at, lower nodes are hidden
+    int32_t start_index;
+    uint8_t drawing;      // start node has been passed
+    uint8_t full_needed;  // screen content is unknown, draw everything
+    uint8_t update_needed; // pre render callbacks have to run
+} cursor = { .full_needed = 1 };
+
+static void label_bounds(const void* comp, rect_t* bounds)
+{
+    label_get_bounds(comp, bounds);
+}
+
+static uint8_t label_opaque(const void* comp)
+{
+    return ((const label_t*)comp)->backgroundColor != TRANSPARENT;
+}
+
+static void image_bounds(const void* comp, rect_t* bounds)
+{
+    *bounds = ((const image_t*)comp)->box;
+}
+
+static void map_bounds(const void* comp, rect_t* bounds)
+{
+    *bounds = ((const map_t*)comp)->box;
+}
+
+static void graph_bounds(const void* comp, rect_t* bounds)
+{
+    *bounds = ((const graph_t*)comp)->box;
+}
+
+static uint8_t graph_opaque(const void* comp)
+{
+    return ((const graph_t*)comp)->background_color != TRANSPARENT;
+}
+
+static uint8_t never_opaque(const void* comp)
+{
+    return 0;
+}
+
+static const render_component_t components[] = {
+    { label_render, label_bounds, label_opaque, offsetof(label_t, dirty) },
+    { image_render, image_bounds, never_opaque, offsetof(image_t, dirty) },
+    { map_render, map_bounds, never_opaque, offsetof(map_t, dirty) },
+    { graph_renderer, graph_bounds, graph_opaque, offsetof(graph_t, dirty) },
+};
+
+static const render_component_t* find_component_type(error_code_t (*render)(const display_t* dsp, void* component))
+{
+    for (size_t i = 0; i < sizeof(components) / sizeof(components[0]); i++)
+        if (components[i].render == render)
+            return &components[i];
+    return NULL;
+}
+
+static inline uint8_t* dirty_flag(const render_t* rd)
+{
+    return (uint8_t*)rd->comp + rd->type->dirty_offset;
+}
+
+static render_layer_t* get_layer(enum RenderLayer layer)
+{
+    render_layer_t* l = &render_pipeline[layer];
+    if (!l->nodes) {
+        l->nodes = node_storage[layer];
+        l->capacity = RENDER_LAYER_CAPACITY;
+    }
+    return l;
+}
+
+static uint8_t is_static_storage(const render_t* nodes)
+{
+    return nodes >= node_storage[0] && nodes < node_storage[RL_MAX];
+}
+
+static error_code_t grow_layer(render_layer_t* l)
+{
+    uint16_t capacity = l->capacity * 2;
+    if (capacity <= l->capacity)
+        return PM_FAIL;
+    render_t* nodes = RTOS_Malloc(capacity * sizeof(render_t));
+    if (!nodes)
+        return PM_FAIL;
+    memcpy(nodes, l->nodes, l->count * sizeof(render_t));
+    if (!is_static_storage(l->nodes))
+        RTOS_Free(l->nodes);
+    ESP_LOGI(TAG, "layer grows to %d nodes", capacity);
+    l->nodes = nodes;
+    l->capacity = capacity;
+    return PM_OK;
+}
+
+/**
+ * Add render function to pipeline
+ *
+ * The returned slot stays valid until the layer is freed or grows.
+ *
+ * @return render slot
+ */
+render_t* add_to_render_pipeline(error_code_t (*render)(const display_t* dsp, void* component),
+    void* comp,
+    enum RenderLayer layer)
+{
+    render_layer_t* l = get_layer(layer);
+    if (l->count == l->capacity && grow_layer(l) != PM_OK) {
+        ESP_LOGE(TAG, "render pipeline full!");
+        return 0;
+    }
+    render_t* rd = &l->nodes[l->count++];
+    rd->render = render;
+    rd->comp = comp;
+    rd->type = comp ? find_component_type(render) : NULL;
+    rd->drawn = (rect_t) { 0, 0, 0, 0 };
+    /* never drawn, a frame that already passed this layer will be repaired later */
+    rd->generation = cursor.generation - 1;
+
+    return rd;
+}
+
+void free_render_pipeline(enum RenderLayer layer)
+{
+    render_pipeline[layer].count = 0;
+    if (cursor.active && cursor.layer == layer) {
+        cursor.index = -1;
+        cursor.drawing = 1;
+    }
+}
+
+void free_all_render_pipelines()
+{
+    for (uint8_t i = 0; i < RL_MAX; i++)
+        free_render_pipeline(i);
+    cursor.active = 0;
+    cursor.full_needed = 1;
+}
+
+/**
+ * Redraw everything with the next frame
+ *
+ * A partly drawn frame starts over.
+ */
+void render_pipeline_invalidate()
+{
+    cursor.active = 0;
+    cursor.full_needed = 1;
+}
+
+/**
+ * Run the pre render callbacks before the next frame
+ *
+ * Components whose inputs change in the callbacks have to be marked dirty
+ * by them. A partly drawn frame is not interrupted.
+ */
+void render_pipeline_request_update()
+{
+    cursor.update_needed = 1;
+}
+
+uint8_t render_pipeline_in_progress()
+{
+    return cursor.active;
+}
+
+/**
+ * Add a prerender callback to pipeline
+ *
+ * This is called before all other renderers are called.
+ *
+ * @return render slot
+ */
+render_t* add_pre_render_callback(error_code_t (*cb)(const display_t* dsp, void* component))
+{
+    return add_to_render_pipeline(cb, NULL, RL_PRE_RENDER);
+}
+
+static void render_one(display_t* dsp, render_t* rd)
+{
+    if (rd->render)
+        rd->render(dsp, rd->comp);
+    if (rd->type) {
+        rd->type->bounds(rd->comp, &rd->drawn);
+        *dirty_flag(rd) = 0;
+    }
+}
+
+static void run_pre_render_callbacks(display_t* dsp)
+{
+    cursor.update_needed = 0;
+    for (uint16_t i = 0; i < render_pipeline[RL_PRE_RENDER].count; i++)
+        render_one(dsp, &render_pipeline[RL_PRE_RENDER].nodes[i]);
+}
+
+/**
+ * Union of the old and new area of all dirty components
+ *
+ * Components that were added after the last frame passed their layer are
+ * damaged as well. Without bounds they damage the whole screen.
+ *
+ * @return 1 if something on the display has to be redrawn
+ */
+uint8_t render_pipeline_get_damage(const display_t* dsp, rect_t* damage)
+{
+    rect_t screen = { 0, 0, dsp->size.width, dsp->size.height };
+    if (cursor.full_needed) {
+        *damage = screen;
+        return 1;
+    }
+
+    rect_t area = { 0, 0, 0, 0 };
+    for (uint8_t layer = RL_PRE_RENDER + 1; layer < RL_MAX; layer++) {
+        for (uint16_t i = 0; i < render_pipeline[layer].count; i++) {
+            render_t* rd = &render_pipeline[layer].nodes[i];
+            uint8_t stale = rd->generation != cursor.generation;
+            if (!rd->type) {
+                if (stale) {
+                    *damage = screen;
+                    return 1;
+                }
+                continue;
+            }
+            if (!stale && !*dirty_flag(rd))
+                continue;
+            rect_t now;
+            rd->type->bounds(rd->comp, &now);
+            area = rect_union(&area, &rd->drawn);
+            area = rect_union(&area, &now);
+        }
+    }
+    *damage = rect_intersect(&area, &screen);
+    return !rect_is_empty(damage);
+}
+
+/**
+ * Anything left to draw
+ *
+ * @return 1 if a frame is unfinished, an update was requested or
+ *         components are damaged
+ */
+uint8_t render_pipeline_pending(const display_t* dsp)
+{
+    rect_t damage;
+    return cursor.active || cursor.update_needed || render_pipeline_get_damage(dsp, &damage);
+}
+
+static void begin_frame(display_t* dsp, const rect_t* area, uint8_t start_layer, int32_t start_index)
+{
+    cursor.active = 1;
+    cursor.generation++;
+    cursor.area = *area;
+    cursor.start_layer = start_layer;
+    cursor.start_index = start_index;
+    cursor.drawing = (start_layer == RL_MAX);
+    cursor.layer = RL_PRE_RENDER;
+    cursor.index = 0;
+    cursor.full_needed = 0;
+
+    display_set_clip(dsp, area);
+    if (cursor.drawing)
+        display_fill(dsp, WHITE);
+}
+
+static void begin_full_frame(display_t* dsp)
+{
+    rect_t screen = { 0, 0, dsp->size.width, dsp->size.height };
+    begin_frame(dsp, &screen, RL_MAX, 0);
+    cursor.update_needed = 0;
+}
+
+/*
+ * Topmost opaque component that covers the whole area
+ *
+ * @return layer of the component, RL_MAX if there is none
+ */
+static uint8_t find_start(const rect_t* area, int32_t* index)
+{
+    uint8_t start = RL_MAX;
+    for (uint8_t layer = RL_PRE_RENDER + 1; layer < RL_MAX; layer++) {
+        for (uint16_t i = 0; i < render_pipeline[layer].count; i++) {
+            render_t* rd = &render_pipeline[layer].nodes[i];
+            if (!rd->type || !rd->type->opaque(rd->comp))
+                continue;
+            rect_t bounds;
+            rd->type->bounds(rd->comp, &bounds);
+            if (rect_contains(&bounds, area)) {
+                start = layer;
+                *index = i;
+            }
+        }
+    }
+    return start;
+}
+
+/*
+ * Draw from the cursor to the end of the frame
+ *
+ * Every visited node is stamped with the frame generation, nodes that are
+ * invalidated after they were drawn keep their dirty flag and are repaired
+ * by the next frame.
+ */
+static error_code_t continue_frame(display_t* dsp, const volatile uint8_t* restart)
+{
+    display_set_clip(dsp, &cursor.area);
+    for (; cursor.layer < RL_MAX; cursor.layer++, cursor.index = 0) {
+        render_layer_t* l = &render_pipeline[cursor.layer];
+        for (;; cursor.index++) {
+            if (cursor.index < 0)
+                cursor.index = 0;
+            if (cursor.index >= l->count)
+                break;
+            if (restart && *restart) {
+                display_reset_clip(dsp);
+                return DEFERRED;
+            }
+            render_t* rd = &l->nodes[cursor.index];
+            if (cursor.layer == cursor.start_layer && cursor.index == cursor.start_index)
+                cursor.drawing = 1;
+            rd->generation = cursor.generation;
+
+            if (cursor.layer == RL_PRE_RENDER) {
+                /* pre render callbacks only run on full frames */
+                if (cursor.drawing)
+                    render_one(dsp, rd);
+            } else if (!rd->type) {
+                if (cursor.drawing)
+                    render_one(dsp, rd);
+            } else {
+                rect_t bounds;
+                rd->type->bounds(rd->comp, &bounds);
+                rect_t hit = rect_intersect(&bounds, &cursor.area);
+                if (cursor.drawing && !rect_is_empty(&hit)) {
+                    render_one(dsp, rd);
+                } else if (*dirty_flag(rd) && rect_contains(&cursor.area, &bounds)
+                    && rect_contains(&cursor.area, &rd->drawn)) {
+                    /* hidden below the start component */
+                    rd->drawn = bounds;
+                    *dirty_flag(rd) = 0;
+                }
+            }
+            /* a callback that frees this layer sets the index to -1 */
+        }
+        RTOS_Yield();
+    }
+    cursor.active = 0;
+    display_reset_clip(dsp);
+    return PM_OK;
+}
+
+/**
+ * Render the whole screen
+ *
+ * Clears the display and calls every renderer of every layer. An
+ * interrupted frame is continued where it stopped.
+ *
+ * @return DEFERRED if restart got set while rendering, call again to finish
+ */
+error_code_t render_pipeline_render(display_t* dsp, const volatile uint8_t* restart)
+{
+    if (!cursor.active)
+        begin_full_frame(dsp);
+    return continue_frame(dsp, restart);
+}
+
+/**
+ * Redraw only the damaged part of the screen
+ *
+ * Drawing is clipped to the damaged area. Rendering starts at the topmost
+ * opaque component covering the whole area, everything below it would be
+ * painted over anyway. Components that do not report bounds are always
+ * drawn. Pre render callbacks only run if an update was requested or the
+ * whole screen has to be drawn. An interrupted frame is continued where it
+ * stopped.
+ *
+ * @return NOT_NEEDED if nothing is damaged
+ * @return DEFERRED if restart got set while rendering, call again to finish
+ */
+error_code_t render_pipeline_render_damage(display_t* dsp, const volatile uint8_t* restart)
+{
+    if (!cursor.active) {
+        if (cursor.full_needed)
+            return render_pipeline_render(dsp, restart);
+        if (cursor.update_needed)
+            run_pre_render_callbacks(dsp);
+
+        rect_t damage;
+        if (!render_pipeline_get_damage(dsp, &damage))
+            return NOT_NEEDED;
+        if (cursor.full_needed)
+            return render_pipeline_render(dsp, restart);
+
+        ESP_LOGI(TAG, "redraw %d/%d %dx%d", damage.left, damage.top, damage.width, damage.height);
+        int32_t start_index = 0;
+        uint8_t start_layer = find_start(&damage, &start_index);
+        begin_frame(dsp, &damage, start_layer, start_index);
+        cursor.layer = RL_PRE_RENDER + 1;
+    }
+    return continue_frame(dsp, restart);
+}
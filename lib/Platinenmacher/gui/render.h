@@ -0,0 +1,71 @@
+/*
+ * Render pipeline with damage tracking
+ *
+ * Components are rendered layer by layer in the order they were added.
+ * Every layer is an array of nodes, adding and freeing nodes does not touch
+ * the heap once the layers are big enough for the screen.
+ * Components the pipeline knows (label, image, map, graph) report their
+ * bounds and a dirty flag, so a frame can redraw only the damaged area.
+ * A frame that gets interrupted keeps its position and continues from there
+ * with the next call, components that changed after they were drawn are
+ * repaired by the following damage frame.
+ *
+ * Copyright (c) 2022, Bastian Neumann <info@platinenmacher.tech>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef PLATINENMACHER_GUI_RENDER_H
+#define PLATINENMACHER_GUI_RENDER_H
+
+#include "display.h"
+#include "error.h"
+#include "geometric.h"
+
+/**
+ * Render layers.
+ *
+ * Each layer pipeline is called after the other until RL_MAX is reaced.
+ */
+enum RenderLayer {
+    RL_PRE_RENDER,
+    RL_BACKGROUND,
+    RL_MAP,
+    RL_PATH,
+    RL_GUI_BACKGROUND,
+    RL_GUI_ELEMENTS,
+    RL_TOP,
+    RL_MAX, // <- Number of Layers
+};
+
+#ifndef RENDER_LAYER_CAPACITY
+#define RENDER_LAYER_CAPACITY 24 /// nodes per layer before the layer moves to the heap
+#endif
+
+typedef struct render_component render_component_t;
+
+typedef struct Render render_t;
+struct Render {
+    error_code_t (*render)(const display_t* dsp, void* component);
+    void* comp;
+    const render_component_t* type; /// bounds and dirty flag access, NULL if unknown
+    rect_t drawn;                   /// area covered by the last draw
+    uint32_t generation;            /// last frame that visited this node
+};
+
+render_t* add_to_render_pipeline(error_code_t (*render)(const display_t* dsp, void* component),
+    void* comp,
+    enum RenderLayer layer);
+render_t* add_pre_render_callback(error_code_t (*cb)(const display_t* dsp, void* component));
+void free_render_pipeline(enum RenderLayer layer);
+void free_all_render_pipelines();
+void render_pipeline_invalidate();
+void render_pipeline_request_update();
+uint8_t render_pipeline_in_progress();
+
+error_code_t render_pipeline_render(display_t* dsp, const volatile uint8_t* restart);
+uint8_t render_pipeline_get_damage(const display_t* dsp, rect_t* damage);
+uint8_t render_pipeline_pending(const display_t* dsp);
+error_code_t render_pipeline_render_damage(display_t* dsp, const volatile uint8_t* restart);
+
+#endif // PLATINENMACHER_GUI_RENDER_H
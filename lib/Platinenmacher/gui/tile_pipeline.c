@@ -0,0 +1,260 @@
+/*
+ * Pipelined map tile loading
+ *
+ * Copyright (c) 2022, Bastian Neumann <info@platinenmacher.tech>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "tile_pipeline.h"
+#include "queue.h"
+
+#if defined(TESTING) || defined(LINUX)
+#include <pthread.h>
+#else
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#endif
+
+static const char* TAG = "tiles";
+
+typedef struct {
+    map_tile_t* tile; /// tile on the map, only touched by the blitter
+    map_tile_t key;   /// copy of the coordinates for the reader
+    uint8_t* data;
+    size_t length;
+    error_code_t status;
+    int64_t read_us;
+} tile_slot_t;
+
+struct tile_pipeline {
+    tile_read_t read;
+    queue_t* to_read;
+    queue_t* to_blit;
+    tile_slot_t slots[TILE_PIPELINE_DEPTH];
+    uint8_t depth; /// slots with buffers
+    tile_pipeline_stats_t stats;
+#if defined(TESTING) || defined(LINUX)
+    pthread_t reader;
+#endif
+};
+
+/*
+ * A NULL slot stops the reader, it forwards the slot to the blitter.
+ */
+static void reader_loop(tile_pipeline_t* p)
+{
+    for (;;) {
+        tile_slot_t* slot;
+        queue_receive(p->to_read, &slot, QUEUE_WAIT_FOREVER);
+        if (slot) {
+            int64_t start = RTOS_Micros();
+            slot->length = 0;
+            slot->status = p->read(&slot->key, slot->data, TILE_PIPELINE_TILE_SIZE, &slot->length);
+            /* buffers are not zeroed, short tiles get a black tail */
+            if (slot->status == PM_OK && slot->length < TILE_PIPELINE_TILE_SIZE)
+                memset(slot->data + slot->length, 0, TILE_PIPELINE_TILE_SIZE - slot->length);
+            slot->read_us = RTOS_Micros() - start;
+        }
+        queue_send(p->to_blit, &slot, QUEUE_WAIT_FOREVER);
+        if (!slot)
+            return;
+    }
+}
+
+#if defined(TESTING) || defined(LINUX)
+static void* reader_task(void* arg)
+{
+    reader_loop(arg);
+    return NULL;
+}
+#else
+static void reader_task(void* arg)
+{
+    reader_loop(arg);
+    vTaskDelete(NULL);
+}
+#endif
+
+/*
+ * Without enough memory for all buffers the pipeline runs with fewer tiles
+ * in flight.
+ */
+static uint8_t alloc_buffers(tile_pipeline_t* p)
+{
+    uint8_t count = 0;
+    for (; count < TILE_PIPELINE_DEPTH; count++) {
+        tile_slot_t* slot = &p->slots[count];
+        slot->data = RTOS_MallocIO(TILE_PIPELINE_TILE_SIZE);
+        if (!slot->data)
+            break;
+    }
+    return count;
+}
+
+static void free_buffers(tile_pipeline_t* p)
+{
+    for (uint8_t i = 0; i < TILE_PIPELINE_DEPTH; i++) {
+        RTOS_Free(p->slots[i].data);
+        p->slots[i].data = NULL;
+    }
+}
+
+/**
+ * Create the pipeline and start the reader task
+ *
+ * The tile buffers are allocated here and kept until the pipeline is freed,
+ * create the pipeline when the map is shown and free it when it is hidden.
+ */
+tile_pipeline_t* tile_pipeline_create(tile_read_t read)
+{
+    tile_pipeline_t* p = RTOS_Malloc(sizeof(tile_pipeline_t));
+    if (!p)
+        return NULL;
+    p->read = read;
+    p->depth = alloc_buffers(p);
+    if (!p->depth)
+        goto fail;
+    /* one extra entry for the stop marker */
+    p->to_read = queue_create(TILE_PIPELINE_DEPTH + 1, sizeof(tile_slot_t*));
+    p->to_blit = queue_create(TILE_PIPELINE_DEPTH + 1, sizeof(tile_slot_t*));
+    if (!p->to_read || !p->to_blit)
+        goto fail;
+
+#if defined(TESTING) || defined(LINUX)
+    if (pthread_create(&p->reader, NULL, reader_task, p))
+        goto fail;
+#else
+    if (xTaskCreate(reader_task, "tile_read", 4096, p, uxTaskPriorityGet(NULL), NULL) != pdPASS)
+        goto fail;
+#endif
+    return p;
+
+fail:
+    ESP_LOGE(TAG, "could not start the tile pipeline");
+    queue_delete(p->to_read);
+    queue_delete(p->to_blit);
+    free_buffers(p);
+    RTOS_Free(p);
+    return NULL;
+}
+
+/**
+ * Stop the reader and free the pipeline with its queues and buffers
+ */
+void tile_pipeline_free(tile_pipeline_t* p)
+{
+    if (!p)
+        return;
+    tile_slot_t* slot = NULL;
+    queue_send(p->to_read, &slot, QUEUE_WAIT_FOREVER);
+    do {
+        queue_receive(p->to_blit, &slot, QUEUE_WAIT_FOREVER);
+    } while (slot);
+#if defined(TESTING) || defined(LINUX)
+    pthread_join(p->reader, NULL);
+#endif
+    /* the reader does not touch the queues after it passed on the stop marker */
+    queue_delete(p->to_read);
+    queue_delete(p->to_blit);
+    free_buffers(p);
+    RTOS_Free(p);
+}
+
+const tile_pipeline_stats_t* tile_pipeline_get_stats(const tile_pipeline_t* p)
+{
+    return &p->stats;
+}
+
+static uint8_t tile_visible(const display_t* dsp, const map_tile_t* tile)
+{
+    /* on partial redraws do not load tiles that are clipped away */
+    uint8_t clipped = dsp->clip.width != dsp->size.width || dsp->clip.height != dsp->size.height;
+    rect_t visible = rect_intersect(&tile->image->box, &dsp->clip);
+    return !clipped || !rect_is_empty(&visible);
+}
+
+static uint32_t next_visible(const display_t* dsp, const map_t* map, uint32_t i)
+{
+    while (i < map->tile_count && !tile_visible(dsp, map->tiles[i]))
+        i++;
+    return i;
+}
+
+static void blit(const display_t* dsp, tile_slot_t* slot)
+{
+    map_tile_t* tile = slot->tile;
+    image_t* img = tile->image;
+
+    if (slot->status == PM_OK) {
+        img->data = slot->data;
+        img->loaded = LOADED;
+        if (tile->label)
+            tile->label->text = "";
+    } else if (slot->status == UNAVAILABLE) {
+        img->loaded = NOT_FOUND;
+        if (tile->label)
+            tile->label->text = "Not Found";
+    } else if (slot->status != TIMEOUT) {
+        img->loaded = ERROR;
+        if (tile->label)
+            tile->label->text = "Error";
+    }
+
+    map_tile_render(dsp, tile);
+
+    img->data = NULL;
+    img->loaded = NOT_LOADED;
+}
+
+/**
+ * Draw all visible tiles of the map
+ *
+ * Tiles are queued in map order and come back in the same order, so the
+ * blitter only ever waits for the next tile.
+ */
+error_code_t tile_pipeline_render(tile_pipeline_t* p, const display_t* dsp, map_t* map)
+{
+    tile_pipeline_stats_t stats = { 0 };
+    int64_t start = RTOS_Micros();
+
+    tile_slot_t* free_slots[TILE_PIPELINE_DEPTH];
+    uint8_t free_count = 0;
+    for (uint8_t i = 0; i < p->depth; i++)
+        free_slots[free_count++] = &p->slots[i];
+
+    uint32_t next = next_visible(dsp, map, 0);
+    for (uint32_t i = next; i < map->tile_count; i = next_visible(dsp, map, i + 1)) {
+        /* keep every free buffer busy */
+        while (free_count && next < map->tile_count) {
+            tile_slot_t* slot = free_slots[--free_count];
+            slot->tile = map->tiles[next];
+            slot->key = *map->tiles[next];
+            queue_send(p->to_read, &slot, QUEUE_WAIT_FOREVER);
+            next = next_visible(dsp, map, next + 1);
+        }
+
+        tile_slot_t* slot;
+        int64_t wait = RTOS_Micros();
+        queue_receive(p->to_blit, &slot, QUEUE_WAIT_FOREVER);
+        int64_t blit_start = RTOS_Micros();
+        stats.stall_us += blit_start - wait;
+
+        blit(dsp, slot);
+
+        stats.blit_us += RTOS_Micros() - blit_start;
+        stats.read_us += slot->read_us;
+        stats.tiles++;
+        if (slot->status != PM_OK)
+            stats.failed++;
+        free_slots[free_count++] = slot;
+    }
+
+    stats.total_us = RTOS_Micros() - start;
+    p->stats = stats;
+    if (stats.tiles)
+        ESP_LOGD(TAG, "%lu tiles in %lu us: read %lu us, blit %lu us, stalled %lu us",
+            (unsigned long)stats.tiles, (unsigned long)stats.total_us, (unsigned long)stats.read_us,
+            (unsigned long)stats.blit_us, (unsigned long)stats.stall_us);
+    return PM_OK;
+}
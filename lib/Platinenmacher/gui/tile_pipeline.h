@@ -0,0 +1,52 @@
+/*
+ * Pipelined map tile loading
+ *
+ * Tiles go through two stages connected by bounded queues: a reader task
+ * fetches the tile from storage and the blitter on the rendering task draws
+ * it. While one tile is drawn the next ones are read.
+ *
+ * Copyright (c) 2022, Bastian Neumann <info@platinenmacher.tech>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef PLATINENMACHER_GUI_TILE_PIPELINE_H
+#define PLATINENMACHER_GUI_TILE_PIPELINE_H
+
+#include "map.h"
+
+#ifndef TILE_PIPELINE_DEPTH
+#define TILE_PIPELINE_DEPTH 3 /// tiles in flight, each one holds a tile buffer
+#endif
+#define TILE_PIPELINE_TILE_SIZE (256 * 256 / 2)
+
+/**
+ * Read a tile into data
+ *
+ * Runs on the reader task. Only x, y and z of the tile may be used.
+ * Returns UNAVAILABLE if the tile does not exist and TIMEOUT if the storage
+ * was busy, the tile keeps its label then.
+ */
+typedef error_code_t (*tile_read_t)(const map_tile_t* tile, uint8_t* data, size_t size, size_t* length);
+
+/**
+ * Time spent per stage during the last map_render
+ *
+ * stall_us is the time the blitter waited for tiles, if it is close to
+ * read_us the map is bound by storage.
+ */
+typedef struct {
+    uint32_t tiles;
+    uint32_t failed;
+    int64_t read_us;
+    int64_t blit_us;
+    int64_t stall_us;
+    int64_t total_us;
+} tile_pipeline_stats_t;
+
+tile_pipeline_t* tile_pipeline_create(tile_read_t read);
+void tile_pipeline_free(tile_pipeline_t* pipeline);
+error_code_t tile_pipeline_render(tile_pipeline_t* pipeline, const display_t* dsp, map_t* map);
+const tile_pipeline_stats_t* tile_pipeline_get_stats(const tile_pipeline_t* pipeline);
+
+#endif // PLATINENMACHER_GUI_TILE_PIPELINE_H
@@ -10,13 +10,17 @@
 
 #if defined(TESTING) || defined(LINUX)
 #include <stdlib.h>
+#include <time.h>
 #else
 #include "rtos.h"
 #include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
 #include <esp_heap_caps.h>
 #include <esp_log.h>
+#include <esp_timer.h>
 #endif /* TESTING */
 
+#include <stdint.h>
 #include <string.h>
 
 inline static void *RTOS_Malloc(size_t size)
@@ -49,6 +53,61 @@ inline static void RTOS_Free(void *pointer)
 #endif
 }
 
+#define RTOS_IO_ALIGN 64 /// cache line of the ESP32-S3, SDMMC DMA needs 4
+
+/*
+ * Buffer for file reads and DMA transfers
+ *
+ * DMA capable and cache line aligned, so the SD driver can transfer whole
+ * sectors directly into it. The memory is not zeroed, the caller
+ * overwrites it anyway. Release it with RTOS_Free.
+ */
+inline static void *RTOS_MallocIO(size_t size)
+{
+#if defined(TESTING) || defined(LINUX)
+    return aligned_alloc(RTOS_IO_ALIGN, (size + RTOS_IO_ALIGN - 1) & ~(size_t)(RTOS_IO_ALIGN - 1));
+#else
+    void *mem = heap_caps_aligned_alloc(RTOS_IO_ALIGN, size, MALLOC_CAP_DMA);
+    if (!mem) // large files may still fit into PSRAM, reads are bounced then
+        mem = heap_caps_aligned_alloc(RTOS_IO_ALIGN, size, MALLOC_CAP_8BIT);
+#ifdef PM_MEMORY_DEBUG
+    if (!mem)
+        ESP_LOGI("MALLOC", "failed to allocate io: %d", size);
+#endif
+    return mem;
+#endif
+}
+
+/* give other tasks of the same priority a chance to run */
+inline static void RTOS_Yield(void)
+{
+#if !defined(TESTING) && !defined(LINUX)
+    vTaskDelay(0);
+#endif
+}
+
+/* let the calling task sleep */
+inline static void RTOS_Delay(uint32_t ms)
+{
+#if defined(TESTING) || defined(LINUX)
+    struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+    nanosleep(&ts, NULL);
+#else
+    vTaskDelay(pdMS_TO_TICKS(ms));
+#endif
+}
+
+/* monotonic time in microseconds, for timing measurements */
+inline static int64_t RTOS_Micros(void)
+{
+#if defined(TESTING) || defined(LINUX)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#else
+    return esp_timer_get_time();
+#endif
+}
 
 #define bit_set(data, pos) (data |= (1U << pos))
 #define bit_clear(data, pos) (data &= (~(1U << pos)))
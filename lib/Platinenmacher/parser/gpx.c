@@ -10,18 +10,18 @@
 
 #include "sxml.h"
 
+#include <float.h>
+
 #if defined(TESTING) || defined(LINUX)
 #    include <assert.h>
 #    include <stdlib.h>
-#    ifndef atoff
-#        define atoff(s) (float)atof(s)
-#    endif
 #endif
 
-#define BUFFER_MAXLEN 1024
 #define MIN(a, b) (((a) < (b)) ? (a) : (b))
 #define COUNT(arr) (sizeof(arr) / sizeof((arr)[0]))
 
+static const char* TAG = "gpx";
+
 typedef enum {
     SKIP,
     TRK,
@@ -37,149 +37,306 @@ typedef enum {
     LAT,
 } gpx_cdata_e;
 
-/* Input XML text */
-static gpx_state_e state = SKIP;
-static gpx_cdata_e cdata = NONE;
-static uint32_t waypoint_num = 0;
-static waypoint_t* wp = NULL;
-waypoint_t* first_wp = NULL;
-uint32_t (*add_waypoint)(waypoint_t* wp);
+typedef struct {
+    gpx_t* gpx;
+    gpx_state_e state;
+    gpx_cdata_e cdata;
+    uint32_t waypoint_num;
+    waypoint_t* wp;
+    waypoint_t* first_wp;
+    uint32_t (*add_waypoint)(waypoint_t* wp);
+
+    /* Parser object stores all data required for SXML to be reentrant */
+    sxml_t parser;
+    /* Output token table */
+    sxmltok_t tokens[GPX_TOKENS];
+    /* Input XML text */
+    char buffer[GPX_BUFFER_SIZE];
+    size_t length; /// bytes in the buffer
+} gpx_parser_t;
+
+typedef struct {
+    const char* data;
+    size_t length;
+    size_t position;
+} gpx_memory_t;
+
+/* the names the parser cares about, told apart by length and first character */
+typedef enum {
+    TAG_OTHER,
+    TAG_TRK,
+    TAG_NAME,
+    TAG_TRKSEG,
+    TAG_TRKPT,
+    TAG_ELE,
+    TAG_LAT,
+    TAG_LON,
+} gpx_tag_e;
+
+#define IS(name) (memcmp(text, name, sizeof(name) - 1) == 0)
+
+static gpx_tag_e tag_of(const char* text, size_t length)
+{
+    switch (length) {
+    case 3:
+        switch (text[0]) {
+        case 't':
+            return IS("trk") ? TAG_TRK : TAG_OTHER;
+        case 'e':
+            return IS("ele") ? TAG_ELE : TAG_OTHER;
+        case 'l':
+            return IS("lat") ? TAG_LAT : IS("lon") ? TAG_LON : TAG_OTHER;
+        }
+        break;
+    case 4:
+        return IS("name") ? TAG_NAME : TAG_OTHER;
+    case 5:
+        return IS("trkpt") ? TAG_TRKPT : TAG_OTHER;
+    case 6:
+        return IS("trkseg") ? TAG_TRKSEG : TAG_OTHER;
+    }
+    return TAG_OTHER;
+}
+
+#undef IS
 
-gpx_t* gpx;
+static const float decimal_scale[] = { 1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f };
 
+/**
+ * Decimal number of a GPX file, e.g. " -49.622274"
+ *
+ * Up to 9 significant digits are used in fixed point, the rest is cut off.
+ * Reading stops at the first character that does not belong to the number.
+ */
+float gpx_decimal(const char* text, size_t length)
+{
+    const char* end = text + length;
+    uint32_t mantissa = 0;
+    uint8_t digits = 0;
+    uint8_t decimals = 0;
+    uint8_t exponent = 0; /// integer digits that did not fit the mantissa, counted up to the float range
+    uint8_t negative = 0;
 
-void process_tokens(const char* buffer, sxmltok_t* tokens, sxml_t* parser)
+    while (text < end && (*text == ' ' || *text == '\t' || *text == '\r' || *text == '\n'))
+        text++;
+    if (text < end && (*text == '-' || *text == '+'))
+        negative = *text++ == '-';
+    for (; text < end && *text >= '0' && *text <= '9'; text++) {
+        if (digits < 9) {
+            mantissa = mantissa * 10 + *text - '0';
+            digits += mantissa != 0;
+        } else if (exponent <= FLT_MAX_10_EXP) {
+            exponent++;
+        }
+    }
+    if (text < end && *text == '.') {
+        for (text++; text < end && *text >= '0' && *text <= '9' && digits < 9 && decimals < 9; text++) {
+            mantissa = mantissa * 10 + *text - '0';
+            digits += mantissa != 0;
+            decimals++;
+        }
+    }
+    float value = (float)mantissa / decimal_scale[decimals];
+    if (exponent) {
+        /* beyond the float range the value ends up infinite */
+        for (; exponent > 9; exponent -= 9)
+            value *= decimal_scale[9];
+        value *= decimal_scale[exponent];
+    }
+    return negative ? -value : value;
+}
+
+static void process_tokens(gpx_parser_t* p)
 {
-    char buf[255];
-    for (uint32_t i = 0; i < parser->ntokens; i++) {
-        strncpy(buf, buffer + tokens[i].startpos, tokens[i].endpos - tokens[i].startpos);
-        buf[tokens[i].endpos - tokens[i].startpos] = 0;
-        switch (tokens[i].type) {
+    for (uint32_t i = 0; i < p->parser.ntokens; i++) {
+        sxmltok_t* token = &p->tokens[i];
+        const char* text = p->buffer + token->startpos;
+        size_t length = token->endpos - token->startpos;
+        switch (token->type) {
         case SXML_STARTTAG:
-            if (state == SKIP && strcmp("trk", buf) == 0)
-                state = TRK;
-            else if (state == TRK && strcmp("name", buf) == 0)
-                state = TRK_NAME;
-            else if (state == TRK && strcmp("trkseg", buf) == 0)
-                state = TRKSEG;
-            else if (state == TRKSEG && strcmp("trkpt", buf) == 0) {
-                state = TRKPT;
-                wp = RTOS_Malloc(sizeof(waypoint_t));
-                if (wp && first_wp == 0)
-                    first_wp = wp;
-            } else if (state == TRKPT && strcmp("ele", buf) == 0)
-                state = ELE;
+            switch (tag_of(text, length)) {
+            case TAG_TRK:
+                if (p->state == SKIP)
+                    p->state = TRK;
+                break;
+            case TAG_NAME:
+                if (p->state == TRK)
+                    p->state = TRK_NAME;
+                break;
+            case TAG_TRKSEG:
+                if (p->state == TRK)
+                    p->state = TRKSEG;
+                break;
+            case TAG_TRKPT:
+                if (p->state == TRKSEG) {
+                    p->state = TRKPT;
+                    p->wp = RTOS_Malloc(sizeof(waypoint_t));
+                    if (p->wp && p->first_wp == 0)
+                        p->first_wp = p->wp;
+                }
+                break;
+            case TAG_ELE:
+                if (p->state == TRKPT)
+                    p->state = ELE;
+                break;
+            default:
+                break;
+            }
             break;
         case SXML_ENDTAG:
-            if (state == TRK && strcmp("trk", buf) == 0)
-                state = SKIP;
-            else if (state == TRK_NAME && strcmp("name", buf) == 0)
-                state = TRK;
-            else if (state == TRKSEG && strcmp("trkseg", buf) == 0)
-                state = TRK;
-            else if (state == TRKPT && strcmp("trkpt", buf) == 0) {
-                state = TRKSEG;
-                if (wp)
-                    waypoint_num = add_waypoint(wp);
-            } else if (state == ELE && strcmp("ele", buf) == 0)
-                state = TRKPT;
+            switch (tag_of(text, length)) {
+            case TAG_TRK:
+                if (p->state == TRK)
+                    p->state = SKIP;
+                break;
+            case TAG_NAME:
+                if (p->state == TRK_NAME)
+                    p->state = TRK;
+                break;
+            case TAG_TRKSEG:
+                if (p->state == TRKSEG)
+                    p->state = TRK;
+                break;
+            case TAG_TRKPT:
+                if (p->state == TRKPT) {
+                    p->state = TRKSEG;
+                    if (p->wp)
+                        p->waypoint_num = p->add_waypoint(p->wp);
+                }
+                break;
+            case TAG_ELE:
+                if (p->state == ELE)
+                    p->state = TRKPT;
+                break;
+            default:
+                break;
+            }
             break;
         case SXML_CHARACTER:
-            if (state == TRK_NAME) {
-                gpx->track_name = RTOS_Malloc(sizeof(char) * (strlen(buf) + 1));
-                strcpy(gpx->track_name, buf);
-                ESP_LOGI("xml_data", "name: %s", buf);
-            } else if (state == ELE) {
-                if (wp)
-                    wp->ele = atoff(buf);
-            } else if (state == TRKPT) {
-                if (cdata == LAT) {
-                    if (wp)
-                        wp->lat = atoff(buf);
-                    cdata = NONE;
+            if (p->state == TRK_NAME) {
+                RTOS_Free(p->gpx->track_name);
+                p->gpx->track_name = RTOS_Malloc(sizeof(char) * (length + 1));
+                if (p->gpx->track_name)
+                    memcpy(p->gpx->track_name, text, length);
+                ESP_LOGI("xml_data", "name: %.*s", (int)length, text);
+            } else if (p->state == ELE) {
+                if (p->wp)
+                    p->wp->ele = gpx_decimal(text, length);
+            } else if (p->state == TRKPT) {
+                if (p->cdata == LAT) {
+                    if (p->wp)
+                        p->wp->lat = gpx_decimal(text, length);
+                    p->cdata = NONE;
                 }
-                if (cdata == LON) {
-                    if (wp)
-                        wp->lon = atoff(buf);
-                    cdata = NONE;
+                if (p->cdata == LON) {
+                    if (p->wp)
+                        p->wp->lon = gpx_decimal(text, length);
+                    p->cdata = NONE;
                 }
             }
             break;
         case SXML_CDATA:
-            if (state == TRKPT && strcmp("lat", buf) == 0)
-                cdata = LAT;
-            else if (state == TRKPT && strcmp("lon", buf) == 0)
-                cdata = LON;
+            if (p->state == TRKPT) {
+                gpx_tag_e tag = tag_of(text, length);
+                if (tag == TAG_LAT)
+                    p->cdata = LAT;
+                else if (tag == TAG_LON)
+                    p->cdata = LON;
+            }
             break;
         case SXML_INSTRUCTION:
-            ESP_LOGI("xml_instruction", "%s", buf);
+            ESP_LOGI("xml_instruction", "%.*s", (int)length, text);
             break;
         case SXML_COMMENT:
-            ESP_LOGI("xml_comment", "%s", buf);
+            ESP_LOGI("xml_comment", "%.*s", (int)length, text);
             break;
         case SXML_DOCTYPE:
-            ESP_LOGI("xml_doctype", "%s", buf);
+            ESP_LOGI("xml_doctype", "%.*s", (int)length, text);
             break;
         default: /* LCOV_EXCL_START */
             assert("case unhandled" && 0);
-            break;/* LCOV_EXCL_STOP */
+            break; /* LCOV_EXCL_STOP */
         }
 #if !defined(TESTING) && !defined(LINUX)
         vPortYield();
 #endif
     }
+    p->parser.ntokens = 0;
 }
 
-gpx_t* gpx_parser(const char* gpx_file_data, uint32_t (*add_waypoint_cb)(waypoint_t* wp))
+/*
+ * Move the unparsed rest to the start of the buffer and read the next chunk
+ *
+ * returns NOT_NEEDED at the end of the file
+ */
+static error_code_t refill(gpx_parser_t* p, gpx_read_t read, void* arg)
 {
-    add_waypoint = add_waypoint_cb;
-    waypoint_num = 0; // reset waypoints
-    gpx = RTOS_Malloc(sizeof(gpx_t));
-    /* Output token table */
-    sxmltok_t tokens[128];
+    size_t n = 0;
+    p->length -= p->parser.bufferpos;
+    memmove(p->buffer, p->buffer + p->parser.bufferpos, p->length);
+    p->parser.bufferpos = 0;
+    if (p->length == sizeof(p->buffer)) {
+        ESP_LOGE(TAG, "token longer than %u bytes: %.30s", GPX_BUFFER_SIZE, p->buffer);
+        return PM_FAIL;
+    }
+    error_code_t ret = read(arg, p->buffer + p->length, sizeof(p->buffer) - p->length, &n);
+    if (ret != PM_OK)
+        return ret;
+    p->length += n;
+    return n ? PM_OK : NOT_NEEDED;
+}
 
-    /* Parser object stores all data required for SXML to be reentrant */
-    sxml_t parser;
-    sxml_init(&parser);
-    size_t data_len = strlen(gpx_file_data);
+/*
+ * Parse a GPX file chunk by chunk
+ *
+ * Every track point is handed to add_waypoint_cb as soon as it is parsed.
+ * A file that ends early or turns out to be broken keeps the points that
+ * were parsed up to there.
+ */
+gpx_t* gpx_parser_read(gpx_read_t read, void* arg, uint32_t (*add_waypoint_cb)(waypoint_t* wp))
+{
+    gpx_parser_t* p = RTOS_Malloc(sizeof(gpx_parser_t));
+    gpx_t* gpx = RTOS_Malloc(sizeof(gpx_t));
+    if (!p || !gpx) {
+        RTOS_Free(p);
+        RTOS_Free(gpx);
+        return NULL;
+    }
+    p->gpx = gpx;
+    p->add_waypoint = add_waypoint_cb;
+    sxml_init(&p->parser);
 
-    size_t parser_running=1;
+    size_t parser_running = 1;
     while (parser_running) {
-        sxmlerr_t err = sxml_parse(&parser, gpx_file_data, data_len, tokens, COUNT(tokens));
-        if (parser.ntokens)
-            process_tokens(gpx_file_data, tokens, &parser);
-
-        if (err == SXML_SUCCESS)
-            break;
+        sxmlerr_t err = sxml_parse(&p->parser, p->buffer, p->length, p->tokens, COUNT(p->tokens));
+        if (p->parser.ntokens)
+            process_tokens(p);
 
         switch (err) {
-        case SXML_ERROR_TOKENSFULL: 
+        case SXML_ERROR_TOKENSFULL:
             /*
              Need to give parser more space for tokens to continue parsing.
              We choose here to reuse the existing token table once tokens have been processed.
             */
-            parser.ntokens = 0;
             break;
 
-        case SXML_ERROR_BUFFERDRY: 
-            parser.ntokens = 0;
+        case SXML_SUCCESS:
+            /* a chunk may end between two elements of the document */
+        case SXML_ERROR_BUFFERDRY:
             /*
-             If position reaches data_len we do not have enough data. This should currently 
-             not happen since we use a buffer big enough for the whole file.
-             If the file is not complete, this is triggered though.
+             The parser stopped in front of the token that is not complete yet,
+             it is parsed again with the next chunk. At the end of the file
+             the document is incomplete and we keep what we have.
             */
-            if(parser.bufferpos == data_len)
+            if (refill(p, read, arg) != PM_OK)
                 parser_running = 0;
-            
-            /* Parser will now have to read from beginning of buffer to contiue */
-            parser.bufferpos = 0;
             break;
 
-        case SXML_ERROR_XMLINVALID: 
+        case SXML_ERROR_XMLINVALID:
             /*
              An error occoured and we break parsing.
             */
-            ESP_LOGI("xml_error", "%.30s [%d]", gpx_file_data + parser.bufferpos, parser.bufferpos);
+            ESP_LOGI("xml_error", "%.30s [%d]", p->buffer + p->parser.bufferpos, p->parser.bufferpos);
             parser_running = 0;
             break;
 
@@ -191,8 +348,27 @@ gpx_t* gpx_parser(const char* gpx_file_data, uint32_t (*add_waypoint_cb)(waypoin
         vPortYield();
 #endif
     }
-    
-    gpx->waypoints_num = waypoint_num;
-    gpx->waypoints = first_wp;
+
+    gpx->waypoints_num = p->waypoint_num;
+    gpx->waypoints = p->first_wp;
+    RTOS_Free(p);
     return gpx;
-}
\ No newline at end of file
+}
+
+static error_code_t read_memory(void* arg, char* data, size_t size, size_t* length)
+{
+    gpx_memory_t* m = arg;
+    *length = MIN(size, m->length - m->position);
+    memcpy(data, m->data + m->position, *length);
+    m->position += *length;
+    return PM_OK;
+}
+
+/*
+ * Parse a GPX file that is in memory
+ */
+gpx_t* gpx_parser(const char* gpx_file_data, uint32_t (*add_waypoint_cb)(waypoint_t* wp))
+{
+    gpx_memory_t m = { .data = gpx_file_data, .length = strlen(gpx_file_data) };
+    return gpx_parser_read(read_memory, &m, add_waypoint_cb);
+}
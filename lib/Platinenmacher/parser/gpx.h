@@ -1,6 +1,11 @@
 /*
  * GPX parser
  *
+ * The file is parsed in a window of GPX_BUFFER_SIZE bytes that is refilled
+ * by a read function, so memory use does not depend on the file size. A
+ * token cut by the end of the window is moved to its start and parsed again
+ * with the next chunk.
+ *
  * Copyright (c) 2022, Bastian Neumann <info@platinenmacher.tech>
  *
  * SPDX-License-Identifier: MIT
@@ -11,12 +16,20 @@
 
 #include "../gui/waypoint.h"
 
+#define GPX_BUFFER_SIZE 4096 /// window of the file, the longest token has to fit
+#define GPX_TOKENS 128       /// tokens parsed before they are processed
+
 typedef struct {
     waypoint_t* waypoints;
     uint16_t waypoints_num;
     char* track_name;
 } gpx_t;
 
+/* fills data with up to size bytes of the file, a length of 0 ends it */
+typedef error_code_t (*gpx_read_t)(void* arg, char* data, size_t size, size_t* length);
+
 gpx_t* gpx_parser(const char* gpx_file_data, uint32_t (*add_waypoint_cb)(waypoint_t* wp));
+gpx_t* gpx_parser_read(gpx_read_t read, void* arg, uint32_t (*add_waypoint_cb)(waypoint_t* wp));
+float gpx_decimal(const char* text, size_t length);
 
-#endif //PLATINENMACHER_PARSER_GPX_H
\ No newline at end of file
+#endif //PLATINENMACHER_PARSER_GPX_H
@@ -0,0 +1,232 @@
+/*
+ * Bulk pixel kernels for 4bpp framebuffers, portable and SWAR versions
+ *
+ * Copyright (c) 2022, Bastian Neumann <info@platinenmacher.tech>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "pixel.h"
+
+#include <string.h>
+
+static void unpack_4bpp_scalar(uint8_t* dst, const uint8_t* src, size_t pixels)
+{
+    size_t bytes = pixels >> 1;
+    for (size_t i = 0; i < bytes; i++) {
+        dst[2 * i] = src[i] >> 4;
+        dst[2 * i + 1] = src[i] & 0x0f;
+    }
+    if (pixels & 1)
+        dst[pixels - 1] = src[bytes] >> 4;
+}
+
+static void pack_4bpp_scalar(uint8_t* dst, const uint8_t* src, size_t pixels)
+{
+    size_t bytes = pixels >> 1;
+    for (size_t i = 0; i < bytes; i++)
+        dst[i] = (src[2 * i] << 4) | (src[2 * i + 1] & 0x0f);
+    if (pixels & 1)
+        dst[bytes] = (dst[bytes] & 0x0f) | (src[pixels - 1] << 4);
+}
+
+static void expand_4bpp_rgba32_scalar(uint32_t* dst, const uint8_t* src, size_t pixels, const uint32_t palette[16])
+{
+    for (size_t i = 0; i < pixels; i++) {
+        uint8_t b = src[i >> 1];
+        dst[i] = palette[(i & 1) ? (b & 0x0f) : (b >> 4)];
+    }
+}
+
+static void merge_keyed_scalar(uint8_t* dst, const uint8_t* src, size_t pixels, uint8_t key)
+{
+    for (size_t i = 0; i < pixels; i++)
+        if (src[i] != key)
+            dst[i] = src[i];
+}
+
+const pixel_kernels_t pixel_kernels_scalar = {
+    .name = "scalar",
+    .unpack_4bpp = unpack_4bpp_scalar,
+    .pack_4bpp = pack_4bpp_scalar,
+    .expand_4bpp_rgba32 = expand_4bpp_rgba32_scalar,
+    .merge_keyed = merge_keyed_scalar,
+};
+
+/*
+ * SWAR versions work on 32 bit words, which is the widest thing the Xtensa
+ * cores handle in one go. Loads and stores go through memcpy so unaligned
+ * buffers do not trap. The byte shuffling assumes little endian.
+ */
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+
+static inline uint32_t load32(const void* p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline void store32(void* p, uint32_t v)
+{
+    memcpy(p, &v, sizeof(v));
+}
+
+static void unpack_4bpp_swar(uint8_t* dst, const uint8_t* src, size_t pixels)
+{
+    size_t words = pixels >> 3;
+    for (size_t i = 0; i < words; i++) {
+        uint32_t w = load32(src + 4 * i);
+        uint32_t hi = (w >> 4) & 0x0f0f0f0f;
+        uint32_t lo = w & 0x0f0f0f0f;
+        /* spread bytes 0,1 and 2,3 to every other byte and interleave */
+        uint32_t hi0 = (hi & 0xff) | ((hi & 0xff00) << 8);
+        uint32_t lo0 = (lo & 0xff) | ((lo & 0xff00) << 8);
+        uint32_t hi1 = ((hi >> 16) & 0xff) | ((hi >> 8) & 0xff0000);
+        uint32_t lo1 = ((lo >> 16) & 0xff) | ((lo >> 8) & 0xff0000);
+        store32(dst + 8 * i, hi0 | (lo0 << 8));
+        store32(dst + 8 * i + 4, hi1 | (lo1 << 8));
+    }
+    unpack_4bpp_scalar(dst + 8 * words, src + 4 * words, pixels - 8 * words);
+}
+
+static void pack_4bpp_swar(uint8_t* dst, const uint8_t* src, size_t pixels)
+{
+    size_t words = pixels >> 3;
+    for (size_t i = 0; i < words; i++) {
+        uint32_t w0 = load32(src + 8 * i);
+        uint32_t w1 = load32(src + 8 * i + 4);
+        /* two packed bytes per word land in bits 0-7 and 16-23 */
+        uint32_t t0 = ((w0 & 0x000f000f) << 4) | ((w0 >> 8) & 0x000f000f);
+        uint32_t t1 = ((w1 & 0x000f000f) << 4) | ((w1 >> 8) & 0x000f000f);
+        t0 = (t0 & 0xff) | ((t0 >> 8) & 0xff00);
+        t1 = (t1 & 0xff) | ((t1 >> 8) & 0xff00);
+        store32(dst + 4 * i, t0 | (t1 << 16));
+    }
+    pack_4bpp_scalar(dst + 4 * words, src + 8 * words, pixels - 8 * words);
+}
+
+static void expand_4bpp_rgba32_swar(uint32_t* dst, const uint8_t* src, size_t pixels, const uint32_t palette[16])
+{
+    /* a palette lookup does not vectorize in a word, unroll per source byte instead */
+    size_t bytes = pixels >> 1;
+    for (size_t i = 0; i < bytes; i++) {
+        uint8_t b = src[i];
+        dst[2 * i] = palette[b >> 4];
+        dst[2 * i + 1] = palette[b & 0x0f];
+    }
+    if (pixels & 1)
+        dst[pixels - 1] = palette[src[bytes] >> 4];
+}
+
+static void merge_keyed_swar(uint8_t* dst, const uint8_t* src, size_t pixels, uint8_t key)
+{
+    uint32_t keys = key * 0x01010101u;
+    size_t words = pixels >> 2;
+    for (size_t i = 0; i < words; i++) {
+        uint32_t s = load32(src + 4 * i);
+        uint32_t x = s ^ keys;
+        /* exact zero byte test, bit 7 of each byte is set where src == key */
+        uint32_t z = ~((((x & 0x7f7f7f7f) + 0x7f7f7f7f) | x) | 0x7f7f7f7f);
+        uint32_t keep = (z >> 7) * 0xff;
+        uint32_t d = load32(dst + 4 * i);
+        store32(dst + 4 * i, (d & keep) | (s & ~keep));
+    }
+    merge_keyed_scalar(dst + 4 * words, src + 4 * words, pixels - 4 * words, key);
+}
+
+const pixel_kernels_t pixel_kernels_swar = {
+    .name = "swar",
+    .unpack_4bpp = unpack_4bpp_swar,
+    .pack_4bpp = pack_4bpp_swar,
+    .expand_4bpp_rgba32 = expand_4bpp_rgba32_swar,
+    .merge_keyed = merge_keyed_swar,
+};
+
+#else
+
+const pixel_kernels_t pixel_kernels_swar = {
+    .name = "swar",
+    .unpack_4bpp = unpack_4bpp_scalar,
+    .pack_4bpp = pack_4bpp_scalar,
+    .expand_4bpp_rgba32 = expand_4bpp_rgba32_scalar,
+    .merge_keyed = merge_keyed_scalar,
+};
+
+#endif
+
+#if !defined(__x86_64__) && !defined(__i386__)
+const pixel_kernels_t* const pixel_kernels_sse2 = NULL;
+const pixel_kernels_t* const pixel_kernels_avx2 = NULL;
+
+static int cpu_supports(pixel_kernel_variant_t variant)
+{
+    (void)variant;
+    return 0;
+}
+#else
+static int cpu_supports(pixel_kernel_variant_t variant)
+{
+    __builtin_cpu_init();
+    if (variant == PIXEL_KERNEL_SSE2)
+        return __builtin_cpu_supports("sse2");
+    if (variant == PIXEL_KERNEL_AVX2)
+        return __builtin_cpu_supports("avx2");
+    return 0;
+}
+#endif
+
+/**
+ * @brief Kernel table for one variant
+ *
+ * @return NULL if the variant is not built for this target or the CPU
+ * does not support it
+ */
+const pixel_kernels_t* pixel_kernels_get(pixel_kernel_variant_t variant)
+{
+    switch (variant) {
+    case PIXEL_KERNEL_SCALAR:
+        return &pixel_kernels_scalar;
+    case PIXEL_KERNEL_SWAR:
+        return &pixel_kernels_swar;
+    case PIXEL_KERNEL_SSE2:
+        return (pixel_kernels_sse2 && cpu_supports(variant)) ? pixel_kernels_sse2 : NULL;
+    case PIXEL_KERNEL_AVX2:
+        return (pixel_kernels_avx2 && cpu_supports(variant)) ? pixel_kernels_avx2 : NULL;
+    default:
+        return NULL;
+    }
+}
+
+/**
+ * @brief Fastest kernel table available, picked once
+ */
+const pixel_kernels_t* pixel_kernels_best(void)
+{
+    static const pixel_kernels_t* best;
+    if (!best) {
+        for (int v = PIXEL_KERNEL_MAX - 1; v >= 0 && !best; v--)
+            best = pixel_kernels_get(v);
+    }
+    return best;
+}
+
+void pixel_unpack_4bpp(uint8_t* dst, const uint8_t* src, size_t pixels)
+{
+    pixel_kernels_best()->unpack_4bpp(dst, src, pixels);
+}
+
+void pixel_pack_4bpp(uint8_t* dst, const uint8_t* src, size_t pixels)
+{
+    pixel_kernels_best()->pack_4bpp(dst, src, pixels);
+}
+
+void pixel_expand_4bpp_rgba32(uint32_t* dst, const uint8_t* src, size_t pixels, const uint32_t palette[16])
+{
+    pixel_kernels_best()->expand_4bpp_rgba32(dst, src, pixels, palette);
+}
+
+void pixel_merge_keyed(uint8_t* dst, const uint8_t* src, size_t pixels, uint8_t key)
+{
+    pixel_kernels_best()->merge_keyed(dst, src, pixels, key);
+}
@@ -0,0 +1,50 @@
+/*
+ * Bulk pixel kernels for 4bpp framebuffers
+ *
+ * Packed 4bpp data stores the first (even) pixel in the high nibble and the
+ * second (odd) pixel in the low nibble, the same layout the ACEP display
+ * driver and the map tiles use. All kernels work on pixel counts, odd
+ * counts are allowed.
+ *
+ * Copyright (c) 2022, Bastian Neumann <info@platinenmacher.tech>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum {
+    PIXEL_KERNEL_SCALAR,
+    PIXEL_KERNEL_SWAR,
+    PIXEL_KERNEL_SSE2,
+    PIXEL_KERNEL_AVX2,
+    PIXEL_KERNEL_MAX,
+} pixel_kernel_variant_t;
+
+typedef struct {
+    const char* name;
+    /* one nibble of src per byte of dst */
+    void (*unpack_4bpp)(uint8_t* dst, const uint8_t* src, size_t pixels);
+    /* low nibble of each src byte into dst, an odd tail keeps the low nibble of its dst byte */
+    void (*pack_4bpp)(uint8_t* dst, const uint8_t* src, size_t pixels);
+    /* palette[nibble] for each pixel of src */
+    void (*expand_4bpp_rgba32)(uint32_t* dst, const uint8_t* src, size_t pixels, const uint32_t palette[16]);
+    /* copy 8bpp src to dst except for pixels that equal key */
+    void (*merge_keyed)(uint8_t* dst, const uint8_t* src, size_t pixels, uint8_t key);
+} pixel_kernels_t;
+
+const pixel_kernels_t* pixel_kernels_get(pixel_kernel_variant_t variant);
+const pixel_kernels_t* pixel_kernels_best(void);
+
+void pixel_unpack_4bpp(uint8_t* dst, const uint8_t* src, size_t pixels);
+void pixel_pack_4bpp(uint8_t* dst, const uint8_t* src, size_t pixels);
+void pixel_expand_4bpp_rgba32(uint32_t* dst, const uint8_t* src, size_t pixels, const uint32_t palette[16]);
+void pixel_merge_keyed(uint8_t* dst, const uint8_t* src, size_t pixels, uint8_t key);
+
+/* variant tables, the SIMD ones are NULL when not compiled in */
+extern const pixel_kernels_t pixel_kernels_scalar;
+extern const pixel_kernels_t pixel_kernels_swar;
+extern const pixel_kernels_t* const pixel_kernels_sse2;
+extern const pixel_kernels_t* const pixel_kernels_avx2;
@@ -0,0 +1,209 @@
+/*
+ * Bulk pixel kernels for 4bpp framebuffers, SSE2 and AVX2 versions
+ *
+ * Only built for x86 hosts (native tests and the Linux simulator). Every
+ * function carries its own target attribute so the file does not need
+ * special compiler flags, pixel_kernels_get checks the CPU at runtime.
+ *
+ * Copyright (c) 2022, Bastian Neumann <info@platinenmacher.tech>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include "pixel.h"
+
+#include <immintrin.h>
+
+#define SSE2 __attribute__((target("sse2")))
+#define AVX2 __attribute__((target("avx2")))
+
+SSE2 static void unpack_4bpp_sse2(uint8_t* dst, const uint8_t* src, size_t pixels)
+{
+    const __m128i mask = _mm_set1_epi8(0x0f);
+    size_t blocks = pixels >> 5;
+    for (size_t i = 0; i < blocks; i++) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + 16 * i));
+        __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), mask);
+        __m128i lo = _mm_and_si128(v, mask);
+        _mm_storeu_si128((__m128i*)(dst + 32 * i), _mm_unpacklo_epi8(hi, lo));
+        _mm_storeu_si128((__m128i*)(dst + 32 * i + 16), _mm_unpackhi_epi8(hi, lo));
+    }
+    pixel_kernels_swar.unpack_4bpp(dst + 32 * blocks, src + 16 * blocks, pixels - 32 * blocks);
+}
+
+SSE2 static inline __m128i pack_lanes_sse2(__m128i v)
+{
+    /* each 16 bit lane holds an even and an odd pixel, fold them into the low byte */
+    const __m128i mask = _mm_set1_epi16(0x0f);
+    return _mm_or_si128(_mm_slli_epi16(_mm_and_si128(v, mask), 4),
+        _mm_and_si128(_mm_srli_epi16(v, 8), mask));
+}
+
+SSE2 static void pack_4bpp_sse2(uint8_t* dst, const uint8_t* src, size_t pixels)
+{
+    size_t blocks = pixels >> 5;
+    for (size_t i = 0; i < blocks; i++) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(src + 32 * i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(src + 32 * i + 16));
+        _mm_storeu_si128((__m128i*)(dst + 16 * i), _mm_packus_epi16(pack_lanes_sse2(a), pack_lanes_sse2(b)));
+    }
+    pixel_kernels_swar.pack_4bpp(dst + 16 * blocks, src + 32 * blocks, pixels - 32 * blocks);
+}
+
+SSE2 static void expand_4bpp_rgba32_sse2(uint32_t* dst, const uint8_t* src, size_t pixels, const uint32_t palette[16])
+{
+    /*
+     * SSE2 has no byte shuffle, so the palette becomes a table of pixel
+     * pairs indexed by the whole source byte. Building it costs 256 lookups
+     * and only pays off on longer runs.
+     */
+    size_t bytes = pixels >> 1;
+    if (bytes < 512) {
+        pixel_kernels_swar.expand_4bpp_rgba32(dst, src, pixels, palette);
+        return;
+    }
+
+    uint64_t pairs[256];
+    for (int i = 0; i < 256; i++)
+        pairs[i] = palette[i >> 4] | ((uint64_t)palette[i & 0x0f] << 32);
+
+    size_t blocks = bytes >> 1;
+    for (size_t i = 0; i < blocks; i++) {
+        __m128i v = _mm_set_epi64x(pairs[src[2 * i + 1]], pairs[src[2 * i]]);
+        _mm_storeu_si128((__m128i*)(dst + 4 * i), v);
+    }
+    pixel_kernels_swar.expand_4bpp_rgba32(dst + 4 * blocks, src + 2 * blocks, pixels - 4 * blocks, palette);
+}
+
+SSE2 static void merge_keyed_sse2(uint8_t* dst, const uint8_t* src, size_t pixels, uint8_t key)
+{
+    const __m128i keys = _mm_set1_epi8(key);
+    size_t blocks = pixels >> 4;
+    for (size_t i = 0; i < blocks; i++) {
+        __m128i s = _mm_loadu_si128((const __m128i*)(src + 16 * i));
+        __m128i d = _mm_loadu_si128((const __m128i*)(dst + 16 * i));
+        __m128i keep = _mm_cmpeq_epi8(s, keys);
+        _mm_storeu_si128((__m128i*)(dst + 16 * i), _mm_or_si128(_mm_and_si128(keep, d), _mm_andnot_si128(keep, s)));
+    }
+    pixel_kernels_swar.merge_keyed(dst + 16 * blocks, src + 16 * blocks, pixels - 16 * blocks, key);
+}
+
+static const pixel_kernels_t sse2_kernels = {
+    .name = "sse2",
+    .unpack_4bpp = unpack_4bpp_sse2,
+    .pack_4bpp = pack_4bpp_sse2,
+    .expand_4bpp_rgba32 = expand_4bpp_rgba32_sse2,
+    .merge_keyed = merge_keyed_sse2,
+};
+
+AVX2 static void unpack_4bpp_avx2(uint8_t* dst, const uint8_t* src, size_t pixels)
+{
+    const __m256i mask = _mm256_set1_epi8(0x0f);
+    size_t blocks = pixels >> 6;
+    for (size_t i = 0; i < blocks; i++) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(src + 32 * i));
+        __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), mask);
+        __m256i lo = _mm256_and_si256(v, mask);
+        /* unpack works per 128 bit lane, put the lanes back in order */
+        __m256i a = _mm256_unpacklo_epi8(hi, lo);
+        __m256i b = _mm256_unpackhi_epi8(hi, lo);
+        _mm256_storeu_si256((__m256i*)(dst + 64 * i), _mm256_permute2x128_si256(a, b, 0x20));
+        _mm256_storeu_si256((__m256i*)(dst + 64 * i + 32), _mm256_permute2x128_si256(a, b, 0x31));
+    }
+    unpack_4bpp_sse2(dst + 64 * blocks, src + 32 * blocks, pixels - 64 * blocks);
+}
+
+AVX2 static inline __m256i pack_lanes_avx2(__m256i v)
+{
+    const __m256i mask = _mm256_set1_epi16(0x0f);
+    return _mm256_or_si256(_mm256_slli_epi16(_mm256_and_si256(v, mask), 4),
+        _mm256_and_si256(_mm256_srli_epi16(v, 8), mask));
+}
+
+AVX2 static void pack_4bpp_avx2(uint8_t* dst, const uint8_t* src, size_t pixels)
+{
+    size_t blocks = pixels >> 6;
+    for (size_t i = 0; i < blocks; i++) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(src + 64 * i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(src + 64 * i + 32));
+        __m256i packed = _mm256_packus_epi16(pack_lanes_avx2(a), pack_lanes_avx2(b));
+        _mm256_storeu_si256((__m256i*)(dst + 32 * i), _mm256_permute4x64_epi64(packed, 0xd8));
+    }
+    pack_4bpp_sse2(dst + 32 * blocks, src + 64 * blocks, pixels - 64 * blocks);
+}
+
+AVX2 static void expand_4bpp_rgba32_avx2(uint32_t* dst, const uint8_t* src, size_t pixels, const uint32_t palette[16])
+{
+    /* split the palette into four byte planes that vpshufb can index with the nibbles */
+    uint8_t planes[4][16];
+    for (int i = 0; i < 16; i++) {
+        planes[0][i] = palette[i];
+        planes[1][i] = palette[i] >> 8;
+        planes[2][i] = palette[i] >> 16;
+        planes[3][i] = palette[i] >> 24;
+    }
+    const __m256i p0 = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)planes[0]));
+    const __m256i p1 = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)planes[1]));
+    const __m256i p2 = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)planes[2]));
+    const __m256i p3 = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)planes[3]));
+    const __m128i mask = _mm_set1_epi8(0x0f);
+
+    size_t blocks = pixels >> 5;
+    for (size_t i = 0; i < blocks; i++) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + 16 * i));
+        __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), mask);
+        __m128i lo = _mm_and_si128(v, mask);
+        /* lane 0 holds pixels 0-15, lane 1 pixels 16-31 */
+        __m256i idx = _mm256_set_m128i(_mm_unpackhi_epi8(hi, lo), _mm_unpacklo_epi8(hi, lo));
+
+        __m256i b0 = _mm256_shuffle_epi8(p0, idx);
+        __m256i b1 = _mm256_shuffle_epi8(p1, idx);
+        __m256i b2 = _mm256_shuffle_epi8(p2, idx);
+        __m256i b3 = _mm256_shuffle_epi8(p3, idx);
+
+        __m256i b01l = _mm256_unpacklo_epi8(b0, b1);
+        __m256i b01h = _mm256_unpackhi_epi8(b0, b1);
+        __m256i b23l = _mm256_unpacklo_epi8(b2, b3);
+        __m256i b23h = _mm256_unpackhi_epi8(b2, b3);
+
+        __m256i q0 = _mm256_unpacklo_epi16(b01l, b23l);
+        __m256i q1 = _mm256_unpackhi_epi16(b01l, b23l);
+        __m256i q2 = _mm256_unpacklo_epi16(b01h, b23h);
+        __m256i q3 = _mm256_unpackhi_epi16(b01h, b23h);
+
+        uint32_t* out = dst + 32 * i;
+        _mm256_storeu_si256((__m256i*)out, _mm256_permute2x128_si256(q0, q1, 0x20));
+        _mm256_storeu_si256((__m256i*)(out + 8), _mm256_permute2x128_si256(q2, q3, 0x20));
+        _mm256_storeu_si256((__m256i*)(out + 16), _mm256_permute2x128_si256(q0, q1, 0x31));
+        _mm256_storeu_si256((__m256i*)(out + 24), _mm256_permute2x128_si256(q2, q3, 0x31));
+    }
+    pixel_kernels_swar.expand_4bpp_rgba32(dst + 32 * blocks, src + 16 * blocks, pixels - 32 * blocks, palette);
+}
+
+AVX2 static void merge_keyed_avx2(uint8_t* dst, const uint8_t* src, size_t pixels, uint8_t key)
+{
+    const __m256i keys = _mm256_set1_epi8(key);
+    size_t blocks = pixels >> 5;
+    for (size_t i = 0; i < blocks; i++) {
+        __m256i s = _mm256_loadu_si256((const __m256i*)(src + 32 * i));
+        __m256i d = _mm256_loadu_si256((const __m256i*)(dst + 32 * i));
+        __m256i keep = _mm256_cmpeq_epi8(s, keys);
+        _mm256_storeu_si256((__m256i*)(dst + 32 * i), _mm256_blendv_epi8(s, d, keep));
+    }
+    merge_keyed_sse2(dst + 32 * blocks, src + 32 * blocks, pixels - 32 * blocks, key);
+}
+
+static const pixel_kernels_t avx2_kernels = {
+    .name = "avx2",
+    .unpack_4bpp = unpack_4bpp_avx2,
+    .pack_4bpp = pack_4bpp_avx2,
+    .expand_4bpp_rgba32 = expand_4bpp_rgba32_avx2,
+    .merge_keyed = merge_keyed_avx2,
+};
+
+const pixel_kernels_t* const pixel_kernels_sse2 = &sse2_kernels;
+const pixel_kernels_t* const pixel_kernels_avx2 = &avx2_kernels;
+
+#endif
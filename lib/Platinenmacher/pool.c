@@ -0,0 +1,77 @@
+/*
+ * Fixed size block pools
+ *
+ * Copyright (c) 2022, Bastian Neumann <info@platinenmacher.tech>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "pool.h"
+#include "memory.h"
+
+static const char* TAG = "pool";
+
+/**
+ * Get a zeroed block
+ *
+ * Falls back to the heap if the pool is exhausted.
+ *
+ * @return block or NULL if the heap is exhausted too
+ */
+void* pool_alloc(pool_t* pool)
+{
+    if (pool->used < pool->capacity) {
+        void* block = pool->blocks + pool->used * pool->block_size;
+        pool->used++;
+        memset(block, 0, pool->block_size);
+        return block;
+    }
+    ESP_LOGI(TAG, "%s exhausted, using heap", pool->name);
+    pool_heap_t* heap = RTOS_Malloc(sizeof(pool_heap_t) + pool->block_size);
+    if (!heap)
+        return NULL;
+    heap->next = pool->heap;
+    pool->heap = heap;
+    return heap->data;
+}
+
+/**
+ * Release a block
+ *
+ * Blocks of the pool itself are only returned by pool_reset.
+ */
+void pool_free(pool_t* pool, void* block)
+{
+    if (!block || pool_owns(pool, block))
+        return;
+    for (pool_heap_t** h = &pool->heap; *h; h = &(*h)->next) {
+        if ((*h)->data == block) {
+            pool_heap_t* heap = *h;
+            *h = heap->next;
+            RTOS_Free(heap);
+            return;
+        }
+    }
+}
+
+/**
+ * Return all blocks at once
+ *
+ * Every pointer handed out by the pool becomes invalid, the blocks from
+ * the heap are freed.
+ */
+void pool_reset(pool_t* pool)
+{
+    while (pool->heap) {
+        pool_heap_t* heap = pool->heap;
+        pool->heap = heap->next;
+        RTOS_Free(heap);
+    }
+    pool->used = 0;
+}
+
+uint8_t pool_owns(const pool_t* pool, const void* block)
+{
+    const uint8_t* b = block;
+    return b >= pool->blocks && b < pool->blocks + pool->capacity * pool->block_size;
+}
@@ -0,0 +1,54 @@
+/*
+ * Fixed size block pools
+ *
+ * Blocks are handed out in order and all of them are returned at once with
+ * pool_reset, which makes a pool a good fit for objects that live as long
+ * as a screen. When a pool runs out, blocks come from the heap, pool_reset
+ * releases them as well.
+ *
+ * Copyright (c) 2022, Bastian Neumann <info@platinenmacher.tech>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef PLATINENMACHER_POOL_H
+#define PLATINENMACHER_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* header of a block from the heap */
+typedef struct pool_heap {
+    struct pool_heap* next;
+    max_align_t data[];
+} pool_heap_t;
+
+typedef struct {
+    const char* name;
+    uint8_t* blocks;
+    size_t block_size;
+    size_t capacity; /// number of blocks
+    size_t used;     /// blocks handed out since the last reset
+    pool_heap_t* heap; /// blocks from the heap since the last reset
+} pool_t;
+
+/*
+ * Define a static pool for count objects of type
+ */
+#define POOL_DEFINE(pool, type, count)        \
+    static type pool##_blocks[count];         \
+    static pool_t pool = {                    \
+        .name = #pool,                        \
+        .blocks = (uint8_t*)pool##_blocks,    \
+        .block_size = sizeof(type),           \
+        .capacity = (count),                  \
+        .used = 0,                            \
+        .heap = NULL,                         \
+    }
+
+void* pool_alloc(pool_t* pool);
+void pool_free(pool_t* pool, void* block);
+void pool_reset(pool_t* pool);
+uint8_t pool_owns(const pool_t* pool, const void* block);
+
+#endif // PLATINENMACHER_POOL_H
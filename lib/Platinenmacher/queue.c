@@ -0,0 +1,147 @@
+/*
+ * Bounded blocking queue
+ *
+ * Copyright (c) 2022, Bastian Neumann <info@platinenmacher.tech>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "queue.h"
+#include "memory.h"
+
+#if defined(TESTING) || defined(LINUX)
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+
+struct queue {
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    size_t length;
+    size_t item_size;
+    size_t head;
+    size_t count;
+    uint8_t items[];
+};
+
+queue_t* queue_create(size_t length, size_t item_size)
+{
+    queue_t* q = RTOS_Malloc(sizeof(queue_t) + length * item_size);
+    if (!q)
+        return NULL;
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->not_empty, NULL);
+    pthread_cond_init(&q->not_full, NULL);
+    q->length = length;
+    q->item_size = item_size;
+    return q;
+}
+
+/*
+ * Nobody may wait on the queue any more
+ */
+void queue_delete(queue_t* q)
+{
+    if (!q)
+        return;
+    pthread_cond_destroy(&q->not_full);
+    pthread_cond_destroy(&q->not_empty);
+    pthread_mutex_destroy(&q->lock);
+    RTOS_Free(q);
+}
+
+/* wait on cond until pred holds, 0 on timeout */
+static int wait_for(queue_t* q, pthread_cond_t* cond, const size_t* value, size_t blocked, uint32_t timeout_ms)
+{
+    struct timespec deadline;
+    if (timeout_ms != QUEUE_WAIT_FOREVER) {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += timeout_ms / 1000;
+        deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+    }
+    while (*value == blocked) {
+        if (timeout_ms == QUEUE_WAIT_FOREVER)
+            pthread_cond_wait(cond, &q->lock);
+        else if (pthread_cond_timedwait(cond, &q->lock, &deadline) == ETIMEDOUT)
+            return *value != blocked;
+    }
+    return 1;
+}
+
+error_code_t queue_send(queue_t* q, const void* item, uint32_t timeout_ms)
+{
+    pthread_mutex_lock(&q->lock);
+    if (!wait_for(q, &q->not_full, &q->count, q->length, timeout_ms)) {
+        pthread_mutex_unlock(&q->lock);
+        return TIMEOUT;
+    }
+    memcpy(&q->items[((q->head + q->count) % q->length) * q->item_size], item, q->item_size);
+    q->count++;
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+    return PM_OK;
+}
+
+error_code_t queue_receive(queue_t* q, void* item, uint32_t timeout_ms)
+{
+    pthread_mutex_lock(&q->lock);
+    if (!wait_for(q, &q->not_empty, &q->count, 0, timeout_ms)) {
+        pthread_mutex_unlock(&q->lock);
+        return TIMEOUT;
+    }
+    memcpy(item, &q->items[q->head * q->item_size], q->item_size);
+    q->head = (q->head + 1) % q->length;
+    q->count--;
+    pthread_cond_signal(&q->not_full);
+    pthread_mutex_unlock(&q->lock);
+    return PM_OK;
+}
+
+size_t queue_count(queue_t* q)
+{
+    pthread_mutex_lock(&q->lock);
+    size_t count = q->count;
+    pthread_mutex_unlock(&q->lock);
+    return count;
+}
+
+#else
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+
+static TickType_t to_ticks(uint32_t timeout_ms)
+{
+    return timeout_ms == QUEUE_WAIT_FOREVER ? portMAX_DELAY : pdMS_TO_TICKS(timeout_ms);
+}
+
+queue_t* queue_create(size_t length, size_t item_size)
+{
+    return (queue_t*)xQueueCreate(length, item_size);
+}
+
+void queue_delete(queue_t* queue)
+{
+    if (queue)
+        vQueueDelete((QueueHandle_t)queue);
+}
+
+error_code_t queue_send(queue_t* queue, const void* item, uint32_t timeout_ms)
+{
+    return xQueueSend((QueueHandle_t)queue, item, to_ticks(timeout_ms)) == pdTRUE ? PM_OK : TIMEOUT;
+}
+
+error_code_t queue_receive(queue_t* queue, void* item, uint32_t timeout_ms)
+{
+    return xQueueReceive((QueueHandle_t)queue, item, to_ticks(timeout_ms)) == pdTRUE ? PM_OK : TIMEOUT;
+}
+
+size_t queue_count(queue_t* queue)
+{
+    return uxQueueMessagesWaiting((QueueHandle_t)queue);
+}
+#endif
@@ -0,0 +1,30 @@
+/*
+ * Bounded blocking queue
+ *
+ * Items are copied in and out. FreeRTOS queues on the ESP32, a ring
+ * buffer with pthread conditions on the host.
+ *
+ * Copyright (c) 2022, Bastian Neumann <info@platinenmacher.tech>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef PLATINENMACHER_QUEUE_H
+#define PLATINENMACHER_QUEUE_H
+
+#include "error.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define QUEUE_WAIT_FOREVER UINT32_MAX
+
+typedef struct queue queue_t;
+
+queue_t* queue_create(size_t length, size_t item_size);
+void queue_delete(queue_t* queue);
+error_code_t queue_send(queue_t* queue, const void* item, uint32_t timeout_ms);
+error_code_t queue_receive(queue_t* queue, void* item, uint32_t timeout_ms);
+size_t queue_count(queue_t* queue);
+
+#endif // PLATINENMACHER_QUEUE_H
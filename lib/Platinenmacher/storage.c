@@ -0,0 +1,529 @@
+/*
+ * File storage
+ *
+ * Copyright (c) 2022, Bastian Neumann <info@platinenmacher.tech>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "storage.h"
+#include "memory.h"
+
+#include <stdio.h>
+
+static const char* TAG = "storage";
+
+/**
+ * Open a file
+ *
+ * Opening a file for writing closes its pooled read handle first.
+ * returns UNAVAILABLE if the file or its folder does not exist
+ */
+error_code_t storage_open(storage_t* st, const char* path, uint8_t mode, storage_file_t** file)
+{
+    *file = NULL;
+    if (mode & STORAGE_WRITE)
+        storage_drop(st, path);
+    storage_file_t* f = RTOS_Malloc(sizeof(storage_file_t));
+    if (!f)
+        return PM_FAIL;
+    f->storage = st;
+    error_code_t ret = st->open(st, f, path, mode);
+    if (ret != PM_OK) {
+        RTOS_Free(f);
+        return ret;
+    }
+    *file = f;
+    return PM_OK;
+}
+
+/* create every folder on the way to path */
+static void storage_create_folders(storage_t* st, const char* path)
+{
+    size_t length = strlen(path);
+    char* folder = RTOS_Malloc(length + 1);
+    if (!folder)
+        return;
+    strcpy(folder, path);
+    for (size_t i = 1; i < length; i++) {
+        if (folder[i] != '/' || folder[i - 1] == '/')
+            continue;
+        folder[i] = 0;
+        st->mkdir(st, folder); // opening the file reports the error
+        folder[i] = '/';
+    }
+    RTOS_Free(folder);
+}
+
+/**
+ * Open a file for writing, missing folders are created
+ */
+error_code_t storage_open_for_writing(storage_t* st, const char* path, uint8_t mode, storage_file_t** file)
+{
+    mode |= STORAGE_WRITE;
+    error_code_t ret = storage_open(st, path, mode, file);
+    if (ret == UNAVAILABLE) {
+        storage_create_folders(st, path);
+        ret = storage_open(st, path, mode, file);
+    }
+    return ret;
+}
+
+error_code_t storage_close(storage_file_t* file)
+{
+    if (!file)
+        return NOT_NEEDED;
+    error_code_t ret = file->storage->close(file);
+    RTOS_Free(file);
+    return ret;
+}
+
+error_code_t storage_read(storage_file_t* file, void* data, size_t size, size_t* length)
+{
+    *length = 0;
+    error_code_t ret = file->storage->read(file, data, size, length);
+    file->position += *length;
+    return ret;
+}
+
+error_code_t storage_write(storage_file_t* file, const void* data, size_t size, size_t* written)
+{
+    *written = 0;
+    error_code_t ret = file->storage->write(file, data, size, written);
+    file->position += *written;
+    if (file->position > file->size)
+        file->size = file->position;
+    if (ret == PM_OK && *written != size)
+        ret = PM_FAIL; // card is full
+    return ret;
+}
+
+error_code_t storage_seek(storage_file_t* file, uint32_t offset)
+{
+    if (offset == file->position)
+        return PM_OK;
+    error_code_t ret = file->storage->seek(file, offset);
+    if (ret == PM_OK)
+        file->position = offset;
+    return ret;
+}
+
+error_code_t storage_sync(storage_file_t* file)
+{
+    return file->storage->sync(file);
+}
+
+/**
+ * Size of a file
+ *
+ * returns UNAVAILABLE if it does not exist
+ */
+error_code_t storage_stat(storage_t* st, const char* path, uint32_t* size)
+{
+    return st->stat(st, path, size);
+}
+
+/**
+ * Time a file was last written, only good to tell if it changed
+ *
+ * returns UNAVAILABLE if it does not exist
+ */
+error_code_t storage_modified(storage_t* st, const char* path, uint32_t* time)
+{
+    return st->modified(st, path, time);
+}
+
+error_code_t storage_unlink(storage_t* st, const char* path)
+{
+    storage_drop(st, path);
+    return st->unlink(st, path);
+}
+
+/* name both files of a replace before the old one is moved aside */
+static error_code_t storage_write_journal(storage_t* st, const char* from, const char* to)
+{
+    char text[2 * STORAGE_PATH_LENGTH + 2];
+    storage_file_t* file;
+    size_t written;
+    int length = snprintf(text, sizeof(text), "%s\n%s\n", from, to);
+    if (length < 0 || length >= (int)sizeof(text))
+        return PM_FAIL;
+    error_code_t ret = storage_open_for_writing(st, STORAGE_REPLACE_JOURNAL, STORAGE_WRITE, &file);
+    if (ret != PM_OK)
+        return ret;
+    ret = storage_write(file, text, length, &written);
+    if (ret == PM_OK)
+        ret = storage_sync(file);
+    if (storage_close(file) != PM_OK)
+        ret = PM_FAIL;
+    return ret;
+}
+
+/**
+ * Rename a file, a file named to is replaced
+ *
+ * FatFs cannot replace a file. The old file is moved aside, the new one
+ * renamed in and the old one deleted. A journal names both files, after a
+ * reset storage_recover finishes the replace, so to is never lost.
+ */
+error_code_t storage_rename(storage_t* st, const char* from, const char* to)
+{
+    uint32_t size;
+    storage_drop(st, from);
+    storage_drop(st, to);
+    if (st->rename_replaces || storage_stat(st, to, &size) == UNAVAILABLE)
+        return st->rename(st, from, to);
+
+    /* a journal that is still there belongs to an earlier replace */
+    storage_recover(st);
+    error_code_t ret = storage_write_journal(st, from, to);
+    if (ret == PM_OK && (ret = st->rename(st, to, STORAGE_REPLACE_ASIDE)) == PM_OK) {
+        if ((ret = st->rename(st, from, to)) != PM_OK) {
+            ESP_LOGE(TAG, "cannot rename %s", from);
+            if (st->rename(st, STORAGE_REPLACE_ASIDE, to) != PM_OK)
+                return ret; // storage_recover puts it back
+        }
+        st->unlink(st, STORAGE_REPLACE_ASIDE);
+    }
+    st->unlink(st, STORAGE_REPLACE_JOURNAL);
+    return ret;
+}
+
+/**
+ * Finish a replacing storage_rename that was cut off by a reset
+ *
+ * Call it when the storage is mounted. If to is gone the new file is
+ * renamed in, or the old one back if the new one is gone as well.
+ *
+ * returns NOT_NEEDED if no replace was running
+ */
+error_code_t storage_recover(storage_t* st)
+{
+    uint32_t size;
+    char* journal = NULL;
+    if (storage_stat(st, STORAGE_REPLACE_JOURNAL, &size) != PM_OK)
+        return NOT_NEEDED;
+    error_code_t ret = storage_load(st, STORAGE_REPLACE_JOURNAL, &journal, NULL);
+    if (ret != PM_OK)
+        return ret;
+
+    /* a journal cut off while it was written did not move anything yet */
+    char* from = journal;
+    char* to = strchr(from, '\n');
+    char* end = to ? strchr(to + 1, '\n') : NULL;
+    if (end) {
+        *to++ = 0;
+        *end = 0;
+        if (storage_stat(st, to, &size) == UNAVAILABLE) {
+            ESP_LOGI(TAG, "finish replacing %s", to);
+            if (storage_stat(st, from, &size) == PM_OK)
+                ret = st->rename(st, from, to);
+            else
+                ret = st->rename(st, STORAGE_REPLACE_ASIDE, to);
+        }
+    }
+    if (ret == PM_OK) {
+        st->unlink(st, STORAGE_REPLACE_ASIDE);
+        ret = st->unlink(st, STORAGE_REPLACE_JOURNAL);
+    }
+    RTOS_Free(journal);
+    return ret;
+}
+
+/**
+ * Call entry for every file in the folder path
+ *
+ * returns UNAVAILABLE if the folder does not exist
+ */
+error_code_t storage_list(storage_t* st, const char* path, storage_entry_t entry, void* arg)
+{
+    return st->list(st, path, entry, arg);
+}
+
+/**
+ * Load a whole file
+ *
+ * Allocates the buffer if *dest is NULL, it gets a terminating zero so text
+ * files can be parsed in place. size may be NULL.
+ */
+error_code_t storage_load(storage_t* st, const char* path, char** dest, uint32_t* size)
+{
+    uint32_t fsize;
+    storage_file_t* file;
+    size_t length;
+    error_code_t ret = storage_stat(st, path, &fsize);
+    if (ret != PM_OK) {
+        ESP_LOGE(TAG, "cannot stat %s", path);
+        return ret;
+    }
+    uint8_t allocated = !*dest;
+    if (allocated) {
+        /* the buffer is not zeroed, keep text files terminated */
+        if (!(*dest = RTOS_MallocIO(fsize + 1)))
+            return PM_FAIL;
+        (*dest)[fsize] = 0;
+    }
+    if ((ret = storage_open(st, path, STORAGE_READ, &file)) == PM_OK) {
+        ret = storage_read(file, *dest, fsize, &length);
+        storage_close(file);
+    }
+    if (ret != PM_OK) {
+        ESP_LOGE(TAG, "cannot read %s", path);
+        if (allocated) {
+            RTOS_Free(*dest);
+            *dest = NULL;
+        }
+        return ret;
+    }
+    if (size)
+        *size = fsize;
+    return PM_OK;
+}
+
+/**
+ * Read the start of a file into data
+ *
+ * returns UNAVAILABLE if the file does not exist
+ */
+error_code_t storage_read_file(storage_t* st, const char* path, void* data, size_t size, size_t* length)
+{
+    storage_file_t* file;
+    *length = 0;
+    error_code_t ret = storage_open(st, path, STORAGE_READ, &file);
+    if (ret != PM_OK)
+        return ret;
+    ret = storage_read(file, data, size, length);
+    storage_close(file);
+    return ret;
+}
+
+/*
+ * Pool of open files
+ *
+ * Files that are read again and again (tile archives, tracks) stay open so
+ * only the first read walks the directory. They are opened with
+ * STORAGE_RANDOM, the FatFs backend gives large files a fast seek link map.
+ */
+static void storage_pool_close(storage_pooled_file_t* e)
+{
+    storage_close(e->file);
+    e->file = NULL;
+    e->path[0] = 0;
+}
+
+/**
+ * Close the pooled handle of path, or all handles if path is NULL
+ *
+ * Has to be called before the card goes away.
+ */
+void storage_drop(storage_t* st, const char* path)
+{
+    for (uint8_t i = 0; i < STORAGE_POOL_SIZE; i++)
+        if (st->pool[i].file && (!path || !strcmp(st->pool[i].path, path)))
+            storage_pool_close(&st->pool[i]);
+}
+
+static error_code_t storage_pool_open(storage_t* st, const char* path, storage_file_t** file)
+{
+    storage_pooled_file_t* victim = NULL;
+    for (uint8_t i = 0; i < STORAGE_POOL_SIZE; i++) {
+        storage_pooled_file_t* e = &st->pool[i];
+        if (e->file && !strcmp(e->path, path)) {
+            e->last_use = ++st->pool_clock;
+            *file = e->file;
+            return PM_OK;
+        }
+        /* prefer a free entry, then the least recently used one */
+        if (!victim || (victim->file && (!e->file || e->last_use < victim->last_use)))
+            victim = e;
+    }
+    if (strlen(path) >= STORAGE_PATH_LENGTH)
+        return storage_open(st, path, STORAGE_READ, file);
+
+    storage_pool_close(victim);
+    error_code_t ret = storage_open(st, path, STORAGE_READ | STORAGE_RANDOM, &victim->file);
+    if (ret != PM_OK)
+        return ret;
+    strcpy(victim->path, path);
+    victim->last_use = ++st->pool_clock;
+    *file = victim->file;
+    return PM_OK;
+}
+
+/**
+ * Read from a file that is kept open
+ *
+ * returns UNAVAILABLE if the file does not exist
+ */
+error_code_t storage_read_at(storage_t* st, const char* path, uint32_t offset, void* data, size_t size, size_t* length)
+{
+    storage_file_t* file;
+    *length = 0;
+    error_code_t ret = storage_pool_open(st, path, &file);
+    if (ret != PM_OK)
+        return ret;
+    if ((ret = storage_seek(file, offset)) == PM_OK)
+        ret = storage_read(file, data, size, length);
+    if (strlen(path) >= STORAGE_PATH_LENGTH)
+        storage_close(file); // too long for the pool
+    else if (ret != PM_OK)
+        storage_drop(st, path);
+    return ret;
+}
+
+/*
+ * Buffered write streams
+ *
+ * Writes are staged in a buffer that is a multiple of the sector size and
+ * reach the card as whole sectors. The FAT and directory entry are only
+ * updated on sync: on close, after max_age_ms in storage_sync_streams, and
+ * on request.
+ */
+struct storage_stream {
+    storage_t* storage;
+    storage_file_t* file;
+    uint8_t* buffer;
+    size_t size;
+    size_t used;
+    int64_t last_sync; /// ms
+    uint8_t unsynced;  /// data written since the last sync
+    uint8_t expanded;  /// file was preallocated and has to be truncated on close
+};
+
+static int64_t storage_millis()
+{
+    return RTOS_Micros() / 1000;
+}
+
+/**
+ * Open a file for buffered writing
+ *
+ * buffer_size is rounded up to whole sectors, 0 selects
+ * STORAGE_STREAM_BUFFER_SIZE. If the final size is known, preallocate
+ * reserves it up front, the file is cut to the written length on close.
+ */
+storage_stream_t* storage_stream_open(storage_t* st, const char* path, size_t buffer_size, uint32_t preallocate)
+{
+    uint8_t slot;
+    for (slot = 0; slot < STORAGE_MAX_STREAMS && st->streams[slot]; slot++)
+        ;
+    if (slot == STORAGE_MAX_STREAMS)
+        return NULL;
+
+    if (!buffer_size)
+        buffer_size = STORAGE_STREAM_BUFFER_SIZE;
+    buffer_size = (buffer_size + STORAGE_SECTOR_SIZE - 1) & ~(STORAGE_SECTOR_SIZE - 1);
+
+    storage_stream_t* s = RTOS_Malloc(sizeof(storage_stream_t));
+    if (!s)
+        return NULL;
+    s->storage = st;
+    s->size = buffer_size;
+    if (!(s->buffer = RTOS_MallocIO(buffer_size))
+        || storage_open_for_writing(st, path, STORAGE_WRITE, &s->file) != PM_OK) {
+        ESP_LOGE(TAG, "cannot open stream %s", path);
+        RTOS_Free(s->buffer);
+        RTOS_Free(s);
+        return NULL;
+    }
+    /* one contiguous area, the FAT is not touched again while writing */
+    if (preallocate && s->file->size == 0)
+        s->expanded = st->expand(s->file, preallocate) == PM_OK;
+    s->last_sync = storage_millis();
+    st->streams[slot] = s;
+    return s;
+}
+
+/* write the staged data, keeps the file position on a sector boundary */
+static error_code_t storage_stream_flush(storage_stream_t* s)
+{
+    size_t written;
+    if (!s->used)
+        return PM_OK;
+    if (storage_write(s->file, s->buffer, s->used, &written) != PM_OK) {
+        ESP_LOGE(TAG, "stream write failed");
+        return PM_FAIL;
+    }
+    s->used = 0;
+    s->unsynced = 1;
+    return PM_OK;
+}
+
+error_code_t storage_stream_write(storage_stream_t* s, const void* data, size_t length)
+{
+    const uint8_t* d = data;
+    while (length) {
+        /* the first buffer of an appended file ends on the next sector boundary */
+        size_t limit = s->size - s->file->position % STORAGE_SECTOR_SIZE;
+        if (!s->used && limit == s->size && length >= s->size) {
+            /* whole buffers go to the card without a copy */
+            size_t written;
+            size_t direct = length - length % s->size;
+            if (storage_write(s->file, d, direct, &written) != PM_OK)
+                return PM_FAIL;
+            s->unsynced = 1;
+            d += direct;
+            length -= direct;
+            continue;
+        }
+        size_t count = limit - s->used;
+        if (count > length)
+            count = length;
+        memcpy(s->buffer + s->used, d, count);
+        s->used += count;
+        d += count;
+        length -= count;
+        if (s->used == limit && storage_stream_flush(s) != PM_OK)
+            return PM_FAIL;
+    }
+    return PM_OK;
+}
+
+/**
+ * Write staged data and update the directory entry
+ */
+error_code_t storage_stream_sync(storage_stream_t* s)
+{
+    if (storage_stream_flush(s) != PM_OK)
+        return PM_FAIL;
+    s->last_sync = storage_millis();
+    if (!s->unsynced)
+        return PM_OK;
+    s->unsynced = 0;
+    return storage_sync(s->file);
+}
+
+error_code_t storage_stream_close(storage_stream_t* s)
+{
+    if (!s)
+        return NOT_NEEDED;
+    error_code_t ret = storage_stream_flush(s);
+    if (s->expanded && s->file->storage->truncate(s->file) != PM_OK)
+        ret = PM_FAIL;
+    if (storage_close(s->file) != PM_OK)
+        ret = PM_FAIL;
+    for (uint8_t i = 0; i < STORAGE_MAX_STREAMS; i++)
+        if (s->storage->streams[i] == s)
+            s->storage->streams[i] = NULL;
+    RTOS_Free(s->buffer);
+    RTOS_Free(s);
+    return ret;
+}
+
+/**
+ * Sync every stream that was not synced for max_age_ms, 0 syncs all
+ */
+error_code_t storage_sync_streams(storage_t* st, uint32_t max_age_ms)
+{
+    error_code_t ret = PM_OK;
+    for (uint8_t i = 0; i < STORAGE_MAX_STREAMS; i++) {
+        storage_stream_t* s = st->streams[i];
+        if (!s || (!s->used && !s->unsynced))
+            continue;
+        if (storage_millis() - s->last_sync < max_age_ms)
+            continue;
+        if (storage_stream_sync(s) != PM_OK)
+            ret = PM_FAIL;
+    }
+    return ret;
+}
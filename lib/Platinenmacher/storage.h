@@ -0,0 +1,112 @@
+/*
+ * File storage
+ *
+ * A backend provides the basic file operations (FatFs on the SD card,
+ * POSIX on the host). Everything built on top of them, loading whole
+ * files, creating missing folders, the pool of open files for random reads
+ * and buffered write streams, is the same code for every backend.
+ *
+ * A storage is not thread safe, the firmware only uses it from the SD task.
+ *
+ * Copyright (c) 2022, Bastian Neumann <info@platinenmacher.tech>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef PLATINENMACHER_STORAGE_H
+#define PLATINENMACHER_STORAGE_H
+
+#include "error.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define STORAGE_POOL_SIZE 3   /// files kept open for storage_read_at
+#define STORAGE_PATH_LENGTH 32
+#define STORAGE_MAX_STREAMS 4
+#define STORAGE_SECTOR_SIZE 512
+#define STORAGE_STREAM_BUFFER_SIZE 4096 /// default staging buffer of a write stream
+#define STORAGE_REPLACE_JOURNAL "//REPLACE.JNL" /// names the files of a running replace
+#define STORAGE_REPLACE_ASIDE "//REPLACE.OLD"   /// the replaced file until the new one is in place
+
+enum StorageMode {
+    STORAGE_READ = 0x01,
+    STORAGE_WRITE = 0x02,  /// create the file or truncate it
+    STORAGE_APPEND = 0x04, /// with STORAGE_WRITE: keep the content and write at the end
+    STORAGE_RANDOM = 0x08, /// hint: the file is read at random offsets
+};
+
+typedef struct storage storage_t;
+
+typedef struct {
+    storage_t* storage;
+    void* handle;      /// backend file
+    uint32_t position;
+    uint32_t size;
+} storage_file_t;
+
+typedef struct {
+    char path[STORAGE_PATH_LENGTH];
+    storage_file_t* file;
+    uint32_t last_use;
+} storage_pooled_file_t;
+
+typedef struct storage_stream storage_stream_t;
+
+/* called with the name of every file in a folder */
+typedef void (*storage_entry_t)(void* arg, const char* name);
+
+struct storage {
+    /* backend, open sets handle, size and position of file */
+    error_code_t (*open)(storage_t* st, storage_file_t* file, const char* path, uint8_t mode);
+    error_code_t (*close)(storage_file_t* file);
+    error_code_t (*read)(storage_file_t* file, void* data, size_t size, size_t* length);
+    error_code_t (*write)(storage_file_t* file, const void* data, size_t size, size_t* written);
+    error_code_t (*seek)(storage_file_t* file, uint32_t offset);
+    error_code_t (*sync)(storage_file_t* file);
+    error_code_t (*truncate)(storage_file_t* file); /// cut the file at the current position
+    error_code_t (*expand)(storage_file_t* file, uint32_t size); /// NOT_NEEDED if not supported
+    error_code_t (*stat)(storage_t* st, const char* path, uint32_t* size);
+    error_code_t (*modified)(storage_t* st, const char* path, uint32_t* time); /// in the backend's own format
+    error_code_t (*unlink)(storage_t* st, const char* path);
+    error_code_t (*rename)(storage_t* st, const char* from, const char* to); /// to must not exist
+    error_code_t (*mkdir)(storage_t* st, const char* path); /// PM_OK if it exists
+    error_code_t (*list)(storage_t* st, const char* path, storage_entry_t entry, void* arg);
+    void* driver;
+    uint8_t rename_replaces; /// rename replaces an existing to atomically
+
+    storage_pooled_file_t pool[STORAGE_POOL_SIZE];
+    uint32_t pool_clock;
+    storage_stream_t* streams[STORAGE_MAX_STREAMS];
+};
+
+storage_t* storage_posix_create(const char* root);
+storage_t* storage_fatfs_create();
+
+error_code_t storage_open(storage_t* st, const char* path, uint8_t mode, storage_file_t** file);
+error_code_t storage_open_for_writing(storage_t* st, const char* path, uint8_t mode, storage_file_t** file);
+error_code_t storage_close(storage_file_t* file);
+error_code_t storage_read(storage_file_t* file, void* data, size_t size, size_t* length);
+error_code_t storage_write(storage_file_t* file, const void* data, size_t size, size_t* written);
+error_code_t storage_seek(storage_file_t* file, uint32_t offset);
+error_code_t storage_sync(storage_file_t* file);
+
+error_code_t storage_stat(storage_t* st, const char* path, uint32_t* size);
+error_code_t storage_modified(storage_t* st, const char* path, uint32_t* time);
+error_code_t storage_unlink(storage_t* st, const char* path);
+error_code_t storage_rename(storage_t* st, const char* from, const char* to);
+error_code_t storage_recover(storage_t* st);
+error_code_t storage_list(storage_t* st, const char* path, storage_entry_t entry, void* arg);
+error_code_t storage_load(storage_t* st, const char* path, char** dest, uint32_t* size);
+error_code_t storage_read_file(storage_t* st, const char* path, void* data, size_t size, size_t* length);
+
+error_code_t storage_read_at(storage_t* st, const char* path, uint32_t offset, void* data, size_t size, size_t* length);
+void storage_drop(storage_t* st, const char* path);
+
+storage_stream_t* storage_stream_open(storage_t* st, const char* path, size_t buffer_size, uint32_t preallocate);
+error_code_t storage_stream_write(storage_stream_t* stream, const void* data, size_t length);
+error_code_t storage_stream_sync(storage_stream_t* stream);
+error_code_t storage_stream_close(storage_stream_t* stream);
+error_code_t storage_sync_streams(storage_t* st, uint32_t max_age_ms);
+
+#endif // PLATINENMACHER_STORAGE_H
@@ -0,0 +1,210 @@
+/*
+ * POSIX storage backend
+ *
+ * Files live below a root directory, so the host tests and the simulator
+ * work on a copy of the SD card folder tree.
+ *
+ * Copyright (c) 2022, Bastian Neumann <info@platinenmacher.tech>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#if defined(TESTING) || defined(LINUX)
+
+#include "memory.h"
+#include "storage.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define POSIX_PATH_LENGTH 256
+
+static int posix_fd(const storage_file_t* file)
+{
+    return (int)(intptr_t)file->handle;
+}
+
+/* path below the root of the storage */
+static const char* posix_path(storage_t* st, const char* path, char* buffer)
+{
+    if (!st->driver)
+        return path;
+    snprintf(buffer, POSIX_PATH_LENGTH, "%s/%s", (const char*)st->driver, path);
+    return buffer;
+}
+
+static error_code_t posix_error()
+{
+    return errno == ENOENT || errno == ENOTDIR ? UNAVAILABLE : PM_FAIL;
+}
+
+static error_code_t posix_open(storage_t* st, storage_file_t* file, const char* path, uint8_t mode)
+{
+    char buffer[POSIX_PATH_LENGTH];
+    int flags = O_RDONLY;
+    if (mode & STORAGE_WRITE)
+        flags = O_WRONLY | O_CREAT | (mode & STORAGE_APPEND ? 0 : O_TRUNC);
+    int fd = open(posix_path(st, path, buffer), flags, 0666);
+    if (fd < 0)
+        return posix_error();
+    struct stat s;
+    if (fstat(fd, &s)) {
+        close(fd);
+        return PM_FAIL;
+    }
+    file->handle = (void*)(intptr_t)fd;
+    file->size = s.st_size;
+    file->position = 0;
+    if (mode & STORAGE_APPEND)
+        file->position = lseek(fd, 0, SEEK_END);
+#ifdef POSIX_FADV_RANDOM
+    if (mode & STORAGE_RANDOM)
+        posix_fadvise(fd, 0, 0, POSIX_FADV_RANDOM);
+#endif
+    return PM_OK;
+}
+
+static error_code_t posix_close(storage_file_t* file)
+{
+    return close(posix_fd(file)) ? PM_FAIL : PM_OK;
+}
+
+static error_code_t posix_read(storage_file_t* file, void* data, size_t size, size_t* length)
+{
+    while (*length < size) {
+        ssize_t count = read(posix_fd(file), (uint8_t*)data + *length, size - *length);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count < 0)
+            return PM_FAIL;
+        if (count == 0)
+            break; // end of file
+        *length += count;
+    }
+    return PM_OK;
+}
+
+static error_code_t posix_write(storage_file_t* file, const void* data, size_t size, size_t* written)
+{
+    while (*written < size) {
+        ssize_t count = write(posix_fd(file), (const uint8_t*)data + *written, size - *written);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            return PM_FAIL;
+        *written += count;
+    }
+    return PM_OK;
+}
+
+static error_code_t posix_seek(storage_file_t* file, uint32_t offset)
+{
+    return lseek(posix_fd(file), offset, SEEK_SET) < 0 ? PM_FAIL : PM_OK;
+}
+
+static error_code_t posix_sync(storage_file_t* file)
+{
+    return fsync(posix_fd(file)) ? PM_FAIL : PM_OK;
+}
+
+static error_code_t posix_truncate(storage_file_t* file)
+{
+    if (ftruncate(posix_fd(file), file->position))
+        return PM_FAIL;
+    file->size = file->position;
+    return PM_OK;
+}
+
+static error_code_t posix_expand(storage_file_t* file, uint32_t size)
+{
+    return posix_fallocate(posix_fd(file), 0, size) ? NOT_NEEDED : PM_OK;
+}
+
+static error_code_t posix_stat(storage_t* st, const char* path, uint32_t* size)
+{
+    char buffer[POSIX_PATH_LENGTH];
+    struct stat s;
+    if (stat(posix_path(st, path, buffer), &s))
+        return posix_error();
+    *size = s.st_size;
+    return PM_OK;
+}
+
+static error_code_t posix_modified(storage_t* st, const char* path, uint32_t* time)
+{
+    char buffer[POSIX_PATH_LENGTH];
+    struct stat s;
+    if (stat(posix_path(st, path, buffer), &s))
+        return posix_error();
+    *time = s.st_mtime;
+    return PM_OK;
+}
+
+static error_code_t posix_unlink(storage_t* st, const char* path)
+{
+    char buffer[POSIX_PATH_LENGTH];
+    return unlink(posix_path(st, path, buffer)) ? posix_error() : PM_OK;
+}
+
+static error_code_t posix_rename(storage_t* st, const char* from, const char* to)
+{
+    char buffer[POSIX_PATH_LENGTH], target[POSIX_PATH_LENGTH];
+    return rename(posix_path(st, from, buffer), posix_path(st, to, target)) ? posix_error() : PM_OK;
+}
+
+static error_code_t posix_mkdir(storage_t* st, const char* path)
+{
+    char buffer[POSIX_PATH_LENGTH];
+    if (mkdir(posix_path(st, path, buffer), 0777) && errno != EEXIST)
+        return posix_error();
+    return PM_OK;
+}
+
+static error_code_t posix_list(storage_t* st, const char* path, storage_entry_t entry, void* arg)
+{
+    char buffer[POSIX_PATH_LENGTH];
+    DIR* dir = opendir(posix_path(st, path, buffer));
+    if (!dir)
+        return posix_error();
+    struct dirent* e;
+    while ((e = readdir(dir)))
+        if (e->d_type != DT_DIR)
+            entry(arg, e->d_name);
+    closedir(dir);
+    return PM_OK;
+}
+
+/**
+ * Storage on the host file system
+ *
+ * Paths are relative to root, or used as they are if root is NULL.
+ */
+storage_t* storage_posix_create(const char* root)
+{
+    storage_t* st = RTOS_Malloc(sizeof(storage_t));
+    if (!st)
+        return NULL;
+    st->open = posix_open;
+    st->close = posix_close;
+    st->read = posix_read;
+    st->write = posix_write;
+    st->seek = posix_seek;
+    st->sync = posix_sync;
+    st->truncate = posix_truncate;
+    st->expand = posix_expand;
+    st->stat = posix_stat;
+    st->modified = posix_modified;
+    st->unlink = posix_unlink;
+    st->rename = posix_rename;
+    st->mkdir = posix_mkdir;
+    st->list = posix_list;
+    st->driver = (void*)root;
+    st->rename_replaces = 1;
+    return st;
+}
+
+#endif
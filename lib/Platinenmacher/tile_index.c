@@ -0,0 +1,153 @@
+/*
+ * Presence index of map tiles
+ *
+ * Copyright (c) 2022, Bastian Neumann <info@platinenmacher.tech>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "tile_index.h"
+#include "memory.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <strings.h>
+
+static const char* TAG = "tile_index";
+
+tile_index_t* tile_index_create()
+{
+    return RTOS_Malloc(sizeof(tile_index_t));
+}
+
+void tile_index_free(tile_index_t* index)
+{
+    if (!index)
+        return;
+    while (index->ranges) {
+        tile_range_t* r = index->ranges;
+        index->ranges = r->next;
+        RTOS_Free(r->bits);
+        RTOS_Free(r);
+    }
+    RTOS_Free(index);
+}
+
+static uint32_t range_width(const tile_range_t* r)
+{
+    return r->y_max - r->y_min + 1;
+}
+
+/* scanning includes ranges that are still being scanned */
+static tile_range_t* find_range(const tile_index_t* index, uint8_t zoom, uint32_t x, uint32_t y, uint8_t scanning)
+{
+    for (tile_range_t* r = __atomic_load_n(&index->ranges, __ATOMIC_ACQUIRE); r; r = r->next)
+        if ((scanning || __atomic_load_n(&r->ready, __ATOMIC_ACQUIRE)) && r->zoom == zoom && x >= r->x_min && x <= r->x_max && y >= r->y_min && y <= r->y_max)
+            return r;
+    return NULL;
+}
+
+/**
+ * Index the bounding box of a tileset
+ *
+ * An identical range is only added once. Tiles of a new range are missing,
+ * the range is used after its folders were scanned and ready is set.
+ *
+ * @return range or NULL if the box is too large or memory is gone
+ */
+tile_range_t* tile_index_add_range(tile_index_t* index, uint8_t zoom, uint32_t x_min, uint32_t x_max, uint32_t y_min, uint32_t y_max)
+{
+    for (tile_range_t* r = index->ranges; r; r = r->next)
+        if (r->zoom == zoom && r->x_min == x_min && r->x_max == x_max && r->y_min == y_min && r->y_max == y_max)
+            return r;
+
+    if (x_max < x_min || y_max < y_min)
+        return NULL;
+    uint64_t tiles = (uint64_t)(x_max - x_min + 1) * (y_max - y_min + 1);
+    if (tiles > TILE_INDEX_MAX_BYTES * 8ULL) {
+        ESP_LOGE(TAG, "range of zoom %u too large: %llu tiles", zoom, (unsigned long long)tiles);
+        return NULL;
+    }
+    tile_range_t* r = RTOS_Malloc(sizeof(tile_range_t));
+    if (!r)
+        return NULL;
+    if (!(r->bits = RTOS_Malloc((tiles + 7) / 8))) {
+        RTOS_Free(r);
+        return NULL;
+    }
+    r->zoom = zoom;
+    r->x_min = x_min;
+    r->x_max = x_max;
+    r->y_min = y_min;
+    r->y_max = y_max;
+    /* lookups skip the range until it is ready */
+    r->next = index->ranges;
+    __atomic_store_n(&index->ranges, r, __ATOMIC_RELEASE);
+    return r;
+}
+
+enum TilePresence tile_index_lookup(const tile_index_t* index, uint8_t zoom, uint32_t x, uint32_t y)
+{
+    if (!index)
+        return TILE_UNKNOWN;
+    tile_range_t* r = find_range(index, zoom, x, y, 0);
+    if (!r)
+        return TILE_UNKNOWN;
+    uint32_t bit = (x - r->x_min) * range_width(r) + y - r->y_min;
+    return __atomic_load_n(&r->bits[bit >> 3], __ATOMIC_RELAXED) & (1 << (bit & 7)) ? TILE_PRESENT : TILE_MISSING;
+}
+
+static void range_set(tile_range_t* r, uint32_t x, uint32_t y, uint8_t present)
+{
+    uint32_t bit = (x - r->x_min) * range_width(r) + y - r->y_min;
+    if (present)
+        __atomic_fetch_or(&r->bits[bit >> 3], 1 << (bit & 7), __ATOMIC_RELAXED);
+    else
+        __atomic_fetch_and(&r->bits[bit >> 3], ~(1 << (bit & 7)), __ATOMIC_RELAXED);
+}
+
+/**
+ * Record a downloaded or a missing tile, tiles outside the index are ignored
+ *
+ * A range that is still scanned gets the tile as well, the scan only adds
+ * tiles it finds on the card.
+ */
+void tile_index_set(tile_index_t* index, uint8_t zoom, uint32_t x, uint32_t y, uint8_t present)
+{
+    if (!index)
+        return;
+    tile_range_t* r = find_range(index, zoom, x, y, 1);
+    if (r)
+        range_set(r, x, y, present);
+}
+
+typedef struct {
+    tile_range_t* range;
+    uint32_t x;
+} column_t;
+
+/* tile files are named <y>.raw */
+static void scan_entry(void* arg, const char* name)
+{
+    column_t* c = arg;
+    char* end;
+    unsigned long y = strtoul(name, &end, 10);
+    if (end == name || strcasecmp(end, ".raw"))
+        return;
+    if (y >= c->range->y_min && y <= c->range->y_max)
+        range_set(c->range, c->x, y, 1);
+}
+
+/**
+ * Mark the tiles found in folder/<zoom>/<x>
+ *
+ * A column with no folder has no tiles.
+ */
+error_code_t tile_index_scan_column(tile_range_t* range, storage_t* st, const char* folder, uint32_t x)
+{
+    char path[STORAGE_PATH_LENGTH];
+    column_t c = { range, x };
+    snprintf(path, sizeof(path), "%s/%u/%lu", folder, range->zoom, (unsigned long)x);
+    error_code_t ret = storage_list(st, path, scan_entry, &c);
+    return ret == UNAVAILABLE ? PM_OK : ret;
+}
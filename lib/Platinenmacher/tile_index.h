@@ -0,0 +1,54 @@
+/*
+ * Presence index of map tiles
+ *
+ * One bitmap per zoom level over the bounding box of a tileset tells if a
+ * tile file exists, so neither the downloader nor the map has to ask the
+ * card. Bitmaps are filled by listing the tile folders once and are kept up
+ * to date by whoever writes or misses a tile.
+ *
+ * Writers have to be serialized by the caller, the firmware runs them all
+ * on the SD task. Readers may run on other tasks: ranges are published
+ * with release stores and the bits are changed with atomic operations.
+ *
+ * Copyright (c) 2022, Bastian Neumann <info@platinenmacher.tech>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef PLATINENMACHER_TILE_INDEX_H
+#define PLATINENMACHER_TILE_INDEX_H
+
+#include "storage.h"
+
+#define TILE_INDEX_MAX_BYTES (64 * 1024) /// largest bitmap of one range
+
+enum TilePresence {
+    TILE_UNKNOWN, /// outside of every indexed range
+    TILE_MISSING,
+    TILE_PRESENT,
+};
+
+typedef struct tile_range tile_range_t;
+struct tile_range {
+    uint8_t zoom;
+    uint32_t x_min;
+    uint32_t x_max;
+    uint32_t y_min;
+    uint32_t y_max;
+    uint8_t* bits;
+    uint8_t ready; /// scan finished, lookups report TILE_UNKNOWN before
+    tile_range_t* next;
+};
+
+typedef struct {
+    tile_range_t* ranges;
+} tile_index_t;
+
+tile_index_t* tile_index_create();
+void tile_index_free(tile_index_t* index);
+tile_range_t* tile_index_add_range(tile_index_t* index, uint8_t zoom, uint32_t x_min, uint32_t x_max, uint32_t y_min, uint32_t y_max);
+enum TilePresence tile_index_lookup(const tile_index_t* index, uint8_t zoom, uint32_t x, uint32_t y);
+void tile_index_set(tile_index_t* index, uint8_t zoom, uint32_t x, uint32_t y, uint8_t present);
+error_code_t tile_index_scan_column(tile_range_t* range, storage_t* st, const char* folder, uint32_t x);
+
+#endif // PLATINENMACHER_TILE_INDEX_H
@@ -0,0 +1,417 @@
+/*
+ * Manifest of the map tiles on the server
+ *
+ * Copyright (c) 2022, Bastian Neumann <info@platinenmacher.tech>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "tile_manifest.h"
+#include "crc32.h"
+#include "memory.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static const char* TAG = "tile_manifest";
+
+/**
+ * Manifest of the tiles in folder
+ *
+ * The manifest files and the journal are kept next to the tiles.
+ */
+tile_manifest_t* tile_manifest_create(storage_t* st, const char* folder)
+{
+    if (strlen(folder) + 14 > STORAGE_PATH_LENGTH)
+        return NULL;
+    tile_manifest_t* m = RTOS_Malloc(sizeof(tile_manifest_t));
+    if (!m)
+        return NULL;
+    if (!(m->stale = tile_index_create())
+        || !(m->old_entries = RTOS_Malloc(TILE_MANIFEST_READ_AHEAD * sizeof(tile_manifest_entry_t)))) {
+        tile_manifest_free(m);
+        return NULL;
+    }
+    m->storage = st;
+    strcpy(m->folder, folder);
+    snprintf(m->current, sizeof(m->current), "%s/MANIFEST", folder);
+    snprintf(m->update, sizeof(m->update), "%s/MANIFEST.NEW", folder);
+    snprintf(m->journal_path, sizeof(m->journal_path), "%s/JOURNAL", folder);
+    return m;
+}
+
+static void close_update(tile_manifest_t* m)
+{
+    storage_stream_close(m->stream);
+    storage_close(m->old);
+    m->stream = NULL;
+    m->old = NULL;
+}
+
+void tile_manifest_free(tile_manifest_t* m)
+{
+    if (!m)
+        return;
+    close_update(m);
+    storage_close(m->journal);
+    tile_index_free(m->stale);
+    RTOS_Free(m->old_entries);
+    RTOS_Free(m);
+}
+
+/**
+ * Track changes in the bounding box of a tileset
+ *
+ * Changed tiles outside of every range are deleted, so they are fetched
+ * when a later download covers them.
+ */
+error_code_t tile_manifest_add_range(tile_manifest_t* m, uint8_t zoom, uint32_t x_min, uint32_t x_max, uint32_t y_min, uint32_t y_max)
+{
+    tile_range_t* r = tile_index_add_range(m->stale, zoom, x_min, x_max, y_min, y_max);
+    if (!r)
+        return PM_FAIL;
+    r->ready = 1;
+    return PM_OK;
+}
+
+void tile_manifest_tile_path(const tile_manifest_t* m, uint8_t zoom, uint32_t x, uint32_t y, char* path, size_t size)
+{
+    snprintf(path, size, "%s/%u/%lu/%lu.raw", m->folder, zoom, (unsigned long)x, (unsigned long)y);
+}
+
+static int entry_compare(const tile_manifest_entry_t* a, uint8_t zoom, uint32_t x, uint32_t y)
+{
+    if (a->zoom != zoom)
+        return a->zoom < zoom ? -1 : 1;
+    if (a->x != x)
+        return a->x < x ? -1 : 1;
+    if (a->y != y)
+        return a->y < y ? -1 : 1;
+    return 0;
+}
+
+/**
+ * Start reading a manifest, again if a download is retried
+ */
+error_code_t tile_manifest_begin(tile_manifest_t* m)
+{
+    close_update(m);
+    storage_close(m->journal);
+    m->journal = NULL;
+    m->ready = 0;
+    m->generation = 0;
+    m->entries = m->changed = m->resumed = 0;
+    m->line_length = 0;
+    m->error = 0;
+    m->old_count = m->old_next = 0;
+    for (tile_range_t* r = m->stale->ranges; r; r = r->next)
+        memset(r->bits, 0, ((uint64_t)(r->x_max - r->x_min + 1) * (r->y_max - r->y_min + 1) + 7) / 8);
+
+    /* without an old manifest every tile is stale */
+    if (storage_open(m->storage, m->current, STORAGE_READ, &m->old) != PM_OK)
+        m->old = NULL;
+    m->stream = storage_stream_open(m->storage, m->update, 0, 0);
+    return m->stream ? PM_OK : PM_FAIL;
+}
+
+/* first entry of the old manifest that is not before the key */
+static const tile_manifest_entry_t* old_seek(tile_manifest_t* m, uint8_t zoom, uint32_t x, uint32_t y)
+{
+    while (m->old) {
+        if (m->old_next == m->old_count) {
+            size_t length = 0;
+            if (storage_read(m->old, m->old_entries, TILE_MANIFEST_READ_AHEAD * sizeof(tile_manifest_entry_t), &length) != PM_OK
+                || length < sizeof(tile_manifest_entry_t)) {
+                storage_close(m->old);
+                m->old = NULL;
+                return NULL;
+            }
+            m->old_count = length / sizeof(tile_manifest_entry_t);
+            m->old_next = 0;
+        }
+        const tile_manifest_entry_t* e = &m->old_entries[m->old_next];
+        if (entry_compare(e, zoom, x, y) >= 0)
+            return e;
+        m->old_next++;
+    }
+    return NULL;
+}
+
+static error_code_t parse_line(const char* line, tile_manifest_entry_t* e)
+{
+    char* end;
+    unsigned long v[5];
+    const char separator[5] = { '/', '/', ' ', ' ', 0 };
+    for (uint8_t i = 0; i < 5; i++) {
+        while (*line == ' ' || *line == '\t')
+            line++;
+        v[i] = strtoul(line, &end, i == 4 ? 16 : 10);
+        if (end == line)
+            return PM_FAIL;
+        line = end;
+        if (separator[i] == ' ' && *line != ' ' && *line != '\t')
+            return PM_FAIL;
+        if (separator[i] == '/' && *line++ != '/')
+            return PM_FAIL;
+    }
+    if (v[0] > 31)
+        return PM_FAIL;
+    memset(e, 0, sizeof(tile_manifest_entry_t));
+    e->zoom = v[0];
+    e->x = v[1];
+    e->y = v[2];
+    e->size = v[3];
+    e->crc = v[4];
+    return PM_OK;
+}
+
+static void read_line(tile_manifest_t* m)
+{
+    tile_manifest_entry_t e;
+    if (!m->line[0] || m->line[0] == '#')
+        return;
+    if (parse_line(m->line, &e) != PM_OK
+        || (m->entries && entry_compare(&m->last, e.zoom, e.x, e.y) >= 0)) {
+        ESP_LOGE(TAG, "line %lu: '%s'", (unsigned long)m->entries + 1, m->line);
+        m->error = 1;
+        return;
+    }
+    const tile_manifest_entry_t* old = old_seek(m, e.zoom, e.x, e.y);
+    uint8_t known = old && !entry_compare(old, e.zoom, e.x, e.y);
+    if (!known || old->size != e.size || old->crc != e.crc) {
+        m->changed++;
+        if (tile_index_lookup(m->stale, e.zoom, e.x, e.y) != TILE_UNKNOWN) {
+            tile_index_set(m->stale, e.zoom, e.x, e.y, 1);
+        } else if (known) {
+            char path[STORAGE_PATH_LENGTH];
+            tile_manifest_tile_path(m, e.zoom, e.x, e.y, path, sizeof(path));
+            storage_unlink(m->storage, path);
+        }
+    }
+    if (storage_stream_write(m->stream, &e, sizeof(e)) != PM_OK)
+        m->error = 1;
+    m->last = e;
+    m->entries++;
+}
+
+/**
+ * Pass the next part of the manifest text
+ *
+ * returns PM_FAIL once the manifest turned out to be broken
+ */
+error_code_t tile_manifest_feed(tile_manifest_t* m, const void* data, size_t length)
+{
+    const char* c = data;
+    if (!m->stream)
+        return PM_FAIL;
+    m->generation = crc32_update(m->generation, data, length);
+    for (size_t i = 0; i < length && !m->error; i++) {
+        if (c[i] == '\n') {
+            m->line[m->line_length] = 0;
+            read_line(m);
+            m->line_length = 0;
+        } else if (c[i] != '\r') {
+            if (m->line_length + 1 >= TILE_MANIFEST_LINE_LENGTH)
+                m->error = 1;
+            else
+                m->line[m->line_length++] = c[i];
+        }
+    }
+    return m->error ? PM_FAIL : PM_OK;
+}
+
+static uint8_t record_check(const tile_journal_record_t* r)
+{
+    uint32_t key[3] = { r->zoom, r->x, r->y };
+    return crc32_update(0, key, sizeof(key)) | 1; // a zeroed record is never valid
+}
+
+/* the journal belongs to this manifest, clear what it finished */
+static uint32_t journal_replay(tile_manifest_t* m)
+{
+    tile_journal_header_t header;
+    tile_journal_record_t records[TILE_MANIFEST_READ_AHEAD];
+    storage_file_t* file;
+    size_t length = 0;
+    uint32_t valid = 0;
+
+    if (storage_open(m->storage, m->journal_path, STORAGE_READ, &file) != PM_OK)
+        return 0;
+    if (storage_read(file, &header, sizeof(header), &length) == PM_OK && length == sizeof(header)
+        && header.magic == TILE_MANIFEST_JOURNAL_MAGIC && header.generation == m->generation) {
+        valid = sizeof(header);
+        while (1) {
+            length = 0;
+            if (storage_read(file, records, sizeof(records), &length) != PM_OK)
+                break;
+            uint8_t count = length / sizeof(tile_journal_record_t), i;
+            for (i = 0; i < count && records[i].check == record_check(&records[i]); i++) {
+                tile_index_set(m->stale, records[i].zoom, records[i].x, records[i].y, 0);
+                m->resumed++;
+                valid += sizeof(tile_journal_record_t);
+            }
+            if (i < count || length < sizeof(records))
+                break;
+        }
+    }
+    storage_close(file);
+    return valid;
+}
+
+static error_code_t journal_open(tile_manifest_t* m)
+{
+    uint32_t valid = journal_replay(m);
+    if (valid) {
+        /* a torn record at the end is cut off before appending */
+        if (storage_open(m->storage, m->journal_path, STORAGE_WRITE | STORAGE_APPEND, &m->journal) != PM_OK)
+            return PM_FAIL;
+        if (m->journal->size == valid)
+            return PM_OK;
+        if (storage_seek(m->journal, valid) == PM_OK && m->storage->truncate(m->journal) == PM_OK)
+            return storage_sync(m->journal);
+        return PM_FAIL;
+    }
+    tile_journal_header_t header = { TILE_MANIFEST_JOURNAL_MAGIC, m->generation };
+    size_t written = 0;
+    if (storage_open_for_writing(m->storage, m->journal_path, STORAGE_WRITE, &m->journal) != PM_OK
+        || storage_write(m->journal, &header, sizeof(header), &written) != PM_OK)
+        return PM_FAIL;
+    return storage_sync(m->journal);
+}
+
+/**
+ * The manifest is complete, resume a previous session of the same manifest
+ */
+error_code_t tile_manifest_end(tile_manifest_t* m)
+{
+    if (m->stream && m->line_length && !m->error) {
+        m->line[m->line_length] = 0;
+        read_line(m);
+        m->line_length = 0;
+    }
+    error_code_t ret = m->stream && !m->error ? PM_OK : PM_FAIL;
+    if (storage_stream_close(m->stream) != PM_OK)
+        ret = PM_FAIL;
+    m->stream = NULL;
+    close_update(m);
+    if (ret == PM_OK)
+        ret = journal_open(m);
+    if (ret != PM_OK) {
+        storage_close(m->journal);
+        m->journal = NULL;
+        storage_unlink(m->storage, m->update);
+        return ret;
+    }
+    m->ready = 1;
+    ESP_LOGI(TAG, "%lu tiles, %lu changed, %lu already updated", (unsigned long)m->entries,
+        (unsigned long)m->changed, (unsigned long)m->resumed);
+    return PM_OK;
+}
+
+/**
+ * A tile that changed since the last complete update
+ */
+uint8_t tile_manifest_stale(const tile_manifest_t* m, uint8_t zoom, uint32_t x, uint32_t y)
+{
+    return tile_index_lookup(m->stale, zoom, x, y) == TILE_PRESENT;
+}
+
+/**
+ * Find a tile in the new manifest
+ *
+ * returns UNAVAILABLE if the server does not have it
+ */
+error_code_t tile_manifest_lookup(tile_manifest_t* m, uint8_t zoom, uint32_t x, uint32_t y, tile_manifest_entry_t* entry)
+{
+    uint32_t low = 0, high = m->ready ? m->entries : 0;
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        size_t length;
+        error_code_t ret = storage_read_at(m->storage, m->update, mid * sizeof(tile_manifest_entry_t), entry, sizeof(tile_manifest_entry_t), &length);
+        if (ret != PM_OK)
+            return ret;
+        if (length != sizeof(tile_manifest_entry_t))
+            return PM_FAIL;
+        int c = entry_compare(entry, zoom, x, y);
+        if (!c)
+            return PM_OK;
+        if (c < 0)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return UNAVAILABLE;
+}
+
+/**
+ * Compare a tile on the card with its entry
+ *
+ * returns PM_OK if size and CRC match, so it does not need a download
+ */
+error_code_t tile_manifest_check_file(tile_manifest_t* m, const tile_manifest_entry_t* entry)
+{
+    char path[STORAGE_PATH_LENGTH];
+    uint8_t buffer[STORAGE_SECTOR_SIZE];
+    storage_file_t* file;
+    uint32_t crc = 0, size = 0;
+    size_t length;
+
+    tile_manifest_tile_path(m, entry->zoom, entry->x, entry->y, path, sizeof(path));
+    error_code_t ret = storage_open(m->storage, path, STORAGE_READ, &file);
+    if (ret != PM_OK)
+        return ret;
+    if (file->size != entry->size) {
+        storage_close(file);
+        return PM_FAIL;
+    }
+    do {
+        length = 0;
+        if ((ret = storage_read(file, buffer, sizeof(buffer), &length)) != PM_OK)
+            break;
+        crc = crc32_update(crc, buffer, length);
+        size += length;
+    } while (length == sizeof(buffer));
+    storage_close(file);
+    if (ret != PM_OK)
+        return ret;
+    return size == entry->size && crc == entry->crc ? PM_OK : PM_FAIL;
+}
+
+/**
+ * Record a tile that is on the card in its new version
+ *
+ * Call it after the tile file is closed, a record that is lost in a crash
+ * only costs the tile again.
+ */
+error_code_t tile_manifest_done(tile_manifest_t* m, uint8_t zoom, uint32_t x, uint32_t y)
+{
+    if (!m->journal)
+        return PM_FAIL;
+    tile_journal_record_t r = { .zoom = zoom, .x = x, .y = y };
+    r.check = record_check(&r);
+    size_t written = 0;
+    if (storage_write(m->journal, &r, sizeof(r), &written) != PM_OK)
+        return PM_FAIL;
+    tile_index_set(m->stale, zoom, x, y, 0);
+    if (++m->unsynced < TILE_MANIFEST_SYNC_RECORDS)
+        return PM_OK;
+    m->unsynced = 0;
+    return storage_sync(m->journal);
+}
+
+/**
+ * Every tile is up to date, the new manifest replaces the old one
+ */
+error_code_t tile_manifest_commit(tile_manifest_t* m)
+{
+    if (!m->ready)
+        return PM_FAIL;
+    storage_close(m->journal);
+    m->journal = NULL;
+    m->ready = 0;
+    /* the journal is only removed once the new manifest is in place */
+    error_code_t ret = storage_rename(m->storage, m->update, m->current);
+    if (ret == PM_OK)
+        storage_unlink(m->storage, m->journal_path);
+    return ret;
+}
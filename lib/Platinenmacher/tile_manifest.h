@@ -0,0 +1,98 @@
+/*
+ * Manifest of the map tiles on the server
+ *
+ * The server lists every tile as a "zoom/x/y size crc" line, size in
+ * decimal, the CRC-32 of the file in hex, sorted by zoom, x and y. While
+ * the manifest downloads it is compared to the one of the last complete
+ * update: tiles that changed are marked stale, and a binary copy of the
+ * list is written for lookups of single tiles.
+ *
+ * Finished tiles are appended to a journal. An update that is interrupted
+ * and finds the same manifest again goes on where it stopped. Only when
+ * every tile is done the new manifest replaces the old one.
+ *
+ * A manifest is used on the task that owns the storage.
+ *
+ * Copyright (c) 2022, Bastian Neumann <info@platinenmacher.tech>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef PLATINENMACHER_TILE_MANIFEST_H
+#define PLATINENMACHER_TILE_MANIFEST_H
+
+#include "storage.h"
+#include "tile_index.h"
+
+#define TILE_MANIFEST_LINE_LENGTH 48
+#define TILE_MANIFEST_READ_AHEAD 32   /// entries of the old manifest read at once
+#define TILE_MANIFEST_SYNC_RECORDS 16 /// journal records between two syncs
+#define TILE_MANIFEST_JOURNAL_MAGIC 0x314A4D54 // "TMJ1"
+
+typedef struct {
+    uint8_t zoom;
+    uint8_t reserved[3];
+    uint32_t x;
+    uint32_t y;
+    uint32_t size;
+    uint32_t crc;
+} tile_manifest_entry_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t generation;
+} tile_journal_header_t;
+
+typedef struct {
+    uint8_t zoom;
+    uint8_t check; /// tells a finished record from a torn one
+    uint16_t reserved;
+    uint32_t x;
+    uint32_t y;
+} tile_journal_record_t;
+
+typedef struct {
+    storage_t* storage;
+    char folder[STORAGE_PATH_LENGTH];  /// of the tiles
+    char current[STORAGE_PATH_LENGTH]; /// manifest of the last complete update
+    char update[STORAGE_PATH_LENGTH];  /// manifest being downloaded
+    char journal_path[STORAGE_PATH_LENGTH];
+    tile_index_t* stale; /// tiles of the ranges that have to be fetched or checked
+    uint32_t generation; /// CRC-32 of the manifest text
+    uint32_t entries;
+    uint32_t changed;
+    uint32_t resumed; /// stale tiles a previous session already finished
+    uint8_t ready;    /// manifest complete, lookups and journal work
+
+    /* parser */
+    storage_stream_t* stream;
+    char line[TILE_MANIFEST_LINE_LENGTH];
+    uint8_t line_length;
+    uint8_t error;
+    tile_manifest_entry_t last;
+    /* old manifest, read alongside */
+    storage_file_t* old;
+    tile_manifest_entry_t* old_entries;
+    uint8_t old_count;
+    uint8_t old_next;
+
+    storage_file_t* journal;
+    uint8_t unsynced;
+} tile_manifest_t;
+
+tile_manifest_t* tile_manifest_create(storage_t* st, const char* folder);
+void tile_manifest_free(tile_manifest_t* m);
+error_code_t tile_manifest_add_range(tile_manifest_t* m, uint8_t zoom, uint32_t x_min, uint32_t x_max, uint32_t y_min, uint32_t y_max);
+
+error_code_t tile_manifest_begin(tile_manifest_t* m);
+error_code_t tile_manifest_feed(tile_manifest_t* m, const void* data, size_t length);
+error_code_t tile_manifest_end(tile_manifest_t* m);
+
+uint8_t tile_manifest_stale(const tile_manifest_t* m, uint8_t zoom, uint32_t x, uint32_t y);
+error_code_t tile_manifest_lookup(tile_manifest_t* m, uint8_t zoom, uint32_t x, uint32_t y, tile_manifest_entry_t* entry);
+error_code_t tile_manifest_check_file(tile_manifest_t* m, const tile_manifest_entry_t* entry);
+error_code_t tile_manifest_done(tile_manifest_t* m, uint8_t zoom, uint32_t x, uint32_t y);
+error_code_t tile_manifest_commit(tile_manifest_t* m);
+void tile_manifest_tile_path(const tile_manifest_t* m, uint8_t zoom, uint32_t x, uint32_t y, char* path, size_t size);
+
+#endif // PLATINENMACHER_TILE_MANIFEST_H
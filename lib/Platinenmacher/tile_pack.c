@@ -0,0 +1,318 @@
+/*
+ * Tile packs, all tiles of a zoom level and bounding box in one file
+ *
+ * Copyright (c) 2022, Bastian Neumann <info@platinenmacher.tech>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "tile_pack.h"
+#include "crc32.h"
+#include "memory.h"
+
+#include <stdio.h>
+
+static const char* TAG = "tile_pack";
+
+/**
+ * Path of the pack of a bounding box in folder/<zoom>
+ *
+ * The name is a hash of the box, it has to fit 8.3 names.
+ */
+void tile_pack_path(char* path, size_t size, const char* folder, uint8_t zoom, uint32_t x_min, uint32_t x_max, uint32_t y_min, uint32_t y_max, const char* extension)
+{
+    uint32_t box[5] = { zoom, x_min, x_max, y_min, y_max };
+    snprintf(path, size, "%s/%u/%08lX.%s", folder, zoom, (unsigned long)crc32_update(0, box, sizeof(box)), extension);
+}
+
+static uint32_t box_height(const tile_pack_header_t* h)
+{
+    return h->y_max - h->y_min + 1;
+}
+
+static uint64_t box_tiles(const tile_pack_header_t* h)
+{
+    return (uint64_t)(h->x_max - h->x_min + 1) * box_height(h);
+}
+
+/**
+ * Start checking the pack of a bounding box
+ */
+void tile_pack_check_begin(tile_pack_check_t* c, uint8_t zoom, uint32_t x_min, uint32_t x_max, uint32_t y_min, uint32_t y_max)
+{
+    memset(c, 0, sizeof(tile_pack_check_t));
+    c->expected.magic = TILE_PACK_MAGIC;
+    c->expected.zoom = zoom;
+    c->expected.x_min = x_min;
+    c->expected.x_max = x_max;
+    c->expected.y_min = y_min;
+    c->expected.y_max = y_max;
+}
+
+/* collect a structure that may be split between chunks, 1 once it is complete */
+static uint8_t gather(tile_pack_check_t* c, const uint8_t** data, size_t* length, void* dest, size_t size)
+{
+    size_t n = size - c->buffered;
+    if (n > *length)
+        n = *length;
+    memcpy(c->buffer + c->buffered, *data, n);
+    c->buffered += n;
+    c->position += n;
+    *data += n;
+    *length -= n;
+    if (c->buffered < size)
+        return 0;
+    memcpy(dest, c->buffer, size);
+    c->buffered = 0;
+    return 1;
+}
+
+static void check_header(tile_pack_check_t* c, const tile_pack_header_t* h)
+{
+    const tile_pack_header_t* e = &c->expected;
+    uint64_t end = sizeof(tile_pack_header_t) + box_tiles(e) * sizeof(tile_pack_entry_t);
+    if (h->magic != e->magic || h->zoom != e->zoom || h->x_min != e->x_min || h->x_max != e->x_max
+        || h->y_min != e->y_min || h->y_max != e->y_max || e->x_max < e->x_min || e->y_max < e->y_min || end > UINT32_MAX) {
+        ESP_LOGE(TAG, "header does not match zoom %u [%lu-%lu]/[%lu-%lu]", e->zoom, (unsigned long)e->x_min,
+            (unsigned long)e->x_max, (unsigned long)e->y_min, (unsigned long)e->y_max);
+        c->error = 1;
+        return;
+    }
+    c->entries = box_tiles(e);
+    c->next = end;
+    c->part = TILE_PACK_INDEX;
+}
+
+/* the records only arrive after the whole index */
+static uint8_t expect_record(tile_pack_check_t* c, const tile_pack_record_t* r)
+{
+    if (c->tiles == c->capacity) {
+        uint32_t capacity = c->capacity ? c->capacity * 2 : TILE_PACK_READ_AHEAD;
+        uint32_t* sums = RTOS_Malloc(capacity * sizeof(uint32_t));
+        if (!sums)
+            return 0;
+        if (c->sums)
+            memcpy(sums, c->sums, c->tiles * sizeof(uint32_t));
+        RTOS_Free(c->sums);
+        c->sums = sums;
+        c->capacity = capacity;
+    }
+    c->sums[c->tiles] = crc32_update(0, r, sizeof(tile_pack_record_t));
+    return 1;
+}
+
+static void check_free(tile_pack_check_t* c)
+{
+    RTOS_Free(c->sums);
+    c->sums = NULL;
+    c->capacity = 0;
+}
+
+/* tiles follow the index back to back, in its order */
+static void check_entry(tile_pack_check_t* c, const tile_pack_entry_t* e)
+{
+    uint32_t i = c->entry++;
+    if (e->length) {
+        tile_pack_record_t r = {
+            .x = c->expected.x_min + i / box_height(&c->expected),
+            .y = c->expected.y_min + i % box_height(&c->expected),
+            .length = e->length,
+            .crc = e->crc,
+        };
+        if (e->length > TILE_PACK_MAX_TILE || (uint64_t)c->next + sizeof(tile_pack_record_t) != e->offset
+            || (uint64_t)e->offset + e->length > UINT32_MAX) {
+            ESP_LOGE(TAG, "entry %lu: %lu bytes at %lu", (unsigned long)i, (unsigned long)e->length, (unsigned long)e->offset);
+            c->error = 1;
+            return;
+        }
+        if (!expect_record(c, &r)) {
+            c->error = 1;
+            return;
+        }
+        c->next = e->offset + e->length;
+        c->tiles++;
+    }
+    if (c->entry == c->entries)
+        c->part = c->tiles ? TILE_PACK_RECORD : TILE_PACK_DONE;
+}
+
+/* the entry checked the length, a matching record can be trusted */
+static void check_record(tile_pack_check_t* c)
+{
+    tile_pack_record_t* r = &c->record;
+    if (crc32_update(0, r, sizeof(tile_pack_record_t)) != c->sums[c->records]) {
+        ESP_LOGE(TAG, "record %lu does not match its entry", (unsigned long)c->records);
+        c->error = 1;
+        return;
+    }
+    c->remaining = r->length;
+    c->crc = 0;
+    c->part = TILE_PACK_DATA;
+}
+
+static void check_tile(tile_pack_check_t* c)
+{
+    if (c->crc != c->record.crc) {
+        ESP_LOGE(TAG, "tile %lu/%lu is corrupt", (unsigned long)c->record.x, (unsigned long)c->record.y);
+        c->error = 1;
+        return;
+    }
+    c->part = ++c->records == c->tiles ? TILE_PACK_DONE : TILE_PACK_RECORD;
+}
+
+/**
+ * Check the next chunk of a pack
+ *
+ * returns PM_FAIL as soon as the pack turns out to be broken
+ */
+error_code_t tile_pack_check(tile_pack_check_t* c, const void* data, size_t length)
+{
+    const uint8_t* d = data;
+    while (length && !c->error) {
+        switch (c->part) {
+        case TILE_PACK_HEADER: {
+            tile_pack_header_t h;
+            if (gather(c, &d, &length, &h, sizeof(h)))
+                check_header(c, &h);
+            break;
+        }
+        case TILE_PACK_INDEX: {
+            tile_pack_entry_t e;
+            if (gather(c, &d, &length, &e, sizeof(e)))
+                check_entry(c, &e);
+            break;
+        }
+        case TILE_PACK_RECORD:
+            if (gather(c, &d, &length, &c->record, sizeof(c->record)))
+                check_record(c);
+            break;
+        case TILE_PACK_DATA: {
+            size_t n = length < c->remaining ? length : c->remaining;
+            c->crc = crc32_update(c->crc, d, n);
+            c->position += n;
+            c->remaining -= n;
+            d += n;
+            length -= n;
+            if (!c->remaining)
+                check_tile(c);
+            break;
+        }
+        default:
+            c->error = 1; // data after the last tile
+        }
+    }
+    if (!c->error)
+        return PM_OK;
+    check_free(c);
+    return PM_FAIL;
+}
+
+/**
+ * The download ended, PM_OK if it was a complete pack
+ *
+ * Has to be called for every pack that did not fail in tile_pack_check.
+ */
+error_code_t tile_pack_check_end(tile_pack_check_t* c)
+{
+    check_free(c);
+    if (c->error || c->part != TILE_PACK_DONE)
+        return PM_FAIL;
+    return PM_OK;
+}
+
+/**
+ * Open a pack, only its header is read
+ *
+ * Its tiles are marked in the tile index with tile_pack_index.
+ *
+ * returns UNAVAILABLE if there is no such file
+ */
+error_code_t tile_pack_open(storage_t* st, const char* path, tile_pack_t** pack)
+{
+    tile_pack_header_t h;
+    size_t length;
+    *pack = NULL;
+    if (strlen(path) >= STORAGE_PATH_LENGTH)
+        return PM_FAIL;
+    error_code_t ret = storage_read_at(st, path, 0, &h, sizeof(h), &length);
+    if (ret != PM_OK)
+        return ret;
+    if (length != sizeof(h) || h.magic != TILE_PACK_MAGIC || h.x_max < h.x_min || h.y_max < h.y_min
+        || sizeof(h) + box_tiles(&h) * sizeof(tile_pack_entry_t) > UINT32_MAX)
+        return PM_FAIL;
+
+    tile_pack_t* p = RTOS_Malloc(sizeof(tile_pack_t));
+    if (!p)
+        return PM_FAIL;
+    strcpy(p->path, path);
+    p->header = h;
+    *pack = p;
+    return PM_OK;
+}
+
+/**
+ * Mark the next TILE_PACK_READ_AHEAD entries of the pack in the index
+ *
+ * One call is one short read, the SD task serves other requests between
+ * the calls.
+ *
+ * returns DEFERRED until the whole index is marked
+ */
+error_code_t tile_pack_index(storage_t* st, tile_pack_t* pack, tile_index_t* index)
+{
+    const tile_pack_header_t* h = &pack->header;
+    tile_pack_entry_t entries[TILE_PACK_READ_AHEAD];
+    uint32_t count = box_tiles(h);
+    size_t length;
+    if (pack->indexed >= count)
+        return PM_OK;
+    uint32_t offset = sizeof(tile_pack_header_t) + pack->indexed * sizeof(tile_pack_entry_t);
+    error_code_t ret = storage_read_at(st, pack->path, offset, entries, sizeof(entries), &length);
+    if (ret != PM_OK)
+        return ret;
+    uint32_t n = length / sizeof(tile_pack_entry_t);
+    if (!n)
+        return PM_FAIL; // cut off
+    for (uint32_t e = 0; e < n && pack->indexed < count; e++, pack->indexed++) {
+        if (!entries[e].length)
+            continue;
+        uint32_t i = pack->indexed;
+        tile_index_set(index, h->zoom, h->x_min + i / box_height(h), h->y_min + i % box_height(h), 1);
+        pack->tiles++;
+    }
+    return pack->indexed < count ? DEFERRED : PM_OK;
+}
+
+/**
+ * Index entry of a tile
+ *
+ * returns UNAVAILABLE if the pack does not have the tile
+ */
+error_code_t tile_pack_lookup(storage_t* st, const tile_pack_t* pack, uint32_t x, uint32_t y, tile_pack_entry_t* entry)
+{
+    const tile_pack_header_t* h = &pack->header;
+    size_t length;
+    if (x < h->x_min || x > h->x_max || y < h->y_min || y > h->y_max)
+        return UNAVAILABLE;
+    uint32_t i = (x - h->x_min) * box_height(h) + y - h->y_min;
+    error_code_t ret = storage_read_at(st, pack->path, sizeof(tile_pack_header_t) + i * sizeof(tile_pack_entry_t),
+        entry, sizeof(tile_pack_entry_t), &length);
+    if (ret != PM_OK)
+        return ret;
+    if (length != sizeof(tile_pack_entry_t))
+        return PM_FAIL;
+    return entry->length ? PM_OK : UNAVAILABLE;
+}
+
+/**
+ * Read a tile, at most size bytes
+ */
+error_code_t tile_pack_read(storage_t* st, const tile_pack_t* pack, uint32_t x, uint32_t y, void* data, size_t size, size_t* length)
+{
+    tile_pack_entry_t e;
+    *length = 0;
+    error_code_t ret = tile_pack_lookup(st, pack, x, y, &e);
+    if (ret != PM_OK)
+        return ret;
+    return storage_read_at(st, pack->path, e.offset, data, e.length < size ? e.length : size, length);
+}
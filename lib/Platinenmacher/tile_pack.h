@@ -0,0 +1,104 @@
+/*
+ * Tile packs, all tiles of a zoom level and bounding box in one file
+ *
+ * A pack starts with a header and an index of one entry per tile of the
+ * box, column by column like the tile folders. Every tile that is in the
+ * pack follows the index in the same order, each behind a record that
+ * repeats its coordinates, length and CRC-32:
+ *
+ *   header | entry (0,0) entry (0,1) ... | record tile record tile ...
+ *
+ * A pack arrives as one large sequential download. It is checked while it
+ * streams in: the records have to follow back to back in index order, each
+ * one has to match its entry and every tile its CRC. Only a CRC-32 of the
+ * record every entry expects is kept, not the index itself. Afterwards a
+ * tile is read with two reads at an offset, its entry and its data.
+ *
+ * Copyright (c) 2022, Bastian Neumann <info@platinenmacher.tech>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef PLATINENMACHER_TILE_PACK_H
+#define PLATINENMACHER_TILE_PACK_H
+
+#include "storage.h"
+#include "tile_index.h"
+
+#define TILE_PACK_MAGIC 0x314B5054      // "TPK1"
+#define TILE_PACK_MAX_TILE (64 * 1024) /// longest tile in a pack
+#define TILE_PACK_READ_AHEAD 32         /// index entries read by one call of tile_pack_index
+
+typedef struct {
+    uint32_t magic;
+    uint8_t zoom;
+    uint8_t reserved[3];
+    uint32_t x_min;
+    uint32_t x_max;
+    uint32_t y_min;
+    uint32_t y_max;
+} tile_pack_header_t;
+
+typedef struct {
+    uint32_t offset; /// of the tile data in the pack
+    uint32_t length; /// 0 if the pack does not have the tile
+    uint32_t crc;    /// CRC-32 of the tile data
+} tile_pack_entry_t;
+
+typedef struct {
+    uint32_t x;
+    uint32_t y;
+    uint32_t length;
+    uint32_t crc;
+} tile_pack_record_t;
+
+enum TilePackPart {
+    TILE_PACK_HEADER,
+    TILE_PACK_INDEX,
+    TILE_PACK_RECORD,
+    TILE_PACK_DATA,
+    TILE_PACK_DONE,
+};
+
+/* checks a pack while it streams in */
+typedef struct {
+    tile_pack_header_t expected;
+    uint8_t part;
+    uint8_t error;
+    uint8_t buffer[sizeof(tile_pack_header_t)]; /// a structure that is split between two chunks
+    uint8_t buffered;
+    uint32_t position;
+    uint32_t entries;    /// in the index
+    uint32_t entry;      /// next entry of the index
+    uint32_t tiles;      /// in the pack
+    uint32_t records;    /// tiles received
+    uint32_t next;       /// offset the next tile of the index has to start at
+    uint32_t* sums;      /// CRC-32 of the record of every tile in the index
+    uint32_t capacity;   /// of sums
+    tile_pack_record_t record;
+    uint32_t remaining; /// of the current tile
+    uint32_t crc;       /// of the current tile so far
+} tile_pack_check_t;
+
+typedef struct tile_pack tile_pack_t;
+struct tile_pack {
+    char path[STORAGE_PATH_LENGTH];
+    tile_pack_header_t header;
+    uint32_t tiles;   /// in the entries indexed so far
+    uint32_t indexed; /// entries marked in the tile index
+    uint8_t ready;    /// the whole index is marked, left to the owner of the pack
+    tile_pack_t* next;
+};
+
+void tile_pack_path(char* path, size_t size, const char* folder, uint8_t zoom, uint32_t x_min, uint32_t x_max, uint32_t y_min, uint32_t y_max, const char* extension);
+
+void tile_pack_check_begin(tile_pack_check_t* c, uint8_t zoom, uint32_t x_min, uint32_t x_max, uint32_t y_min, uint32_t y_max);
+error_code_t tile_pack_check(tile_pack_check_t* c, const void* data, size_t length);
+error_code_t tile_pack_check_end(tile_pack_check_t* c);
+
+error_code_t tile_pack_open(storage_t* st, const char* path, tile_pack_t** pack);
+error_code_t tile_pack_index(storage_t* st, tile_pack_t* pack, tile_index_t* index);
+error_code_t tile_pack_lookup(storage_t* st, const tile_pack_t* pack, uint32_t x, uint32_t y, tile_pack_entry_t* entry);
+error_code_t tile_pack_read(storage_t* st, const tile_pack_t* pack, uint32_t x, uint32_t y, void* data, size_t size, size_t* length);
+
+#endif // PLATINENMACHER_TILE_PACK_H
@@ -0,0 +1,259 @@
+/*
+ * Order in which the tiles of a track are downloaded
+ *
+ * Copyright (c) 2022, Bastian Neumann <info@platinenmacher.tech>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "tile_schedule.h"
+#include "memory.h"
+
+#include <math.h>
+
+static const char* TAG = "tile_schedule";
+
+/**
+ * Schedule for the tiles around a track
+ *
+ * track may be NULL, the tiles are handed out in folder order then.
+ */
+tile_schedule_t* tile_schedule_create(const track_point_t* track, uint32_t points, uint8_t corridor)
+{
+    tile_schedule_t* s = RTOS_Malloc(sizeof(tile_schedule_t));
+    if (!s)
+        return NULL;
+    if (track && points && !(s->track = RTOS_Malloc(points * 2 * sizeof(float)))) {
+        RTOS_Free(s);
+        return NULL;
+    }
+    if (s->track) {
+        for (uint32_t i = 0; i < points; i++) {
+            float lat = track[i].lat * M_PI / 180;
+            s->track[2 * i] = (track[i].lon + 180) / 360;
+            s->track[2 * i + 1] = (1 - log(tan(lat) + 1 / cos(lat)) / M_PI) / 2;
+        }
+        s->points = points;
+    }
+    s->corridor = corridor;
+    return s;
+}
+
+static void area_release(tile_area_t* a)
+{
+    RTOS_Free(a->done);
+    RTOS_Free(a->ring);
+    RTOS_Free(a->fresh);
+    a->done = a->ring = a->fresh = NULL;
+}
+
+void tile_schedule_free(tile_schedule_t* s)
+{
+    if (!s)
+        return;
+    for (uint8_t i = 0; i < s->area_count; i++)
+        area_release(&s->areas[i]);
+    RTOS_Free(s->track);
+    RTOS_Free(s);
+}
+
+/**
+ * Add the bounding box of a zoom level
+ *
+ * Areas are handed out in the order they were added.
+ */
+error_code_t tile_schedule_add(tile_schedule_t* s, uint8_t zoom, uint32_t x_min, uint32_t x_max, uint32_t y_min, uint32_t y_max)
+{
+    if (s->area_count >= TILE_SCHEDULE_MAX_AREAS || x_max < x_min || y_max < y_min)
+        return PM_FAIL;
+    tile_area_t* a = &s->areas[s->area_count++];
+    a->zoom = zoom;
+    a->x_min = x_min;
+    a->x_max = x_max;
+    a->y_min = y_min;
+    a->y_max = y_max;
+    uint64_t tiles = (uint64_t)(x_max - x_min + 1) * (y_max - y_min + 1);
+    s->tiles += tiles;
+    if (tiles > TILE_SCHEDULE_MAX_BYTES * 8ULL) {
+        ESP_LOGI(TAG, "zoom %u has %llu tiles, downloaded in folder order", zoom, (unsigned long long)tiles);
+        return PM_OK;
+    }
+    size_t bytes = (tiles + 7) / 8;
+    a->done = RTOS_Malloc(bytes);
+    a->ring = RTOS_Malloc(bytes);
+    a->fresh = RTOS_Malloc(bytes);
+    if (!a->done || !a->ring || !a->fresh)
+        area_release(a);
+    return PM_OK;
+}
+
+static uint32_t area_bit(const tile_area_t* a, uint32_t x, uint32_t y)
+{
+    return (x - a->x_min) * (a->y_max - a->y_min + 1) + y - a->y_min;
+}
+
+static uint8_t bitmap_test(const uint8_t* bits, uint32_t bit)
+{
+    return bits[bit >> 3] & (1 << (bit & 7));
+}
+
+static void bitmap_set(uint8_t* bits, uint32_t bit)
+{
+    bits[bit >> 3] |= 1 << (bit & 7);
+}
+
+/* endpoints of the current track segment in tiles of the area */
+static void segment_load(tile_schedule_t* s, const tile_area_t* a)
+{
+    float scale = (float)(1UL << a->zoom);
+    uint32_t next = s->segment + 1 < s->points ? s->segment + 1 : s->segment;
+    for (uint8_t i = 0; i < 2; i++) {
+        s->from[i] = s->track[2 * s->segment + i] * scale;
+        s->to[i] = s->track[2 * next + i] * scale;
+    }
+    /* half a tile per step, so the route cannot jump over a tile */
+    float dx = fabsf(s->to[0] - s->from[0]);
+    float dy = fabsf(s->to[1] - s->from[1]);
+    s->steps = (uint32_t)ceilf((dx > dy ? dx : dy) * 2);
+    if (!s->steps)
+        s->steps = 1;
+    s->step = 0;
+    s->square = 0;
+}
+
+/* next tile of the corridor, along the route */
+static error_code_t corridor_next(tile_schedule_t* s, tile_area_t* a, uint32_t* x, uint32_t* y)
+{
+    uint16_t side = 2 * s->corridor + 1;
+    while (s->segment < s->points) {
+        if (!s->steps)
+            segment_load(s, a);
+        float t = (float)s->step / s->steps;
+        int64_t cx = (int64_t)floorf(s->from[0] + (s->to[0] - s->from[0]) * t);
+        int64_t cy = (int64_t)floorf(s->from[1] + (s->to[1] - s->from[1]) * t);
+        while (s->square < side * side) {
+            int64_t tx = cx - s->corridor + s->square % side;
+            int64_t ty = cy - s->corridor + s->square / side;
+            s->square++;
+            if (tx < a->x_min || tx > a->x_max || ty < a->y_min || ty > a->y_max)
+                continue;
+            uint32_t bit = area_bit(a, tx, ty);
+            if (bitmap_test(a->done, bit))
+                continue;
+            bitmap_set(a->done, bit);
+            bitmap_set(a->ring, bit);
+            *x = tx;
+            *y = ty;
+            return PM_OK;
+        }
+        s->square = 0;
+        if (++s->step >= s->steps) {
+            s->segment++;
+            s->steps = 0;
+        }
+    }
+    return NOT_NEEDED;
+}
+
+/* a tile next to one of the previous ring */
+static uint8_t touches_ring(const tile_area_t* a, uint32_t x, uint32_t y)
+{
+    for (int8_t dx = -1; dx <= 1; dx++) {
+        for (int8_t dy = -1; dy <= 1; dy++) {
+            int64_t nx = (int64_t)x + dx, ny = (int64_t)y + dy;
+            if ((dx || dy) && nx >= a->x_min && nx <= a->x_max && ny >= a->y_min && ny <= a->y_max
+                && bitmap_test(a->ring, area_bit(a, nx, ny)))
+                return 1;
+        }
+    }
+    return 0;
+}
+
+/* next tile of the bounding box, ring by ring */
+static error_code_t area_next(tile_schedule_t* s, tile_area_t* a, uint32_t* x, uint32_t* y)
+{
+    while (1) {
+        for (; s->x <= a->x_max; s->x++, s->y = a->y_min) {
+            for (; s->y <= a->y_max; s->y++) {
+                if (s->plain && !a->done) {
+                    *x = s->x;
+                    *y = s->y++;
+                    return PM_OK;
+                }
+                uint32_t bit = area_bit(a, s->x, s->y);
+                if (bitmap_test(a->done, bit) || (!s->plain && !touches_ring(a, s->x, s->y)))
+                    continue;
+                bitmap_set(a->done, bit);
+                bitmap_set(a->fresh, bit);
+                s->ring_count++;
+                *x = s->x;
+                *y = s->y++;
+                return PM_OK;
+            }
+        }
+        if (s->plain || !s->ring_count)
+            return NOT_NEEDED;
+        /* the ring is complete, the next one grows around it */
+        uint8_t* ring = a->ring;
+        size_t bytes = ((uint64_t)(a->x_max - a->x_min + 1) * (a->y_max - a->y_min + 1) + 7) / 8;
+        a->ring = a->fresh;
+        a->fresh = ring;
+        memset(a->fresh, 0, bytes);
+        s->ring_count = 0;
+        s->x = a->x_min;
+        s->y = a->y_min;
+    }
+}
+
+static void area_begin(tile_schedule_t* s)
+{
+    if (s->area >= s->area_count)
+        return;
+    tile_area_t* a = &s->areas[s->area];
+    s->x = a->x_min;
+    s->y = a->y_min;
+    s->ring_count = 0;
+    /* an area the route does not touch has nothing to grow from */
+    s->plain = !a->done || !a->scheduled;
+}
+
+/**
+ * Next tile to download
+ *
+ * returns NOT_NEEDED once every tile of every area was handed out
+ */
+error_code_t tile_schedule_next(tile_schedule_t* s, uint8_t* zoom, uint32_t* x, uint32_t* y)
+{
+    while (s->phase == TILE_SCHEDULE_ROUTE) {
+        if (s->area >= s->area_count) {
+            s->phase = TILE_SCHEDULE_AREA;
+            s->area = 0;
+            area_begin(s);
+            break;
+        }
+        tile_area_t* a = &s->areas[s->area];
+        if (a->done && corridor_next(s, a, x, y) == PM_OK) {
+            a->scheduled++;
+            s->scheduled++;
+            *zoom = a->zoom;
+            return PM_OK;
+        }
+        s->area++;
+        s->segment = 0;
+        s->steps = 0;
+    }
+
+    while (s->area < s->area_count) {
+        tile_area_t* a = &s->areas[s->area];
+        if (area_next(s, a, x, y) == PM_OK) {
+            a->scheduled++;
+            s->scheduled++;
+            *zoom = a->zoom;
+            return PM_OK;
+        }
+        area_release(a);
+        s->area++;
+        area_begin(s);
+    }
+    return NOT_NEEDED;
+}
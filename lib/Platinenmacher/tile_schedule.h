@@ -0,0 +1,76 @@
+/*
+ * Order in which the tiles of a track are downloaded
+ *
+ * First the tiles in a corridor along the route at every zoom level, in
+ * the order the route passes them, then the rest of every bounding box in
+ * rings growing outwards from the corridor. If the download stops early,
+ * the tiles that are needed most are already on the card.
+ *
+ * Copyright (c) 2022, Bastian Neumann <info@platinenmacher.tech>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef PLATINENMACHER_TILE_SCHEDULE_H
+#define PLATINENMACHER_TILE_SCHEDULE_H
+
+#include "error.h"
+
+#include <stdint.h>
+
+#define TILE_SCHEDULE_MAX_AREAS 8
+#define TILE_SCHEDULE_MAX_BYTES (16 * 1024) /// largest bitmap of one area, larger areas are not ordered
+
+enum TileSchedulePhase {
+    TILE_SCHEDULE_ROUTE, /// corridor along the track
+    TILE_SCHEDULE_AREA,  /// rest of the bounding boxes
+};
+
+typedef struct {
+    float lat;
+    float lon;
+} track_point_t;
+
+typedef struct {
+    uint8_t zoom;
+    uint32_t x_min;
+    uint32_t x_max;
+    uint32_t y_min;
+    uint32_t y_max;
+    uint32_t scheduled;
+    uint8_t* done;  /// tiles handed out
+    uint8_t* ring;  /// tiles of the previous ring
+    uint8_t* fresh; /// tiles of the current ring
+} tile_area_t;
+
+typedef struct {
+    float* track; /// mercator x and y of every point, 0 to 1
+    uint32_t points;
+    uint8_t corridor; /// tiles on each side of the route
+    tile_area_t areas[TILE_SCHEDULE_MAX_AREAS];
+    uint8_t area_count;
+    uint32_t tiles;
+    uint32_t scheduled;
+
+    uint8_t phase;
+    uint8_t area;
+    /* corridor position */
+    uint32_t segment;
+    uint32_t step;
+    uint32_t steps;
+    uint16_t square;
+    float from[2];
+    float to[2];
+    /* ring position */
+    uint32_t x;
+    uint32_t y;
+    uint32_t ring_count;
+    uint8_t plain; /// no corridor in this area, tiles in folder order
+} tile_schedule_t;
+
+tile_schedule_t* tile_schedule_create(const track_point_t* track, uint32_t points, uint8_t corridor);
+void tile_schedule_free(tile_schedule_t* s);
+error_code_t tile_schedule_add(tile_schedule_t* s, uint8_t zoom, uint32_t x_min, uint32_t x_max, uint32_t y_min, uint32_t y_max);
+error_code_t tile_schedule_next(tile_schedule_t* s, uint8_t* zoom, uint32_t* x, uint32_t* y);
+
+#endif // PLATINENMACHER_TILE_SCHEDULE_H
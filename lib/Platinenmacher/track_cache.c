@@ -0,0 +1,203 @@
+/*
+ * Track cache, the parsed GPX track in a binary file next to it
+ *
+ * Copyright (c) 2022, Bastian Neumann <info@platinenmacher.tech>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "track_cache.h"
+#include "crc32.h"
+#include "memory.h"
+
+#include <stdio.h>
+
+#define TRACK_CACHE_BATCH 64 /// values written at once
+
+static const char* TAG = "track_cache";
+
+/**
+ * Path of the cache of a GPX file, the same name with an other extension
+ */
+void track_cache_path(char* path, size_t size, const char* gpx_path, const char* extension)
+{
+    const char* dot = strrchr(gpx_path, '.');
+    const char* slash = strrchr(gpx_path, '/');
+    int length = dot && (!slash || dot > slash) ? dot - gpx_path : (int)strlen(gpx_path);
+    snprintf(path, size, "%.*s.%s", length, gpx_path, extension);
+}
+
+/**
+ * Size and modification time of the GPX file, source_crc is left as it is
+ */
+error_code_t track_cache_source(storage_t* st, const char* gpx_path, track_cache_header_t* source)
+{
+    error_code_t ret = storage_stat(st, gpx_path, &source->source_size);
+    if (ret != PM_OK)
+        return ret;
+    return storage_modified(st, gpx_path, &source->source_modified);
+}
+
+static uint32_t name_length(const char* name)
+{
+    if (!name)
+        return 0;
+    size_t length = strlen(name);
+    if (length >= TRACK_CACHE_NAME_LENGTH)
+        length = TRACK_CACHE_NAME_LENGTH - 1;
+    return (length + 4) & ~3u;
+}
+
+/**
+ * Load the cache with one read
+ *
+ * returns UNAVAILABLE if there is none and PM_FAIL if it does not belong to
+ * the GPX file of source or is broken
+ */
+error_code_t track_cache_load(storage_t* st, const char* path, const track_cache_header_t* source, track_cache_t** cache)
+{
+    uint32_t size;
+    char* data = NULL;
+    *cache = NULL;
+    error_code_t ret = storage_stat(st, path, &size);
+    if (ret != PM_OK)
+        return ret;
+    if (size < sizeof(track_cache_header_t))
+        return PM_FAIL;
+    if ((ret = storage_load(st, path, &data, &size)) != PM_OK)
+        return ret;
+
+    track_cache_header_t* h = (track_cache_header_t*)data;
+    uint64_t expected = sizeof(track_cache_header_t) + (uint64_t)h->name_length + (uint64_t)h->points * 3 * sizeof(float);
+    if (h->magic != TRACK_CACHE_MAGIC || h->source_size != source->source_size
+        || h->source_modified != source->source_modified || expected != size || h->name_length % 4
+        || h->name_length > TRACK_CACHE_NAME_LENGTH) {
+        ESP_LOGI(TAG, "%s is outdated", path);
+        RTOS_Free(data);
+        return PM_FAIL;
+    }
+    if (crc32_update(0, data + sizeof(track_cache_header_t), size - sizeof(track_cache_header_t)) != h->crc) {
+        ESP_LOGE(TAG, "%s is corrupt", path);
+        RTOS_Free(data);
+        return PM_FAIL;
+    }
+
+    track_cache_t* c = RTOS_Malloc(sizeof(track_cache_t));
+    if (!c) {
+        RTOS_Free(data);
+        return PM_FAIL;
+    }
+    char* body = data + sizeof(track_cache_header_t);
+    c->header = *h;
+    c->data = data;
+    c->name = h->name_length ? body : NULL;
+    c->lat = (const float*)(body + h->name_length);
+    c->lon = c->lat + h->points;
+    c->ele = c->lon + h->points;
+    if (h->name_length)
+        body[h->name_length - 1] = 0;
+    *cache = c;
+    return PM_OK;
+}
+
+/* lat, lon or ele of every waypoint, in batches */
+static error_code_t write_values(storage_stream_t* stream, const waypoint_t* wp, size_t field, uint32_t* crc)
+{
+    float values[TRACK_CACHE_BATCH];
+    error_code_t ret = PM_OK;
+    while (wp && ret == PM_OK) {
+        uint32_t n = 0;
+        for (; wp && n < TRACK_CACHE_BATCH; wp = wp->next)
+            memcpy(&values[n++], (const char*)wp + field, sizeof(float));
+        *crc = crc32_update(*crc, values, n * sizeof(float));
+        if (stream)
+            ret = storage_stream_write(stream, values, n * sizeof(float));
+    }
+    return ret;
+}
+
+static error_code_t write_body(storage_stream_t* stream, const gpx_t* gpx, const char* name, uint32_t length, uint32_t* crc)
+{
+    size_t fields[] = { offsetof(waypoint_t, lat), offsetof(waypoint_t, lon), offsetof(waypoint_t, ele) };
+    error_code_t ret = PM_OK;
+    *crc = crc32_update(0, name, length);
+    if (stream && length)
+        ret = storage_stream_write(stream, name, length);
+    for (uint8_t i = 0; i < 3 && ret == PM_OK; i++)
+        ret = write_values(stream, gpx->waypoints, fields[i], crc);
+    return ret;
+}
+
+/**
+ * Write the cache of a parsed GPX file
+ *
+ * The cache is written under an other name and renamed once it is
+ * complete, so an interrupted write leaves no cache that looks valid.
+ */
+error_code_t track_cache_save(storage_t* st, const char* path, const track_cache_header_t* source, const gpx_t* gpx)
+{
+    char temp[STORAGE_PATH_LENGTH];
+    char name[TRACK_CACHE_NAME_LENGTH] = { 0 };
+    track_cache_header_t h = *source;
+    h.magic = TRACK_CACHE_MAGIC;
+    h.points = 0;
+    h.name_length = name_length(gpx->track_name);
+    if (h.name_length)
+        strncpy(name, gpx->track_name, h.name_length - 1);
+    for (const waypoint_t* wp = gpx->waypoints; wp; wp = wp->next)
+        h.points++;
+    write_body(NULL, gpx, name, h.name_length, &h.crc);
+
+    track_cache_path(temp, sizeof(temp), path, "TMP");
+    uint32_t size = sizeof(h) + h.name_length + h.points * 3 * sizeof(float);
+    storage_stream_t* stream = storage_stream_open(st, temp, 0, size);
+    if (!stream)
+        return PM_FAIL;
+    uint32_t crc;
+    error_code_t ret = storage_stream_write(stream, &h, sizeof(h));
+    if (ret == PM_OK)
+        ret = write_body(stream, gpx, name, h.name_length, &crc);
+    if (storage_stream_close(stream) != PM_OK)
+        ret = PM_FAIL;
+    if (ret == PM_OK)
+        ret = storage_rename(st, temp, path);
+    if (ret != PM_OK) {
+        ESP_LOGE(TAG, "cannot write %s", path);
+        storage_unlink(st, temp);
+        return ret;
+    }
+    ESP_LOGI(TAG, "%s with %lu points", path, (unsigned long)h.points);
+    return PM_OK;
+}
+
+/**
+ * The track of the cache as the GPX parser would return it
+ */
+gpx_t* track_cache_gpx(const track_cache_t* cache, uint32_t (*add_waypoint_cb)(waypoint_t* wp))
+{
+    gpx_t* gpx = RTOS_Malloc(sizeof(gpx_t));
+    if (!gpx)
+        return NULL;
+    if (cache->name && (gpx->track_name = RTOS_Malloc(cache->header.name_length)))
+        strcpy(gpx->track_name, cache->name);
+    for (uint32_t i = 0; i < cache->header.points; i++) {
+        waypoint_t* wp = RTOS_Malloc(sizeof(waypoint_t));
+        if (!wp)
+            break;
+        wp->lat = cache->lat[i];
+        wp->lon = cache->lon[i];
+        wp->ele = cache->ele[i];
+        if (!gpx->waypoints)
+            gpx->waypoints = wp;
+        gpx->waypoints_num = add_waypoint_cb(wp);
+    }
+    return gpx;
+}
+
+void track_cache_free(track_cache_t* cache)
+{
+    if (!cache)
+        return;
+    RTOS_Free(cache->data);
+    RTOS_Free(cache);
+}
@@ -0,0 +1,54 @@
+/*
+ * Track cache, the parsed GPX track in a binary file next to it
+ *
+ * Parsing the GPX file is the slowest part of showing the map after a
+ * boot. The cache holds the track name and the coordinates as arrays, so
+ * it loads with one sequential read:
+ *
+ *   header | name | lat[points] | lon[points] | ele[points]
+ *
+ * It is only used while the GPX file has the size and modification time
+ * the cache was written for, otherwise the GPX is parsed and the cache
+ * written again.
+ *
+ * Copyright (c) 2022, Bastian Neumann <info@platinenmacher.tech>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef PLATINENMACHER_TRACK_CACHE_H
+#define PLATINENMACHER_TRACK_CACHE_H
+
+#include "parser/gpx.h"
+#include "storage.h"
+
+#define TRACK_CACHE_MAGIC 0x31435254 // "TRC1"
+#define TRACK_CACHE_NAME_LENGTH 128  /// longest track name that is kept
+
+typedef struct {
+    uint32_t magic;
+    uint32_t source_size;     /// of the GPX file
+    uint32_t source_modified; /// storage_modified of the GPX file
+    uint32_t source_crc;      /// CRC-32 of the GPX file
+    uint32_t points;
+    uint32_t name_length; /// with the terminating zero, padded to 4 bytes
+    uint32_t crc;         /// CRC-32 of everything behind the header
+} track_cache_header_t;
+
+typedef struct {
+    track_cache_header_t header;
+    const char* name; /// NULL if the track has none
+    const float* lat;
+    const float* lon;
+    const float* ele;
+    char* data; /// the file as it was loaded
+} track_cache_t;
+
+void track_cache_path(char* path, size_t size, const char* gpx_path, const char* extension);
+error_code_t track_cache_source(storage_t* st, const char* gpx_path, track_cache_header_t* source);
+error_code_t track_cache_load(storage_t* st, const char* path, const track_cache_header_t* source, track_cache_t** cache);
+error_code_t track_cache_save(storage_t* st, const char* path, const track_cache_header_t* source, const gpx_t* gpx);
+gpx_t* track_cache_gpx(const track_cache_t* cache, uint32_t (*add_waypoint_cb)(waypoint_t* wp));
+void track_cache_free(track_cache_t* cache);
+
+#endif // PLATINENMACHER_TRACK_CACHE_H
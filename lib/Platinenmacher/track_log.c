@@ -0,0 +1,458 @@
+/*
+ * Track log, every GPS fix recorded without loss
+ *
+ * Copyright (c) 2022, Bastian Neumann <info@platinenmacher.tech>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "track_log.h"
+#include "crc32.h"
+#include "memory.h"
+#include "track_cache.h"
+
+static const char* TAG = "track_log";
+
+#define BLOCK_CRC (TRACK_LOG_BLOCK_SIZE - sizeof(uint32_t))
+
+/**
+ * Keep the fixes of a ring that survived a sleep, clear it otherwise
+ */
+void track_ring_init(track_ring_t* ring)
+{
+    if (ring->magic == TRACK_RING_MAGIC && ring->head - ring->tail <= TRACK_RING_SIZE)
+        return;
+    memset(ring, 0, sizeof(track_ring_t));
+    ring->magic = TRACK_RING_MAGIC;
+}
+
+uint32_t track_ring_count(const track_ring_t* ring)
+{
+    return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) - ring->tail;
+}
+
+/**
+ * Add a fix, 0 if the ring is full and the fix was dropped
+ *
+ * Only one task may add fixes.
+ */
+uint8_t track_ring_push(track_ring_t* ring, const track_fix_t* fix)
+{
+    uint32_t head = ring->head;
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= TRACK_RING_SIZE) {
+        ring->dropped++;
+        return 0;
+    }
+    ring->fixes[head % TRACK_RING_SIZE] = *fix;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+/**
+ * Fix number index of the ones waiting, it stays in the ring until it is
+ * released
+ */
+uint8_t track_ring_peek(const track_ring_t* ring, uint32_t index, track_fix_t* fix)
+{
+    if (index >= track_ring_count(ring))
+        return 0;
+    *fix = ring->fixes[(ring->tail + index) % TRACK_RING_SIZE];
+    return 1;
+}
+
+/**
+ * Remove the count oldest fixes, only one task may take fixes
+ */
+void track_ring_release(track_ring_t* ring, uint32_t count)
+{
+    __atomic_store_n(&ring->tail, ring->tail + count, __ATOMIC_RELEASE);
+}
+
+static uint8_t* put_varint(uint8_t* p, uint32_t value)
+{
+    while (value >= 0x80) {
+        *p++ = value | 0x80;
+        value >>= 7;
+    }
+    *p++ = value;
+    return p;
+}
+
+/* the difference wraps, the sum on decoding wraps back */
+static uint8_t* put_delta(uint8_t* p, uint32_t value, uint32_t last)
+{
+    int32_t d = (int32_t)(value - last);
+    return put_varint(p, ((uint32_t)d << 1) ^ (uint32_t)(d >> 31));
+}
+
+static const uint8_t* get_varint(const uint8_t* p, const uint8_t* end, uint32_t* value)
+{
+    *value = 0;
+    for (uint8_t shift = 0; shift < 35 && p < end; shift += 7) {
+        *value |= (uint32_t)(*p & 0x7f) << shift;
+        if (!(*p++ & 0x80))
+            return p;
+    }
+    return NULL;
+}
+
+static const uint8_t* get_delta(const uint8_t* p, const uint8_t* end, uint32_t* value)
+{
+    uint32_t z = 0;
+    p = p ? get_varint(p, end, &z) : NULL;
+    *value += (z >> 1) ^ -(z & 1);
+    return p;
+}
+
+void track_block_begin(track_block_t* b, uint16_t session, uint32_t sequence)
+{
+    memset(b, 0, sizeof(track_block_t));
+    b->session = session;
+    b->sequence = sequence;
+    b->length = sizeof(track_block_header_t);
+}
+
+/**
+ * Add a fix, 0 if the block is full
+ */
+uint8_t track_block_add(track_block_t* b, const track_fix_t* fix)
+{
+    if (!b->count) {
+        b->first = *fix;
+    } else {
+        if (b->length + TRACK_FIX_MAX_BYTES > BLOCK_CRC)
+            return 0;
+        uint8_t* p = b->data + b->length;
+        p = put_delta(p, fix->time, b->last.time);
+        p = put_delta(p, fix->lat, b->last.lat);
+        p = put_delta(p, fix->lon, b->last.lon);
+        p = put_delta(p, fix->ele, b->last.ele);
+        b->length = p - b->data;
+    }
+    b->last = *fix;
+    b->count++;
+    return 1;
+}
+
+/**
+ * Header and CRC, the block is ready to be written
+ */
+void track_block_finish(track_block_t* b)
+{
+    track_block_header_t h = { TRACK_LOG_MAGIC, b->session, b->count, b->sequence, b->first };
+    memcpy(b->data, &h, sizeof(h));
+    memset(b->data + b->length, 0, BLOCK_CRC - b->length);
+    uint32_t crc = crc32_update(0, b->data, BLOCK_CRC);
+    memcpy(b->data + BLOCK_CRC, &crc, sizeof(crc));
+}
+
+/**
+ * Call fix for every fix of a block in order
+ *
+ * returns PM_FAIL without calling it if the block is torn or no block at all
+ */
+error_code_t track_block_decode(const uint8_t* data, track_block_header_t* header, void (*fix)(void* arg, const track_fix_t* fix), void* arg)
+{
+    uint32_t crc;
+    memcpy(header, data, sizeof(track_block_header_t));
+    memcpy(&crc, data + BLOCK_CRC, sizeof(crc));
+    if (header->magic != TRACK_LOG_MAGIC || !header->count || crc != crc32_update(0, data, BLOCK_CRC))
+        return PM_FAIL;
+
+    /* the deltas are checked before the first fix is handed out */
+    const uint8_t* end = data + BLOCK_CRC;
+    const uint8_t* p = data + sizeof(track_block_header_t);
+    track_fix_t f = header->first;
+    for (uint16_t i = 1; i < header->count && p; i++) {
+        p = get_delta(p, end, &f.time);
+        p = get_delta(p, end, (uint32_t*)&f.lat);
+        p = get_delta(p, end, (uint32_t*)&f.lon);
+        p = get_delta(p, end, (uint32_t*)&f.ele);
+    }
+    if (!p)
+        return PM_FAIL;
+
+    f = header->first;
+    fix(arg, &f);
+    p = data + sizeof(track_block_header_t);
+    for (uint16_t i = 1; i < header->count; i++) {
+        p = get_delta(p, end, &f.time);
+        p = get_delta(p, end, (uint32_t*)&f.lat);
+        p = get_delta(p, end, (uint32_t*)&f.lon);
+        p = get_delta(p, end, (uint32_t*)&f.ele);
+        fix(arg, &f);
+    }
+    return PM_OK;
+}
+
+static void skip_fix(void* arg, const track_fix_t* fix)
+{
+}
+
+/* header of the last block that is intact */
+static uint8_t last_header(storage_t* st, const char* path, uint32_t blocks, uint8_t* data, track_block_header_t* h)
+{
+    size_t length;
+    while (blocks--) {
+        if (storage_read_at(st, path, blocks * TRACK_LOG_BLOCK_SIZE, data, TRACK_LOG_BLOCK_SIZE, &length) == PM_OK
+            && length == TRACK_LOG_BLOCK_SIZE && track_block_decode(data, h, skip_fix, NULL) == PM_OK)
+            return 1;
+    }
+    return 0;
+}
+
+/**
+ * Open a log for a new recording, its fixes start a new track segment
+ */
+track_log_t* track_log_open(storage_t* st, const char* path)
+{
+    uint32_t size = 0;
+    track_block_header_t h;
+    if (strlen(path) >= STORAGE_PATH_LENGTH)
+        return NULL;
+    track_log_t* log = RTOS_Malloc(sizeof(track_log_t));
+    if (!log)
+        return NULL;
+    log->st = st;
+    strcpy(log->path, path);
+    if (storage_stat(st, path, &size) == PM_OK)
+        log->blocks = size / TRACK_LOG_BLOCK_SIZE;
+    if (last_header(st, path, log->blocks, log->block.data, &h))
+        log->session = h.session + 1;
+    storage_drop(st, path);
+    track_block_begin(&log->block, log->session, log->blocks);
+    ESP_LOGI(TAG, "%s: %lu blocks, session %u", path, (unsigned long)log->blocks, log->session);
+    return log;
+}
+
+static error_code_t write_block(track_log_t* log, storage_file_t* file)
+{
+    size_t written = 0;
+    track_block_finish(&log->block);
+    error_code_t ret = storage_seek(file, log->block.sequence * TRACK_LOG_BLOCK_SIZE);
+    if (ret == PM_OK)
+        ret = storage_write(file, log->block.data, TRACK_LOG_BLOCK_SIZE, &written);
+    if (ret == PM_OK && written != TRACK_LOG_BLOCK_SIZE)
+        ret = PM_FAIL;
+    if (ret == PM_OK && log->blocks <= log->block.sequence)
+        log->blocks = log->block.sequence + 1;
+    return ret;
+}
+
+/**
+ * Move the fixes of the ring to the log
+ *
+ * Full blocks are written once, the block being filled is written again
+ * on every flush. A fix leaves the ring only after its block was written,
+ * if writing fails it is tried again on the next flush.
+ */
+error_code_t track_log_flush(track_log_t* log, track_ring_t* ring)
+{
+    track_fix_t fix;
+    storage_file_t* file;
+    uint32_t pending = track_ring_count(ring);
+    if (!pending)
+        return NOT_NEEDED;
+    storage_drop(log->st, log->path);
+    error_code_t ret = storage_open_for_writing(log->st, log->path, STORAGE_WRITE | STORAGE_APPEND, &file);
+    if (ret != PM_OK)
+        return ret;
+
+    /* the block as it was with the fixes that left the ring */
+    track_block_t* b = &log->block;
+    uint16_t length = b->length, count = b->count;
+    track_fix_t first = b->first, last = b->last;
+    uint32_t done = 0;
+    for (uint32_t i = 0; i < pending && ret == PM_OK; i++) {
+        track_ring_peek(ring, i, &fix);
+        if (track_block_add(b, &fix))
+            continue;
+        if ((ret = write_block(log, file)) != PM_OK)
+            break;
+        done = i;
+        track_block_begin(b, log->session, b->sequence + 1);
+        length = b->length;
+        count = b->count;
+        first = b->first;
+        last = b->last;
+        track_block_add(b, &fix);
+    }
+    if (ret == PM_OK)
+        ret = write_block(log, file);
+    if (ret == PM_OK) {
+        track_ring_release(ring, pending);
+    } else {
+        track_ring_release(ring, done);
+        ESP_LOGE(TAG, "cannot write block %lu", (unsigned long)b->sequence);
+        b->length = length;
+        b->count = count;
+        b->first = first;
+        b->last = last;
+    }
+    if (storage_close(file) != PM_OK && ret == PM_OK)
+        ret = PM_FAIL;
+    return ret;
+}
+
+void track_log_close(track_log_t* log)
+{
+    if (!log)
+        return;
+    storage_drop(log->st, log->path);
+    RTOS_Free(log);
+}
+
+static error_code_t write_gpx(void* arg, const void* data, size_t length)
+{
+    track_export_t* e = arg;
+    size_t written = 0;
+    error_code_t ret;
+    if (e->file) {
+        ret = storage_write(e->file, data, length, &written);
+        if (ret == PM_OK && written != length)
+            ret = PM_FAIL;
+    } else {
+        ret = storage_stream_write(e->stream, data, length);
+    }
+    e->offset += length;
+    return ret;
+}
+
+/* open the file of the last export at its closing tags */
+static uint8_t resume_export(track_export_t* e, const track_export_mark_t* mark)
+{
+    uint32_t size;
+    if (!mark || !mark->size || mark->sequence >= e->blocks)
+        return 0;
+    if (storage_stat(e->st, e->gpx, &size) != PM_OK || size != mark->size)
+        return 0;
+    storage_drop(e->st, e->gpx);
+    if (storage_open_for_writing(e->st, e->gpx, STORAGE_APPEND, &e->file) != PM_OK)
+        return 0;
+    if (storage_seek(e->file, mark->tail) != PM_OK) {
+        storage_close(e->file);
+        e->file = NULL;
+        return 0;
+    }
+    gpx_writer_resume(&e->writer, write_gpx, e, mark->in_segment);
+    e->offset = mark->tail;
+    e->sequence = mark->sequence;
+    e->skip = mark->fixes;
+    e->session = mark->session;
+    e->points = mark->points;
+    return 1;
+}
+
+/**
+ * Start converting a log to GPX
+ *
+ * With the mark of the last export the fixes that came since are added to
+ * its file. Otherwise the file is written under an other name and replaces
+ * gpx once it is complete. Returns NULL if there is no log.
+ */
+track_export_t* track_export_begin(storage_t* st, const char* log, const char* gpx, const char* name, uint32_t time, track_export_mark_t* mark)
+{
+    uint32_t size;
+    if (strlen(log) >= STORAGE_PATH_LENGTH || strlen(gpx) >= STORAGE_PATH_LENGTH)
+        return NULL;
+    if (storage_stat(st, log, &size) != PM_OK || size < TRACK_LOG_BLOCK_SIZE)
+        return NULL;
+    track_export_t* e = RTOS_Malloc(sizeof(track_export_t));
+    if (!e)
+        return NULL;
+    e->st = st;
+    e->mark = mark;
+    e->blocks = size / TRACK_LOG_BLOCK_SIZE;
+    strcpy(e->log, log);
+    strcpy(e->gpx, gpx);
+    if (resume_export(e, mark))
+        return e;
+    track_cache_path(e->temp, sizeof(e->temp), gpx, "TMP");
+    e->stream = storage_stream_open(st, e->temp, 0, 0);
+    if (!e->stream) {
+        RTOS_Free(e);
+        return NULL;
+    }
+    gpx_writer_begin(&e->writer, write_gpx, e, name, time);
+    return e;
+}
+
+static void export_fix(void* arg, const track_fix_t* fix)
+{
+    track_export_t* e = arg;
+    if (e->skip) {
+        e->skip--;
+        return;
+    }
+    if (!e->points || e->header.session != e->session)
+        gpx_writer_segment(&e->writer);
+    e->session = e->header.session;
+    gpx_writer_point(&e->writer, fix->lat, fix->lon, fix->ele, fix->time);
+    e->points++;
+}
+
+/**
+ * Convert the next block
+ *
+ * returns NOT_NEEDED once every block is done
+ */
+error_code_t track_export_step(track_export_t* e)
+{
+    size_t length;
+    if (e->sequence >= e->blocks)
+        return NOT_NEEDED;
+    uint32_t sequence = e->sequence++;
+    error_code_t ret = storage_read_at(e->st, e->log, sequence * TRACK_LOG_BLOCK_SIZE, e->data, TRACK_LOG_BLOCK_SIZE, &length);
+    if (ret != PM_OK) {
+        e->writer.error = ret;
+        return ret;
+    }
+
+    /* a torn block only costs its own fixes */
+    e->fixes = e->skip;
+    if (length != TRACK_LOG_BLOCK_SIZE || track_block_decode(e->data, &e->header, export_fix, e) != PM_OK)
+        ESP_LOGE(TAG, "block %lu is broken", (unsigned long)sequence);
+    else
+        e->fixes = e->header.count;
+    e->skip = 0;
+    return e->writer.error;
+}
+
+/**
+ * Finish the file and replace the last export with it
+ *
+ * The mark is updated to continue the file next time, or cleared if the
+ * export failed.
+ */
+error_code_t track_export_end(track_export_t* e)
+{
+    track_export_mark_t next = {
+        .tail = e->offset + e->writer.length,
+        .sequence = e->blocks - 1,
+        .fixes = e->fixes,
+        .session = e->session,
+        .points = e->points,
+        .in_segment = e->writer.in_segment,
+    };
+    error_code_t ret = gpx_writer_end(&e->writer);
+    if (e->file) {
+        if (storage_close(e->file) != PM_OK && ret == PM_OK)
+            ret = PM_FAIL;
+    } else if (storage_stream_close(e->stream) != PM_OK && ret == PM_OK) {
+        ret = PM_FAIL;
+    }
+    storage_drop(e->st, e->log);
+    if (ret == PM_OK && e->sequence < e->blocks)
+        ret = ABORT;
+    else if (ret == PM_OK && !e->file)
+        ret = storage_rename(e->st, e->temp, e->gpx);
+    if (ret != PM_OK && !e->file)
+        storage_unlink(e->st, e->temp);
+    if (ret == PM_OK)
+        next.size = e->offset;
+    if (e->mark)
+        *e->mark = next;
+    ESP_LOGI(TAG, "%s: %lu points", e->gpx, (unsigned long)e->points);
+    RTOS_Free(e);
+    return ret;
+}
@@ -0,0 +1,128 @@
+/*
+ * Track log, every GPS fix recorded without loss
+ *
+ * The GPS parser puts every fix into a ring that only the GPS task takes
+ * fixes from, so neither of them waits for the other. The ring can live in
+ * RTC memory, fixes that were not written yet survive a sleep then.
+ *
+ * The GPS task packs the fixes into blocks of one sector: a header with the
+ * first fix, the following fixes as zigzag varint deltas and a CRC-32 at
+ * the end. Every block decodes on its own, so a block torn by a power loss
+ * only costs its own fixes. The block being filled is written again at the
+ * same offset on every flush.
+ *
+ * The log is converted to GPX by a streaming writer, one block at a time.
+ * An export can continue the file of the previous one: the fixes that came
+ * since are written over its closing tags, so the work does not grow with
+ * the log.
+ *
+ * Copyright (c) 2022, Bastian Neumann <info@platinenmacher.tech>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef PLATINENMACHER_TRACK_LOG_H
+#define PLATINENMACHER_TRACK_LOG_H
+
+#include "gpx_writer.h"
+#include "storage.h"
+
+#define TRACK_LOG_MAGIC 0x31424C54 // "TLB1"
+#define TRACK_RING_MAGIC 0x31474E52 // "RNG1"
+#define TRACK_LOG_BLOCK_SIZE STORAGE_SECTOR_SIZE
+#define TRACK_RING_SIZE 128 /// fixes, a power of two
+#define TRACK_FIX_MAX_BYTES 20 /// four varints of up to 5 bytes
+
+typedef struct {
+    uint32_t time; /// seconds since 1970, UTC
+    int32_t lat;   /// degrees * 1e7
+    int32_t lon;   /// degrees * 1e7
+    int32_t ele;   /// decimeters
+} track_fix_t;
+
+typedef struct {
+    uint32_t magic;
+    volatile uint32_t head; /// next free entry, only the producer writes it
+    volatile uint32_t tail; /// next entry to take, only the consumer writes it
+    volatile uint32_t dropped;
+    track_fix_t fixes[TRACK_RING_SIZE];
+} track_ring_t;
+
+typedef struct {
+    uint32_t magic;
+    uint16_t session; /// a new recording starts a new track segment
+    uint16_t count;   /// fixes in the block
+    uint32_t sequence;
+    track_fix_t first;
+} track_block_header_t;
+
+typedef struct {
+    uint8_t data[TRACK_LOG_BLOCK_SIZE];
+    uint16_t length; /// bytes of data used
+    uint16_t session;
+    uint16_t count;
+    uint32_t sequence;
+    track_fix_t first;
+    track_fix_t last;
+} track_block_t;
+
+typedef struct {
+    storage_t* st;
+    char path[STORAGE_PATH_LENGTH];
+    uint16_t session;
+    uint32_t sequence; /// of the block being filled
+    uint32_t blocks;   /// complete or partial blocks in the file
+    track_block_t block;
+} track_log_t;
+
+/* where an export ended, the next one only appends what came since */
+typedef struct {
+    uint32_t size;     /// of the GPX file, 0 if the next export is a full one
+    uint32_t tail;     /// offset of the closing tags
+    uint32_t sequence; /// block the export ended in
+    uint16_t fixes;    /// of that block in the file
+    uint16_t session;
+    uint32_t points;
+    uint8_t in_segment;
+} track_export_mark_t;
+
+typedef struct {
+    storage_t* st;
+    char log[STORAGE_PATH_LENGTH];
+    char gpx[STORAGE_PATH_LENGTH];
+    char temp[STORAGE_PATH_LENGTH];
+    storage_stream_t* stream; /// of a full export
+    storage_file_t* file;     /// of an export that continues the last one
+    gpx_writer_t writer;
+    track_export_mark_t* mark;
+    uint32_t offset;   /// in the GPX file
+    uint32_t blocks;   /// in the log when the export started
+    uint32_t sequence; /// next block to convert
+    uint16_t skip;     /// fixes of the block that are in the file already
+    uint16_t fixes;    /// of the last block that are in the file
+    track_block_header_t header;
+    uint16_t session;
+    uint32_t points;
+    uint8_t data[TRACK_LOG_BLOCK_SIZE];
+} track_export_t;
+
+void track_ring_init(track_ring_t* ring);
+uint8_t track_ring_push(track_ring_t* ring, const track_fix_t* fix);
+uint8_t track_ring_peek(const track_ring_t* ring, uint32_t index, track_fix_t* fix);
+void track_ring_release(track_ring_t* ring, uint32_t count);
+uint32_t track_ring_count(const track_ring_t* ring);
+
+void track_block_begin(track_block_t* b, uint16_t session, uint32_t sequence);
+uint8_t track_block_add(track_block_t* b, const track_fix_t* fix);
+void track_block_finish(track_block_t* b);
+error_code_t track_block_decode(const uint8_t* data, track_block_header_t* header, void (*fix)(void* arg, const track_fix_t* fix), void* arg);
+
+track_log_t* track_log_open(storage_t* st, const char* path);
+error_code_t track_log_flush(track_log_t* log, track_ring_t* ring);
+void track_log_close(track_log_t* log);
+
+track_export_t* track_export_begin(storage_t* st, const char* log, const char* gpx, const char* name, uint32_t time, track_export_mark_t* mark);
+error_code_t track_export_step(track_export_t* e);
+error_code_t track_export_end(track_export_t* e);
+
+#endif // PLATINENMACHER_TRACK_LOG_H
@@ -0,0 +1,37 @@
+/*
+ * Byte stream connection to a server
+ *
+ * The downloader speaks HTTP over this interface. The socket transport
+ * uses the BSD socket API, which lwIP provides on the device, so the same
+ * code talks to the tile server on the device and to a local server on the
+ * host.
+ *
+ * Copyright (c) 2022, Bastian Neumann <info@platinenmacher.tech>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef PLATINENMACHER_TRANSPORT_H
+#define PLATINENMACHER_TRANSPORT_H
+
+#include "error.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct transport transport_t;
+
+struct transport {
+    error_code_t (*connect)(transport_t* t, const char* host, uint16_t port);
+    /* send every byte or fail */
+    error_code_t (*send)(transport_t* t, const void* data, size_t length);
+    /* wait for at least one byte, ABORT if the server closed the connection */
+    error_code_t (*recv)(transport_t* t, void* data, size_t size, size_t* length);
+    void (*close)(transport_t* t);
+    void* driver;
+};
+
+transport_t* transport_socket_create(uint32_t timeout_ms);
+void transport_socket_free(transport_t* t);
+
+#endif // PLATINENMACHER_TRANSPORT_H
@@ -0,0 +1,134 @@
+/*
+ * TCP socket transport
+ *
+ * Copyright (c) 2022, Bastian Neumann <info@platinenmacher.tech>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "memory.h"
+#include "transport.h"
+
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+static const char* TAG = "transport";
+
+typedef struct {
+    int fd;
+    uint32_t timeout_ms;
+} socket_driver_t;
+
+static void socket_close(transport_t* t)
+{
+    socket_driver_t* s = t->driver;
+    if (s->fd >= 0)
+        close(s->fd);
+    s->fd = -1;
+}
+
+static error_code_t socket_connect(transport_t* t, const char* host, uint16_t port)
+{
+    socket_driver_t* s = t->driver;
+    struct addrinfo hints = { .ai_family = AF_INET, .ai_socktype = SOCK_STREAM };
+    struct addrinfo* res;
+    char service[6];
+
+    socket_close(t);
+    snprintf(service, sizeof(service), "%u", port);
+    if (getaddrinfo(host, service, &hints, &res) || !res) {
+        ESP_LOGE(TAG, "cannot resolve %s", host);
+        return UNAVAILABLE;
+    }
+    s->fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (s->fd < 0) {
+        freeaddrinfo(res);
+        return PM_FAIL;
+    }
+    struct timeval tv = { s->timeout_ms / 1000, (s->timeout_ms % 1000) * 1000 };
+    int one = 1;
+    setsockopt(s->fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(s->fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    /* requests are small and sent back to back */
+    setsockopt(s->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    int ret = connect(s->fd, res->ai_addr, res->ai_addrlen);
+    freeaddrinfo(res);
+    if (ret) {
+        ESP_LOGE(TAG, "cannot connect to %s:%u (%d)", host, port, errno);
+        socket_close(t);
+        return UNAVAILABLE;
+    }
+    return PM_OK;
+}
+
+static error_code_t socket_send(transport_t* t, const void* data, size_t length)
+{
+    socket_driver_t* s = t->driver;
+    size_t sent = 0;
+    while (sent < length) {
+        ssize_t count = send(s->fd, (const uint8_t*)data + sent, length - sent, MSG_NOSIGNAL);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            return errno == EAGAIN || errno == EWOULDBLOCK ? TIMEOUT : PM_FAIL;
+        sent += count;
+    }
+    return PM_OK;
+}
+
+static error_code_t socket_recv(transport_t* t, void* data, size_t size, size_t* length)
+{
+    socket_driver_t* s = t->driver;
+    ssize_t count;
+    *length = 0;
+    do {
+        count = recv(s->fd, data, size, 0);
+    } while (count < 0 && errno == EINTR);
+    if (count == 0)
+        return ABORT;
+    if (count < 0)
+        return errno == EAGAIN || errno == EWOULDBLOCK ? TIMEOUT : PM_FAIL;
+    *length = count;
+    return PM_OK;
+}
+
+/**
+ * TCP connection, send and receive give up after timeout_ms
+ */
+transport_t* transport_socket_create(uint32_t timeout_ms)
+{
+    transport_t* t = RTOS_Malloc(sizeof(transport_t));
+    socket_driver_t* s = RTOS_Malloc(sizeof(socket_driver_t));
+    if (!t || !s) {
+        RTOS_Free(t);
+        RTOS_Free(s);
+        return NULL;
+    }
+    s->fd = -1;
+    s->timeout_ms = timeout_ms;
+    t->connect = socket_connect;
+    t->send = socket_send;
+    t->recv = socket_recv;
+    t->close = socket_close;
+    t->driver = s;
+    return t;
+}
+
+void transport_socket_free(transport_t* t)
+{
+    if (!t)
+        return;
+    socket_close(t);
+    RTOS_Free(t->driver);
+    RTOS_Free(t);
+}
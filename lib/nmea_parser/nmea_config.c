@@ -0,0 +1,109 @@
+/*
+ * Output configuration of the GPS receiver
+ *
+ * Copyright (c) 2023, Bastian Neumann <info@platinenmacher.tech>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "nmea_config.h"
+#include <stdarg.h>
+#include <stdio.h>
+
+/* order of the statements in PMTK314, the other 13 fields are reserved */
+static const uint8_t output_order[] = {
+    STATEMENT_GLL,
+    STATEMENT_RMC,
+    STATEMENT_VTG,
+    STATEMENT_GGA,
+    STATEMENT_GSA,
+    STATEMENT_GSV,
+};
+
+#define OUTPUT_FIELDS 19
+
+/**
+ * Format a command with the checksum and the line end, "$<body>*hh\r\n"
+ *
+ * @return size_t length of the command, 0 if it does not fit
+ */
+size_t nmea_command(char* command, size_t size, const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(command + 1, size > 1 ? size - 1 : 0, format, args);
+    va_end(args);
+    if (length < 0 || (size_t)length + 6 >= size)
+        return 0;
+
+    uint8_t crc = 0;
+    for (int i = 1; i <= length; i++)
+        crc ^= (uint8_t)command[i];
+    command[0] = '$';
+    snprintf(command + length + 1, size - length - 1, "*%02X\r\n", crc);
+    return length + 6;
+}
+
+/**
+ * Statements that complete a fix, the ones sent with every fix that the
+ * decoder has a parser for
+ *
+ * @return uint32_t mask of 1 << STATEMENT_*
+ */
+uint32_t nmea_config_statements(const nmea_config_t* config)
+{
+    uint32_t statements = 0;
+    for (uint8_t i = 0; i < sizeof(output_order); i++)
+        if (config->every[output_order[i]] == 1)
+            statements |= 1 << output_order[i];
+    return statements & nmea_decoder_statements();
+}
+
+/**
+ * PMTK314, the statements to send and how often
+ */
+size_t nmea_config_output(const nmea_config_t* config, char* command, size_t size)
+{
+    uint8_t every[OUTPUT_FIELDS] = { 0 };
+    for (uint8_t i = 0; i < sizeof(output_order); i++) {
+        every[i] = config->every[output_order[i]];
+        if (every[i] > NMEA_CONFIG_MAX_EVERY)
+            every[i] = NMEA_CONFIG_MAX_EVERY;
+    }
+    return nmea_command(command, size, "PMTK314,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u",
+        every[0], every[1], every[2], every[3], every[4], every[5], every[6], every[7], every[8], every[9],
+        every[10], every[11], every[12], every[13], every[14], every[15], every[16], every[17], every[18]);
+}
+
+/**
+ * PMTK220, the time between two fixes
+ */
+size_t nmea_config_fix_interval(const nmea_config_t* config, char* command, size_t size)
+{
+    uint16_t interval = config->fix_interval;
+    if (interval < 100)
+        interval = 100;
+    if (interval > 10000)
+        interval = 10000;
+    return nmea_command(command, size, "PMTK220,%u", interval);
+}
+
+/**
+ * PMTK251, the receiver changes the baud rate right away and does not
+ * acknowledge it
+ */
+size_t nmea_config_baud_rate(const nmea_config_t* config, char* command, size_t size)
+{
+    switch (config->baud_rate) {
+    case 4800:
+    case 9600:
+    case 14400:
+    case 19200:
+    case 38400:
+    case 57600:
+    case 115200:
+        return nmea_command(command, size, "PMTK251,%lu", (unsigned long)config->baud_rate);
+    default:
+        return 0;
+    }
+}
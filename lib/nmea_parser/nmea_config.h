@@ -0,0 +1,31 @@
+/*
+ * Output configuration of the GPS receiver
+ *
+ * Builds the PMTK commands that select which statements the receiver sends,
+ * how often it calculates a fix and the baud rate. The statements sent with
+ * every fix are the ones the decoder waits for.
+ *
+ * Copyright (c) 2023, Bastian Neumann <info@platinenmacher.tech>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include "nmea_decoder.h"
+
+#define NMEA_CONFIG_COMMAND 64  /// longest command with checksum and line end
+#define NMEA_CONFIG_MAX_EVERY 5 /// a statement is sent with every fifth fix at most
+
+typedef struct
+{
+    uint8_t every[STATEMENT_PLUGIN]; /*!< Send a statement with every n-th fix, 0 for never, by STATEMENT_* */
+    uint16_t fix_interval;           /*!< Milliseconds between fixes, 100 to 10000 */
+    uint32_t baud_rate;              /*!< 0 keeps the baud rate */
+} nmea_config_t;
+
+size_t nmea_command(char* command, size_t size, const char* format, ...);
+uint32_t nmea_config_statements(const nmea_config_t* config);
+size_t nmea_config_output(const nmea_config_t* config, char* command, size_t size);
+size_t nmea_config_fix_interval(const nmea_config_t* config, char* command, size_t size);
+size_t nmea_config_baud_rate(const nmea_config_t* config, char* command, size_t size);
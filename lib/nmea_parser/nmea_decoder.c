@@ -0,0 +1,535 @@
+// Copyright 2015-2018 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "nmea_decoder.h"
+#include <string.h>
+
+#define NMEA_MAX_MANTISSA 100000000 /// 9 significant digits, further decimals are dropped
+#define NMEA_MAX_ITEMS 32 /// items behind the address, further ones are not parsed
+#define NMEA_INVALID_ITEMS 0xff
+
+static const float decimal_scale[] = { 1e-0f, 1e-1f, 1e-2f, 1e-3f, 1e-4f, 1e-5f, 1e-6f, 1e-7f, 1e-8f, 1e-9f };
+
+static inline bool is_digit(char c)
+{
+    return (uint8_t)(c - '0') < 10;
+}
+
+/**
+ * @brief Digits of a decimal number as integer
+ *
+ * @param field text of the number
+ * @param decimals number of digits behind the point that are in the result
+ * @return uint32_t value * 10^decimals
+ */
+static inline uint32_t parse_mantissa(nmea_field_t field, uint8_t* decimals)
+{
+    const char* p = field.text;
+    const char* end = p + field.length;
+    uint32_t value = 0;
+    for (; p < end && is_digit(*p); p++)
+        value = value * 10 + (*p - '0');
+    const char* point = p;
+    if (p < end && *p == '.') {
+        for (p++; p < end && is_digit(*p) && value < NMEA_MAX_MANTISSA && p - point < (ptrdiff_t)(sizeof(decimal_scale) / sizeof(decimal_scale[0])); p++)
+            value = value * 10 + (*p - '0');
+        *decimals = p - point - 1;
+    } else {
+        *decimals = 0;
+    }
+    return value;
+}
+
+static inline uint32_t parse_uint(nmea_field_t field)
+{
+    /* most are 2 digits, satellite numbers, elevations and SNRs */
+    if (field.length == 2 && is_digit(field.text[0]) && is_digit(field.text[1]))
+        return 10 * (field.text[0] - '0') + (field.text[1] - '0');
+    uint32_t value = 0;
+    for (const char* p = field.text; p < field.text + field.length && is_digit(*p); p++)
+        value = value * 10 + (*p - '0');
+    return value;
+}
+
+static inline float parse_float(nmea_field_t field)
+{
+    bool negative = field.length && field.text[0] == '-';
+    if (negative) {
+        field.text++;
+        field.length--;
+    }
+    uint8_t decimals;
+    float value = (float)parse_mantissa(field, &decimals) * decimal_scale[decimals];
+    return negative ? -value : value;
+}
+
+/**
+ * @brief Unsigned integer, 0 if the field is empty
+ */
+uint32_t nmea_uint(nmea_field_t field)
+{
+    return parse_uint(field);
+}
+
+/**
+ * @brief Decimal number, within a bit of what strtof returns
+ */
+float nmea_float(nmea_field_t field)
+{
+    return parse_float(field);
+}
+
+bool nmea_field_starts_with(nmea_field_t field, const char* prefix)
+{
+    size_t length = strlen(prefix);
+    return field.length >= length && memcmp(field.text, prefix, length) == 0;
+}
+
+/**
+ * @brief parse latitude or longitude
+ *              format of latitude in NMEA is ddmm.sss and longitude is dddmm.sss
+ * @param field text of the item
+ * @return float Latitude or Longitude value (unit: degree)
+ */
+static float parse_lat_long(nmea_field_t field)
+{
+    nmea_field_t minutes = field;
+    uint32_t degree = 0;
+    /* the degrees are the digits before the last two in front of the point */
+    for (; minutes.length > 2 && is_digit(minutes.text[2]); minutes.text++, minutes.length--)
+        degree = degree * 10 + (minutes.text[0] - '0');
+    return degree + parse_float(minutes) * (1.0f / 60);
+}
+
+/**
+ * @brief Converter two continuous numeric character into a uint8_t number
+ *
+ * @param digit_char numeric character
+ * @return uint8_t result of converting
+ */
+static inline uint8_t convert_two_digit2number(const char* digit_char)
+{
+    return 10 * (digit_char[0] - '0') + (digit_char[1] - '0');
+}
+
+/**
+ * @brief Parse UTC time in GPS statements
+ *
+ * @param tim time to set
+ * @param item hhmmss.sss
+ */
+static void parse_utc_time(gps_time_t* tim, nmea_field_t item)
+{
+    if (item.length < 6)
+        return;
+    tim->hour = convert_two_digit2number(item.text + 0);
+    tim->minute = convert_two_digit2number(item.text + 2);
+    tim->second = convert_two_digit2number(item.text + 4);
+    if (item.length > 6 && item.text[6] == '.') {
+        nmea_field_t fraction = { item.text + 7, item.length - 7 };
+        tim->thousand = parse_uint(fraction);
+    }
+}
+
+static inline bool is_south_or_west(nmea_field_t item)
+{
+    char c = item.length ? item.text[0] | 0x20 : 0;
+    return c == 's' || c == 'w';
+}
+
+static inline bool is_valid(nmea_field_t item)
+{
+    return item.length && item.text[0] == 'A';
+}
+
+/* latitude and longitude in 4 items, ddmm.mmmm,N,dddmm.mmmm,E */
+static void parse_position(gps_t* gps, const nmea_field_t* item)
+{
+    gps->latitude = parse_lat_long(item[0]);
+    if (is_south_or_west(item[1]))
+        gps->latitude *= -1;
+    gps->longitude = parse_lat_long(item[2]);
+    if (is_south_or_west(item[3]))
+        gps->longitude *= -1;
+}
+
+#if CONFIG_NMEA_STATEMENT_GGA
+/**
+ * @brief Parse GGA statements
+ *
+ * @param decoder nmea_decoder_t type object
+ * @param item items of the statement, the address is item 0
+ * @param items number of items behind the address
+ */
+static void parse_gga(nmea_decoder_t* decoder, const nmea_field_t* item, uint8_t items)
+{
+    gps_t* gps = &decoder->parent;
+    parse_utc_time(&gps->tim, item[1]);
+    parse_position(gps, item + 2);
+    gps->fix = (gps_fix_t)parse_uint(item[6]);
+    gps->sats_in_use = (uint8_t)parse_uint(item[7]);
+    gps->dop_h = parse_float(item[8]);
+    /* Altitude above ellipsoid */
+    gps->altitude = parse_float(item[9]) + parse_float(item[11]);
+}
+#endif
+
+#if CONFIG_NMEA_STATEMENT_GSA
+/**
+ * @brief Parse GSA statements
+ *
+ * @param decoder nmea_decoder_t type object
+ * @param item items of the statement, the address is item 0
+ * @param items number of items behind the address
+ */
+static void parse_gsa(nmea_decoder_t* decoder, const nmea_field_t* item, uint8_t items)
+{
+    gps_t* gps = &decoder->parent;
+    gps->fix_mode = (gps_fix_mode_t)parse_uint(item[2]);
+    /* Parse satellite IDs */
+    for (uint8_t i = 0; i < GPS_MAX_SATELLITES_IN_USE; i++)
+        gps->sats_id_in_use[i] = (uint8_t)parse_uint(item[3 + i]);
+    gps->dop_p = parse_float(item[15]);
+    gps->dop_h = parse_float(item[16]);
+    gps->dop_v = parse_float(item[17]);
+}
+#endif
+
+#if CONFIG_NMEA_STATEMENT_GSV
+/**
+ * @brief Parse GSV statements
+ *
+ * @param decoder nmea_decoder_t type object
+ * @param item items of the statement, the address is item 0
+ * @param items number of items behind the address
+ */
+static void parse_gsv(nmea_decoder_t* decoder, const nmea_field_t* item, uint8_t items)
+{
+    gps_t* gps = &decoder->parent;
+    decoder->sat_count = (uint8_t)parse_uint(item[1]); /* total GSV numbers */
+    decoder->sat_num = (uint8_t)parse_uint(item[2]);   /* Current GSV statement number */
+    gps->sats_in_view = (uint8_t)parse_uint(item[3]);
+    /* up to 4 satellites with 4 items each */
+    for (uint8_t i = 4; i + 3 <= items && i < 20; i += 4) {
+        uint8_t index = 4 * (decoder->sat_num - 1) + (i - 4) / 4;
+        if (index >= GPS_MAX_SATELLITES_IN_VIEW)
+            break;
+        gps_satellite_t* sat = &gps->sats_desc_in_view[index];
+        sat->num = (uint8_t)parse_uint(item[i]);
+        sat->elevation = (uint8_t)parse_uint(item[i + 1]);
+        sat->azimuth = (uint16_t)parse_uint(item[i + 2]);
+        sat->snr = (uint8_t)parse_uint(item[i + 3]);
+    }
+}
+#endif
+
+#if CONFIG_NMEA_STATEMENT_RMC
+/**
+ * @brief Parse RMC statements
+ *
+ * @param decoder nmea_decoder_t type object
+ * @param item items of the statement, the address is item 0
+ * @param items number of items behind the address
+ */
+static void parse_rmc(nmea_decoder_t* decoder, const nmea_field_t* item, uint8_t items)
+{
+    gps_t* gps = &decoder->parent;
+    parse_utc_time(&gps->tim, item[1]);
+    gps->valid = is_valid(item[2]);
+    parse_position(gps, item + 3);
+    gps->speed = parse_float(item[7]) * 1.852f;
+    gps->cog = parse_float(item[8]);
+    if (item[9].length >= 6) {
+        gps->date.day = convert_two_digit2number(item[9].text + 0);
+        gps->date.month = convert_two_digit2number(item[9].text + 2);
+        gps->date.year = convert_two_digit2number(item[9].text + 4);
+    }
+    gps->variation = parse_float(item[10]);
+}
+#endif
+
+#if CONFIG_NMEA_STATEMENT_GLL
+/**
+ * @brief Parse GLL statements
+ *
+ * @param decoder nmea_decoder_t type object
+ * @param item items of the statement, the address is item 0
+ * @param items number of items behind the address
+ */
+static void parse_gll(nmea_decoder_t* decoder, const nmea_field_t* item, uint8_t items)
+{
+    gps_t* gps = &decoder->parent;
+    parse_position(gps, item + 1);
+    parse_utc_time(&gps->tim, item[5]);
+    gps->valid = is_valid(item[6]);
+}
+#endif
+
+#if CONFIG_NMEA_STATEMENT_VTG
+/**
+ * @brief Parse VTG statements
+ *
+ * @param decoder nmea_decoder_t type object
+ * @param item items of the statement, the address is item 0
+ * @param items number of items behind the address
+ */
+static void parse_vtg(nmea_decoder_t* decoder, const nmea_field_t* item, uint8_t items)
+{
+    gps_t* gps = &decoder->parent;
+    gps->cog = parse_float(item[1]);
+    gps->variation = parse_float(item[3]);
+    gps->speed = parse_float(item[7]) / 3.6f; /* km/h to m/s */
+}
+#endif
+
+/* sentences by the hash of their 3 letter code, it has no collisions for these */
+#define NMEA_CODE_HASH(a, b, c) ((((a) ^ ((b) << 1) ^ (c)) & 0x0f))
+
+typedef struct {
+    char code[3];
+    uint8_t statement;
+    uint8_t items; /* the parser reads up to this item */
+    void (*parse)(nmea_decoder_t* decoder, const nmea_field_t* item, uint8_t items);
+} nmea_sentence_t;
+
+static const nmea_sentence_t sentences[16] = {
+#if CONFIG_NMEA_STATEMENT_GGA
+    [NMEA_CODE_HASH('G', 'G', 'A')] = { "GGA", STATEMENT_GGA, 11, parse_gga },
+#endif
+#if CONFIG_NMEA_STATEMENT_GSA
+    [NMEA_CODE_HASH('G', 'S', 'A')] = { "GSA", STATEMENT_GSA, 17, parse_gsa },
+#endif
+#if CONFIG_NMEA_STATEMENT_RMC
+    [NMEA_CODE_HASH('R', 'M', 'C')] = { "RMC", STATEMENT_RMC, 10, parse_rmc },
+#endif
+#if CONFIG_NMEA_STATEMENT_GSV
+    [NMEA_CODE_HASH('G', 'S', 'V')] = { "GSV", STATEMENT_GSV, 3, parse_gsv },
+#endif
+#if CONFIG_NMEA_STATEMENT_GLL
+    [NMEA_CODE_HASH('G', 'L', 'L')] = { "GLL", STATEMENT_GLL, 6, parse_gll },
+#endif
+#if CONFIG_NMEA_STATEMENT_VTG
+    [NMEA_CODE_HASH('V', 'T', 'G')] = { "VTG", STATEMENT_VTG, 7, parse_vtg },
+#endif
+};
+
+static const nmea_sentence_t* lookup_sentence(const nmea_field_t* address)
+{
+    if (address->length != 5)
+        return NULL;
+    const char* code = address->text + 2;
+    const nmea_sentence_t* s = &sentences[NMEA_CODE_HASH(code[0], code[1], code[2])];
+    if (!s->parse || memcmp(s->code, code, 3) != 0)
+        return NULL;
+    return s;
+}
+
+/**
+ * @brief Statements the decoder was built with, every fix has all of them
+ *
+ * @return uint32_t mask of 1 << STATEMENT_*
+ */
+uint32_t nmea_decoder_statements(void)
+{
+    uint32_t statements = 0;
+    for (uint8_t i = 0; i < sizeof(sentences) / sizeof(sentences[0]); i++)
+        if (sentences[i].parse)
+            statements |= 1 << sentences[i].statement;
+    return statements;
+}
+
+/* proprietary sentences start with P */
+static uint8_t detect_plugin(nmea_decoder_t* decoder)
+{
+    if (!decoder->plugins || !decoder->address.length || decoder->address.text[0] != 'P')
+        return STATEMENT_UNKNOWN;
+    for (uint8_t i = 0; i < GPS_MAX_PARSER_PLUGINS; i++)
+        if (decoder->plugins[i].detect && decoder->plugins[i].detect(decoder) == ESP_OK)
+            return STATEMENT_PLUGIN + i;
+    return STATEMENT_UNKNOWN;
+}
+
+static inline int8_t hex_digit(char c)
+{
+    if (is_digit(c))
+        return c - '0';
+    c |= 0x20;
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
+}
+
+/* a machine word with every byte set to b */
+#define NMEA_WORD_BYTES(b) ((size_t)-1 / 0xff * (b))
+
+/* 0x80 in every byte of the word that is 0 */
+static inline size_t zero_bytes(size_t word)
+{
+    return ~(((word & NMEA_WORD_BYTES(0x7f)) + NMEA_WORD_BYTES(0x7f)) | word | NMEA_WORD_BYTES(0x7f));
+}
+
+/**
+ * @brief Split a sentence into its items and verify the checksum
+ *
+ * A machine word of characters is XOR'd and searched for commas at once,
+ * the line is in little endian order in the word like on the ESP32.
+ *
+ * @param start first character behind the '$'
+ * @param end end of the line
+ * @param item the address and up to NMEA_MAX_ITEMS items behind it
+ * @return uint8_t number of items behind the address, NMEA_INVALID_ITEMS if the checksum is missing or wrong
+ */
+static uint8_t split_sentence(const char* start, const char* end, nmea_field_t* item)
+{
+    /* the checksum is at the end, "*hh\r\n" */
+    const char* star = end;
+    while (star > start && star[-1] != '*')
+        star--;
+    if (star == start || end - star < 2)
+        return NMEA_INVALID_ITEMS;
+    star--;
+
+    size_t crc = 0;
+    uint8_t count = 0;
+    const char* p = start;
+    item[0].text = start;
+    for (; star - p >= (ptrdiff_t)sizeof(size_t); p += sizeof(size_t)) {
+        size_t word;
+        memcpy(&word, p, sizeof(word));
+        crc ^= word;
+        for (size_t found = zero_bytes(word ^ NMEA_WORD_BYTES(',')); found && count < NMEA_MAX_ITEMS; found &= found - 1) {
+            const char* comma = p + (__builtin_ctzll(found) >> 3);
+            item[count].length = comma - item[count].text;
+            item[++count].text = comma + 1;
+        }
+    }
+    for (; p < star; p++) {
+        crc ^= (uint8_t)*p;
+        if (*p == ',' && count < NMEA_MAX_ITEMS) {
+            item[count].length = p - item[count].text;
+            item[++count].text = p + 1;
+        }
+    }
+    item[count].length = star - item[count].text;
+    for (uint8_t shift = sizeof(crc) * 4; shift >= 8; shift /= 2)
+        crc ^= crc >> shift;
+
+    int8_t high = hex_digit(star[1]), low = hex_digit(star[2]);
+    if (high < 0 || low < 0 || ((high << 4) | low) != (crc & 0xff))
+        return NMEA_INVALID_ITEMS;
+    return count;
+}
+
+/**
+ * @brief Set the statements that make up a complete fix
+ *
+ * @param decoder nmea_decoder_t type object
+ * @param all_statements mask of 1 << STATEMENT_*
+ * @param plugins GPS_MAX_PARSER_PLUGINS plugins or NULL
+ */
+void nmea_decoder_init(nmea_decoder_t* decoder, uint32_t all_statements, const nmea_parser_plugin_t* plugins)
+{
+    memset(decoder, 0, sizeof(nmea_decoder_t));
+    decoder->all_statements = all_statements;
+    decoder->pending_statements = all_statements;
+    decoder->plugins = plugins;
+}
+
+/**
+ * @brief The receiver was asked to output other statements
+ *
+ * Until it acknowledged them a fix is complete with the statements that are
+ * sent before and after the change.
+ *
+ * @param decoder nmea_decoder_t type object
+ * @param statements mask of 1 << STATEMENT_*
+ */
+void nmea_decoder_expect(nmea_decoder_t* decoder, uint32_t statements)
+{
+    decoder->pending_statements = statements & nmea_decoder_statements();
+    if (decoder->all_statements & decoder->pending_statements)
+        decoder->all_statements &= decoder->pending_statements;
+    else
+        decoder->all_statements = decoder->pending_statements;
+    decoder->parsed_statement = 0;
+}
+
+/**
+ * @brief The receiver acknowledged the output of the expected statements
+ *
+ * @param decoder nmea_decoder_t type object
+ */
+void nmea_decoder_confirm(nmea_decoder_t* decoder)
+{
+    decoder->all_statements = decoder->pending_statements;
+    decoder->parsed_statement = 0;
+}
+
+/**
+ * @brief Decode one line from the GPS receiver
+ *
+ * The line does not have to be terminated, the items the parsers get point
+ * into it.
+ *
+ * @param decoder nmea_decoder_t type object
+ * @param line received line
+ * @param length number of bytes of the line
+ * @return nmea_result_t NMEA_UPDATE once every statement of a fix has been parsed
+ */
+nmea_result_t nmea_decode(nmea_decoder_t* decoder, const char* line, size_t length)
+{
+    nmea_field_t item[NMEA_MAX_ITEMS + 1];
+    const char* start = memchr(line, '$', length);
+    if (!start)
+        return NMEA_INVALID;
+    start++;
+    uint8_t items = split_sentence(start, line + length, item);
+    if (items == NMEA_INVALID_ITEMS)
+        return NMEA_INVALID;
+
+    /* Reset runtime information */
+    decoder->address = item[0];
+    decoder->item = item[0];
+    decoder->item_num = 0;
+    decoder->sat_count = 0;
+    decoder->sat_num = 0;
+
+    const nmea_sentence_t* sentence = lookup_sentence(&decoder->address);
+    if (sentence) {
+        if (items < sentence->items)
+            return NMEA_INVALID;
+        decoder->cur_statement = sentence->statement;
+        sentence->parse(decoder, item, items);
+    } else {
+        decoder->cur_statement = detect_plugin(decoder);
+        if (decoder->cur_statement == STATEMENT_UNKNOWN)
+            return NMEA_UNKNOWN;
+        /* plugins get one item after the other */
+        const nmea_parser_plugin_t* plugin = &decoder->plugins[decoder->cur_statement - STATEMENT_PLUGIN];
+        for (decoder->item_num = 1; decoder->item_num <= items; decoder->item_num++) {
+            decoder->item = item[decoder->item_num];
+            plugin->parse(decoder);
+        }
+        return NMEA_PARSED;
+    }
+
+    if (decoder->cur_statement != STATEMENT_GSV || decoder->sat_num == decoder->sat_count)
+        decoder->parsed_statement |= 1 << decoder->cur_statement;
+    /* Check if all statements have been parsed */
+    if ((decoder->parsed_statement & decoder->all_statements) == decoder->all_statements) {
+        decoder->parsed_statement = 0;
+        return NMEA_UPDATE;
+    }
+    return NMEA_PARSED;
+}
@@ -0,0 +1,219 @@
+// Copyright 2015-2018 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * NMEA sentence decoder
+ *
+ * Decodes one line where it is: the checksum is verified first, the
+ * sentence is dispatched on its 3 letter code through a table and the
+ * fields are parsed as fixed point numbers straight from the line. It does
+ * not depend on the UART driver or the event loop.
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(TESTING) || defined(LINUX)
+typedef int esp_err_t;
+#    define ESP_OK 0
+#    define ESP_FAIL -1
+#    define ESP_ERR_INVALID_ARG 0x102
+#    define ESP_ERR_INVALID_STATE 0x103
+#    define ESP_ERR_NOT_FOUND 0x105
+#    define ESP_ERR_NOT_SUPPORTED 0x106
+#    define ESP_ERR_TIMEOUT 0x107
+#    define ESP_ERR_NOT_FINISHED 0x10C
+#else
+#    include "esp_err.h"
+#endif
+
+#define GPS_MAX_SATELLITES_IN_USE (12)
+#define GPS_MAX_SATELLITES_IN_VIEW (16)
+
+#ifndef GPS_MAX_PARSER_PLUGINS
+#    define GPS_MAX_PARSER_PLUGINS (2)
+#endif
+
+/**
+ * @brief GPS fix type
+ *
+ */
+typedef enum {
+    GPS_FIX_INVALID, /*!< Not fixed */
+    GPS_FIX_GPS,     /*!< GPS */
+    GPS_FIX_DGPS,    /*!< Differential GPS */
+    GPS_FIX_DR = 6,  /*!< Dead Reckoning, valid fix */
+} gps_fix_t;
+
+/**
+ * @brief GPS fix mode
+ *
+ */
+typedef enum {
+    GPS_MODE_INVALID = 1, /*!< Not fixed */
+    GPS_MODE_2D,          /*!< 2D GPS */
+    GPS_MODE_3D           /*!< 3D GPS */
+} gps_fix_mode_t;
+
+/**
+ * @brief GPS satellite information
+ *
+ */
+typedef struct
+{
+    uint8_t num;       /*!< Satellite number */
+    uint8_t elevation; /*!< Satellite elevation */
+    uint16_t azimuth;  /*!< Satellite azimuth */
+    uint8_t snr;       /*!< Satellite signal noise ratio */
+} gps_satellite_t;
+
+/**
+ * @brief GPS time
+ *
+ */
+typedef struct
+{
+    uint8_t hour;      /*!< Hour */
+    uint8_t minute;    /*!< Minute */
+    uint8_t second;    /*!< Second */
+    uint16_t thousand; /*!< Thousand */
+} gps_time_t;
+
+/**
+ * @brief GPS date
+ *
+ */
+typedef struct
+{
+    uint8_t day;   /*!< Day (start from 1) */
+    uint8_t month; /*!< Month (start from 1) */
+    uint16_t year; /*!< Year (start from 2000) */
+} gps_date_t;
+
+/**
+ * @brief NMEA Statement
+ *
+ */
+typedef enum {
+    STATEMENT_UNKNOWN = 0, /*!< Unknown statement */
+    STATEMENT_GGA,         /*!< GGA */
+    STATEMENT_GSA,         /*!< GSA */
+    STATEMENT_RMC,         /*!< RMC */
+    STATEMENT_GSV,         /*!< GSV */
+    STATEMENT_GLL,         /*!< GLL */
+    STATEMENT_VTG,         /*!< VTG */
+    STATEMENT_PLUGIN,      /*!< Parse in plugin */
+    /* -- do not add after the STATEMENT_PLUGIN element -- */
+} nmea_statement_t;
+
+/**
+ * @brief GPS object
+ *
+ */
+typedef struct
+{
+    float latitude;                                                /*!< Latitude (degrees) */
+    float longitude;                                               /*!< Longitude (degrees) */
+    float altitude;                                                /*!< Altitude (meters) */
+    gps_fix_t fix;                                                 /*!< Fix status */
+    uint8_t sats_in_use;                                           /*!< Number of satellites in use */
+    gps_time_t tim;                                                /*!< time in UTC */
+    gps_fix_mode_t fix_mode;                                       /*!< Fix mode */
+    uint8_t sats_id_in_use[GPS_MAX_SATELLITES_IN_USE];             /*!< ID list of satellite in use */
+    float dop_h;                                                   /*!< Horizontal dilution of precision */
+    float dop_p;                                                   /*!< Position dilution of precision  */
+    float dop_v;                                                   /*!< Vertical dilution of precision  */
+    uint8_t sats_in_view;                                          /*!< Number of satellites in view */
+    gps_satellite_t sats_desc_in_view[GPS_MAX_SATELLITES_IN_VIEW]; /*!< Information of satellites in view */
+    gps_date_t date;                                               /*!< Fix date */
+    bool valid;                                                    /*!< GPS validity */
+    float speed;                                                   /*!< Ground speed, unit: m/s */
+    float cog;                                                     /*!< Course over ground */
+    float variation;                                               /*!< Magnetic variation */
+} gps_t;
+
+/**
+ * @brief Part of the line that is decoded, it is not terminated
+ *
+ */
+typedef struct
+{
+    const char* text;
+    size_t length;
+} nmea_field_t;
+
+typedef struct nmea_parser_plugin nmea_parser_plugin_t;
+
+/**
+ * @brief Decoder state, kept from one sentence to the next
+ *
+ */
+typedef struct
+{
+    gps_t parent;                        /*!< Parent class */
+    nmea_field_t address;                /*!< Talker and sentence, "GPGGA" or "PMTK001" */
+    nmea_field_t item;                   /*!< Current item of a plugin sentence */
+    uint8_t item_num;                    /*!< Current item number, the address is 0 */
+    uint8_t cur_statement;               /*!< Current statement ID */
+    uint8_t sat_num;                     /*!< Satellite number */
+    uint8_t sat_count;                   /*!< Satellite count */
+    uint32_t parsed_statement;           /*!< OR'd of statements that have been parsed */
+    uint32_t all_statements;             /*!< All statements mask */
+    uint32_t pending_statements;         /*!< All statements once the receiver acknowledged its new output */
+    const nmea_parser_plugin_t* plugins; /*!< GPS_MAX_PARSER_PLUGINS plugins or NULL */
+} nmea_decoder_t;
+
+/**
+ * @brief Parser plugin functions
+ *
+ * detect looks at the address of a proprietary sentence, parse is called
+ * for every item of a sentence that was detected.
+ */
+struct nmea_parser_plugin
+{
+    esp_err_t (*detect)(nmea_decoder_t* decoder);
+    esp_err_t (*parse)(nmea_decoder_t* decoder);
+};
+
+/**
+ * @brief Outcome of decoding a line
+ *
+ */
+typedef enum {
+    NMEA_PARSED,  /*!< Known sentence */
+    NMEA_UPDATE,  /*!< Known sentence, every statement of a fix has been parsed */
+    NMEA_UNKNOWN, /*!< Valid sentence nobody parses */
+    NMEA_INVALID, /*!< No sentence, wrong checksum or too few items, nothing was changed */
+} nmea_result_t;
+
+uint32_t nmea_decoder_statements(void);
+void nmea_decoder_init(nmea_decoder_t* decoder, uint32_t all_statements, const nmea_parser_plugin_t* plugins);
+nmea_result_t nmea_decode(nmea_decoder_t* decoder, const char* line, size_t length);
+void nmea_decoder_expect(nmea_decoder_t* decoder, uint32_t statements);
+void nmea_decoder_confirm(nmea_decoder_t* decoder);
+
+uint32_t nmea_uint(nmea_field_t field);
+float nmea_float(nmea_field_t field);
+bool nmea_field_starts_with(nmea_field_t field, const char* prefix);
+
+#ifdef __cplusplus
+}
+#endif
@@ -12,12 +12,13 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+/* the glue between UART, decoder and event loop, only on the device */
+#if !defined(TESTING) && !defined(LINUX)
+
 #include "nmea_parser.h"
-#include <ctype.h>
 #include <esp_log.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
-#include <math.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -30,518 +31,31 @@ ESP_EVENT_DEFINE_BASE(ESP_NMEA_EVENT);
 static const char* GPS_TAG = "nmea_parser";
 
 /**
- * @brief parse latitude or longitude
- *              format of latitude in NMEA is ddmm.sss and longitude is dddmm.sss
- * @param esp_gps esp_gps_t type object
- * @return float Latitude or Longitude value (unit: degree)
- */
-static float parse_lat_long(esp_gps_t* esp_gps)
-{
-    float ll = strtof(esp_gps->item_str, NULL);
-    int deg = ((int)ll) / 100;
-    float min = ll - (deg * 100);
-    ll = deg + min / 60.0f;
-    return ll;
-}
-
-/**
- * @brief Converter two continuous numeric character into a uint8_t number
- *
- * @param digit_char numeric character
- * @return uint8_t result of converting
- */
-static inline uint8_t convert_two_digit2number(const char* digit_char)
-{
-    return 10 * (digit_char[0] - '0') + (digit_char[1] - '0');
-}
-
-/**
- * @brief Parse UTC time in GPS statements
- *
- * @param esp_gps esp_gps_t type object
- */
-static void parse_utc_time(esp_gps_t* esp_gps)
-{
-    esp_gps->parent.tim.hour = convert_two_digit2number(esp_gps->item_str + 0);
-    esp_gps->parent.tim.minute = convert_two_digit2number(esp_gps->item_str + 2);
-    esp_gps->parent.tim.second = convert_two_digit2number(esp_gps->item_str + 4);
-    if (esp_gps->item_str[6] == '.') {
-        uint16_t tmp = 0;
-        uint8_t i = 7;
-        while (esp_gps->item_str[i]) {
-            tmp = 10 * tmp + esp_gps->item_str[i] - '0';
-            i++;
-        }
-        esp_gps->parent.tim.thousand = tmp;
-    }
-}
-
-#if CONFIG_NMEA_STATEMENT_GGA
-/**
- * @brief Parse GGA statements
- *
- * @param esp_gps esp_gps_t type object
- */
-static void parse_gga(esp_gps_t* esp_gps)
-{
-    /* Process GGA statement */
-    switch (esp_gps->item_num) {
-    case 1: /* Process UTC time */
-        parse_utc_time(esp_gps);
-        break;
-    case 2: /* Latitude */
-        esp_gps->parent.latitude = parse_lat_long(esp_gps);
-        break;
-    case 3: /* Latitude north(1)/south(-1) information */
-        if (esp_gps->item_str[0] == 'S' || esp_gps->item_str[0] == 's') {
-            esp_gps->parent.latitude *= -1;
-        }
-        break;
-    case 4: /* Longitude */
-        esp_gps->parent.longitude = parse_lat_long(esp_gps);
-        break;
-    case 5: /* Longitude east(1)/west(-1) information */
-        if (esp_gps->item_str[0] == 'W' || esp_gps->item_str[0] == 'w') {
-            esp_gps->parent.longitude *= -1;
-        }
-        break;
-    case 6: /* Fix status */
-        esp_gps->parent.fix = (gps_fix_t)strtol(esp_gps->item_str, NULL, 10);
-        break;
-    case 7: /* Satellites in use */
-        esp_gps->parent.sats_in_use = (uint8_t)strtol(esp_gps->item_str, NULL, 10);
-        break;
-    case 8: /* HDOP */
-        esp_gps->parent.dop_h = strtof(esp_gps->item_str, NULL);
-        break;
-    case 9: /* Altitude */
-        esp_gps->parent.altitude = strtof(esp_gps->item_str, NULL);
-        break;
-    case 11: /* Altitude above ellipsoid */
-        esp_gps->parent.altitude += strtof(esp_gps->item_str, NULL);
-        break;
-    default:
-        break;
-    }
-}
-#endif
-
-#if CONFIG_NMEA_STATEMENT_GSA
-/**
- * @brief Parse GSA statements
- *
- * @param esp_gps esp_gps_t type object
- */
-static void parse_gsa(esp_gps_t* esp_gps)
-{
-    /* Process GSA statement */
-    switch (esp_gps->item_num) {
-    case 2: /* Process fix mode */
-        esp_gps->parent.fix_mode = (gps_fix_mode_t)strtol(esp_gps->item_str, NULL, 10);
-        break;
-    case 15: /* Process PDOP */
-        esp_gps->parent.dop_p = strtof(esp_gps->item_str, NULL);
-        break;
-    case 16: /* Process HDOP */
-        esp_gps->parent.dop_h = strtof(esp_gps->item_str, NULL);
-        break;
-    case 17: /* Process VDOP */
-        esp_gps->parent.dop_v = strtof(esp_gps->item_str, NULL);
-        break;
-    default:
-        /* Parse satellite IDs */
-        if (esp_gps->item_num >= 3 && esp_gps->item_num <= 14) {
-            esp_gps->parent.sats_id_in_use[esp_gps->item_num - 3] = (uint8_t)strtol(esp_gps->item_str, NULL, 10);
-        }
-        break;
-    }
-}
-#endif
-
-#if CONFIG_NMEA_STATEMENT_GSV
-/**
- * @brief Parse GSV statements
- *
- * @param esp_gps esp_gps_t type object
- */
-static void parse_gsv(esp_gps_t* esp_gps)
-{
-    /* Process GSV statement */
-    switch (esp_gps->item_num) {
-    case 1: /* total GSV numbers */
-        esp_gps->sat_count = (uint8_t)strtol(esp_gps->item_str, NULL, 10);
-        break;
-    case 2: /* Current GSV statement number */
-        esp_gps->sat_num = (uint8_t)strtol(esp_gps->item_str, NULL, 10);
-        break;
-    case 3: /* Process satellites in view */
-        esp_gps->parent.sats_in_view = (uint8_t)strtol(esp_gps->item_str, NULL, 10);
-        break;
-    default:
-        if (esp_gps->item_num >= 4 && esp_gps->item_num <= 19) {
-            uint8_t item_num = esp_gps->item_num - 4; /* Normalize item number from 4-19 to 0-15 */
-            uint8_t index;
-            index = 4 * (esp_gps->sat_num - 1) + item_num / 4; /* Get array index */
-            if (index < GPS_MAX_SATELLITES_IN_VIEW) {
-                uint32_t value;
-                value = strtol(esp_gps->item_str, NULL, 10);
-                switch (item_num % 4) {
-                case 0:
-                    esp_gps->parent.sats_desc_in_view[index].num = (uint8_t)value;
-                    break;
-                case 1:
-                    esp_gps->parent.sats_desc_in_view[index].elevation = (uint8_t)value;
-                    break;
-                case 2:
-                    esp_gps->parent.sats_desc_in_view[index].azimuth = (uint16_t)value;
-                    break;
-                case 3:
-                    esp_gps->parent.sats_desc_in_view[index].snr = (uint8_t)value;
-                    break;
-                default:
-                    break;
-                }
-            }
-        }
-        break;
-    }
-}
-#endif
-
-#if CONFIG_NMEA_STATEMENT_RMC
-/**
- * @brief Parse RMC statements
- *
- * @param esp_gps esp_gps_t type object
- */
-static void parse_rmc(esp_gps_t* esp_gps)
-{
-    /* Process GPRMC statement */
-    switch (esp_gps->item_num) {
-    case 1: /* Process UTC time */
-        parse_utc_time(esp_gps);
-        break;
-    case 2: /* Process valid status */
-        esp_gps->parent.valid = (esp_gps->item_str[0] == 'A');
-        break;
-    case 3: /* Latitude */
-        esp_gps->parent.latitude = parse_lat_long(esp_gps);
-        break;
-    case 4: /* Latitude north(1)/south(-1) information */
-        if (esp_gps->item_str[0] == 'S' || esp_gps->item_str[0] == 's') {
-            esp_gps->parent.latitude *= -1;
-        }
-        break;
-    case 5: /* Longitude */
-        esp_gps->parent.longitude = parse_lat_long(esp_gps);
-        break;
-    case 6: /* Longitude east(1)/west(-1) information */
-        if (esp_gps->item_str[0] == 'W' || esp_gps->item_str[0] == 'w') {
-            esp_gps->parent.longitude *= -1;
-        }
-        break;
-    case 7: /* Process ground speed in unit m/s */
-        esp_gps->parent.speed = strtof(esp_gps->item_str, NULL) * 1.852;
-        break;
-    case 8: /* Process true course over ground */
-        esp_gps->parent.cog = strtof(esp_gps->item_str, NULL);
-        break;
-    case 9: /* Process date */
-        esp_gps->parent.date.day = convert_two_digit2number(esp_gps->item_str + 0);
-        esp_gps->parent.date.month = convert_two_digit2number(esp_gps->item_str + 2);
-        esp_gps->parent.date.year = convert_two_digit2number(esp_gps->item_str + 4);
-        break;
-    case 10: /* Process magnetic variation */
-        esp_gps->parent.variation = strtof(esp_gps->item_str, NULL);
-        break;
-    default:
-        break;
-    }
-}
-#endif
-
-#if CONFIG_NMEA_STATEMENT_GLL
-/**
- * @brief Parse GLL statements
- *
- * @param esp_gps esp_gps_t type object
- */
-static void parse_gll(esp_gps_t* esp_gps)
-{
-    /* Process GPGLL statement */
-    switch (esp_gps->item_num) {
-    case 1: /* Latitude */
-        esp_gps->parent.latitude = parse_lat_long(esp_gps);
-        break;
-    case 2: /* Latitude north(1)/south(-1) information */
-        if (esp_gps->item_str[0] == 'S' || esp_gps->item_str[0] == 's') {
-            esp_gps->parent.latitude *= -1;
-        }
-        break;
-    case 3: /* Longitude */
-        esp_gps->parent.longitude = parse_lat_long(esp_gps);
-        break;
-    case 4: /* Longitude east(1)/west(-1) information */
-        if (esp_gps->item_str[0] == 'W' || esp_gps->item_str[0] == 'w') {
-            esp_gps->parent.longitude *= -1;
-        }
-        break;
-    case 5: /* Process UTC time */
-        parse_utc_time(esp_gps);
-        break;
-    case 6: /* Process valid status */
-        esp_gps->parent.valid = (esp_gps->item_str[0] == 'A');
-        break;
-    default:
-        break;
-    }
-}
-#endif
-
-#if CONFIG_NMEA_STATEMENT_VTG
-/**
- * @brief Parse VTG statements
+ * @brief Parse NMEA statements from GPS receiver
  *
  * @param esp_gps esp_gps_t type object
+ * @param len number of bytes to decode
+ * @return esp_err_t ESP_OK on success, ESP_FAIL on error
  */
-static void parse_vtg(esp_gps_t* esp_gps)
+static esp_err_t gps_decode(esp_gps_t* esp_gps, size_t len)
 {
-    /* Process GPVGT statement */
-    switch (esp_gps->item_num) {
-    case 1: /* Process true course over ground */
-        esp_gps->parent.cog = strtof(esp_gps->item_str, NULL);
-        break;
-    case 3: /* Process magnetic variation */
-        esp_gps->parent.variation = strtof(esp_gps->item_str, NULL);
+    switch (nmea_decode(&esp_gps->decoder, (const char*)esp_gps->buffer, len)) {
+    case NMEA_UPDATE:
+        /* Send signal to notify that GPS information has been updated */
+        esp_event_post_to(esp_gps->event_loop_hdl, ESP_NMEA_EVENT, GPS_UPDATE,
+            &(esp_gps->decoder.parent), sizeof(gps_t), 100 / portTICK_PERIOD_MS);
         break;
-    case 5:                                                              /* Process ground speed in unit m/s */
-        esp_gps->parent.speed = strtof(esp_gps->item_str, NULL) * 1.852; // knots to m/s
+    case NMEA_UNKNOWN:
+        /* Send signal to notify that one unknown statement has been met */
+        esp_event_post_to(esp_gps->event_loop_hdl, ESP_NMEA_EVENT, GPS_UNKNOWN,
+            esp_gps->buffer, len + 1, 100 / portTICK_PERIOD_MS);
         break;
-    case 7:                                                            /* Process ground speed in unit m/s */
-        esp_gps->parent.speed = strtof(esp_gps->item_str, NULL) / 3.6; // km/h to m/s
+    case NMEA_INVALID:
+        ESP_LOGD(GPS_TAG, "Invalid statement:%s", esp_gps->buffer);
         break;
     default:
         break;
     }
-}
-#endif
-
-/**
- * @brief Parse received item
- *
- * @param esp_gps esp_gps_t type object
- * @return esp_err_t ESP_OK on success, ESP_FAIL on error
- */
-static esp_err_t parse_item(esp_gps_t* esp_gps)
-{
-    esp_err_t err = ESP_OK;
-    /* start of a statement */
-    if (esp_gps->item_num == 0 && esp_gps->item_str[0] == '$') {
-        if (0) {
-        }
-#if CONFIG_NMEA_STATEMENT_GGA
-        else if (strstr(esp_gps->item_str, "GGA")) {
-            esp_gps->cur_statement = STATEMENT_GGA;
-        }
-#endif
-#if CONFIG_NMEA_STATEMENT_GSA
-        else if (strstr(esp_gps->item_str, "GSA")) {
-            esp_gps->cur_statement = STATEMENT_GSA;
-        }
-#endif
-#if CONFIG_NMEA_STATEMENT_RMC
-        else if (strstr(esp_gps->item_str, "RMC")) {
-            esp_gps->cur_statement = STATEMENT_RMC;
-        }
-#endif
-#if CONFIG_NMEA_STATEMENT_GSV
-        else if (strstr(esp_gps->item_str, "GSV")) {
-            esp_gps->cur_statement = STATEMENT_GSV;
-        }
-#endif
-#if CONFIG_NMEA_STATEMENT_GLL
-        else if (strstr(esp_gps->item_str, "GLL")) {
-            esp_gps->cur_statement = STATEMENT_GLL;
-        }
-#endif
-#if CONFIG_NMEA_STATEMENT_VTG
-        else if (strstr(esp_gps->item_str, "VTG")) {
-            esp_gps->cur_statement = STATEMENT_VTG;
-        }
-#endif
-        else {
-            esp_gps->cur_statement = STATEMENT_UNKNOWN;
-            for (uint8_t i = 0; i < GPS_MAX_PARSER_PLUGINS; i++)
-                if (esp_gps->plugins != NULL && esp_gps->plugins[i].detect) {
-                    if (ESP_OK == esp_gps->plugins[i].detect(esp_gps)) {
-                        esp_gps->cur_statement = STATEMENT_PLUGIN + i;
-                    }
-                }
-        }
-        goto out;
-    }
-    /* Parse each item, depend on the type of the statement */
-    if (esp_gps->cur_statement == STATEMENT_UNKNOWN) {
-        goto out;
-    }
-#if CONFIG_NMEA_STATEMENT_GGA
-    else if (esp_gps->cur_statement == STATEMENT_GGA) {
-        parse_gga(esp_gps);
-    }
-#endif
-#if CONFIG_NMEA_STATEMENT_GSA
-    else if (esp_gps->cur_statement == STATEMENT_GSA) {
-        parse_gsa(esp_gps);
-    }
-#endif
-#if CONFIG_NMEA_STATEMENT_GSV
-    else if (esp_gps->cur_statement == STATEMENT_GSV) {
-        parse_gsv(esp_gps);
-    }
-#endif
-#if CONFIG_NMEA_STATEMENT_RMC
-    else if (esp_gps->cur_statement == STATEMENT_RMC) {
-        parse_rmc(esp_gps);
-    }
-#endif
-#if CONFIG_NMEA_STATEMENT_GLL
-    else if (esp_gps->cur_statement == STATEMENT_GLL) {
-        parse_gll(esp_gps);
-    }
-#endif
-#if CONFIG_NMEA_STATEMENT_VTG
-    else if (esp_gps->cur_statement == STATEMENT_VTG) {
-        parse_vtg(esp_gps);
-    }
-#endif
-    else if (esp_gps->cur_statement >= STATEMENT_PLUGIN) {
-        err = esp_gps->plugins[esp_gps->cur_statement - STATEMENT_PLUGIN].parse(esp_gps);
-    }
-    else {
-        err = ESP_FAIL;
-    }
-out:
-    return err;
-}
-
-/**
- * @brief Parse NMEA statements from GPS receiver
- *
- * @param esp_gps esp_gps_t type object
- * @param len number of bytes to decode
- * @return esp_err_t ESP_OK on success, ESP_FAIL on error
- */
-static esp_err_t gps_decode(esp_gps_t* esp_gps, size_t len)
-{
-    const uint8_t* d = esp_gps->buffer;
-    while (*d) {
-        /* Start of a statement */
-        if (*d == '$') {
-            /* Reset runtime information */
-            esp_gps->asterisk = 0;
-            esp_gps->item_num = 0;
-            esp_gps->item_pos = 0;
-            esp_gps->cur_statement = 0;
-            esp_gps->crc = 0;
-            esp_gps->sat_count = 0;
-            esp_gps->sat_num = 0;
-            /* Add character to item */
-            esp_gps->item_str[esp_gps->item_pos++] = *d;
-            esp_gps->item_str[esp_gps->item_pos] = '\0';
-        }
-        /* Detect item separator character */
-        else if (*d == ',') {
-            /* Parse current item */
-            parse_item(esp_gps);
-            /* Add character to CRC computation */
-            esp_gps->crc ^= (uint8_t)(*d);
-            /* Start with next item */
-            esp_gps->item_pos = 0;
-            esp_gps->item_str[0] = '\0';
-            esp_gps->item_num++;
-        }
-        /* End of CRC computation */
-        else if (*d == '*') {
-            /* Parse current item */
-            parse_item(esp_gps);
-            /* Asterisk detected */
-            esp_gps->asterisk = 1;
-            /* Start with next item */
-            esp_gps->item_pos = 0;
-            esp_gps->item_str[0] = '\0';
-            esp_gps->item_num++;
-        }
-        /* End of statement */
-        else if (*d == '\r') {
-            /* Convert received CRC from string (hex) to number */
-            uint8_t crc = (uint8_t)strtol(esp_gps->item_str, NULL, 16);
-            /* CRC passed */
-            if (esp_gps->crc == crc) {
-                switch (esp_gps->cur_statement) {
-#if CONFIG_NMEA_STATEMENT_GGA
-                case STATEMENT_GGA:
-                    esp_gps->parsed_statement |= 1 << STATEMENT_GGA;
-                    break;
-#endif
-#if CONFIG_NMEA_STATEMENT_GSA
-                case STATEMENT_GSA:
-                    esp_gps->parsed_statement |= 1 << STATEMENT_GSA;
-                    break;
-#endif
-#if CONFIG_NMEA_STATEMENT_RMC
-                case STATEMENT_RMC:
-                    esp_gps->parsed_statement |= 1 << STATEMENT_RMC;
-                    break;
-#endif
-#if CONFIG_NMEA_STATEMENT_GSV
-                case STATEMENT_GSV:
-                    if (esp_gps->sat_num == esp_gps->sat_count) {
-                        esp_gps->parsed_statement |= 1 << STATEMENT_GSV;
-                    }
-                    break;
-#endif
-#if CONFIG_NMEA_STATEMENT_GLL
-                case STATEMENT_GLL:
-                    esp_gps->parsed_statement |= 1 << STATEMENT_GLL;
-                    break;
-#endif
-#if CONFIG_NMEA_STATEMENT_VTG
-                case STATEMENT_VTG:
-                    esp_gps->parsed_statement |= 1 << STATEMENT_VTG;
-                    break;
-#endif
-                default:
-                    break;
-                }
-                /* Check if all statements have been parsed */
-                if (((esp_gps->parsed_statement) & esp_gps->all_statements) == esp_gps->all_statements) {
-                    esp_gps->parsed_statement = 0;
-                    /* Send signal to notify that GPS information has been updated */
-                    esp_event_post_to(esp_gps->event_loop_hdl, ESP_NMEA_EVENT, GPS_UPDATE,
-                        &(esp_gps->parent), sizeof(gps_t), 100 / portTICK_PERIOD_MS);
-                }
-            } else {
-                ESP_LOGD(GPS_TAG, "CRC Error for statement:%s", esp_gps->buffer);
-            }
-            if (esp_gps->cur_statement == STATEMENT_UNKNOWN) {
-                /* Send signal to notify that one unknown statement has been met */
-                esp_event_post_to(esp_gps->event_loop_hdl, ESP_NMEA_EVENT, GPS_UNKNOWN,
-                    esp_gps->buffer, len, 100 / portTICK_PERIOD_MS);
-            }
-        }
-        /* Other non-space character */
-        else {
-            if (!(esp_gps->asterisk)) {
-                /* Add to CRC */
-                esp_gps->crc ^= (uint8_t)(*d);
-            }
-            /* Add character to item */
-            esp_gps->item_str[esp_gps->item_pos++] = *d;
-            esp_gps->item_str[esp_gps->item_pos] = '\0';
-        }
-        /* Process next character */
-        d++;
-    }
     return ESP_OK;
 }
 
@@ -559,7 +73,7 @@ static void esp_handle_uart_pattern(esp_gps_t* esp_gps)
         /* make sure the line is a standard string */
         esp_gps->buffer[read_len] = '\0';
         /* Send new line to handle */
-        if (gps_decode(esp_gps, read_len + 1) != ESP_OK) {
+        if (gps_decode(esp_gps, read_len) != ESP_OK) {
             ESP_LOGW(GPS_TAG, "GPS decode line failed");
         }
     } else {
@@ -578,7 +92,12 @@ static void nmea_parser_task_entry(void* arg)
     esp_gps_t* esp_gps = (esp_gps_t*)arg;
     uart_event_t event;
     while (1) {
-        if (xQueueReceive(esp_gps->event_queue, &event, pdMS_TO_TICKS(200))) {
+        bool received = xQueueReceive(esp_gps->event_queue, &event, pdMS_TO_TICKS(200));
+        /* before the acknowledge of the new output is decoded */
+        uint32_t statements = __atomic_exchange_n(&esp_gps->expected_statements, 0, __ATOMIC_ACQUIRE);
+        if (statements)
+            nmea_decoder_expect(&esp_gps->decoder, statements);
+        if (received) {
             switch (event.type) {
             case UART_DATA:
                 break;
@@ -633,28 +152,9 @@ nmea_parser_handle_t nmea_parser_init(const nmea_parser_config_t* config)
         ESP_LOGE(GPS_TAG, "calloc memory for runtime buffer failed");
         goto err_buffer;
     }
-#if CONFIG_NMEA_STATEMENT_GSA
-    esp_gps->all_statements
-        |= (1 << STATEMENT_GSA);
-#endif
-#if CONFIG_NMEA_STATEMENT_GSV
-    esp_gps->all_statements |= (1 << STATEMENT_GSV);
-#endif
-#if CONFIG_NMEA_STATEMENT_GGA
-    esp_gps->all_statements |= (1 << STATEMENT_GGA);
-#endif
-#if CONFIG_NMEA_STATEMENT_RMC
-    esp_gps->all_statements |= (1 << STATEMENT_RMC);
-#endif
-#if CONFIG_NMEA_STATEMENT_GLL
-    esp_gps->all_statements |= (1 << STATEMENT_GLL);
-#endif
-#if CONFIG_NMEA_STATEMENT_VTG
-    esp_gps->all_statements |= (1 << STATEMENT_VTG);
-#endif
-    /* Set attributes */
+    /* Set attributes and plugins */
+    nmea_decoder_init(&esp_gps->decoder, nmea_decoder_statements(), config->plugins);
     esp_gps->uart_port = config->uart.uart_port;
-    esp_gps->all_statements &= 0xFE;
     /* Install UART friver */
     uart_config_t uart_config = {
         .baud_rate = config->uart.baud_rate,
@@ -694,9 +194,6 @@ nmea_parser_handle_t nmea_parser_init(const nmea_parser_config_t* config)
         ESP_LOGE(GPS_TAG, "create event loop faild");
         goto err_eloop;
     }
-    /* Set plugins */
-    esp_gps->plugins = config->plugins;
-
     /* Create NMEA Parser task */
     BaseType_t err = xTaskCreate(
         nmea_parser_task_entry,
@@ -800,4 +297,46 @@ esp_err_t nmea_send_command(nmea_parser_handle_t nmea_hdl, char* cmd)
         return ESP_ERR_NO_MEM;
 
     return ESP_OK;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Configure the output of the GPS module
+ *
+ * @param nmea_hdl handle of NMEA parser
+ * @param config statements, fix interval and baud rate
+ * @return esp_err_t
+ *  - EPS_OK: Success
+ *  - ESP_ERR_NO_MEM: TX buffer not big enough for command sequence
+ *  - ESP_ERR_INVALID_STATE: Parser Task not initialized or not running
+ *  - Others: Fail
+ */
+esp_err_t nmea_parser_configure(nmea_parser_handle_t nmea_hdl, const nmea_config_t* config)
+{
+    esp_gps_t* esp_gps = (esp_gps_t*)nmea_hdl;
+    char cmd[NMEA_CONFIG_COMMAND];
+    esp_err_t err;
+
+    /* the parser task picks the statements up before the acknowledge can arrive */
+    __atomic_store_n(&esp_gps->expected_statements, nmea_config_statements(config), __ATOMIC_RELEASE);
+    if (!nmea_config_output(config, cmd, sizeof(cmd)))
+        return ESP_ERR_INVALID_ARG;
+    if ((err = nmea_send_command(nmea_hdl, cmd)) != ESP_OK)
+        return err;
+    if (!nmea_config_fix_interval(config, cmd, sizeof(cmd)))
+        return ESP_ERR_INVALID_ARG;
+    if ((err = nmea_send_command(nmea_hdl, cmd)) != ESP_OK)
+        return err;
+
+    uint32_t baud_rate;
+    if (!config->baud_rate || (uart_get_baudrate(esp_gps->uart_port, &baud_rate) == ESP_OK && baud_rate == config->baud_rate))
+        return ESP_OK;
+    if (!nmea_config_baud_rate(config, cmd, sizeof(cmd)))
+        return ESP_ERR_INVALID_ARG;
+    if ((err = nmea_send_command(nmea_hdl, cmd)) != ESP_OK)
+        return err;
+    /* the module switches as soon as it has the command */
+    uart_wait_tx_done(esp_gps->uart_port, pdMS_TO_TICKS(100));
+    return uart_set_baudrate(esp_gps->uart_port, config->baud_rate);
+}
+
+#endif
@@ -22,161 +22,37 @@ extern "C" {
 #include "esp_err.h"
 #include "esp_event.h"
 #include "esp_types.h"
-
-#define GPS_MAX_SATELLITES_IN_USE (12)
-#define GPS_MAX_SATELLITES_IN_VIEW (16)
+#include "nmea_config.h"
+#include "nmea_decoder.h"
 
 /**
  * @brief NMEA Parser runtime buffer size
  *
  */
 #define NMEA_PARSER_RUNTIME_BUFFER_SIZE (CONFIG_NMEA_PARSER_RING_BUFFER_SIZE / 2)
-#define NMEA_MAX_STATEMENT_ITEM_LENGTH (16)
 #define NMEA_EVENT_LOOP_QUEUE_SIZE (16)
 
-#ifndef GPS_MAX_PARSER_PLUGINS
-#    define GPS_MAX_PARSER_PLUGINS (2)
-#endif
-
 /**
  * @brief Declare of NMEA Parser Event base
  *
  */
 ESP_EVENT_DECLARE_BASE(ESP_NMEA_EVENT);
 
-/**
- * @brief GPS fix type
- *
- */
-typedef enum {
-    GPS_FIX_INVALID, /*!< Not fixed */
-    GPS_FIX_GPS,     /*!< GPS */
-    GPS_FIX_DGPS,    /*!< Differential GPS */
-    GPS_FIX_DR = 6,  /*!< Dead Reckoning, valid fix */
-} gps_fix_t;
-
-/**
- * @brief GPS fix mode
- *
- */
-typedef enum {
-    GPS_MODE_INVALID = 1, /*!< Not fixed */
-    GPS_MODE_2D,          /*!< 2D GPS */
-    GPS_MODE_3D           /*!< 3D GPS */
-} gps_fix_mode_t;
-
-/**
- * @brief GPS satellite information
- *
- */
-typedef struct
-{
-    uint8_t num;       /*!< Satellite number */
-    uint8_t elevation; /*!< Satellite elevation */
-    uint16_t azimuth;  /*!< Satellite azimuth */
-    uint8_t snr;       /*!< Satellite signal noise ratio */
-} gps_satellite_t;
-
-/**
- * @brief GPS time
- *
- */
-typedef struct
-{
-    uint8_t hour;      /*!< Hour */
-    uint8_t minute;    /*!< Minute */
-    uint8_t second;    /*!< Second */
-    uint16_t thousand; /*!< Thousand */
-} gps_time_t;
-
-/**
- * @brief GPS date
- *
- */
-typedef struct
-{
-    uint8_t day;   /*!< Day (start from 1) */
-    uint8_t month; /*!< Month (start from 1) */
-    uint16_t year; /*!< Year (start from 2000) */
-} gps_date_t;
-
-/**
- * @brief NMEA Statement
- *
- */
-typedef enum {
-    STATEMENT_UNKNOWN = 0, /*!< Unknown statement */
-    STATEMENT_GGA,         /*!< GGA */
-    STATEMENT_GSA,         /*!< GSA */
-    STATEMENT_RMC,         /*!< RMC */
-    STATEMENT_GSV,         /*!< GSV */
-    STATEMENT_GLL,         /*!< GLL */
-    STATEMENT_VTG,         /*!< VTG */
-    STATEMENT_PLUGIN,      /*!< Parse in plugin */
-    /* -- do not add after the STATEMENT_PLUGIN element -- */
-} nmea_statement_t;
-
-/**
- * @brief GPS object
- *
- */
-typedef struct
-{
-    float latitude;                                                /*!< Latitude (degrees) */
-    float longitude;                                               /*!< Longitude (degrees) */
-    float altitude;                                                /*!< Altitude (meters) */
-    gps_fix_t fix;                                                 /*!< Fix status */
-    uint8_t sats_in_use;                                           /*!< Number of satellites in use */
-    gps_time_t tim;                                                /*!< time in UTC */
-    gps_fix_mode_t fix_mode;                                       /*!< Fix mode */
-    uint8_t sats_id_in_use[GPS_MAX_SATELLITES_IN_USE];             /*!< ID list of satellite in use */
-    float dop_h;                                                   /*!< Horizontal dilution of precision */
-    float dop_p;                                                   /*!< Position dilution of precision  */
-    float dop_v;                                                   /*!< Vertical dilution of precision  */
-    uint8_t sats_in_view;                                          /*!< Number of satellites in view */
-    gps_satellite_t sats_desc_in_view[GPS_MAX_SATELLITES_IN_VIEW]; /*!< Information of satellites in view */
-    gps_date_t date;                                               /*!< Fix date */
-    bool valid;                                                    /*!< GPS validity */
-    float speed;                                                   /*!< Ground speed, unit: m/s */
-    float cog;                                                     /*!< Course over ground */
-    float variation;                                               /*!< Magnetic variation */
-} gps_t;
-
-typedef struct nmea_parser_plugin nmea_parser_plugin_t;
 /**
  * @brief GPS parser library runtime structure
  *
  */
 typedef struct
 {
-    uint8_t item_pos;                              /*!< Current position in item */
-    uint8_t item_num;                              /*!< Current item number */
-    uint8_t asterisk;                              /*!< Asterisk detected flag */
-    uint8_t crc;                                   /*!< Calculated CRC value */
-    uint8_t parsed_statement;                      /*!< OR'd of statements that have been parsed */
-    uint8_t sat_num;                               /*!< Satellite number */
-    uint8_t sat_count;                             /*!< Satellite count */
-    uint8_t cur_statement;                         /*!< Current statement ID */
-    uint32_t all_statements;                       /*!< All statements mask */
-    char item_str[NMEA_MAX_STATEMENT_ITEM_LENGTH]; /*!< Current item */
-    gps_t parent;                                  /*!< Parent class */
-    uart_port_t uart_port;                         /*!< Uart port number */
-    uint8_t* buffer;                               /*!< Runtime buffer */
-    esp_event_loop_handle_t event_loop_hdl;        /*!< Event loop handle */
-    TaskHandle_t tsk_hdl;                          /*!< NMEA Parser task handle */
-    QueueHandle_t event_queue;                     /*!< UART event queue handle */
-    const nmea_parser_plugin_t *plugins;           /*!< Configuration options */
+    nmea_decoder_t decoder;                 /*!< Decoder of the received lines */
+    uart_port_t uart_port;                  /*!< Uart port number */
+    uint8_t* buffer;                        /*!< Runtime buffer */
+    esp_event_loop_handle_t event_loop_hdl; /*!< Event loop handle */
+    TaskHandle_t tsk_hdl;                   /*!< NMEA Parser task handle */
+    QueueHandle_t event_queue;              /*!< UART event queue handle */
+    uint32_t expected_statements;           /*!< Requested output, taken over by the parser task */
 } esp_gps_t;
 
-/**
- * @brief Parser plugin functions
- */
-struct nmea_parser_plugin
-{
-    esp_err_t(*detect)(esp_gps_t* esp_gps);
-    esp_err_t(*parse)(esp_gps_t* esp_gps);
-};
-
 /**
  * @brief Configuration of NMEA Parser
  *
@@ -283,6 +159,22 @@ esp_err_t nmea_parser_remove_handler(nmea_parser_handle_t nmea_hdl, esp_event_ha
  */
 esp_err_t nmea_send_command(nmea_parser_handle_t nmea_hdl, char* cmd);
 
+/**
+ * @brief Configure the output of the GPS module
+ *
+ * The parser waits for the statements sent with every fix once the module
+ * acknowledged them.
+ *
+ * @param nmea_hdl handle of NMEA parser
+ * @param config statements, fix interval and baud rate
+ * @return esp_err_t
+ *  - EPS_OK: Success
+ *  - ESP_ERR_NO_MEM: TX buffer not big enough for command sequence
+ *  - ESP_ERR_INVALID_STATE: Parser Task not initialized or not running
+ *  - Others: Fail
+ */
+esp_err_t nmea_parser_configure(nmea_parser_handle_t nmea_hdl, const nmea_config_t* config);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,181 @@
+/*
+ * Replay of recorded NMEA logs through the decoder on the host
+ *
+ * Copyright (c) 2023, Bastian Neumann <info@platinenmacher.tech>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#if defined(TESTING) || defined(LINUX)
+
+#include "nmea_replay.h"
+#include <string.h>
+#include <time.h>
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void sleep_until_ns(uint64_t deadline)
+{
+    uint64_t now = now_ns();
+    if (deadline <= now)
+        return;
+    struct timespec ts = { (deadline - now) / 1000000000, (deadline - now) % 1000000000 };
+    nanosleep(&ts, NULL);
+}
+
+/* milliseconds of the day */
+static uint32_t utc_ms(const gps_time_t* tim)
+{
+    return ((tim->hour * 60 + tim->minute) * 60 + tim->second) * 1000 + tim->thousand;
+}
+
+static uint8_t bucket(uint32_t ns)
+{
+    uint8_t n = 0;
+    while (ns >>= 1)
+        n++;
+    return n < NMEA_REPLAY_BUCKETS ? n : NMEA_REPLAY_BUCKETS - 1;
+}
+
+/**
+ * Decode with the statements the firmware uses, update is called with every
+ * complete fix
+ */
+void nmea_replay_init(nmea_replay_t* replay, nmea_replay_mode_t mode, const nmea_parser_plugin_t* plugins, nmea_replay_update_t update, void* arg)
+{
+    memset(replay, 0, sizeof(nmea_replay_t));
+    nmea_decoder_init(&replay->decoder, nmea_decoder_statements(), plugins);
+    replay->mode = mode;
+    replay->update = update;
+    replay->arg = arg;
+    replay->stats.min_ns = UINT32_MAX;
+
+    /* the latency is measured between two clock reads */
+    replay->clock_ns = UINT32_MAX;
+    for (int i = 0; i < 100; i++) {
+        uint64_t start = now_ns();
+        uint32_t ns = now_ns() - start;
+        if (ns < replay->clock_ns)
+            replay->clock_ns = ns;
+    }
+}
+
+/**
+ * Feed the lines of a log to the decoder, the stats add up over several runs
+ */
+void nmea_replay_run(nmea_replay_t* replay, const char* log, size_t length)
+{
+    nmea_replay_stats_t* stats = &replay->stats;
+    const char* end = log + length;
+    uint64_t wall = now_ns();
+    bool paced = false;
+    uint32_t first_ms = 0;
+
+    while (log < end) {
+        const char* eol = memchr(log, '\n', end - log);
+        const char* next = eol ? eol + 1 : end;
+        if (!memchr(log, '$', next - log)) {
+            log = next;
+            continue;
+        }
+
+        uint64_t start = now_ns();
+        nmea_result_t result = nmea_decode(&replay->decoder, log, next - log);
+        uint64_t ns = now_ns() - start;
+        ns = ns > replay->clock_ns ? ns - replay->clock_ns : 0;
+
+        stats->sentences++;
+        stats->bytes += next - log;
+        stats->decode_ns += ns;
+        if (ns < stats->min_ns)
+            stats->min_ns = ns;
+        if (ns > stats->max_ns)
+            stats->max_ns = ns;
+        stats->histogram[bucket(ns)]++;
+
+        switch (result) {
+        case NMEA_UPDATE:
+            stats->updates++;
+            if (replay->update)
+                replay->update(replay->arg, &replay->decoder.parent);
+            break;
+        case NMEA_UNKNOWN:
+            stats->unknown++;
+            break;
+        case NMEA_INVALID:
+            stats->invalid++;
+            break;
+        default:
+            break;
+        }
+
+        /* the receiver sends one epoch per second, wait for the time of the next */
+        if (replay->mode == NMEA_REPLAY_REAL_TIME && result != NMEA_INVALID) {
+            uint32_t ms = utc_ms(&replay->decoder.parent.tim);
+            if (!paced) {
+                first_ms = ms;
+                paced = ms != 0;
+            } else {
+                uint32_t elapsed = (ms + 86400000 - first_ms) % 86400000;
+                sleep_until_ns(wall + (uint64_t)elapsed * 1000000);
+            }
+        }
+        log = next;
+    }
+    stats->wall_ns += now_ns() - wall;
+}
+
+/**
+ * Latency that percent of the sentences stay below, the upper end of its
+ * histogram bucket
+ */
+uint32_t nmea_replay_percentile(const nmea_replay_stats_t* stats, uint8_t percent)
+{
+    uint64_t wanted = ((uint64_t)stats->sentences * percent + 99) / 100;
+    uint64_t count = 0;
+    for (uint8_t n = 0; n < NMEA_REPLAY_BUCKETS; n++) {
+        count += stats->histogram[n];
+        if (count >= wanted)
+            return n + 1 < 32 ? (1u << (n + 1)) - 1 : UINT32_MAX;
+    }
+    return stats->max_ns;
+}
+
+void nmea_replay_report(const nmea_replay_stats_t* stats, FILE* out)
+{
+    double decode_s = stats->decode_ns / 1e9;
+    double wall_s = stats->wall_ns / 1e9;
+    fprintf(out, "sentences %u, fixes %u, unknown %u, invalid %u, %llu bytes\n",
+        stats->sentences, stats->updates, stats->unknown, stats->invalid, (unsigned long long)stats->bytes);
+    if (!stats->sentences)
+        return;
+    fprintf(out, "decode    %.0f sentences/s, %.1f MB/s\n",
+        decode_s > 0 ? stats->sentences / decode_s : 0, decode_s > 0 ? stats->bytes / decode_s / 1e6 : 0);
+    fprintf(out, "replay    %.0f sentences/s in %.1f ms\n", wall_s > 0 ? stats->sentences / wall_s : 0, wall_s * 1e3);
+    fprintf(out, "latency   min %u ns, mean %llu ns, p50 < %u ns, p99 < %u ns, max %u ns\n",
+        stats->min_ns, (unsigned long long)(stats->decode_ns / stats->sentences),
+        nmea_replay_percentile(stats, 50), nmea_replay_percentile(stats, 99), stats->max_ns);
+}
+
+/**
+ * One line for the golden output, the floats are rounded to what the
+ * receiver resolves
+ */
+size_t nmea_replay_format(const gps_t* gps, char* line, size_t size)
+{
+    int length = snprintf(line, size,
+        "%02u:%02u:%02u.%03u %02u.%02u.%02u fix %u mode %u valid %u sats %u/%u lat %.6f lon %.6f alt %.1f dop %.2f/%.2f/%.2f speed %.2f cog %.1f\n",
+        gps->tim.hour, gps->tim.minute, gps->tim.second, gps->tim.thousand,
+        gps->date.day, gps->date.month, gps->date.year,
+        gps->fix, gps->fix_mode, gps->valid, gps->sats_in_use, gps->sats_in_view,
+        gps->latitude, gps->longitude, gps->altitude,
+        gps->dop_p, gps->dop_h, gps->dop_v, gps->speed, gps->cog);
+    return length < 0 ? 0 : (size_t)length < size ? (size_t)length : size - 1;
+}
+
+#endif
@@ -0,0 +1,57 @@
+/*
+ * Replay of recorded NMEA logs through the decoder on the host
+ *
+ * Copyright (c) 2023, Bastian Neumann <info@platinenmacher.tech>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#if defined(TESTING) || defined(LINUX)
+
+#include "nmea_decoder.h"
+#include <stdio.h>
+
+#define NMEA_REPLAY_BUCKETS 24 /// latency histogram, bucket n counts [2^n, 2^(n+1)) ns
+#define NMEA_REPLAY_LINE 192   /// a formatted gps_t
+
+typedef enum {
+    NMEA_REPLAY_MAX_SPEED, /*!< Decode one sentence after the other */
+    NMEA_REPLAY_REAL_TIME, /*!< Wait for the UTC time of the sentences */
+} nmea_replay_mode_t;
+
+typedef struct
+{
+    uint32_t sentences;                       /*!< Lines with a '$' */
+    uint32_t updates;                         /*!< Complete fixes */
+    uint32_t unknown;                         /*!< Valid sentences nobody parses */
+    uint32_t invalid;                         /*!< Checksum failures and cut off sentences */
+    uint64_t bytes;                           /*!< Of the sentences */
+    uint64_t decode_ns;                       /*!< Sum of the decode latencies */
+    uint64_t wall_ns;                         /*!< Whole replay, with the waiting */
+    uint32_t min_ns;                          /*!< Fastest sentence */
+    uint32_t max_ns;                          /*!< Slowest sentence */
+    uint32_t histogram[NMEA_REPLAY_BUCKETS]; /*!< Sentences by decode latency */
+} nmea_replay_stats_t;
+
+/* called with every complete fix */
+typedef void (*nmea_replay_update_t)(void* arg, const gps_t* gps);
+
+typedef struct
+{
+    nmea_decoder_t decoder;
+    nmea_replay_mode_t mode;
+    nmea_replay_update_t update;
+    void* arg;
+    uint32_t clock_ns; /*!< Cost of reading the clock, not counted as latency */
+    nmea_replay_stats_t stats;
+} nmea_replay_t;
+
+void nmea_replay_init(nmea_replay_t* replay, nmea_replay_mode_t mode, const nmea_parser_plugin_t* plugins, nmea_replay_update_t update, void* arg);
+void nmea_replay_run(nmea_replay_t* replay, const char* log, size_t length);
+uint32_t nmea_replay_percentile(const nmea_replay_stats_t* stats, uint8_t percent);
+void nmea_replay_report(const nmea_replay_stats_t* stats, FILE* out);
+size_t nmea_replay_format(const gps_t* gps, char* line, size_t size);
+
+#endif
@@ -0,0 +1,249 @@
+/*
+ * Aiding of the GPS receiver after a sleep
+ *
+ * Copyright (c) 2023, Bastian Neumann <info@platinenmacher.tech>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "pmtk_aiding.h"
+#include "nmea_config.h"
+#if !defined(TESTING) && !defined(LINUX)
+#include "esp_log.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define GPS_EPOCH 315964800 /// 1980-01-06 in seconds since 1970
+#define GPS_LEAP_SECONDS 18 /// GPS time is ahead of UTC
+
+static const char* TAG = "pmtk_aiding";
+
+/* degrees * 1e7 with 6 decimals, like the receiver prints them */
+static int format_degrees(char* text, size_t size, int32_t degrees)
+{
+    uint32_t value = ((degrees < 0 ? -(int64_t)degrees : degrees) + 5) / 10;
+    return snprintf(text, size, "%s%lu.%06lu", degrees < 0 ? "-" : "",
+        (unsigned long)(value / 1000000), (unsigned long)(value % 1000000));
+}
+
+/**
+ * PMTK740, the UTC time
+ */
+size_t pmtk_time_aiding(uint32_t utc, char* command, size_t size)
+{
+    time_t t = utc;
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    return nmea_command(command, size, "PMTK740,%04d,%02d,%02d,%02d,%02d,%02d",
+        tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec);
+}
+
+/**
+ * PMTK741, the position with the UTC time
+ *
+ * @param lat degrees * 1e7
+ * @param lon degrees * 1e7
+ * @param ele decimeters
+ */
+size_t pmtk_position_aiding(int32_t lat, int32_t lon, int32_t ele, uint32_t utc, char* command, size_t size)
+{
+    char latitude[16], longitude[16];
+    format_degrees(latitude, sizeof(latitude), lat);
+    format_degrees(longitude, sizeof(longitude), lon);
+    time_t t = utc;
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    return nmea_command(command, size, "PMTK741,%s,%s,%ld,%04d,%02d,%02d,%02d,%02d,%02d",
+        latitude, longitude, (long)(ele / 10),
+        tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec);
+}
+
+/**
+ * PMTK721, one record of the EPO file as 18 little endian words
+ *
+ * @param satellite PRN, 1 for the first record of a segment
+ */
+size_t pmtk_epo_command(uint8_t satellite, const uint8_t* record, char* command, size_t size)
+{
+    char body[PMTK_AIDING_COMMAND];
+    int length = snprintf(body, sizeof(body), "PMTK721,%u", satellite);
+    for (uint8_t i = 0; i < PMTK_EPO_RECORD; i += 4) {
+        uint32_t word = record[i] | record[i + 1] << 8 | record[i + 2] << 16 | (uint32_t)record[i + 3] << 24;
+        length += snprintf(body + length, sizeof(body) - length, ",%08lX", (unsigned long)word);
+    }
+    return nmea_command(command, size, "%s", body);
+}
+
+/**
+ * GPS hour the segment of a record starts with
+ */
+uint32_t pmtk_epo_hour(const uint8_t* record)
+{
+    return record[0] | record[1] << 8 | (uint32_t)record[2] << 16;
+}
+
+/**
+ * Hours since the start of the GPS time
+ */
+uint32_t pmtk_gps_hour(uint32_t utc)
+{
+    if (utc < GPS_EPOCH)
+        return 0;
+    return (utc - GPS_EPOCH + GPS_LEAP_SECONDS) / 3600;
+}
+
+/**
+ * Send a command until the receiver acknowledges it, the packet type is
+ * taken from the command
+ *
+ * @return esp_err_t
+ *  - ESP_OK: The action succeeded
+ *  - ESP_ERR_NOT_SUPPORTED: The receiver does not know the command
+ *  - ESP_ERR_TIMEOUT: No acknowledge for the last try
+ *  - ESP_FAIL: The action failed on the last try
+ */
+esp_err_t pmtk_send_acknowledged(const pmtk_link_t* link, const char* command)
+{
+    uint16_t packet_type = strtoul(command + 5, NULL, 10);
+    esp_err_t err = ESP_ERR_INVALID_ARG;
+    for (uint8_t i = 0; i < PMTK_AIDING_RETRIES; i++) {
+        if ((err = link->send(link->arg, command)) != ESP_OK)
+            return err;
+        switch (link->wait_ack(link->arg, packet_type, PMTK_AIDING_TIMEOUT_MS)) {
+        case 3:
+            return ESP_OK;
+        case 2:
+            err = ESP_FAIL;
+            break;
+        case -1:
+            err = ESP_ERR_TIMEOUT;
+            break;
+        default:
+            return ESP_ERR_NOT_SUPPORTED;
+        }
+    }
+    ESP_LOGE(TAG, "PMTK%u not acknowledged", packet_type);
+    return err;
+}
+
+/**
+ * Tell the receiver the time and where it was
+ *
+ * @param lat degrees * 1e7
+ * @param lon degrees * 1e7
+ * @param ele decimeters
+ */
+esp_err_t pmtk_aid(const pmtk_link_t* link, int32_t lat, int32_t lon, int32_t ele, uint32_t utc)
+{
+    char command[PMTK_AIDING_COMMAND];
+    esp_err_t err;
+    pmtk_time_aiding(utc, command, sizeof(command));
+    if ((err = pmtk_send_acknowledged(link, command)) != ESP_OK)
+        return err;
+    pmtk_position_aiding(lat, lon, ele, utc, command, sizeof(command));
+    return pmtk_send_acknowledged(link, command);
+}
+
+static bool is_empty(const uint8_t* record)
+{
+    for (uint8_t i = 0; i < PMTK_EPO_RECORD; i++)
+        if (record[i])
+            return false;
+    return true;
+}
+
+/**
+ * Start uploading the segments of an EPO file from the one valid at utc on
+ *
+ * The segments of the file follow each other without a gap, the one that
+ * is valid now is found from the first one. The orbits of the last upload
+ * are cleared, pmtk_epo_step sends the new ones.
+ *
+ * @return esp_err_t
+ *  - ESP_OK: The upload can go on
+ *  - ESP_ERR_NOT_FOUND: The file has no orbits for utc
+ *  - Others: From pmtk_send_acknowledged
+ */
+esp_err_t pmtk_epo_begin(pmtk_epo_upload_t* upload, const pmtk_link_t* link, pmtk_epo_read_t read, void* arg, uint32_t utc)
+{
+    uint8_t record[PMTK_EPO_RECORD];
+    char command[PMTK_AIDING_COMMAND];
+    uint32_t hour = pmtk_gps_hour(utc);
+
+    if (read(arg, 0, record, sizeof(record)) != sizeof(record) || hour < pmtk_epo_hour(record))
+        return ESP_ERR_NOT_FOUND;
+    uint32_t segment = (hour - pmtk_epo_hour(record)) / PMTK_EPO_SEGMENT_HOURS;
+    uint32_t offset = segment * PMTK_EPO_SEGMENT;
+    if (read(arg, offset, record, sizeof(record)) != sizeof(record)
+        || hour - pmtk_epo_hour(record) >= PMTK_EPO_SEGMENT_HOURS)
+        return ESP_ERR_NOT_FOUND;
+
+    /* the orbits of the last upload are outdated */
+    nmea_command(command, sizeof(command), "PMTK127");
+    esp_err_t err = pmtk_send_acknowledged(link, command);
+    if (err != ESP_OK)
+        return err;
+
+    upload->read = read;
+    upload->arg = arg;
+    upload->offset = offset;
+    upload->start = pmtk_epo_hour(record);
+    upload->next = 0;
+    upload->records = 0;
+    return ESP_OK;
+}
+
+/**
+ * Send up to commands orbits of an upload, records without an orbit are
+ * skipped without counting
+ *
+ * @return esp_err_t
+ *  - ESP_OK: Every orbit was uploaded
+ *  - ESP_ERR_NOT_FINISHED: Orbits are left for the next step
+ *  - Others: From pmtk_send_acknowledged, the upload is given up
+ */
+esp_err_t pmtk_epo_step(pmtk_epo_upload_t* upload, const pmtk_link_t* link, uint16_t commands)
+{
+    uint8_t record[PMTK_EPO_RECORD];
+    char command[PMTK_AIDING_COMMAND];
+    const uint16_t total = PMTK_EPO_SEGMENTS * PMTK_EPO_SATELLITES;
+
+    while (commands && upload->next < total) {
+        uint16_t i = upload->next;
+        /* the file may end before the last segment */
+        if (upload->read(upload->arg, upload->offset + i * PMTK_EPO_RECORD, record, sizeof(record)) != sizeof(record)) {
+            upload->next = total;
+            break;
+        }
+        upload->next++;
+        if (is_empty(record))
+            continue;
+        pmtk_epo_command(i % PMTK_EPO_SATELLITES + 1, record, command, sizeof(command));
+        esp_err_t err = pmtk_send_acknowledged(link, command);
+        if (err != ESP_OK)
+            return err;
+        upload->records++;
+        commands--;
+    }
+    if (upload->next < total)
+        return ESP_ERR_NOT_FINISHED;
+    ESP_LOGI(TAG, "EPO: %u records from GPS hour %lu", upload->records, (unsigned long)upload->start);
+    return ESP_OK;
+}
+
+/**
+ * Upload the segments of an EPO file from the one valid at utc on at once
+ *
+ * @return esp_err_t like pmtk_epo_begin and pmtk_epo_step
+ */
+esp_err_t pmtk_epo_upload(const pmtk_link_t* link, pmtk_epo_read_t read, void* arg, uint32_t utc)
+{
+    pmtk_epo_upload_t upload;
+    esp_err_t err = pmtk_epo_begin(&upload, link, read, arg, utc);
+    if (err != ESP_OK)
+        return err;
+    return pmtk_epo_step(&upload, link, PMTK_EPO_SEGMENTS * PMTK_EPO_SATELLITES);
+}
@@ -0,0 +1,66 @@
+/*
+ * Aiding of the GPS receiver after a sleep
+ *
+ * The last position and the time let the receiver search the satellites
+ * that are above it, the EPO orbits predicted for the next days replace
+ * the ephemeris it would have to download from every satellite first.
+ *
+ * Every command is acknowledged by the receiver with PMTK001, a command is
+ * sent again if it failed or the acknowledge did not come in time. The EPO
+ * file is uploaded in the NMEA form of the MTK protocol, one satellite of
+ * a segment per PMTK721. At 9600 baud the upload takes a while, it can go
+ * on a few commands at a time between the other work of the GPS task.
+ *
+ * Copyright (c) 2023, Bastian Neumann <info@platinenmacher.tech>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include "nmea_decoder.h"
+
+#define PMTK_AIDING_COMMAND 192     /// longest command, a PMTK721 with a whole record
+#define PMTK_AIDING_RETRIES 3       /// a command is sent this often before giving up
+#define PMTK_AIDING_TIMEOUT_MS 1000 /// for the acknowledge
+
+#define PMTK_EPO_RECORD 72      /// orbit of one satellite for one segment
+#define PMTK_EPO_SATELLITES 32  /// records of a segment
+#define PMTK_EPO_SEGMENT (PMTK_EPO_RECORD * PMTK_EPO_SATELLITES)
+#define PMTK_EPO_SEGMENT_HOURS 6
+#define PMTK_EPO_SEGMENTS 4     /// uploaded from the current one on, a day of orbits
+
+/* the receiver on the other end of the UART */
+typedef struct
+{
+    esp_err_t (*send)(void* arg, const char* command);
+    /* flag of the next acknowledge of packet_type, -1 if none came within timeout_ms */
+    int (*wait_ack)(void* arg, uint16_t packet_type, uint32_t timeout_ms);
+    void* arg;
+} pmtk_link_t;
+
+/* up to length bytes of the EPO file at offset, the number of bytes read */
+typedef size_t (*pmtk_epo_read_t)(void* arg, uint32_t offset, uint8_t* data, size_t length);
+
+/* an EPO upload in progress */
+typedef struct
+{
+    pmtk_epo_read_t read;
+    void* arg;
+    uint32_t offset;  /// of the segment valid when the upload started
+    uint32_t start;   /// GPS hour of that segment
+    uint16_t next;    /// record to upload next
+    uint16_t records; /// uploaded so far
+} pmtk_epo_upload_t;
+
+size_t pmtk_time_aiding(uint32_t utc, char* command, size_t size);
+size_t pmtk_position_aiding(int32_t lat, int32_t lon, int32_t ele, uint32_t utc, char* command, size_t size);
+size_t pmtk_epo_command(uint8_t satellite, const uint8_t* record, char* command, size_t size);
+uint32_t pmtk_epo_hour(const uint8_t* record);
+uint32_t pmtk_gps_hour(uint32_t utc);
+
+esp_err_t pmtk_send_acknowledged(const pmtk_link_t* link, const char* command);
+esp_err_t pmtk_aid(const pmtk_link_t* link, int32_t lat, int32_t lon, int32_t ele, uint32_t utc);
+esp_err_t pmtk_epo_begin(pmtk_epo_upload_t* upload, const pmtk_link_t* link, pmtk_epo_read_t read, void* arg, uint32_t utc);
+esp_err_t pmtk_epo_step(pmtk_epo_upload_t* upload, const pmtk_link_t* link, uint16_t commands);
+esp_err_t pmtk_epo_upload(const pmtk_link_t* link, pmtk_epo_read_t read, void* arg, uint32_t utc);
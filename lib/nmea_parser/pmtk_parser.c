@@ -11,10 +11,14 @@
 
 typedef struct {
     uint32_t packet_type;
-    esp_err_t (*parse_packet_type)(esp_gps_t* esp_gps);
+    esp_err_t (*parse_packet_type)(nmea_decoder_t* decoder);
+    void (*acknowledged)(nmea_decoder_t* decoder); /* the action succeeded */
 } message_parser_t;
 
 uint32_t messageNumber;
+static pmtk_ack_t ack;
+static pmtk_ack_handler_t ack_handler;
+static void* ack_arg;
 char* pmtkSystemMessages[] = {
     "Unknown",
     "Startup",
@@ -22,38 +26,43 @@ char* pmtkSystemMessages[] = {
     "Notification for the transisiton to normal mode done successfully",
 };
 
-esp_err_t parse_packet_type_353(esp_gps_t* esp_gps)
+static bool item_is_set(const nmea_decoder_t* decoder)
 {
-    switch (esp_gps->item_num) {
+    return decoder->item.length && decoder->item.text[0] == '1';
+}
+
+esp_err_t parse_packet_type_353(nmea_decoder_t* decoder)
+{
+    switch (decoder->item_num) {
     case 3: /* Enabled GPS */
-        if (esp_gps->item_str[0] == '1')
+        if (item_is_set(decoder))
             ESP_LOGI(__func__, "PMTK_API_SET_GNSS_SEARCH_MODE: GPS enabled");
         else
             ESP_LOGI(__func__, "PMTK_API_SET_GNSS_SEARCH_MODE: GPS disabled");
         break;
     case 4: /* Enabled GLONASS */
-        if (esp_gps->item_str[0] == '1')
+        if (item_is_set(decoder))
             ESP_LOGI(__func__, "PMTK_API_SET_GNSS_SEARCH_MODE: GLONASS enabled");
         else
             ESP_LOGI(__func__, "PMTK_API_SET_GNSS_SEARCH_MODE: GLONASS disabled");
 
         break;
     case 5: /* Enabled GALILEO */
-        if (esp_gps->item_str[0] == '1')
+        if (item_is_set(decoder))
             ESP_LOGI(__func__, "PMTK_API_SET_GNSS_SEARCH_MODE: GALILEO enabled");
         else
             ESP_LOGI(__func__, "PMTK_API_SET_GNSS_SEARCH_MODE: GALILEO disabled");
 
         break;
     case 6: /* Enabled GALILEO_FULL*/
-        if (esp_gps->item_str[0] == '1')
+        if (item_is_set(decoder))
             ESP_LOGI(__func__, "PMTK_API_SET_GNSS_SEARCH_MODE: GALILEO_FULL enabled");
         else
             ESP_LOGI(__func__, "PMTK_API_SET_GNSS_SEARCH_MODE: GALILEO_FULL disabled");
 
         break;
     case 7: /* Enables BEIDOU */
-        if (esp_gps->item_str[0] == '1')
+        if (item_is_set(decoder))
             ESP_LOGI(__func__, "PMTK_API_SET_GNSS_SEARCH_MODE: BEIDOU enabled");
         else
             ESP_LOGI(__func__, "PMTK_API_SET_GNSS_SEARCH_MODE: BEIDOU disabled");
@@ -61,29 +70,56 @@ esp_err_t parse_packet_type_353(esp_gps_t* esp_gps)
     return ESP_OK;
 }
 
-esp_err_t parse_packet_type_161(esp_gps_t* esp_gps)
+esp_err_t parse_packet_type_161(nmea_decoder_t* decoder)
 {
-    ESP_LOGI(__func__, "PMTK_CMD_STANDBY_MODE: %s", esp_gps->item_str);
+    ESP_LOGI(__func__, "PMTK_CMD_STANDBY_MODE: %.*s", (int)decoder->item.length, decoder->item.text);
     return ESP_OK;
 }
 
+/* the decoder waits for the new statements from now on */
+void acknowledged_314(nmea_decoder_t* decoder)
+{
+    ESP_LOGI(__func__, "PMTK_API_SET_NMEA_OUTPUT: done");
+    nmea_decoder_confirm(decoder);
+}
+
+void acknowledged_220(nmea_decoder_t* decoder)
+{
+    ESP_LOGI(__func__, "PMTK_SET_POS_FIX: done");
+}
+
 static message_parser_t message_parser[] = {
     { .packet_type = 161,
         .parse_packet_type = parse_packet_type_161 },
+    { .packet_type = 220,
+        .acknowledged = acknowledged_220 },
+    { .packet_type = 314,
+        .acknowledged = acknowledged_314 },
     { .packet_type = 353,
         .parse_packet_type = parse_packet_type_353 },
 };
 
-esp_err_t pmtk_detect(esp_gps_t* esp_gps)
+/**
+ * Every acknowledge is passed to the handler, it is called from the task
+ * that decodes the lines
+ */
+void pmtk_set_ack_handler(pmtk_ack_handler_t handler, void* arg)
 {
-    if (strstr(esp_gps->item_str, "PMTK")) {
-        messageNumber = atoi(esp_gps->item_str + 5);
+    ack_arg = arg;
+    ack_handler = handler;
+}
+
+esp_err_t pmtk_detect(nmea_decoder_t* decoder)
+{
+    if (nmea_field_starts_with(decoder->address, "PMTK")) {
+        nmea_field_t number = { decoder->address.text + 4, decoder->address.length - 4 };
+        messageNumber = nmea_uint(number);
         return ESP_OK;
     }
     return ESP_ERR_NOT_SUPPORTED;
 }
 
-esp_err_t pmtk_parse(esp_gps_t* esp_gps)
+esp_err_t pmtk_parse(nmea_decoder_t* decoder)
 {
     /* Process PMTK statement
    $PMTK001,353,3,1,1,1,0,0,15*00
@@ -97,22 +133,25 @@ esp_err_t pmtk_parse(esp_gps_t* esp_gps)
    3 ..: Packet specific
 
    */
-    static int message_id;
+    static const message_parser_t* message;
     switch (messageNumber) {
     case 1:
-        switch (esp_gps->item_num) {
+        switch (decoder->item_num) {
         case 1: /* Process message */
-            message_id = atoi(esp_gps->item_str);
-            for (int i = 0; i < sizeof(message_parser); i++)
-                if (message_parser[i].packet_type == message_id) {
-                    if (message_parser[i].parse_packet_type)
-                        return ESP_OK;
+            message = NULL;
+            ack.packet_type = nmea_uint(decoder->item);
+            for (int i = 0; i < sizeof(message_parser) / sizeof(message_parser[0]); i++)
+                if (message_parser[i].packet_type == nmea_uint(decoder->item)) {
+                    message = &message_parser[i];
+                    return ESP_OK;
                 }
             return ESP_ERR_NOT_SUPPORTED;
             break;
         case 2: /* Process flag */
-            int flag = atoi(esp_gps->item_str);
-            switch (flag) {
+            ack.flag = nmea_uint(decoder->item);
+            if (ack_handler)
+                ack_handler(ack_arg, &ack);
+            switch (ack.flag) {
             case 0:
                 return ESP_ERR_INVALID_ARG;
             case 1:
@@ -120,25 +159,30 @@ esp_err_t pmtk_parse(esp_gps_t* esp_gps)
             case 2:
                 return ESP_FAIL;
             case 3:
+                if (message && message->acknowledged)
+                    message->acknowledged(decoder);
                 return ESP_OK;
             }
             break;
         default:
-            if (message_id)
-                return message_parser[message_id].parse_packet_type(esp_gps);
+            if (message && message->parse_packet_type)
+                return message->parse_packet_type(decoder);
             break;
         }
         break;
-    case 10:
+    case 10: {
         /* PMTK_SYS_MSG */
-        int systemMessage = atoi(esp_gps->item_str);
+        uint32_t systemMessage = nmea_uint(decoder->item);
+        if (systemMessage >= sizeof(pmtkSystemMessages) / sizeof(pmtkSystemMessages[0]))
+            systemMessage = 0;
         ESP_LOGI(__func__, "PMTK_SYS_MSG: %s", pmtkSystemMessages[systemMessage]);
         break;
+    }
     case 11:
         /* PMTK_TXT_MSG */
-        ESP_LOGI(__func__, "PMTK_TXT_MSG: %s", esp_gps->item_str);
+        ESP_LOGI(__func__, "PMTK_TXT_MSG: %.*s", (int)decoder->item.length, decoder->item.text);
         messageNumber = 0;
         break;
     }
     return ESP_OK;
-}
\ No newline at end of file
+}
@@ -8,8 +8,20 @@
 
 #pragma once
 
-#include "nmea_parser.h"
+#include "nmea_decoder.h"
+#if !defined(TESTING) && !defined(LINUX)
 #include "esp_log.h"
+#endif
 
-esp_err_t pmtk_detect(esp_gps_t* esp_gps);
-esp_err_t pmtk_parse(esp_gps_t* esp_gps);
+esp_err_t pmtk_detect(nmea_decoder_t* decoder);
+esp_err_t pmtk_parse(nmea_decoder_t* decoder);
+
+/* PMTK001, the answer of the receiver to a command */
+typedef struct {
+    uint16_t packet_type; /* of the command */
+    uint8_t flag;         /* 0 invalid, 1 unsupported, 2 failed, 3 succeeded */
+} pmtk_ack_t;
+
+typedef void (*pmtk_ack_handler_t)(void* arg, const pmtk_ack_t* ack);
+
+void pmtk_set_ack_handler(pmtk_ack_handler_t handler, void* arg);
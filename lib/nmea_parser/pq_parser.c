@@ -27,58 +27,56 @@ typedef enum {
 
 static pq_statement_t statement = STATEMENT_UNKNOWN;
 
-esp_err_t pq_parse_glp(esp_gps_t* esp_gps)
+esp_err_t pq_parse_glp(nmea_decoder_t* decoder)
 {
     static int write = 0;
 
-    if (esp_gps->item_num == 1) {
-        if (esp_gps->item_str[0] == 'W') {
-            write = 1;
-        }
-    } else if (esp_gps->item_num == 2) {
+    if (decoder->item_num == 1) {
+        write = decoder->item.length && decoder->item.text[0] == 'W';
+    } else if (decoder->item_num == 2) {
         if (write)
-            ESP_LOGI(__func__, "GLP set: %s", esp_gps->item_str);
+            ESP_LOGI(__func__, "GLP set: %.*s", (int)decoder->item.length, decoder->item.text);
         else
-            ESP_LOGI(__func__, "GLP get: %s", esp_gps->item_str);
+            ESP_LOGI(__func__, "GLP get: %.*s", (int)decoder->item.length, decoder->item.text);
     }
     return ESP_OK;
 }
 
-esp_err_t pq_detect(esp_gps_t* esp_gps)
+/* by the address behind PQ, "$PQGLP,W,1,1*21" */
+static const struct {
+    const char* name;
+    pq_statement_t statement;
+} pq_statements[] = {
+    { "BAUD", STATEMENT_PQBAUD },
+    { "EPE", STATEMENT_PQEPE },
+    { "1PPS", STATEMENT_PQ1PPS },
+    { "FLP", STATEMENT_PQFLP },
+    { "TXT", STATEMENT_PQTXT },
+    { "ECEF", STATEMENT_PQECEF },
+    { "ODO", STATEMENT_PQODO },
+    { "PZ90", STATEMENT_PQPZ90 },
+    { "GLP", STATEMENT_PQGLP },
+    { "VEL", STATEMENT_PQVEL },
+    { "JAM", STATEMENT_PQJAM },
+    { "RLM", STATEMENT_PQRLM },
+    { "GEO", STATEMENT_PQGEO },
+};
+
+esp_err_t pq_detect(nmea_decoder_t* decoder)
 {
-    if (strstr(esp_gps->item_str, "PQBAUD")) {
-        statement = STATEMENT_PQBAUD;
-    } else if (strstr(esp_gps->item_str, "PQEPE")) {
-        statement = STATEMENT_PQEPE;
-    } else if (strstr(esp_gps->item_str, "PQ1PPS")) {
-        statement = STATEMENT_PQ1PPS;
-    } else if (strstr(esp_gps->item_str, "PQLFP")) {
-        statement = STATEMENT_PQFLP;
-    } else if (strstr(esp_gps->item_str, "PQTXT")) {
-        statement = STATEMENT_PQTXT;
-    } else if (strstr(esp_gps->item_str, "PQECEF")) {
-        statement = STATEMENT_PQECEF;
-    } else if (strstr(esp_gps->item_str, "PQODO")) {
-        statement = STATEMENT_PQODO;
-    } else if (strstr(esp_gps->item_str, "PQPZ90")) {
-        statement = STATEMENT_PQPZ90;
-    } else if (strstr(esp_gps->item_str, "PQGLP")) {
-        statement = STATEMENT_PQGLP;
-    } else if (strstr(esp_gps->item_str, "PQVEL")) {
-        statement = STATEMENT_PQVEL;
-    } else if (strstr(esp_gps->item_str, "PQJAM")) {
-        statement = STATEMENT_PQJAM;
-    } else if (strstr(esp_gps->item_str, "PQRLM")) {
-        statement = STATEMENT_PQRLM;
-    } else if (strstr(esp_gps->item_str, "PQGEO")) {
-        statement = STATEMENT_PQGEO;
-    } else {
+    if (!nmea_field_starts_with(decoder->address, "PQ"))
         return ESP_ERR_NOT_SUPPORTED;
+    nmea_field_t name = { decoder->address.text + 2, decoder->address.length - 2 };
+    for (uint8_t i = 0; i < sizeof(pq_statements) / sizeof(pq_statements[0]); i++) {
+        if (name.length == strlen(pq_statements[i].name) && nmea_field_starts_with(name, pq_statements[i].name)) {
+            statement = pq_statements[i].statement;
+            return ESP_OK;
+        }
     }
-    return ESP_OK;
+    return ESP_ERR_NOT_SUPPORTED;
 }
 
-esp_err_t pq_parse(esp_gps_t* esp_gps)
+esp_err_t pq_parse(nmea_decoder_t* decoder)
 {
     switch (statement) {
     case STATEMENT_PQBAUD:
@@ -98,7 +96,7 @@ esp_err_t pq_parse(esp_gps_t* esp_gps)
     case STATEMENT_PQPZ90:
         break;
     case STATEMENT_PQGLP:
-        pq_parse_glp(esp_gps);
+        pq_parse_glp(decoder);
         break;
     case STATEMENT_PQVEL:
         break;
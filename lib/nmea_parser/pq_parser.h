@@ -8,8 +8,10 @@
 
 #pragma once
 
-#include "nmea_parser.h"
+#include "nmea_decoder.h"
+#if !defined(TESTING) && !defined(LINUX)
 #include "esp_log.h"
+#endif
 
-esp_err_t pq_detect(esp_gps_t* esp_gps);
-esp_err_t pq_parse(esp_gps_t* esp_gps);
+esp_err_t pq_detect(nmea_decoder_t* decoder);
+esp_err_t pq_parse(nmea_decoder_t* decoder);
@@ -19,49 +19,74 @@
 
 #include "l96.h"
 #include "nmea_parser.h"
+#include "pmtk_aiding.h"
 #include "pmtk_parser.h"
 #include "pq_parser.h"
 
 #include <math.h>
+#include <stddef.h>
 #include <string.h>
 
 #include <driver/uart.h>
+#include <esp_attr.h>
 #include <esp_log.h>
 #include <icons_32.h>
 
+#include "crc32.h"
+#include "queue.h"
+#include "track_log.h"
+
 static const char* TAG = "GPS";
-char timeString[20];
+
+#define TRACK_LOG_PATH "//GPSLOG.BIN"
+#define TRACK_GPX_PATH "//log.gpx"
+#define TRACK_FLUSH_S 30        /// a partial block is written at least this often
+#define TRACK_EXPORT_IDLE_S 300 /// without a new fix for this long the track is exported
+#define TRACK_UPDATE_S 60       /// the map screen is updated with the position
+#define EPO_PATH "//MTK14.EPO"  /// orbits for 14 days, copied onto the card
+#define EPO_COMMANDS 4          /// orbits sent per second, the GPS loop goes on in between
+#define LAST_FIX_MAGIC 0x31584946 // "FIX1"
 
 nmea_parser_handle_t nmea_hdl;
 static async_file_t AFILE;
-static async_file_t BFILE;
 char timezone_file[100];
 uint8_t hour;
 uint32_t gps_ticks = 0;
 
-QueueHandle_t gpstrack_queue;
-
-static char gpx_header[] = "<?xml version=\"1.0\" encoding=\"UTF-8\"  standalone=\"yes\"?>\n"
-                           "<gpx version=\"1.1\" creator=\"IndiaNavi\" xmlns=\"http://www.topografix.com/GPX/1/1\" xmlns:xsi=\"http://www.w3.org/2001/XMLSchema-instance\" xsi:schemaLocation=\"http://www.topografix.com/GPX/1/1 http://www.topografix.com/GPX/1/1/gpx.xsd\" xmlns:oa=\"http://www.outdooractive.com/GPX/Extensions/1\">\n"
-                           "<metadata>\n"
-                           "<name>WanderNavi IndiaNavi</name>\n"
-                           "<link href=\"https://platinenmacher.tech\"/>\n"
-                           "<time>%s</time>\n"
-                           "<extensions><oa:oaCategory>hikingTourTrail</oa:oaCategory></extensions>\n"
-                           "</metadata>\n"
-                           "<trk>\n"
-                           "<name>IndiaNavi GPS Log</name>\n"
-                           "<type>hikingTourTrail</type>\n"
-                           "<trkseg>\n";
+/* the receiver stays at 9600 baud, it keeps a changed rate after a reset of the ESP32 */
+static const nmea_config_t profiles[GPS_PROFILE_MAX] = {
+    [GPS_PROFILE_MAP] = {
+        .every = { [STATEMENT_RMC] = 1, [STATEMENT_GGA] = 1, [STATEMENT_GSV] = 5 },
+        .fix_interval = 1000,
+    },
+    [GPS_PROFILE_SATELLITES] = {
+        .every = { [STATEMENT_RMC] = 1, [STATEMENT_GGA] = 1, [STATEMENT_GSA] = 1, [STATEMENT_GSV] = 1 },
+        .fix_interval = 1000,
+    },
+};
+static volatile gps_profile_t requested_profile = GPS_PROFILE_MAP;
 
-static char* gpx_footer = "</trkseg></trk></gpx>\n";
+/* fixes that were not written yet survive a sleep */
+static RTC_NOINIT_ATTR track_ring_t track_ring;
+static track_log_t* track_log;
+static track_export_mark_t export_mark; /// the next export only adds the new fixes
+static volatile bool export_requested;
 
+/* the receiver is aided with the last fix after a sleep */
 typedef struct {
-    map_position_t position;
-    time_t timestamp;
-} log_position_t;
+    uint32_t magic;
+    track_fix_t fix;
+    uint32_t clock; /// system time of the fix, it keeps running in deep sleep
+    uint32_t crc;
+} last_fix_t;
+static RTC_NOINIT_ATTR last_fix_t last_fix;
+static queue_t* acks;
+static pmtk_link_t aiding_link;
+static pmtk_epo_upload_t epo_upload;
+static bool epo_uploading;
 
-static map_position_t current_position = {
+/* published by the event handler, read by the gui task */
+static gps_position_t current_position = GPS_POSITION_INITIALIZER(
 #ifdef NO_GPS
     .longitude = 8.581875,
     .latitude = 49.626846,
@@ -71,11 +96,13 @@ static map_position_t current_position = {
 #else
     .fix = GPS_FIX_INVALID,
 #endif
-};
+);
 
 bool gps_is_position_known()
 {
-    return current_position.fix != GPS_FIX_INVALID;
+    map_position_t position;
+    gps_position_read(&current_position, &position);
+    return position.fix != GPS_FIX_INVALID;
 }
 
 /**
@@ -96,13 +123,18 @@ gps_event_handler(void* event_handler_arg, esp_event_base_t event_base, int32_t
     switch (event_id) {
     case GPS_UPDATE:
         _gps = (gps_t*)event_data;
-        current_position.longitude = _gps->longitude;
-        current_position.latitude = _gps->latitude;
-        current_position.altitude = _gps->altitude;
-        current_position.hdop = _gps->dop_h;
-        current_position.fix = _gps->fix;
-        current_position.satellites_in_use = _gps->sats_in_use;
-        current_position.satellites_in_view = _gps->sats_in_view;
+        uint32_t fix_time = gpx_time(_gps->date.year + 2000, _gps->date.month, _gps->date.day, _gps->tim.hour, _gps->tim.minute, _gps->tim.second);
+        map_position_t position = {
+            .longitude = _gps->longitude,
+            .latitude = _gps->latitude,
+            .altitude = _gps->altitude,
+            .hdop = _gps->dop_h,
+            .fix = _gps->fix,
+            .satellites_in_use = _gps->sats_in_use,
+            .satellites_in_view = _gps->sats_in_view,
+            .time = fix_time,
+        };
+        gps_position_publish(&current_position, &position);
 
         struct tm t = { 0 };               // Initalize to all 0's
         t.tm_year = _gps->date.year + 100; // This is year+100, so 121 = 2021
@@ -116,9 +148,18 @@ gps_event_handler(void* event_handler_arg, esp_event_base_t event_base, int32_t
         settimeofday(&tv, NULL);
 
         gps_ticks++;
-        if (gpstrack_queue != NULL) {
-            log_position_t log_position = { .position = current_position, .timestamp = mktime(&t) };
-            xQueueSendFromISR(gpstrack_queue, &log_position, 0);
+        if (_gps->fix != GPS_FIX_INVALID) {
+            track_fix_t fix = {
+                .time = fix_time,
+                .lat = lround(_gps->latitude * 1e7),
+                .lon = lround(_gps->longitude * 1e7),
+                .ele = lroundf(_gps->altitude * 10),
+            };
+            track_ring_push(&track_ring, &fix);
+            last_fix.magic = LAST_FIX_MAGIC;
+            last_fix.fix = fix;
+            last_fix.clock = time(NULL);
+            last_fix.crc = crc32_update(0, &last_fix, offsetof(last_fix_t, crc));
         }
         break;
     case GPS_UNKNOWN:
@@ -146,11 +187,169 @@ void gps_enter_standby()
     ESP_ERROR_CHECK(nmea_send_command(nmea_hdl, L96_ENTER_STANDBY));
 }
 
+/**
+ * Convert the track log to GPX as soon as the GPS task gets to it
+ */
+void gps_export_track()
+{
+    export_requested = true;
+}
+
+/**
+ * Configure the receiver for what the screen shows as soon as the GPS task
+ * gets to it
+ */
+void gps_set_profile(gps_profile_t profile)
+{
+    if (profile < GPS_PROFILE_MAX)
+        requested_profile = profile;
+}
+
+static void queue_ack(void* arg, const pmtk_ack_t* ack)
+{
+    queue_send(arg, ack, 0);
+}
+
+static esp_err_t send_command(void* arg, const char* command)
+{
+    return nmea_send_command(nmea_hdl, (char*)command);
+}
+
+/* acknowledges of other commands are dropped */
+static int wait_ack(void* arg, uint16_t packet_type, uint32_t timeout_ms)
+{
+    pmtk_ack_t ack;
+    while (queue_receive(arg, &ack, timeout_ms) == PM_OK)
+        if (ack.packet_type == packet_type)
+            return ack.flag;
+    return -1;
+}
+
+typedef struct {
+    uint32_t offset;
+    uint8_t* data;
+    size_t size;
+    size_t length;
+} epo_chunk_t;
+
+static error_code_t read_epo_sd(void* arg)
+{
+    epo_chunk_t* c = arg;
+    return sd_read_at(EPO_PATH, c->offset, c->data, c->size, &c->length);
+}
+
+static size_t read_epo(void* arg, uint32_t offset, uint8_t* data, size_t length)
+{
+    epo_chunk_t chunk = { offset, data, length, 0 };
+    if (sd_call(SD_PRIO_LOG, read_epo_sd, &chunk) != PM_OK)
+        return 0;
+    return chunk.length;
+}
+
+static error_code_t close_epo(void* arg)
+{
+    storage_drop(sd_storage, EPO_PATH);
+    return PM_OK;
+}
+
+/**
+ * Tell the receiver where it was and start the upload of the orbits from
+ * the SD card, it finds the satellites within seconds instead of minutes
+ * then
+ */
+static void aid_receiver()
+{
+    if (!acks && !(acks = queue_create(8, sizeof(pmtk_ack_t))))
+        return;
+    aiding_link = (pmtk_link_t) { .send = send_command, .wait_ack = wait_ack, .arg = acks };
+    pmtk_set_ack_handler(queue_ack, acks);
+
+    /* the clock is only trusted if it kept running since the fix */
+    uint32_t now = time(NULL);
+    bool valid = last_fix.magic == LAST_FIX_MAGIC
+        && last_fix.crc == crc32_update(0, &last_fix, offsetof(last_fix_t, crc))
+        && now >= last_fix.clock;
+    if (valid) {
+        uint32_t utc = last_fix.fix.time + (now - last_fix.clock);
+        esp_err_t err = pmtk_aid(&aiding_link, last_fix.fix.lat, last_fix.fix.lon, last_fix.fix.ele, utc);
+        ESP_LOGI(TAG, "Aiding with the fix from %lu s ago: %s", (unsigned long)(now - last_fix.clock), esp_err_to_name(err));
+
+        err = pmtk_epo_begin(&epo_upload, &aiding_link, read_epo, NULL, utc);
+        if (err == ESP_OK) {
+            epo_uploading = true;
+            return;
+        }
+        ESP_LOGW(TAG, "No EPO upload: %s", esp_err_to_name(err));
+        sd_call(SD_PRIO_LOG, close_epo, NULL);
+    }
+    pmtk_set_ack_handler(NULL, NULL);
+}
+
+/* a few orbits per call, the receiver uses the ones it has already */
+static void continue_epo_upload()
+{
+    if (!epo_uploading)
+        return;
+    esp_err_t err = pmtk_epo_step(&epo_upload, &aiding_link, EPO_COMMANDS);
+    if (err == ESP_ERR_NOT_FINISHED)
+        return;
+    if (err != ESP_OK)
+        ESP_LOGW(TAG, "EPO upload stopped: %s", esp_err_to_name(err));
+    epo_uploading = false;
+    sd_call(SD_PRIO_LOG, close_epo, NULL);
+    pmtk_set_ack_handler(NULL, NULL);
+}
+
+static error_code_t open_track_log(void* arg)
+{
+    track_log = track_log_open(sd_storage, TRACK_LOG_PATH);
+    return track_log ? PM_OK : PM_FAIL;
+}
+
+static error_code_t flush_track_log(void* arg)
+{
+    if (!track_log)
+        return UNAVAILABLE;
+    return track_log_flush(track_log, &track_ring);
+}
+
+static error_code_t begin_export(void* arg)
+{
+    track_export_t** e = arg;
+    *e = track_export_begin(sd_storage, TRACK_LOG_PATH, TRACK_GPX_PATH, "IndiaNavi GPS Log", time(NULL), &export_mark);
+    return *e ? PM_OK : UNAVAILABLE;
+}
+
+static error_code_t export_step(void* arg)
+{
+    return track_export_step(arg);
+}
+
+static error_code_t end_export(void* arg)
+{
+    return track_export_end(arg);
+}
+
+/* one block per request, the screen can read tiles in between */
+static error_code_t export_track()
+{
+    track_export_t* e = NULL;
+    sd_call(SD_PRIO_LOG, flush_track_log, NULL);
+    error_code_t ret = sd_call(SD_PRIO_LOG, begin_export, &e);
+    if (ret != PM_OK)
+        return ret;
+    while ((ret = sd_call(SD_PRIO_LOG, export_step, e)) == PM_OK)
+        ;
+    if (ret == NOT_NEEDED)
+        ret = PM_OK;
+    error_code_t end = sd_call(SD_PRIO_LOG, end_export, e);
+    return ret == PM_OK ? end : ret;
+}
+
 void StartGpsTask(void const* argument)
 {
-    uint8_t minute = 0;
     /* make current gps position known globally */
-    map_position = &current_position;
+    gps_position = &current_position;
 
     ESP_LOGI(TAG, "init gpio %d\n\r", GPS_VCC_nEN);
     /* create power regulator */
@@ -173,13 +372,6 @@ void StartGpsTask(void const* argument)
     tz_file->dest = timezone_file;
     tz_file->loaded = false;
     loadFile(tz_file);
-    uint8_t delay = 0;
-    ESP_LOGI(TAG, "Load timezone information queued");
-    while (!tz_file->loaded) {
-        vTaskDelay(100 / portTICK_PERIOD_MS);
-        if (delay++ == 20)
-            break;
-    }
     ESP_LOGI(TAG, "Load timezone information loaded");
     if (tz_file->loaded) {
         char tz[50] = { 0 };
@@ -192,7 +384,10 @@ void StartGpsTask(void const* argument)
     }
     tzset();
 
-    gpstrack_queue = xQueueCreate(10, sizeof(log_position_t));
+    track_ring_init(&track_ring);
+    ESP_LOGI(TAG, "%lu fixes from before the sleep", (unsigned long)track_ring_count(&track_ring));
+    if (sd_call(SD_PRIO_LOG, open_track_log, NULL) != PM_OK)
+        ESP_LOGE(TAG, "Cannot open track log");
 
     ESP_LOGI(TAG, "UART config");
     /* NMEA parser configuration */
@@ -216,56 +411,58 @@ void StartGpsTask(void const* argument)
     // send initial commands to GPS module
     ESP_ERROR_CHECK(nmea_send_command(nmea_hdl, L96_SEARCH_GPS_GLONASS_GALILEO));
     ESP_ERROR_CHECK(nmea_send_command(nmea_hdl, L96_ENTER_GLP));
+    aid_receiver();
 
-    async_file_t* gps_track = &BFILE;
-    gps_track->filename = "//log.gpx";
-    if (PM_OK == openFileForWriting(gps_track)) {
-        char* gpxbuffer = RTOS_Malloc(1024);
-        if (gpxbuffer) {
-            struct tm timeinfo;
-            time_t now;
-            time(&now);
-            localtime_r(&now, &timeinfo);
-            ctime_r(&now, timeString);
-            save_snprintf(gpxbuffer, 1024, gpx_header, timeString);
-            uint32_t bytes_written;
-            writeToFile(gps_track, gpxbuffer, strlen(gpxbuffer), &bytes_written);
-            ESP_LOGI(TAG, "Written %lu", bytes_written);
-            RTOS_Free(gpxbuffer);
+    uint32_t seconds = 0, flushed = 0, last_fix_second = 0, dropped = 0;
+    bool exported = true;
+    uint32_t head = track_ring.head;
+    uint32_t shown = gps_position_generation(&current_position);
+    gps_profile_t profile = GPS_PROFILE_MAX;
+    for (;;) {
+        if (profile != requested_profile) {
+            profile = requested_profile;
+            ESP_LOGI(TAG, "Profile %d", profile);
+            if (nmea_parser_configure(nmea_hdl, &profiles[profile]) != ESP_OK)
+                ESP_LOGE(TAG, "Cannot configure the receiver");
         }
-    } else {
-        ESP_LOGE(TAG, "Cannot open log file for writing");
-    }
+        continue_epo_upload();
 
-    for (;;) {
-        // struct tm timeinfo;
-        struct timeval tv;
-        gettimeofday(&tv, NULL);
-        struct tm* timeinfo = localtime(&tv.tv_sec);
-        if (clock_label && minute != timeinfo->tm_min) {
-            trigger_rendering();
+        /* the clock is updated by the gui task, the map screen picks up the new position */
+        if (seconds % TRACK_UPDATE_S == 0 && gps_position_generation(&current_position) != shown) {
+            map_position_t position;
+            shown = gps_position_read(&current_position, &position);
+            if (position.fix != GPS_FIX_INVALID) {
+                ESP_LOGI(TAG, "Fix: %d", position.fix);
+                trigger_update();
+            }
         }
 
-        /* check for lon and lat to be a number */
-        if ((current_position.fix != GPS_FIX_INVALID)) {
-            ESP_LOGI(TAG, "Fix: %d", current_position.fix);
+        /* every fix is kept, the ring is emptied long before it is full */
+        if (track_ring.head != head) {
+            head = track_ring.head;
+            last_fix_second = seconds;
+        }
+        uint32_t pending = track_ring_count(&track_ring);
+        if (pending >= TRACK_RING_SIZE / 2 || (pending && seconds - flushed >= TRACK_FLUSH_S)) {
+            if (sd_call(SD_PRIO_LOG, flush_track_log, NULL) == PM_OK)
+                exported = false;
+            flushed = seconds;
+        }
+        if (track_ring.dropped != dropped) {
+            dropped = track_ring.dropped;
+            ESP_LOGE(TAG, "%lu fixes dropped", (unsigned long)dropped);
         }
 
-        log_position_t position;
-        char trkpt[] = "<trkpt lat=\"%f\" lon=\"%f\"><ele>%f</ele><time>%s</time></trkpt>\n";
-        char trkpt_buf[255];
-        if (gps_track->loaded) {
-            while (xQueueReceive(gpstrack_queue, &position, 0) == pdTRUE) {
-                if (position.position.fix == GPS_FIX_GPS) {
-                    ctime_r(&position.timestamp, timeString);
-                    save_snprintf(trkpt_buf, sizeof(trkpt_buf), trkpt, position.position.latitude, position.position.longitude, position.position.altitude, timeString);
-                    uint32_t bytes_written;
-                    writeToFile(gps_track, trkpt_buf, strlen(trkpt_buf), &bytes_written);
-                    ESP_LOGI(TAG, "GPS queue: %f, %f, written %lu", position.position.latitude, position.position.longitude, bytes_written);
-                }
-            }
+        /* the GPX file is written when it does not get in the way */
+        bool idle = seconds - last_fix_second >= TRACK_EXPORT_IDLE_S;
+        if (export_requested || (!exported && (is_charging || idle))) {
+            export_requested = false;
+            exported = true;
+            if (export_track() != PM_OK)
+                ESP_LOGE(TAG, "Cannot export track");
         }
-        // Update every minute
-        vTaskDelay(60000 / portTICK_PERIOD_MS);
+
+        vTaskDelay(1000 / portTICK_PERIOD_MS);
+        seconds++;
     }
 }
@@ -35,15 +35,19 @@ const uint16_t margin_left = 5;
 const uint16_t margin_right = 5;
 const uint16_t margin_horizontal = 10;
 
+/* frames drawn before the display is refreshed, the first one is followed by repairs */
+static const uint8_t max_frames_per_refresh = 3;
+
 static const char* TAG = "GUI";
 
 static display_t* eink;
 
 extern void vTaskGetRunTimeStats(char* pcWriteBuffer);
 
-render_t* render_pipeline[RL_MAX]; // maximum number of rendered items
-render_t* render_last[RL_MAX];     // pointer to end of render pipeline
-static uint8_t render_needed = 0;
+static volatile uint8_t render_needed = 0;
+static volatile uint8_t redraw_needed = 0;
+static volatile uint8_t update_needed = 0;
+static int clock_minute = -1;
 
 app_mode_t _app_mode = INITIAL_APP_MODE;
 font_t f8x8, f8x16;
@@ -58,7 +62,7 @@ size_t _post_rener_hook_arg;
 
 void (*free_screen_func)(void);
 
-map_position_t* map_position;
+gps_position_t* gps_position;
 
 acep_5in65_dev_t eink_dev = {
     .clk = EINK_SPI_CLK,
@@ -69,64 +73,6 @@ acep_5in65_dev_t eink_dev = {
     .host = SPI3_HOST,
 };
 
-/**
- * Add render function to pipeline
- *
- * @return render slot
- */
-render_t* add_to_render_pipeline(error_code_t (*render)(const display_t* dsp, void* component),
-    void* comp,
-    enum RenderLayer layer)
-{
-    // increase render slot before adding this one. Slot 0 is overflow!
-    render_t* rd = RTOS_Malloc(sizeof(render_t));
-    if (!rd) {
-        ESP_LOGE(TAG, "render pipeline full!");
-        return 0;
-    }
-    rd->render = render;
-    rd->comp = comp;
-
-    if (render_pipeline[layer] == NULL) {
-        render_pipeline[layer] = rd;
-    } else {
-        render_last[layer]->next = rd;
-    }
-    render_last[layer] = rd;
-
-    return rd;
-}
-
-void free_render_pipeline(enum RenderLayer layer)
-{
-    render_t* r = render_pipeline[layer];
-    while (r) {
-        render_t* rn;
-        rn = r;
-        r = r->next;
-        RTOS_Free(rn);
-    }
-    render_pipeline[layer] = 0;
-}
-
-void free_all_render_pipelines()
-{
-    for (uint8_t i = 0; i < RL_MAX; i++)
-        free_render_pipeline(i);
-}
-
-/**
- * Add a prerender callback to pipeline
- *
- * This is called before all other renderers are called.
- *
- * @return render slot
- */
-render_t* add_pre_render_callback(error_code_t (*cb)(const display_t* dsp, void* component))
-{
-    return add_to_render_pipeline(cb, NULL, RL_PRE_RENDER);
-}
-
 static label_t* create_icon_with_text(const display_t* dsp, uint8_t* icon_data,
     uint16_t left, uint16_t top, char* text, font_t* font)
 {
@@ -157,9 +103,28 @@ error_code_t updateTimeText(const display_t* dsp, void* comp)
     sprintf(clock_label->text, "%02d:%02d", timeinfo->tm_hour,
         timeinfo->tm_min);
     xSemaphoreGive(print_semaphore);
+    clock_minute = timeinfo->tm_min;
     return PM_OK;
 }
 
+/**
+ * Mark the clock label dirty when the minute changes
+ */
+static void clock_tick()
+{
+    if (!clock_label)
+        return;
+
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    struct tm* timeinfo = localtime(&tv.tv_sec);
+    if (timeinfo->tm_min == clock_minute)
+        return;
+
+    updateTimeText(eink, clock_label);
+    clock_label->dirty = 1;
+}
+
 static int sprint_battery_percent(char* buffer, const char* format, ...)
 {
     va_list args;
@@ -209,30 +174,24 @@ static void create_top_bar(const display_t* dsp)
         sb->box.width, sb->box.height);
     clock_label->alignVertical = MIDDLE;
     clock_label->alignHorizontal = CENTER;
-    clock_label->onBeforeRender = updateTimeText;
+    /* text is kept current by clock_tick */
+    updateTimeText(dsp, clock_label);
     add_to_render_pipeline(label_render, clock_label, RL_GUI_ELEMENTS);
 #endif
 }
 
 /**
- * Render all App components.
+ * Render all App components that need it.
+ *
+ * Continues an interrupted frame, otherwise draws what changed since the
+ * last frame.
  */
 static error_code_t app_render()
 {
-    render_t* rd;
     uint64_t start = esp_timer_get_time();
-    display_fill(eink, WHITE);
-    for (uint8_t layer = 0; layer < RL_MAX; layer++) {
-        rd = render_pipeline[layer];
-        while (rd) {
-            if (render_needed)
-                return DEFERRED;
-            if (rd->render)
-                rd->render(eink, rd->comp);
-            rd = rd->next;
-        }
-        vTaskDelay(0);
-    }
+    error_code_t ret = render_pipeline_render_damage(eink, &render_needed);
+    if (ret != PM_OK)
+        return ret;
 
     uint64_t end = esp_timer_get_time();
 
@@ -273,10 +232,28 @@ void set_post_rendering_hook(error_code_t (*cb)(size_t arg), size_t arg)
     _post_render_hook = cb;
 }
 
+/**
+ * Run the free function of the current screen once
+ */
 void free_screen(void)
 {
     if (free_screen_func)
         free_screen_func();
+    free_screen_func = NULL;
+}
+
+/**
+ * Drop the render pipeline and all labels and images of the current screen
+ */
+static void free_screen_components(void)
+{
+    free_all_render_pipelines();
+    label_pool_reset();
+    image_pool_reset();
+    clock_label = NULL;
+    north_indicator_label = NULL;
+    gps_indicator_label = NULL;
+    sd_indicator_label = NULL;
 }
 /**
  * Set screen free function
@@ -299,6 +276,7 @@ void app_screen(const display_t* dsp)
     case APP_TEST_SCREEN:
         create_top_bar(dsp);
         test_screen_create(dsp);
+        gps_set_profile(GPS_PROFILE_SATELLITES);
         gui_set_app_mode(APP_MODE_RUNNING);
         break;
     case APP_START_SCREEN_TRANSITION:
@@ -306,15 +284,18 @@ void app_screen(const display_t* dsp)
             break;
         /* free start screen and fall throught to map screen generation*/
         free_screen();
+        free_screen_components();
         gui_set_app_mode(APP_MODE_GPS_CREATE);
         __attribute__((fallthrough));
     case APP_MODE_GPS_CREATE:
         create_top_bar(dsp);
         map_screen_create(dsp);
+        gps_set_profile(GPS_PROFILE_MAP);
         gui_set_app_mode(APP_MODE_RUNNING);
         break;
     case APP_MODE_TURN_OFF:
-        free_all_render_pipelines();
+        free_screen();
+        free_screen_components();
         off_screen_create(dsp);
         set_post_rendering_hook(enter_deep_sleep_if_not_charging, 0);
         gps_enter_standby();
@@ -327,11 +308,25 @@ void app_screen(const display_t* dsp)
     }
 }
 
+/**
+ * Redraw the whole screen
+ */
 void trigger_rendering()
 {
+    redraw_needed = 1;
     render_needed = 1;
 }
 
+/**
+ * Rerun the pre render callbacks and redraw the components they changed
+ *
+ * Does not interrupt a frame that is currently drawn.
+ */
+void trigger_update()
+{
+    update_needed = 1;
+}
+
 void render_cmd_cb(const command_t* cmd)
 {
     ESP_LOGI(TAG, "manual redraw");
@@ -385,21 +380,36 @@ void StartGuiTask(void const* argument)
     trigger_rendering();
 
     for (;;) {
-        if (render_needed) {
+        clock_tick();
+        if (render_needed || update_needed || render_pipeline_pending(eink)) {
             if (xSemaphoreTake(gui_semaphore, 0) == pdTRUE) {
-                while (render_needed) {
-                    // reset render count. if a renderer triggers a rerender we will directly rerender
-                    render_needed = 0;
-                    app_screen(eink);
-                    if (DEFERRED == app_render())
-                        ESP_LOGI(TAG, "rendering got restarted");
+                uint8_t frames = 0;
+                error_code_t ret;
+                do {
+                    if (render_needed || update_needed) {
+                        // reset render count. if a renderer triggers a rerender we will directly rerender
+                        render_needed = 0;
+                        update_needed = 0;
+                        app_screen(eink);
+                        render_pipeline_request_update();
+                    }
+                    if (redraw_needed) {
+                        redraw_needed = 0;
+                        render_pipeline_invalidate();
+                    }
+                    ret = app_render();
+                    if (ret == DEFERRED)
+                        ESP_LOGI(TAG, "rendering interrupted, continue frame");
+                    else if (ret == PM_OK)
+                        frames++;
+                } while (ret == DEFERRED || (ret == PM_OK && frames < max_frames_per_refresh));
+
+                if (frames) {
+                    ESP_LOGI(TAG, "Refresh.");
+                    display_commit_fb(eink);
+                    ESP_LOGI(TAG, "Refresh finished.");
+                    run_post_render_hook(eink);
                 }
-                ESP_LOGI(TAG, "Refresh.");
-                // vTaskPrioritySet(NULL, 1);
-                display_commit_fb(eink);
-                // vTaskPrioritySet(NULL, 5);
-                ESP_LOGI(TAG, "Refresh finished.");
-                run_post_render_hook(eink);
                 xSemaphoreGive(gui_semaphore);
             } else {
                 ESP_LOGI(TAG, "Render Mutex locked.");
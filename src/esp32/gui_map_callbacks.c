@@ -13,149 +13,174 @@
 
 static const char* TAG = "GUI_MAP";
 
+typedef struct {
+    const map_tile_t* tile;
+    uint8_t* data;
+    size_t size;
+    size_t length;
+} tile_file_t;
+
+/*
+ * Read a tile file into a buffer, runs on the SD task
+ *
+ * returns UNAVAILABLE if neither a file nor a pack has the tile
+ */
+static error_code_t read_tile_file(void* arg)
+{
+    tile_file_t* t = arg;
+    char fn[30]; // Filename size for zoom level 16.
+
+    // TODO: decompress lz4 tiles
+    save_sprintf(fn, "//MAPS/%u/%lu/%lu.RAW",
+        t->tile->z,
+        t->tile->x,
+        t->tile->y);
+
+    error_code_t ret = storage_read_file(sd_storage, fn, t->data, t->size, &t->length);
+    if (UNAVAILABLE == ret) // a file of its own wins over the pack of the tileset
+        ret = map_tiles_read_packed(t->tile, t->data, t->size, &t->length);
+    if (UNAVAILABLE == ret)
+        map_tiles_set(t->tile->z, t->tile->x, t->tile->y, 0);
+    if (PM_OK == ret && t->length < t->size) // short tile, the buffer is not zeroed
+        memset(t->data + t->length, 0, t->size - t->length);
+    if (PM_OK != ret && UNAVAILABLE != ret)
+        ESP_LOGI(TAG, "Error from SD card reading %s", fn);
+    return ret;
+}
+
+/*
+ * Read a tile on the SD task unless the index knows it is missing
+ */
+static error_code_t read_tile(tile_file_t* t)
+{
+    if (map_tiles_lookup(t->tile) == TILE_MISSING)
+        return UNAVAILABLE;
+    return sd_call(SD_PRIO_INTERACTIVE, read_tile_file, t);
+}
+
 /*
  * Load tile data from SD Card on render command
  *
  * We need a memory buffer since it is not enough memory available
  * to hold all 6 tiles in memory at once.
  *
- * returns PK_OK if loaded, UNAVAILABLE if buffer or sd semaphore is not available and
- * TIMEOUT if loading timed out
+ * returns PK_OK if loaded, UNAVAILABLE if there is no buffer and
+ * TIMEOUT if the tile could not be loaded
  */
 error_code_t load_map_tile_on_demand(const display_t* dsp, void* image)
 {
-    char fn[30]; // Filename size for zoom level 16.
-    FRESULT res = FR_NOT_READY;
-    uint8_t* imageBuf = RTOS_Malloc(256 * 256 / 2);
+    uint8_t* imageBuf = RTOS_MallocIO(256 * 256 / 2);
 
     if (!imageBuf)
         return UNAVAILABLE;
 
     image_t* img = (image_t*)image;
-    if (!uxSemaphoreGetCount(sd_semaphore)) { // binary semaphore returns 1 on not taken
-        RTOS_Free(imageBuf);
-        return UNAVAILABLE;
-    }
-
-    img->data = imageBuf;
     map_tile_t* tile = img->parent; // the parent component of the image is the tile
-    FIL t_img;
-    uint32_t br;
-    // TODO: decompress lz4 tiles
-    save_sprintf(fn, "//MAPS/%u/%lu/%lu.RAW",
-        tile->z,
-        tile->x,
-        tile->y);
-    ESP_LOGI(TAG, "Load %s  to %p", fn, tile->image->data);
-
-    waitForSDInit();
-    if (xSemaphoreTake(sd_semaphore, pdTICKS_TO_MS(1000))) {
-
-        res = f_open(&t_img, fn, FA_READ);
-        if (FR_OK == res && tile->image->data != 0) {
-            res = f_read(&t_img,
-                tile->image->data, 32768,
-                (UINT*)&br); // Tilesize 256*256/2 bytes
-            if (FR_OK == res) {
-                tile->image->loaded = LOADED;
-            }
-            f_close(&t_img);
-        } else {
-            ESP_LOGI(TAG, "Error from SD card: %d", res);
-            tile->image->loaded = NOT_FOUND;
-        }
-        xSemaphoreGive(sd_semaphore);
-    } else {
-        ESP_LOGI(TAG, "load timeout!");
-        goto freeImageMemory;
-    }
-
     label_t* l = (label_t*)img->child;
-    if (img->loaded == LOADED) {
+    tile_file_t t = { tile, imageBuf, 256 * 256 / 2 };
+
+    switch (read_tile(&t)) {
+    case PM_OK:
+        img->data = imageBuf;
+        img->loaded = LOADED;
         l->text = "";
         return PM_OK;
-    }
-
-    if (img->loaded == ERROR) {
-        l->text = "Error";
-        goto freeImageMemory;
-    }
-    if (img->loaded == NOT_FOUND) {
+    case UNAVAILABLE:
+        img->loaded = NOT_FOUND;
         l->text = "Not Found";
-        goto freeImageMemory;
+        break;
+    default:
+        img->loaded = ERROR;
+        l->text = "Error";
+        break;
     }
 
-freeImageMemory:
     RTOS_Free(imageBuf);
     return TIMEOUT;
 }
 
-error_code_t load_map_tiles_to_permanent_memory(const display_t* dsp, void* _map)
+/*
+ * Read a tile for the tile pipeline
+ *
+ * Runs on the pipeline reader task, so the GUI task can draw the previous
+ * tile while the SD task reads this one.
+ */
+error_code_t read_map_tile(const map_tile_t* tile, uint8_t* data, size_t size, size_t* length)
 {
-    char fn[30]; // Filename size for zoom level 16.
-    FRESULT res = FR_NOT_READY;
+    tile_file_t t = { tile, data, size };
+    error_code_t ret = read_tile(&t);
+    *length = t.length;
+    return ret;
+}
 
-    map_t* map = (map_t*)_map;
+static error_code_t load_tile_to_permanent_memory(void* arg)
+{
+    map_tile_t* tile = arg;
+    char fn[30]; // Filename size for zoom level 16.
+    uint32_t fsize;
+    size_t br;
+    tile_pack_entry_t entry;
+    uint8_t packed = 0;
 
-    if (!uxSemaphoreGetCount(sd_semaphore)) { // binary semaphore returns 1 on not taken
+    save_sprintf(fn, "//MAPS/%u/%lu/%lu.RAW",
+        tile->z,
+        tile->x,
+        tile->y);
+    // TODO: decompress lz4 tiles
+    // Check file info
+    if (PM_OK != storage_stat(sd_storage, fn, &fsize)) {
+        if (PM_OK != map_tiles_packed_entry(tile->z, tile->x, tile->y, &entry)) {
+            ESP_LOGI(TAG, "Error from SD card stat %s", fn);
+            return UNAVAILABLE;
+        }
+        fsize = entry.length;
+        packed = 1;
+    }
+    // Allocate file size if we need to
+    if (!tile->image->data || tile->image->data_length != fsize) {
+        if (tile->image->data)        // throw away old memory
+            RTOS_Free(tile->image->data);
+        tile->image->data_length = 0; // reset length
+        if ((tile->image->data = RTOS_MallocIO(fsize)))
+            tile->image->data_length = fsize;
+    }
+    ESP_LOGI(TAG, "Load %s to %p", fn, tile->image->data);
+    if (tile->image->data == 0) {
+        tile->image->loaded = NOT_FOUND;
         return UNAVAILABLE;
     }
+    // open file and load image data
+    error_code_t ret = packed ? map_tiles_read_packed(tile, tile->image->data, fsize, &br)
+                              : storage_read_file(sd_storage, fn, tile->image->data, fsize, &br);
+    if (PM_OK == ret) {
+        tile->image->loaded = LOADED;
+    } else if (UNAVAILABLE == ret) {
+        tile->image->loaded = NOT_FOUND;
+    } else {
+        ESP_LOGI(TAG, "Error from SD card reading %s", fn);
+    }
+    return ret;
+}
+
+error_code_t load_map_tiles_to_permanent_memory(const display_t* dsp, void* _map)
+{
+    map_t* map = (map_t*)_map;
 
     for (size_t i = 0; i < map->tile_count; i++) {
         map_tile_t* tile = map->tiles[i];
-        FIL t_img;
-        FILINFO t_img_nfo;
-        uint32_t br;
 
         if (tile->image->loaded == LOADED) {
             continue;
         }
 
-        save_sprintf(fn, "//MAPS/%u/%lu/%lu.RAW",
-            tile->z,
-            tile->x,
-            tile->y);
-        // TODO: decompress lz4 tiles
-        waitForSDInit();
-        if (xSemaphoreTake(sd_semaphore, pdTICKS_TO_MS(1000))) {
-            // Check file info
-            res = f_stat((const TCHAR*)&fn, &t_img_nfo);
-            if (FR_OK == res) {
-                // Allocate file size if we need to
-                if (!tile->image->data || tile->image->data_length != t_img_nfo.fsize) {
-                    if (tile->image->data)        // throw away old memory
-                        RTOS_Free(tile->image->data);
-                    tile->image->data_length = 0; // reset length
-                    if ((tile->image->data = RTOS_Malloc(t_img_nfo.fsize)))
-                        tile->image->data_length = t_img_nfo.fsize;
-                }
-            } else {
-                ESP_LOGI(TAG, "Error from SD card f_stat: %d", res);
-                continue;
-            }
-            // open file and load image data
-            res = f_open(&t_img, fn, FA_READ);
-            ESP_LOGI(TAG, "Load %s to %p", fn, tile->image->data);
-            if (FR_OK == res && tile->image->data != 0) {
-                res = f_read(&t_img,
-                    tile->image->data, t_img_nfo.fsize,
-                    (UINT*)&br);
-                if (FR_OK == res) {
-                    tile->image->loaded = LOADED;
-                    tile->label->text = "";
-                } else {
-                    ESP_LOGI(TAG, "Error from SD card f_read: %d", res);
-                }
-                f_close(&t_img);
-            } else {
-                ESP_LOGI(TAG, "Error from SD card f_open: %d", res);
-                tile->image->loaded = NOT_FOUND;
-            }
-            xSemaphoreGive(sd_semaphore);
-        } else {
-            ESP_LOGI(TAG, "load timeout!");
-        }
+        if (map_tiles_lookup(tile) == TILE_MISSING)
+            tile->image->loaded = NOT_FOUND;
+        else
+            sd_call(SD_PRIO_INTERACTIVE, load_tile_to_permanent_memory, tile);
 
+        if (tile->image->loaded == LOADED) {
+            tile->label->text = "";
+        }
         if (tile->image->loaded == ERROR) {
             tile->label->text = "Error";
         }
@@ -180,7 +205,10 @@ error_code_t check_if_map_tile_is_loaded(const display_t* dsp, void* image)
 error_code_t map_render_copyright(const display_t* dsp, void* label)
 {
     label_t* l = (label_t*)label;
-    if (map_position && map_position->fix) {
+    map_position_t position = { 0 };
+    if (gps_position)
+        gps_position_read(gps_position, &position);
+    if (position.fix) {
         // TODO: get this information from map info on SD card!
         l->text = "(c) OpenStreetMap contributors";
         label_shrink_to_text(l);
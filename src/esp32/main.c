@@ -57,7 +57,6 @@ void StartMapDownloaderTask(void* argument);
 // Create semphore
 SemaphoreHandle_t print_semaphore = NULL;
 SemaphoreHandle_t gui_semaphore = NULL;
-SemaphoreHandle_t sd_semaphore = NULL;
 
 TaskHandle_t housekeepingTask_h;
 TaskHandle_t gpsTask_h;
@@ -217,6 +216,7 @@ error_code_t enter_deep_sleep_if_not_charging()
     rtc_gpio_pullup_en(BTN);
     rtc_gpio_pulldown_dis(BTN);
 
+    sd_stream_sync_all();
     ESP_LOGI(TAG, "enter deep sleep now...");
     esp_deep_sleep_start();
     return PM_OK;
@@ -302,10 +302,9 @@ void app_main()
     esp_timer_create(&button_timer_args, &button_timer);
 
 #ifndef JTAG
-    xTaskCreate(&StartSDTask, "sd", taskSDStackSize, NULL, 1, &sdTask_h);
-    while (!sd_semaphore) {
-        vTaskDelay(pdMS_TO_TICKS(100));
-    }
+    /* the GUI waits for tiles from the SD task, run it at the same priority */
+    xTaskCreate(&StartSDTask, "sd", taskSDStackSize, NULL, 6, &sdTask_h);
+    waitForSDInit();
 #endif
 
     ESP_LOGI(TAG, "load configuration file");
@@ -344,8 +343,8 @@ void app_main()
         // ESP_ERROR_CHECK(lsm303_read_tap(&tap_register));
         if (tap_register & 0x09) // double tap
         {
-            ESP_LOGI(TAG, "Double Tap recognized. rerender.");
-            trigger_rendering();
+            ESP_LOGI(TAG, "Double Tap recognized. update.");
+            trigger_update();
         }
 #endif
         if (++cnt >= 300) {
@@ -382,7 +381,7 @@ void app_main()
                 xTaskCreate(&StartWiFiTask, "wifi", taskWifiStackSize, NULL, 8, &wifiTask_h);
             } else if (event_num == TASK_EVENT_DISABLE_WIFI || event_num == TASK_EVENT_STOP_CHARGING) {
                 vTaskDelete(wifiTask_h);
-                trigger_rendering();
+                off_screen_invalidate();
             }
         }
     }
@@ -15,8 +15,12 @@
 #include "nvs_flash.h"
 #include <sys/socket.h>
 
+#include "downloader.h"
 #include "gui.h"
 #include "tasks.h"
+#include "tile_manifest.h"
+#include "tile_pack.h"
+#include "tile_schedule.h"
 
 typedef struct tileset tileset_t;
 struct tileset {
@@ -31,10 +35,70 @@ struct tileset {
     tileset_t* next;
 };
 
+typedef struct {
+    tile_schedule_t* schedule;
+    tile_manifest_t* manifest; /// NULL if the server has none, tiles on the card are kept then
+    const char* path;          /// of the tiles on the server
+    sd_stream_t* stream;
+    download_t* owner; /// download the stream belongs to
+    uint8_t percent;   /// shown in the status label
+    uint32_t failed;   /// tiles that are not up to date after the download
+} tile_download_t;
+
+/* manifest work that runs on the SD task */
+typedef struct {
+    tile_manifest_t* manifest;
+    const void* data;
+    size_t length;
+    uint8_t zoom;
+    uint32_t x;
+    uint32_t y;
+    tile_manifest_entry_t entry;
+} manifest_call_t;
+
+typedef struct {
+    manifest_call_t call;
+    const char* path; /// of the tiles on the server
+    uint8_t requested;
+    uint8_t loaded;
+} manifest_download_t;
+
+/* the packs of the areas that are mostly missing come as one stream each */
+typedef struct {
+    tile_schedule_t* schedule;
+    const char* path; /// of the tiles on the server
+    uint8_t area;     /// next area to ask for
+    sd_stream_t* stream;
+    download_t* owner; /// download the stream belongs to
+    tile_pack_check_t check;
+    uint32_t packs; /// that arrived complete
+} pack_download_t;
+
+typedef struct {
+    const char* from;
+    const char* to;
+} file_rename_t;
+
+#define DOWNLOAD_IN_FLIGHT 4
+#define DOWNLOAD_ATTEMPTS 5
+#define DOWNLOAD_TIMEOUT_MS 10000
+#define DOWNLOAD_BACKOFF_MS 1000
+#define DOWNLOAD_BACKOFF_MAX_MS 60000
+#define DOWNLOAD_CORRIDOR 1 /// tiles on each side of the route that come first
+#define DOWNLOAD_STATUS_LENGTH 24
+#define DOWNLOAD_MANIFEST "/manifest" /// on the server, next to the tile folders
+#define DOWNLOAD_PACK_MISSING 50           /// percent of an area that has to be missing to fetch its pack
+#define DOWNLOAD_PACK_BUFFER (16 * 1024)   /// stream buffer, a pack is written in large sequential blocks
+#define MAP_TILE_FOLDER "//MAPS"
+
 static const char* TAG = "DL";
-static async_file_t* downloadfile;
+static char* download_filename;
+static sd_stream_t* download_stream;
 label_t* download_status;
-char* download_status_text = "Downloader active";
+char download_status_text[DOWNLOAD_STATUS_LENGTH] = "Downloader active";
+static track_point_t* route;
+static uint32_t route_points;
+static uint32_t route_size;
 esp_err_t startDownloadFile(void* handler, const char* url);
 
 static esp_err_t _http_event_handler(esp_http_client_event_t* evt)
@@ -53,27 +117,30 @@ static esp_err_t _http_event_handler(esp_http_client_event_t* evt)
         ESP_LOGD(TAG, "HTTP_EVENT_ON_HEADER, key=%s, value=%s", evt->header_key, evt->header_value);
         const char* contentLength = "Content-Length";
         if (0 == strcmp(evt->header_key, contentLength)) {
-            if (PM_OK != openFileForWriting(downloadfile))
+            sd_stream_close(download_stream);
+            download_stream = sd_stream_open(download_filename, SD_PRIO_DOWNLOAD, 0, atoi(evt->header_value));
+            if (!download_stream)
                 return ESP_FAIL;
-            ESP_LOGD(TAG, "Create File to download: %s", downloadfile->filename);
+            ESP_LOGD(TAG, "Create File to download: %s", download_filename);
         }
         break;
     case HTTP_EVENT_ON_DATA:
         ESP_LOGD(TAG, "HTTP_EVENT_ON_DATA, len=%d", evt->data_len);
-        if (downloadfile->file != 0) {
-            uint32_t bytes_written = 0;
-            writeToFile(downloadfile, evt->data, evt->data_len, &bytes_written);
-            ESP_LOGD(TAG, "Wrote to download: %d/%lu", evt->data_len, bytes_written);
-            if (evt->data_len != bytes_written)
+        if (download_stream) {
+            if (PM_OK != sd_stream_write(download_stream, evt->data, evt->data_len))
                 return ESP_FAIL;
+            ESP_LOGD(TAG, "Wrote to download: %d", evt->data_len);
         }
         break;
     case HTTP_EVENT_ON_FINISH:
         ESP_LOGD(TAG, "HTTP_EVENT_ON_FINISH");
-        closeFile(downloadfile);
+        sd_stream_close(download_stream);
+        download_stream = NULL;
         break;
     case HTTP_EVENT_DISCONNECTED:
         ESP_LOGD(TAG, "HTTP_EVENT_DISCONNECTED");
+        sd_stream_close(download_stream);
+        download_stream = NULL;
         break;
     case HTTP_EVENT_REDIRECT:
         ESP_LOGD(TAG, "HTTP_EVENT_REDIRECT");
@@ -82,47 +149,542 @@ static esp_err_t _http_event_handler(esp_http_client_event_t* evt)
     return ESP_OK;
 }
 
-static void downloadMapTilesForZoomLevel(tileset_t* t, async_file_t* wp_file)
-{
-    uint32_t fail_counter = 0;
-    ESP_LOGE(TAG, "URL Size is:%d", strlen(t->baseurl) + 26);
-    char* url = RTOS_Malloc(strlen(t->baseurl) + 26); // base+/zz/xxxxx/yyyyy.raw
-    downloadfile = createPhysicalFile();
-    ESP_LOGI(TAG, "Run zoom level:%d from %s", t->zoom, t->baseurl);
-    for (uint32_t x = t->folder_min; x <= t->folder_max; x++) {
-        for (uint32_t y = t->file_min; y <= t->file_max; y++) {
-            save_sprintf(url, "%s/%u/%lu/%lu.raw", t->baseurl, t->zoom, x, y);
-            save_sprintf(wp_file->filename, "//MAPS/%u/%lu/%lu.raw", t->zoom, x, y);
-            if (fileExists(wp_file) != PM_OK) {
-                // Get File because we can not find it on the SD card
-                downloadfile->filename = wp_file->filename;
-                esp_err_t err;
-                do {
-                    while (isConnected() != PM_OK) {
-                        ESP_LOGI(TAG, "Wait for WiFi connection");
-                        vTaskDelay(3000 / portTICK_PERIOD_MS);
-                    }
-                    ESP_LOGI(TAG, "Get %s -> '%s'", url, wp_file->filename);
-                    err = startDownloadFile(_http_event_handler, url);
-                    if (err != ESP_OK) {
-                        ESP_LOGE(TAG, "HTTP GET request failed: %s", esp_err_to_name(err));
-                        if (++fail_counter == 10) {
-                            fail_counter = 0;
-                            esp_restart();
-                        }
-                        vTaskDelay(1000 / portTICK_PERIOD_MS);
-                    }
-                } while (err != ESP_OK);
-            } else {
-                ESP_LOGD(TAG, "File %s exists!", wp_file->filename);
+static void wait_for_wifi()
+{
+    while (!isConnected()) {
+        ESP_LOGI(TAG, "Wait for WiFi connection");
+        vTaskDelay(3000 / portTICK_PERIOD_MS);
+    }
+}
+
+/* show how much of the schedule went through */
+static void show_progress(tile_download_t* td)
+{
+    tile_schedule_t* sc = td->schedule;
+    uint8_t percent = sc->tiles ? (uint64_t)sc->scheduled * 100 / sc->tiles : 100;
+    if (!download_status || percent == td->percent)
+        return;
+    td->percent = percent;
+    save_snprintf(download_status_text, DOWNLOAD_STATUS_LENGTH, "%s %u%%",
+        sc->phase == TILE_SCHEDULE_ROUTE ? "Route" : "Map", percent);
+    download_status->dirty = 1;
+    trigger_update();
+}
+
+static error_code_t manifest_create(void* arg)
+{
+    manifest_call_t* c = arg;
+    c->manifest = tile_manifest_create(sd_storage, MAP_TILE_FOLDER);
+    return c->manifest ? PM_OK : PM_FAIL;
+}
+
+static error_code_t manifest_free(void* arg)
+{
+    tile_manifest_free(((manifest_call_t*)arg)->manifest);
+    return PM_OK;
+}
+
+static error_code_t manifest_begin(void* arg)
+{
+    return tile_manifest_begin(((manifest_call_t*)arg)->manifest);
+}
+
+static error_code_t manifest_feed(void* arg)
+{
+    manifest_call_t* c = arg;
+    return tile_manifest_feed(c->manifest, c->data, c->length);
+}
+
+static error_code_t manifest_end(void* arg)
+{
+    return tile_manifest_end(((manifest_call_t*)arg)->manifest);
+}
+
+static error_code_t manifest_lookup(void* arg)
+{
+    manifest_call_t* c = arg;
+    return tile_manifest_lookup(c->manifest, c->zoom, c->x, c->y, &c->entry);
+}
+
+/* a tile without a file of its own is compared with its pack entry */
+static error_code_t manifest_check(void* arg)
+{
+    manifest_call_t* c = arg;
+    tile_pack_entry_t e;
+    error_code_t ret = tile_manifest_check_file(c->manifest, &c->entry);
+    if (ret != UNAVAILABLE || map_tiles_packed_entry(c->zoom, c->x, c->y, &e) != PM_OK)
+        return ret;
+    return e.length == c->entry.size && e.crc == c->entry.crc ? PM_OK : PM_FAIL;
+}
+
+static error_code_t manifest_done(void* arg)
+{
+    manifest_call_t* c = arg;
+    return tile_manifest_done(c->manifest, c->zoom, c->x, c->y);
+}
+
+static error_code_t manifest_commit(void* arg)
+{
+    return tile_manifest_commit(((manifest_call_t*)arg)->manifest);
+}
+
+/*
+ * A tile of the manifest is fetched unless the card has its version, a
+ * changed tile on the card is only checked against size and CRC
+ */
+static uint8_t tile_outdated(tile_download_t* td, const map_tile_t* tile, enum TilePresence presence, download_t* d)
+{
+    manifest_call_t c = { .manifest = td->manifest, .zoom = tile->z, .x = tile->x, .y = tile->y };
+    error_code_t ret = sd_call(SD_PRIO_DOWNLOAD, manifest_lookup, &c);
+    if (ret != PM_OK) {
+        if (ret != UNAVAILABLE)
+            td->failed++;
+        return 0; // not on the server
+    }
+    if (presence == TILE_PRESENT && sd_call(SD_PRIO_DOWNLOAD, manifest_check, &c) == PM_OK) {
+        sd_call(SD_PRIO_DOWNLOAD, manifest_done, &c);
+        return 0;
+    }
+    d->verify = 1;
+    d->size = c.entry.size;
+    d->crc = c.entry.crc;
+    return 1;
+}
+
+/* next tile of the schedule that is not on the card yet, or changed on the server */
+static error_code_t next_tile(void* arg, download_t* d)
+{
+    tile_download_t* td = arg;
+    char filename[STORAGE_PATH_LENGTH];
+    async_file_t file = { .filename = filename, .priority = SD_PRIO_DOWNLOAD };
+    map_tile_t tile;
+
+    while (tile_schedule_next(td->schedule, &tile.z, &tile.x, &tile.y) == PM_OK) {
+        show_progress(td);
+        enum TilePresence presence = map_tiles_lookup(&tile);
+        if (presence == TILE_UNKNOWN) {
+            save_sprintf(filename, MAP_TILE_FOLDER "/%u/%lu/%lu.raw", tile.z, tile.x, tile.y);
+            presence = fileExists(&file) == PM_OK ? TILE_PRESENT : TILE_MISSING;
+        }
+        if (td->manifest) {
+            if (presence == TILE_PRESENT && !tile_manifest_stale(td->manifest, tile.z, tile.x, tile.y))
+                continue;
+            if (!tile_outdated(td, &tile, presence, d))
+                continue;
+        } else if (presence == TILE_PRESENT) {
+            continue;
+        }
+        d->key[0] = tile.z;
+        d->key[1] = tile.x;
+        d->key[2] = tile.y;
+        save_snprintf(d->path, sizeof(d->path), "%s/%u/%lu/%lu.raw", td->path, tile.z, tile.x, tile.y);
+        return PM_OK;
+    }
+    return NOT_NEEDED;
+}
+
+static error_code_t rename_file(void* arg)
+{
+    file_rename_t* r = arg;
+    return storage_rename(sd_storage, r->from, r->to);
+}
+
+static void tile_filename(const download_t* d, char* filename, const char* extension)
+{
+    save_sprintf(filename, MAP_TILE_FOLDER "/%lu/%lu/%lu.%s", d->key[0], d->key[1], d->key[2], extension);
+}
+
+/* a tile is complete on the card or not at all, the tile it replaces stays until then */
+static error_code_t store_tile(const download_t* d)
+{
+    char part[STORAGE_PATH_LENGTH];
+    char tile[STORAGE_PATH_LENGTH];
+    tile_filename(d, part, "PAR");
+    tile_filename(d, tile, "raw");
+    file_rename_t r = { part, tile };
+    return sd_call(SD_PRIO_DOWNLOAD, rename_file, &r);
+}
+
+/*
+ * Responses arrive one after the other, so one stream is enough. The tile
+ * is written as .PAR and only renamed once it is complete.
+ */
+static error_code_t open_tile(void* arg, download_t* d, uint32_t length)
+{
+    tile_download_t* td = arg;
+    char filename[STORAGE_PATH_LENGTH];
+    /* an interrupted tile is either retried, which truncates it, or deleted in finish_tile */
+    sd_stream_close(td->stream);
+    tile_filename(d, filename, "PAR");
+    td->stream = sd_stream_open(filename, SD_PRIO_DOWNLOAD, 0, length);
+    td->owner = d;
+    return td->stream ? PM_OK : PM_FAIL;
+}
+
+static error_code_t write_tile(void* arg, download_t* d, const uint8_t* data, size_t length)
+{
+    tile_download_t* td = arg;
+    return sd_stream_write(td->stream, data, length);
+}
+
+static void finish_tile(void* arg, download_t* d, error_code_t result)
+{
+    tile_download_t* td = arg;
+    error_code_t ret = result;
+    if (td->owner == d) {
+        if (sd_stream_close(td->stream) != PM_OK)
+            ret = PM_FAIL;
+        td->stream = NULL;
+        td->owner = NULL;
+    }
+    if (ret == PM_OK && (ret = store_tile(d)) == PM_OK) {
+        map_tiles_set(d->key[0], d->key[1], d->key[2], 1);
+        /* the tile is closed, the journal can tell it is done */
+        manifest_call_t c = { .manifest = td->manifest, .zoom = d->key[0], .x = d->key[1], .y = d->key[2] };
+        if (td->manifest && sd_call(SD_PRIO_DOWNLOAD, manifest_done, &c) != PM_OK)
+            td->failed++;
+        return;
+    }
+    char filename[STORAGE_PATH_LENGTH];
+    async_file_t file = { .filename = filename, .priority = SD_PRIO_DOWNLOAD };
+    tile_filename(d, filename, "PAR");
+    deleteFile(&file);
+    td->failed++;
+    if (result == UNAVAILABLE)
+        ESP_LOGE(TAG, "Tile %s is not on the server", d->path);
+}
+
+/* fallback for servers the downloader does not speak to, e.g. https */
+static void downloadMapTilesOneByOne(tile_download_t* td, const char* baseurl)
+{
+    char* url = RTOS_Malloc(strlen(baseurl) + 26); // base+/zz/xxxxx/yyyyy.raw
+    char filename[STORAGE_PATH_LENGTH];
+    async_file_t file = { .filename = filename, .priority = SD_PRIO_DOWNLOAD };
+    download_t d;
+    while (next_tile(td, &d) == PM_OK) {
+        save_sprintf(url, "%s/%lu/%lu/%lu.raw", baseurl, d.key[0], d.key[1], d.key[2]);
+        tile_filename(&d, filename, "PAR");
+        download_filename = filename;
+        uint32_t delay = DOWNLOAD_BACKOFF_MS;
+        uint8_t stored = 0;
+        for (uint8_t attempt = 0; attempt < DOWNLOAD_ATTEMPTS; attempt++) {
+            wait_for_wifi();
+            ESP_LOGI(TAG, "Get %s -> '%s'", url, filename);
+            esp_err_t err = startDownloadFile(_http_event_handler, url);
+            if (err == ESP_OK && store_tile(&d) == PM_OK) {
+                map_tiles_set(d.key[0], d.key[1], d.key[2], 1);
+                stored = 1;
+                break;
             }
-            vPortYield();
+            ESP_LOGE(TAG, "HTTP GET request failed: %s", esp_err_to_name(err));
+            vTaskDelay(pdMS_TO_TICKS(delay));
+            if (delay < DOWNLOAD_BACKOFF_MAX_MS)
+                delay <<= 1;
         }
+        if (!stored)
+            deleteFile(&file);
+        vPortYield();
     }
-    closePhysicalFile(downloadfile);
     RTOS_Free(url);
 }
 
+static void count_route_point(waypoint_t* wp)
+{
+    route_points++;
+}
+
+static void copy_route_point(waypoint_t* wp)
+{
+    if (route_points >= route_size)
+        return;
+    route[route_points].lat = wp->lat;
+    route[route_points].lon = wp->lon;
+    route_points++;
+}
+
+/*
+ * The route is the loaded GPX track or, if the map has none, the
+ * polyline at the end of the TRACK file, one "lat,lon" per line.
+ */
+static void load_route(char* f, char* line)
+{
+    /* the GUI task appends to the waypoints while it builds the map screen */
+    xSemaphoreTake(gui_semaphore, portMAX_DELAY);
+    route_points = 0;
+    map_run_on_waypoints(count_route_point);
+    route_size = route_points;
+    route_points = 0;
+    if (route_size && (route = RTOS_Malloc(route_size * sizeof(track_point_t))))
+        map_run_on_waypoints(copy_route_point);
+    xSemaphoreGive(gui_semaphore);
+
+    if (!route_size) {
+        for (char* l = f; l && (l = readline(l, line));)
+            route_size++;
+        if (!route_size || !(route = RTOS_Malloc(route_size * sizeof(track_point_t))))
+            return;
+        while (f && (f = readline(f, line))) {
+            char* lon = strchr(line, ',');
+            if (!lon)
+                continue;
+            route[route_points].lat = strtof(line, NULL);
+            route[route_points].lon = strtof(lon + 1, NULL);
+            if (++route_points >= route_size)
+                break;
+        }
+    }
+    ESP_LOGI(TAG, "Route with %lu points", route_points);
+}
+
+/* the manifest is one file, its text goes straight to the SD task */
+static error_code_t next_manifest(void* arg, download_t* d)
+{
+    manifest_download_t* md = arg;
+    if (md->requested)
+        return NOT_NEEDED;
+    md->requested = 1;
+    save_snprintf(d->path, sizeof(d->path), "%s" DOWNLOAD_MANIFEST, md->path);
+    return PM_OK;
+}
+
+static error_code_t open_manifest(void* arg, download_t* d, uint32_t length)
+{
+    manifest_download_t* md = arg;
+    return sd_call(SD_PRIO_DOWNLOAD, manifest_begin, &md->call);
+}
+
+static error_code_t write_manifest(void* arg, download_t* d, const uint8_t* data, size_t length)
+{
+    manifest_download_t* md = arg;
+    md->call.data = data;
+    md->call.length = length;
+    return sd_call(SD_PRIO_DOWNLOAD, manifest_feed, &md->call);
+}
+
+static void finish_manifest(void* arg, download_t* d, error_code_t result)
+{
+    manifest_download_t* md = arg;
+    md->loaded = result == PM_OK && sd_call(SD_PRIO_DOWNLOAD, manifest_end, &md->call) == PM_OK;
+}
+
+/* a pack pays off if most tiles of the area are missing */
+static uint8_t pack_needed(const tile_area_t* a)
+{
+    uint64_t tiles = (uint64_t)(a->x_max - a->x_min + 1) * (a->y_max - a->y_min + 1);
+    uint64_t missing = 0;
+    map_tile_t tile = { .z = a->zoom };
+    if (map_tiles_has_pack(a->zoom, a->x_min, a->x_max, a->y_min, a->y_max))
+        return 0;
+    for (tile.x = a->x_min; tile.x <= a->x_max; tile.x++)
+        for (tile.y = a->y_min; tile.y <= a->y_max; tile.y++)
+            missing += map_tiles_lookup(&tile) != TILE_PRESENT;
+    return missing * 100 >= tiles * DOWNLOAD_PACK_MISSING;
+}
+
+static void pack_filename(pack_download_t* pd, const download_t* d, char* filename, const char* extension)
+{
+    tile_area_t* a = &pd->schedule->areas[d->key[0]];
+    map_tiles_pack_path(filename, a->zoom, a->x_min, a->x_max, a->y_min, a->y_max, extension);
+}
+
+static error_code_t next_pack(void* arg, download_t* d)
+{
+    pack_download_t* pd = arg;
+    tile_schedule_t* sc = pd->schedule;
+    while (pd->area < sc->area_count) {
+        tile_area_t* a = &sc->areas[pd->area++];
+        if (!pack_needed(a))
+            continue;
+        d->key[0] = pd->area - 1;
+        save_snprintf(d->path, sizeof(d->path), "%s/%u/%lu-%lu_%lu-%lu.tpk", pd->path, a->zoom,
+            a->x_min, a->x_max, a->y_min, a->y_max);
+        return PM_OK;
+    }
+    return NOT_NEEDED;
+}
+
+/* the pack is written as .PAR and only renamed once it is complete */
+static error_code_t open_pack(void* arg, download_t* d, uint32_t length)
+{
+    pack_download_t* pd = arg;
+    tile_area_t* a = &pd->schedule->areas[d->key[0]];
+    char filename[STORAGE_PATH_LENGTH];
+    sd_stream_close(pd->stream);
+    tile_pack_check_end(&pd->check);
+    pack_filename(pd, d, filename, "PAR");
+    tile_pack_check_begin(&pd->check, a->zoom, a->x_min, a->x_max, a->y_min, a->y_max);
+    pd->stream = sd_stream_open(filename, SD_PRIO_DOWNLOAD, DOWNLOAD_PACK_BUFFER, length);
+    pd->owner = d;
+    return pd->stream ? PM_OK : PM_FAIL;
+}
+
+/* a broken pack is refused as soon as it shows, the downloader retries it */
+static error_code_t write_pack(void* arg, download_t* d, const uint8_t* data, size_t length)
+{
+    pack_download_t* pd = arg;
+    if (tile_pack_check(&pd->check, data, length) != PM_OK)
+        return PM_FAIL;
+    return sd_stream_write(pd->stream, data, length);
+}
+
+static void finish_pack(void* arg, download_t* d, error_code_t result)
+{
+    pack_download_t* pd = arg;
+    char part[STORAGE_PATH_LENGTH];
+    char pack[STORAGE_PATH_LENGTH];
+    async_file_t file = { .filename = part, .priority = SD_PRIO_DOWNLOAD };
+    error_code_t ret = pd->owner == d ? result : PM_FAIL;
+    if (pd->owner == d) {
+        if (sd_stream_close(pd->stream) != PM_OK || tile_pack_check_end(&pd->check) != PM_OK)
+            ret = PM_FAIL;
+        pd->stream = NULL;
+        pd->owner = NULL;
+    }
+    pack_filename(pd, d, part, "PAR");
+    pack_filename(pd, d, pack, "TPK");
+    file_rename_t r = { part, pack };
+    if (ret == PM_OK && sd_call(SD_PRIO_DOWNLOAD, rename_file, &r) == PM_OK
+        && map_tiles_add_pack(SD_PRIO_DOWNLOAD, pack) == PM_OK) {
+        pd->packs++;
+        return;
+    }
+    deleteFile(&file);
+    if (result == UNAVAILABLE)
+        ESP_LOGI(TAG, "No pack %s, its tiles come one by one", d->path);
+}
+
+static downloader_t* create_downloader(transport_t* transport, const char* host, uint16_t port, const downloader_handler_t* handler)
+{
+    downloader_t* d = downloader_create(transport, host, port, handler);
+    if (!d)
+        return NULL;
+    d->max_in_flight = DOWNLOAD_IN_FLIGHT;
+    d->max_attempts = DOWNLOAD_ATTEMPTS;
+    d->backoff_ms = DOWNLOAD_BACKOFF_MS;
+    d->backoff_max_ms = DOWNLOAD_BACKOFF_MAX_MS;
+    return d;
+}
+
+static void run_downloader(downloader_t* d)
+{
+    do {
+        wait_for_wifi();
+    } while (downloader_run(d) != PM_OK);
+}
+
+/*
+ * Fetch the manifest and compare it with the tiles on the card
+ *
+ * returns NULL if the server has no manifest
+ */
+static tile_manifest_t* load_manifest(transport_t* transport, const char* host, uint16_t port, tile_download_t* td)
+{
+    manifest_download_t md = { .path = td->path };
+    downloader_handler_t handler = {
+        .next = next_manifest,
+        .open = open_manifest,
+        .write = write_manifest,
+        .finish = finish_manifest,
+        .arg = &md,
+    };
+    if (sd_call(SD_PRIO_DOWNLOAD, manifest_create, &md.call) != PM_OK)
+        return NULL;
+    tile_schedule_t* sc = td->schedule;
+    for (uint8_t i = 0; i < sc->area_count; i++) {
+        tile_area_t* a = &sc->areas[i];
+        tile_manifest_add_range(md.call.manifest, a->zoom, a->x_min, a->x_max, a->y_min, a->y_max);
+    }
+    downloader_t* d = create_downloader(transport, host, port, &handler);
+    if (d)
+        run_downloader(d);
+    downloader_free(d);
+    if (md.loaded)
+        return md.call.manifest;
+    ESP_LOGI(TAG, "No manifest, tiles on the card are kept");
+    sd_call(SD_PRIO_DOWNLOAD, manifest_free, &md.call);
+    return NULL;
+}
+
+/*
+ * Fetch the packs of the areas that are mostly missing
+ *
+ * Whatever is still missing afterwards is fetched tile by tile.
+ */
+static void load_packs(transport_t* transport, const char* host, uint16_t port, tile_download_t* td)
+{
+    pack_download_t pd = { .schedule = td->schedule, .path = td->path };
+    downloader_handler_t handler = {
+        .next = next_pack,
+        .open = open_pack,
+        .write = write_pack,
+        .finish = finish_pack,
+        .arg = &pd,
+    };
+    if (strlen(td->path) + 52 > DOWNLOADER_PATH_LENGTH) // base+/zz/x_min-x_max_y_min-y_max.tpk
+        return;
+    downloader_t* d = create_downloader(transport, host, port, &handler);
+    if (!d)
+        return;
+    int64_t start = RTOS_Micros();
+    run_downloader(d);
+    sd_stream_close(pd.stream);
+    tile_pack_check_end(&pd.check);
+    ESP_LOGI(TAG, "%lu packs, %lu missing, %lu failed, %lu kB in %lu s", pd.packs, d->stats.missing,
+        d->stats.failed, (uint32_t)(d->stats.bytes / 1024), (uint32_t)((RTOS_Micros() - start) / 1000000));
+    downloader_free(d);
+}
+
+static void downloadMapTiles(tile_schedule_t* schedule, const char* baseurl)
+{
+    char host[DOWNLOADER_HOST_LENGTH];
+    uint16_t port;
+    const char* path;
+    tile_download_t td = { .schedule = schedule, .percent = 0xFF };
+
+    if (downloader_parse_url(baseurl, host, sizeof(host), &port, &path) != PM_OK
+        || strlen(path) + 26 > DOWNLOADER_PATH_LENGTH) {
+        downloadMapTilesOneByOne(&td, baseurl);
+        return;
+    }
+    td.path = path;
+
+    downloader_handler_t handler = {
+        .next = next_tile,
+        .open = open_tile,
+        .write = write_tile,
+        .finish = finish_tile,
+        .arg = &td,
+    };
+    transport_t* transport = transport_socket_create(DOWNLOAD_TIMEOUT_MS);
+    if (transport) {
+        td.manifest = load_manifest(transport, host, port, &td);
+        load_packs(transport, host, port, &td);
+    }
+    downloader_t* d = transport ? create_downloader(transport, host, port, &handler) : NULL;
+    manifest_call_t c = { .manifest = td.manifest };
+    if (!d) {
+        if (td.manifest)
+            sd_call(SD_PRIO_DOWNLOAD, manifest_free, &c);
+        transport_socket_free(transport);
+        td.manifest = NULL;
+        downloadMapTilesOneByOne(&td, baseurl);
+        return;
+    }
+
+    int64_t start = RTOS_Micros();
+    run_downloader(d);
+    ESP_LOGI(TAG, "%lu tiles, %lu missing, %lu failed, %lu corrupt, %lu retries, %lu connections in %lu s",
+        d->stats.files, d->stats.missing, d->stats.failed, d->stats.corrupt, d->stats.retries, d->stats.connections,
+        (uint32_t)((RTOS_Micros() - start) / 1000000));
+    /* with every tile up to date the next update compares against this manifest */
+    if (td.manifest && !td.failed && sd_call(SD_PRIO_DOWNLOAD, manifest_commit, &c) == PM_OK)
+        ESP_LOGI(TAG, "Map is up to date");
+    if (td.manifest)
+        sd_call(SD_PRIO_DOWNLOAD, manifest_free, &c);
+    downloader_free(d);
+    transport_socket_free(transport);
+}
+
 void maploader_screen_element(const display_t* dsp)
 {
     download_status = label_create(download_status_text, &f8x8, 0, 100, 0, 0);
@@ -133,7 +695,7 @@ void maploader_screen_element(const display_t* dsp)
 
 void StartMapDownloaderTask(void* pvParameter)
 {
-    async_file_t AFILE;
+    async_file_t AFILE = { 0 };
     async_file_t* wp_file = &AFILE;
     ESP_LOGI(TAG, "Checking Map files...");
     char* waypoint_file = RTOS_Malloc(32768);
@@ -143,8 +705,8 @@ void StartMapDownloaderTask(void* pvParameter)
     save_sprintf(wp_file->filename, "//TRACK");
     wp_file->dest = waypoint_file;
     wp_file->loaded = false;
+    wp_file->priority = SD_PRIO_DOWNLOAD;
     ESP_ERROR_CHECK(loadFile(wp_file));
-    ESP_LOGI(TAG, "Load track information queued.");
     /*
     esp_http_client_config_t client_config = {
         //.url is set in loop
@@ -169,11 +731,6 @@ void StartMapDownloaderTask(void* pvParameter)
         vTaskDelay(1000);
     }
 */
-    while (!wp_file->loaded) {
-        vTaskDelay(100 / portTICK_PERIOD_MS);
-        //if (delay++ == 20)
-        //	break;
-    }
     ESP_LOGI(TAG, "Loaded track information.");
 
     tileset_t* base_tileset = RTOS_Malloc(sizeof(tileset_t));
@@ -191,6 +748,7 @@ void StartMapDownloaderTask(void* pvParameter)
     tileset->baseurl = baseurl;
     tileset->wp_line = wp_line;
     gui_set_app_mode(APP_MODE_DOWNLOAD);
+    tileset = NULL;
     while (1) {
         f = readline(f, wp_line);
         if (!f) {
@@ -204,6 +762,9 @@ void StartMapDownloaderTask(void* pvParameter)
         if (zoom == 0)
             break;
 
+        tileset = tileset ? (tileset->next = RTOS_Malloc(sizeof(tileset_t))) : base_tileset;
+        if (!tileset)
+            goto fail_url;
         tileset->zoom = zoom;
 
         f = readline(f, wp_line);
@@ -235,14 +796,30 @@ void StartMapDownloaderTask(void* pvParameter)
         tileset->file_max = atoi(wp_line);
 
         ESP_LOGI(TAG, "Get Map for [%lu-%lu]/[%lu-%lu]", tileset->folder_min, tileset->folder_max, tileset->file_min, tileset->file_max);
-        ESP_LOGI(TAG, "Download from: %s", baseurl);
-
         tileset->file_count = 0;
+    }
 
-        ESP_LOGI(TAG, "Connected. Start downloading maps");
-        downloadMapTilesForZoomLevel(tileset, wp_file);
+    /* tiles along the route first, at every zoom level */
+    load_route(f, wp_line);
+    tile_schedule_t* schedule = tile_schedule_create(route, route_points, DOWNLOAD_CORRIDOR);
+    RTOS_Free(route);
+    route = NULL;
+    for (tileset = base_tileset; schedule && tileset && tileset->zoom; tileset = tileset->next) {
+        /* one folder scan instead of a stat per tile */
+        map_tiles_index_range(SD_PRIO_DOWNLOAD, tileset->zoom, tileset->folder_min, tileset->folder_max, tileset->file_min, tileset->file_max);
+        tile_schedule_add(schedule, tileset->zoom, tileset->folder_min, tileset->folder_max, tileset->file_min, tileset->file_max);
+    }
+    if (schedule) {
+        ESP_LOGI(TAG, "Download from: %s", baseurl);
+        downloadMapTiles(schedule, baseurl);
+        tile_schedule_free(schedule);
+    }
+    while (base_tileset) {
+        tileset = base_tileset->next;
+        RTOS_Free(base_tileset);
+        base_tileset = tileset;
     }
-    RTOS_Free(base_tileset);
+    RTOS_Free(baseurl);
     RTOS_Free(waypoint_file);
     RTOS_Free(wp_line);
 #if 0
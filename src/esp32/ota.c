@@ -85,14 +85,10 @@ error_code_t do_background_ota(void* pvParameter)
     async_file_t* ota = &AFILE;
     ota->filename = "//OTA";
     ota->loaded = false;
-    loadFile(ota);
-    uint8_t timeout = 0;
-    while (!ota->loaded) {
-        vTaskDelay(pdMS_TO_TICKS(100));
-        if (timeout++ > 100) {
-            ESP_LOGI(TAG, "timeout loading OTA url");
-            return TIMEOUT;
-        }
+    ota->priority = SD_PRIO_DOWNLOAD;
+    if (PM_OK != loadFile(ota)) {
+        ESP_LOGI(TAG, "cannot load OTA url");
+        return UNAVAILABLE;
     }
 
     esp_err_t ret = ESP_FAIL;
@@ -27,11 +27,15 @@
 #include <icons_32.h>
 
 uint8_t sd_status = UNAVAILABLE;
+storage_t* sd_storage;
 char fn[30];
 sdmmc_card_t* card;
 
 static const char* TAG = "SD";
 
+#define SD_QUEUE_LENGTH 8 /// requests per priority
+#define SD_STREAM_SYNC_MS 10000 /// longest time written data stays unsynced
+
 #ifdef ESP_S3
 static const sdmmc_slot_config_t slot_config = {
     .clk = SD_SPI_CLK,
@@ -56,7 +60,7 @@ static const sdmmc_host_t host = SDMMC_HOST_DEFAULT();
 
 static const esp_vfs_fat_sdmmc_mount_config_t mount_config = {
     .format_if_mount_failed = false,
-    .max_files = 1,
+    .max_files = 4,
     .allocation_unit_size = 0
 };
 
@@ -72,188 +76,118 @@ error_code_t statusRender(const display_t* dsp, void* comp)
 }
 
 /*
- * Wait for initialization of SD semaphore
+ * Redraw the SD card symbol with the next update
  */
-error_code_t waitForSDInit()
+static void sd_indicator_invalidate()
 {
-    size_t count = 0;
-    while (!sd_semaphore) {
-        vTaskDelay(1);
-        if (count++ > 1000)
-            return PM_FAIL;
-    }
-    return PM_OK;
+    if (!sd_indicator_label)
+        return;
+    sd_indicator_label->onBeforeRender = statusRender;
+    sd_indicator_label->dirty = 1;
+    ((image_t*)sd_indicator_label->child)->dirty = 1;
+    trigger_update();
 }
+
 /*
- * Queue arbitrary file reads.
+ * SD card service
  *
- * Allocates memory if destination buffer is not initialized.
+ * All card access runs on the SD task. Requests wait in one queue per
+ * priority and the task always serves the most urgent one, so a tile the
+ * screen is waiting for does not queue up behind a download.
  */
-error_code_t loadFile(async_file_t* file)
-{
-    FRESULT res;
-    FIL t_file;
-    FILINFO fno;
-    uint32_t br;
-    ESP_LOGI(TAG, "Load %s ", file->filename);
-    waitForSDInit();
-    if (xSemaphoreTake(sd_semaphore, pdTICKS_TO_MS(1000))) {
-        res = f_stat(file->filename, &fno);
-        if (FR_OK == res) {
-            if (!file->dest) {
-                file->dest = RTOS_Malloc(fno.fsize);
-            }
-            res = f_open(&t_file, file->filename, FA_READ);
-            if (FR_OK == res && file->dest != 0) {
-                res = f_read(&t_file,
-                    file->dest, fno.fsize, (UINT*)&br);
-                if (FR_OK == res) {
-                    file->loaded = LOADED;
-                } else {
-                    ESP_LOGE(TAG, "cannot read %s", file->filename);
-                }
-                f_close(&t_file);
-            } else {
-                ESP_LOGE(TAG, "cannot open %s", file->filename);
-            }
-        } else {
-            ESP_LOGE(TAG, "cannot stat %s", file->filename);
-        }
-        xSemaphoreGive(sd_semaphore);
-    } else {
-        ESP_LOGE(TAG, "sd semapore not available");
-    }
-
-    if (file->loaded == LOADED)
-        return PM_OK;
-    return PM_FAIL;
-}
-
-error_code_t fileExists(async_file_t* file)
-{
-    xSemaphoreTake(sd_semaphore, portMAX_DELAY);
-    FILINFO fno;
-    FRESULT fres = f_stat(file->filename, &fno);
-    xSemaphoreGive(sd_semaphore);
-    if (FR_OK == fres)
-        return PM_OK;
-    return PM_FAIL;
-}
+static QueueHandle_t sd_requests[SD_PRIO_MAX];
+static SemaphoreHandle_t sd_requests_pending; // counts queued requests
+static TaskHandle_t sd_task;
 
-error_code_t createFileBuffer(async_file_t* file)
+static void sd_serve_request(sd_request_t* req)
 {
-    xSemaphoreTake(sd_semaphore, portMAX_DELAY);
-    FILINFO fno;
-    FRESULT fres = f_stat(file->filename, &fno);
-    xSemaphoreGive(sd_semaphore);
-    if (FR_OK == fres) {
-        file->dest = RTOS_Malloc(fno.fsize);
-        return PM_OK;
-    }
-    return PM_FAIL;
+    /* only the SD task touches the card, no need to lock it */
+    req->status = sd_status == PM_OK ? req->run(req->arg) : UNAVAILABLE;
+    if (req->done)
+        req->done(req);
 }
 
-error_code_t openFileForWriting(async_file_t* file)
+/*
+ * Wait until the SD task accepts requests
+ */
+error_code_t waitForSDInit()
 {
-    if (!file->file)
-        file->file = RTOS_Malloc(sizeof(FIL));
-    // try to open file
-    FRESULT res = f_open(file->file, file->filename, FA_WRITE | FA_CREATE_ALWAYS | FA_OPEN_ALWAYS | FA_OPEN_APPEND);
-    if (FR_NO_PATH == res) {
-        // 1. try to create path to file if a path is given
-        if (strlen(file->filename) < 2)
+    size_t count = 0;
+    while (!__atomic_load_n(&sd_requests_pending, __ATOMIC_ACQUIRE)) {
+        vTaskDelay(1);
+        if (count++ > 1000)
             return PM_FAIL;
-
-        char* path = RTOS_Malloc(strlen(file->filename) + 1);
-        char* tmp_path = RTOS_Malloc(strlen(file->filename) + 1);
-
-        // 2. skip first // for root
-        strcpy(path, file->filename);
-        path += 2;
-        // strcat(tmp_path, "/");
-
-        // 3. loop through folders
-        char* strtokCtx;
-        char* token = strtok_r(path, "/", &strtokCtx);
-        while (token != NULL) {
-            strcat(tmp_path, token);
-            // Create the folder in the path
-            res = f_mkdir(tmp_path);
-            if (FR_OK != res) {
-                ESP_LOGD(TAG, "Folder %s could not be created: %d", tmp_path, res);
-                break;
-            }
-            strcat(tmp_path, "/");
-            token = strtok_r(NULL, "/", &strtokCtx);
-
-            // Check if the path has a "File extention" so we skip creating a folder for it
-            if (token && strchr(token, '.'))
-                break;
-        }
-        RTOS_Free(tmp_path);
-        // Retry to open file for writing
-        res = f_open(file->file, file->filename, FA_WRITE | FA_CREATE_NEW);
     }
-
-    ESP_LOGD(TAG, "File %s -> %d", file->filename, res);
-    if (FR_OK == res)
-        return PM_OK;
-    return PM_FAIL;
-}
-
-async_file_t* createPhysicalFile()
-{
-    async_file_t* f = RTOS_Malloc(sizeof(async_file_t));
-    f->file = RTOS_Malloc(sizeof(FIL));
-    return f;
+    return PM_OK;
 }
 
-error_code_t writeToFile(async_file_t* file, void* in_data, uint32_t count, uint32_t* written)
+/*
+ * Queue a request for the SD task
+ *
+ * req->done is called on the SD task once req->run has finished, req has to
+ * stay valid until then. The SD task itself cannot wait for its own queue,
+ * its requests are served right away.
+ */
+error_code_t sd_submit(sd_request_t* req, sd_priority_t priority)
 {
-    FRESULT res = f_write(file->file, in_data, count, (UINT*)written);
-    if (FR_OK == res && FR_OK == f_sync(file->file))
+    if (waitForSDInit() != PM_OK || priority >= SD_PRIO_MAX)
+        return UNAVAILABLE;
+    if (xTaskGetCurrentTaskHandle() == sd_task) {
+        sd_serve_request(req);
         return PM_OK;
-    return PM_FAIL;
+    }
+    if (xQueueSend(sd_requests[priority], &req, portMAX_DELAY) != pdTRUE)
+        return PM_FAIL;
+    xSemaphoreGive(sd_requests_pending);
+    return PM_OK;
 }
 
-error_code_t closeFile(async_file_t* file)
+static void sd_call_done(sd_request_t* req)
 {
-    FRESULT res = f_close(file->file);
-    if (FR_OK == res)
-        return PM_OK;
-    return PM_FAIL;
+    xSemaphoreGive((SemaphoreHandle_t)req->context);
 }
 
-error_code_t deleteFile(async_file_t* file)
+/*
+ * Run a request on the SD task and wait for its result
+ */
+error_code_t sd_call(sd_priority_t priority, error_code_t (*run)(void* arg), void* arg)
 {
-    FRESULT res = f_unlink(file->filename);
-    if (FR_OK == res)
-        return PM_OK;
-    return PM_FAIL;
+    if (xTaskGetCurrentTaskHandle() == sd_task)
+        return sd_status == PM_OK ? run(arg) : UNAVAILABLE;
+
+    StaticSemaphore_t done_buffer;
+    sd_request_t req = {
+        .run = run,
+        .done = sd_call_done,
+        .arg = arg,
+        .context = xSemaphoreCreateBinaryStatic(&done_buffer),
+    };
+    error_code_t ret = sd_submit(&req, priority);
+    if (ret == PM_OK) {
+        xSemaphoreTake((SemaphoreHandle_t)req.context, portMAX_DELAY);
+        ret = req.status;
+    }
+    vSemaphoreDelete((SemaphoreHandle_t)req.context);
+    return ret;
 }
 
-void closePhysicalFile(async_file_t* file)
+static sd_request_t* sd_next_request()
 {
-    if (file) {
-        if (file->file) {
-            if (file->file->fptr)
-                ESP_LOGI(TAG, "File: %lu is still open", file->file->fptr);
-            // f_close(file->file);
-            // RTOS_Free(file->file);
-        }
-        if (file->dest) {
-            ESP_LOGI(TAG, "Free file->dest");
-            RTOS_Free(file->dest);
-        }
-        RTOS_Free(file);
-    }
+    sd_request_t* req;
+    for (uint8_t prio = 0; prio < SD_PRIO_MAX; prio++)
+        if (xQueueReceive(sd_requests[prio], &req, 0) == pdTRUE)
+            return req;
+    return NULL;
 }
 
 void StartSDTask(void const* argument)
 {
-    sd_semaphore = xSemaphoreCreateMutex();
-    ESP_LOGI(TAG, "init semaphore");
-    xSemaphoreTake(sd_semaphore, portMAX_DELAY); // block SD mutex
+    sd_task = xTaskGetCurrentTaskHandle();
+    sd_storage = storage_fatfs_create();
+    for (uint8_t prio = 0; prio < SD_PRIO_MAX; prio++)
+        sd_requests[prio] = xQueueCreate(SD_QUEUE_LENGTH, sizeof(sd_request_t*));
+    /* published last, the other tasks wait for it before they use the queues */
+    __atomic_store_n(&sd_requests_pending, xSemaphoreCreateCounting(SD_PRIO_MAX * SD_QUEUE_LENGTH, 0), __ATOMIC_RELEASE);
     ESP_LOGI(TAG, "init gpio %d", SD_VCC_nEN);
 
     /* create power regulator */
@@ -284,18 +218,20 @@ void StartSDTask(void const* argument)
                 }
                 // Card has been initialized, print its properties
                 ESP_LOGI(TAG, "SDC: init done");
-                xSemaphoreGive(sd_semaphore);
-                trigger_rendering();
+                /* a replace cut off by a reset or a pulled card */
+                if (sd_status == PM_OK)
+                    storage_recover(sd_storage);
+                sd_indicator_invalidate();
             }
         } else {
             if (sd_status == PM_OK) {
                 ESP_LOGE("SD", "Unmount filesystem.");
                 sd_status = UNAVAILABLE;
-                xSemaphoreTake(sd_semaphore, portMAX_DELAY);
+                storage_drop(sd_storage, NULL);
                 // deinit SDMMC periphery
                 esp_vfs_fat_sdmmc_unmount();
                 // show on gui
-                trigger_rendering();
+                sd_indicator_invalidate();
                 vTaskDelay(pdMS_TO_TICKS(1000));
             }
         }
@@ -303,6 +239,14 @@ void StartSDTask(void const* argument)
         if (sd_indicator_label)
             sd_indicator_label->onBeforeRender = statusRender;
 
-        vTaskDelay(pdMS_TO_TICKS(100));
+        /* serve one request and look at the card detect pin again, poll it at least every 100 ms */
+        if (xSemaphoreTake(sd_requests_pending, pdMS_TO_TICKS(100)) == pdTRUE) {
+            sd_request_t* req = sd_next_request();
+            if (req)
+                sd_serve_request(req);
+        }
+        if (sd_status == PM_OK)
+            storage_sync_streams(sd_storage, SD_STREAM_SYNC_MS);
+        sd_stream_release_unclosed();
     }
 }
@@ -0,0 +1,212 @@
+/*
+ * FatFs storage backend for the SD card
+ *
+ * Copyright (c) 2022, Bastian Neumann <info@platinenmacher.tech>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <Platinenmacher.h>
+#include <esp_log.h>
+#include <ff.h>
+
+#include "storage.h"
+
+#define FATFS_FASTSEEK_MIN_SIZE (256 * 1024) /// files from this size get a cluster link map
+#define FATFS_CLMT_LENGTH 64                 /// initial link map entries, grown once if the file is fragmented
+
+typedef struct {
+    FIL fil;
+    DWORD* clmt;
+} fatfs_file_t;
+
+static error_code_t fatfs_error(FRESULT res)
+{
+    if (FR_OK == res)
+        return PM_OK;
+    if (FR_NO_FILE == res || FR_NO_PATH == res)
+        return UNAVAILABLE;
+    return PM_FAIL;
+}
+
+#if FF_USE_FASTSEEK
+/*
+ * A link map lets f_lseek look up the cluster in memory instead of
+ * following the FAT chain.
+ */
+static void fatfs_link_map(fatfs_file_t* f)
+{
+    DWORD length = FATFS_CLMT_LENGTH;
+    for (uint8_t tries = 0; tries < 2; tries++) {
+        if (!(f->clmt = RTOS_Malloc(length * sizeof(DWORD))))
+            return;
+        f->clmt[0] = length;
+        f->fil.cltbl = f->clmt;
+        FRESULT res = f_lseek(&f->fil, CREATE_LINKMAP);
+        if (FR_OK == res)
+            return;
+        /* on FR_NOT_ENOUGH_CORE the first entry holds the needed length */
+        length = f->clmt[0];
+        f->fil.cltbl = NULL;
+        RTOS_Free(f->clmt);
+        f->clmt = NULL;
+        if (FR_NOT_ENOUGH_CORE != res)
+            return;
+    }
+}
+#endif
+
+static error_code_t fatfs_open(storage_t* st, storage_file_t* file, const char* path, uint8_t mode)
+{
+    BYTE flags = FA_READ;
+    if (mode & STORAGE_WRITE)
+        flags = FA_WRITE | (mode & STORAGE_APPEND ? FA_OPEN_APPEND : FA_CREATE_ALWAYS);
+    fatfs_file_t* f = RTOS_Malloc(sizeof(fatfs_file_t));
+    if (!f)
+        return PM_FAIL;
+    FRESULT res = f_open(&f->fil, path, flags);
+    if (FR_OK != res) {
+        RTOS_Free(f);
+        return fatfs_error(res);
+    }
+#if FF_USE_FASTSEEK
+    if ((mode & STORAGE_RANDOM) && !(mode & STORAGE_WRITE) && f_size(&f->fil) >= FATFS_FASTSEEK_MIN_SIZE)
+        fatfs_link_map(f);
+#endif
+    file->handle = f;
+    file->size = f_size(&f->fil);
+    file->position = f_tell(&f->fil);
+    return PM_OK;
+}
+
+static error_code_t fatfs_close(storage_file_t* file)
+{
+    fatfs_file_t* f = file->handle;
+    FRESULT res = f_close(&f->fil);
+    RTOS_Free(f->clmt);
+    RTOS_Free(f);
+    return fatfs_error(res);
+}
+
+static error_code_t fatfs_read(storage_file_t* file, void* data, size_t size, size_t* length)
+{
+    fatfs_file_t* f = file->handle;
+    UINT br = 0;
+    FRESULT res = f_read(&f->fil, data, size, &br);
+    *length = br;
+    return fatfs_error(res);
+}
+
+static error_code_t fatfs_write(storage_file_t* file, const void* data, size_t size, size_t* written)
+{
+    fatfs_file_t* f = file->handle;
+    UINT bw = 0;
+    FRESULT res = f_write(&f->fil, data, size, &bw);
+    *written = bw;
+    return fatfs_error(res);
+}
+
+static error_code_t fatfs_seek(storage_file_t* file, uint32_t offset)
+{
+    fatfs_file_t* f = file->handle;
+    return fatfs_error(f_lseek(&f->fil, offset));
+}
+
+static error_code_t fatfs_sync(storage_file_t* file)
+{
+    fatfs_file_t* f = file->handle;
+    return fatfs_error(f_sync(&f->fil));
+}
+
+static error_code_t fatfs_truncate(storage_file_t* file)
+{
+    fatfs_file_t* f = file->handle;
+    FRESULT res = f_truncate(&f->fil);
+    if (FR_OK == res)
+        file->size = file->position;
+    return fatfs_error(res);
+}
+
+static error_code_t fatfs_expand(storage_file_t* file, uint32_t size)
+{
+#if FF_USE_EXPAND
+    fatfs_file_t* f = file->handle;
+    return fatfs_error(f_expand(&f->fil, size, 1));
+#else
+    return NOT_NEEDED;
+#endif
+}
+
+static error_code_t fatfs_stat(storage_t* st, const char* path, uint32_t* size)
+{
+    FILINFO fno;
+    FRESULT res = f_stat(path, &fno);
+    if (FR_OK == res)
+        *size = fno.fsize;
+    return fatfs_error(res);
+}
+
+/* FAT date in the upper and time in the lower half */
+static error_code_t fatfs_modified(storage_t* st, const char* path, uint32_t* time)
+{
+    FILINFO fno;
+    FRESULT res = f_stat(path, &fno);
+    if (FR_OK == res)
+        *time = (uint32_t)fno.fdate << 16 | fno.ftime;
+    return fatfs_error(res);
+}
+
+static error_code_t fatfs_unlink(storage_t* st, const char* path)
+{
+    return fatfs_error(f_unlink(path));
+}
+
+static error_code_t fatfs_rename(storage_t* st, const char* from, const char* to)
+{
+    return fatfs_error(f_rename(from, to));
+}
+
+static error_code_t fatfs_mkdir(storage_t* st, const char* path)
+{
+    FRESULT res = f_mkdir(path);
+    return FR_EXIST == res ? PM_OK : fatfs_error(res);
+}
+
+static error_code_t fatfs_list(storage_t* st, const char* path, storage_entry_t entry, void* arg)
+{
+    FF_DIR dir;
+    FILINFO fno;
+    FRESULT res = f_opendir(&dir, path);
+    if (FR_OK != res)
+        return fatfs_error(res);
+    while (FR_OK == (res = f_readdir(&dir, &fno)) && fno.fname[0])
+        if (!(fno.fattrib & AM_DIR))
+            entry(arg, fno.fname);
+    f_closedir(&dir);
+    return fatfs_error(res);
+}
+
+/**
+ * Storage on the mounted FatFs volume
+ */
+storage_t* storage_fatfs_create()
+{
+    storage_t* st = RTOS_Malloc(sizeof(storage_t));
+    if (!st)
+        return NULL;
+    st->open = fatfs_open;
+    st->close = fatfs_close;
+    st->read = fatfs_read;
+    st->write = fatfs_write;
+    st->seek = fatfs_seek;
+    st->sync = fatfs_sync;
+    st->truncate = fatfs_truncate;
+    st->expand = fatfs_expand;
+    st->stat = fatfs_stat;
+    st->modified = fatfs_modified;
+    st->unlink = fatfs_unlink;
+    st->rename = fatfs_rename;
+    st->mkdir = fatfs_mkdir;
+    st->list = fatfs_list;
+    return st;
+}
@@ -217,15 +217,15 @@ void StartWiFiTask(void const* argument)
             ESP_LOGI(TAG, "ssid is: %d", sta_record.rssi);
             if (sta_record.rssi >= -70 && last_rssi_state != 3) {
                 wifi_indicator_image_data = WIFI_3;
-                trigger_rendering();
+                off_screen_invalidate();
                 last_rssi_state = 3;
             } else if (sta_record.rssi < -70 && sta_record.rssi >= -80 && last_rssi_state != 2) {
                 wifi_indicator_image_data = WIFI_2;
-                trigger_rendering();
+                off_screen_invalidate();
                 last_rssi_state = 2;
             } else if (sta_record.rssi < -80 && last_rssi_state != 1) {
                 wifi_indicator_image_data = WIFI_1;
-                trigger_rendering();
+                off_screen_invalidate();
                 last_rssi_state = 1;
             }
             vTaskDelay(pdMS_TO_TICKS(30000));
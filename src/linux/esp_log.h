@@ -2,6 +2,7 @@
 
 #ifdef LINUX
 #include <stdio.h>
-#define ESP_LOGI(tag, format_str, ...)        printf("I[%s] " format_str "\n", tag, ##__VA_ARGS__);
-#define ESP_LOGE(tag, format_str, ...)        printf("E[%s] " format_str "\n", tag, ##__VA_ARGS__);
+#define ESP_LOGI(tag, format_str, ...)        printf("I[%s] " format_str "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGE(tag, format_str, ...)        printf("E[%s] " format_str "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format_str, ...)        do { } while (0)
 #endif
\ No newline at end of file
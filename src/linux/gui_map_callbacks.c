@@ -9,9 +9,7 @@
 #include "gui/map.h"
 #include "tasks.h"
 
-#include <fcntl.h>
 #include <stdio.h>
-#include <unistd.h>
 
 #if USE_CURL
 #    include <curl/curl.h>
@@ -26,6 +24,45 @@ void set_path_prefix(char* prefix)
     path_prefix = prefix;
 }
 
+typedef struct {
+    const map_tile_t* tile;
+    uint8_t* data;
+    size_t size;
+    size_t length;
+} tile_file_t;
+
+/*
+ * Read a tile file into a buffer
+ *
+ * returns UNAVAILABLE if there is no file for the tile
+ */
+static error_code_t read_tile_file(void* arg)
+{
+    tile_file_t* t = arg;
+    char fn[255];
+    save_sprintf(fn, "%s/%u/%u/%u.raw",
+        path_prefix,
+        t->tile->z,
+        t->tile->x,
+        t->tile->y);
+    error_code_t ret = storage_read_file(sd_storage, fn, t->data, t->size, &t->length);
+    if (ret == UNAVAILABLE)
+        map_tiles_set(t->tile->z, t->tile->x, t->tile->y, 0);
+    if (ret == PM_OK && t->length != t->size)
+        return PM_FAIL;
+    return ret;
+}
+
+/*
+ * Read a tile unless the index knows it is missing
+ */
+static error_code_t read_tile(tile_file_t* t)
+{
+    if (map_tiles_lookup(t->tile) == TILE_MISSING)
+        return UNAVAILABLE;
+    return sd_call(SD_PRIO_INTERACTIVE, read_tile_file, t);
+}
+
 size_t load_data(void* ptr, size_t size, size_t nmemb, FILE* stream)
 {
     image_t* img = (image_t*)stream;
@@ -42,8 +79,7 @@ size_t load_data(void* ptr, size_t size, size_t nmemb, FILE* stream)
 error_code_t load_map_tile_on_demand(const display_t* dsp, void* image)
 {
     char fn[255]; // Filename size for zoom level 16.
-    int fd;
-    uint8_t* imageBuf = RTOS_Malloc(256 * 256 / 2);
+    uint8_t* imageBuf = RTOS_MallocIO(256 * 256 / 2);
 
     if (!imageBuf)
         return UNAVAILABLE;
@@ -54,7 +90,6 @@ error_code_t load_map_tile_on_demand(const display_t* dsp, void* image)
     img->data = imageBuf;
     map_tile_t* tile = img->parent; // the parent component of the image is the tile
 
-    uint32_t br;
     // TODO: decompress lz4 tiles
     save_sprintf(fn, "%s/%u/%u/%u.raw",
         path_prefix,
@@ -75,16 +110,12 @@ error_code_t load_map_tile_on_demand(const display_t* dsp, void* image)
     }
 
 #else
-    fd = open(fn, O_RDONLY);
-    if (-1 != fd && tile->image->data != 0) {
-        ssize_t count;
-        count = read(fd, tile->image->data, 32768); // Tilesize 256*256/2 bytes
-        ESP_LOGI(TAG, "Load %ld bytes", count);
-        if (count == 32768) {
-            tile->image->loaded = LOADED;
-            l->text = NULL;
-        }
-        close(fd);
+    tile_file_t t = { tile, imageBuf, 256 * 256 / 2 };
+    error_code_t ret = read_tile(&t);
+    ESP_LOGI(TAG, "Load %zu bytes", t.length);
+    if (ret == PM_OK) {
+        tile->image->loaded = LOADED;
+        l->text = NULL;
     } else {
         tile->image->loaded = NOT_FOUND;
     }
@@ -106,6 +137,56 @@ freeImageMemory:
     return TIMEOUT;
 }
 
+#if USE_CURL
+typedef struct {
+    uint8_t* data;
+    size_t size;
+    size_t length;
+} tile_buffer_t;
+
+static size_t load_tile_buffer(void* ptr, size_t size, size_t nmemb, void* stream)
+{
+    tile_buffer_t* buf = stream;
+    size_t count = size * nmemb;
+    if (count > buf->size - buf->length)
+        count = buf->size - buf->length;
+    memcpy(buf->data + buf->length, ptr, count);
+    buf->length += count;
+    return size * nmemb;
+}
+#endif
+
+/*
+ * Read a tile for the tile pipeline, runs on the pipeline reader thread
+ */
+error_code_t read_map_tile(const map_tile_t* tile, uint8_t* data, size_t size, size_t* length)
+{
+#if USE_CURL
+    char fn[255];
+    save_sprintf(fn, "%s/%u/%u/%u.raw",
+        path_prefix,
+        tile->z,
+        tile->x,
+        tile->y);
+    tile_buffer_t buf = { data, size, 0 };
+    CURL* curl = curl_easy_init();
+    if (!curl)
+        return PM_FAIL;
+    curl_easy_setopt(curl, CURLOPT_URL, fn);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, load_tile_buffer);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &buf);
+    CURLcode res = curl_easy_perform(curl);
+    curl_easy_cleanup(curl);
+    *length = buf.length;
+    return res == CURLE_OK && buf.length == size ? PM_OK : UNAVAILABLE;
+#else
+    tile_file_t t = { tile, data, size };
+    error_code_t ret = read_tile(&t);
+    *length = t.length;
+    return ret;
+#endif
+}
+
 error_code_t check_if_map_tile_is_loaded(const display_t* dsp, void* image)
 {
     image_t* img = (image_t*)image;
@@ -119,7 +200,10 @@ error_code_t check_if_map_tile_is_loaded(const display_t* dsp, void* image)
 error_code_t map_render_copyright(const display_t* dsp, void* label)
 {
     label_t* l = (label_t*)label;
-    if (map_position && map_position->fix) {
+    map_position_t position = { 0 };
+    if (gps_position)
+        gps_position_read(gps_position, &position);
+    if (position.fix) {
         // TODO: get this information from map info on SD card!
         l->text = "(c) OpenStreetMap contributors";
         label_shrink_to_text(l);
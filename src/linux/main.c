@@ -3,6 +3,7 @@
 #include <X11/Xutil.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/time.h>
 #include <time.h>
 
@@ -18,6 +19,7 @@ GC gc;
 #include "fonts/font8x8.h"
 #include "gui/image.h"
 #include "gui/label.h"
+#include "pixel.h"
 #include <icons_32.h>
 
 #include "gui.h"
@@ -42,9 +44,6 @@ extern void toggleZoom();
 extern void set_path_prefix(char *prefix);
 
 
-render_t* render_pipeline[RL_MAX]; // maximum number of rendered items
-render_t* render_last[RL_MAX];     // pointer to end of render pipeline
-
 typedef enum {
     GPS_FIX_INVALID, /*!< Not fixed */
     GPS_FIX_GPS,     /*!< GPS */
@@ -52,7 +51,7 @@ typedef enum {
     GPS_FIX_DR = 6,  /*!< Dead Reckoning, valid fix */
 } gps_fix_t;
 
-static map_position_t current_position = {
+static gps_position_t current_position = GPS_POSITION_INITIALIZER(
 #ifdef NO_GPS
     .longitude = 12.665907,
     .latitude = 47.737665,
@@ -62,7 +61,7 @@ static map_position_t current_position = {
 #else
     .fix = GPS_FIX_INVALID,
 #endif
-};
+);
 
 label_t* clock_label;
 label_t* battery_label;
@@ -72,84 +71,46 @@ label_t* gps_indicator_label;
 label_t* sd_indicator_label;
 
 /* the global position object */
-map_position_t* map_position;
+gps_position_t* gps_position;
 
 XImage* frame;
 
-error_code_t write_pixel(const display_t* _, int16_t x, int16_t y, uint8_t c)
-{
-    if (!frame)
-        return PM_FAIL;
-    x *= 2;
-    y *= 2;
-    XPutPixel(frame, x, y, color[c].pixel);
-    XPutPixel(frame, x+1, y, color[c].pixel);
-    XPutPixel(frame, x+1, y+1, color[c].pixel);
-    XPutPixel(frame, x, y+1, color[c].pixel);
-    return PM_OK;
-
-    XSetForeground(dsp, gc, color[c].pixel);
-    XDrawPoint(dsp, win, gc, x, y);
-}
-
-void set_short_press_event(void (*event)(void))
-{
-}
+/* the screen is rendered into a 4bpp buffer like the eink and converted in one go */
+static uint8_t fb[ACEP_5IN65_WIDTH * ACEP_5IN65_HEIGHT / 2];
+static uint32_t fb_rgba[ACEP_5IN65_WIDTH * ACEP_5IN65_HEIGHT];
+static uint32_t palette[16];
 
-/**
- * Add render function to pipeline
- *
- * @return render slot
- */
-render_t* add_to_render_pipeline(error_code_t (*render)(const display_t* dsp, void* component),
-    void* comp,
-    enum RenderLayer layer)
+error_code_t write_pixel(const display_t* dsp, int16_t x, int16_t y, uint8_t c)
 {
-    // increase render slot before adding this one. Slot 0 is overflow!
-    render_t* rd = RTOS_Malloc(sizeof(render_t));
-    if (!rd) {
-        return 0;
-    }
-    rd->render = render;
-    rd->comp = comp;
-
-    if (render_pipeline[layer] == NULL) {
-        render_pipeline[layer] = rd;
+    uint32_t pos = y * dsp->size.width + x;
+    if (pos & 0x1) {
+        dsp->fb[pos >> 1] = (dsp->fb[pos >> 1] & 0xf0) | (c & 0x0f);
     } else {
-        render_last[layer]->next = rd;
+        dsp->fb[pos >> 1] = (dsp->fb[pos >> 1] & 0x0f) | ((c & 0x0f) << 4);
     }
-    render_last[layer] = rd;
-
-    return rd;
+    return PM_OK;
 }
 
-void free_render_pipeline(enum RenderLayer layer)
+/**
+ * Expand the 4bpp framebuffer into the doubled X image
+ */
+static void commit_frame()
 {
-    render_t* r = render_pipeline[layer];
-    while (r) {
-        render_t* rn;
-        rn = r;
-        r = r->next;
-        RTOS_Free(rn);
+    pixel_expand_4bpp_rgba32(fb_rgba, eink->fb, ACEP_5IN65_WIDTH * ACEP_5IN65_HEIGHT, palette);
+    for (int y = 0; y < ACEP_5IN65_WIDTH; y++) {
+        uint32_t* src = &fb_rgba[y * ACEP_5IN65_HEIGHT];
+        uint32_t* line = (uint32_t*)(frame->data + 2 * y * frame->bytes_per_line);
+        for (int x = 0; x < ACEP_5IN65_HEIGHT; x++) {
+            line[2 * x] = src[x];
+            line[2 * x + 1] = src[x];
+        }
+        memcpy(frame->data + (2 * y + 1) * frame->bytes_per_line, line, frame->bytes_per_line);
     }
+    XPutImage(dsp, win, gc, frame, 0, 0, 0, 0, ACEP_5IN65_HEIGHT*2, ACEP_5IN65_WIDTH*2);
 }
 
-void free_all_render_pipelines()
-{
-    for (uint8_t i = 0; i < RL_MAX; i++)
-        free_render_pipeline(i);
-}
-
-/**
- * Add a prerender callback to pipeline
- *
- * This is called before all other renderers are called.
- *
- * @return render slot
- */
-render_t* add_pre_render_callback(error_code_t (*cb)(const display_t* dsp, void* component))
+void set_short_press_event(void (*event)(void))
 {
-    return add_to_render_pipeline(cb, NULL, RL_PRE_RENDER);
 }
 
 /**
@@ -283,17 +244,7 @@ uint8_t Decompress_Pixel(rect_t* size, int16_t x, int16_t y,
 
 void render()
 {
-    render_t* rd;
-    //    uint64_t start = esp_timer_get_time();
-    display_fill(eink, WHITE);
-    for (uint8_t layer = 0; layer < RL_MAX; layer++) {
-        rd = render_pipeline[layer];
-        while (rd) {
-            if (rd->render)
-                rd->render(eink, rd->comp);
-            rd = rd->next;
-        }
-    }
+    render_pipeline_render(eink, NULL);
 }
 
 void trigger_rendering()
@@ -301,6 +252,33 @@ void trigger_rendering()
     render();
 }
 
+void set_screen_free_function(void (*free_screen_cb)(void))
+{
+}
+
+void trigger_update()
+{
+    render_pipeline_request_update();
+    render_pipeline_render_damage(eink, NULL);
+}
+
+/* the simulator publishes the position like the GPS task */
+static void set_position(float latitude, float longitude)
+{
+    map_position_t position;
+    gps_position_read(&current_position, &position);
+    position.latitude = latitude;
+    position.longitude = longitude;
+    gps_position_publish(&current_position, &position);
+}
+
+static void move_position(float latitude, float longitude)
+{
+    map_position_t position;
+    gps_position_read(&current_position, &position);
+    set_position(position.latitude + latitude, position.longitude + longitude);
+}
+
 int save_ximage_pnm(XImage* img, const char* pnmname, int type)
 {
     int ret, x, y;
@@ -401,7 +379,12 @@ int main(int argc, char* argv[])
         fprintf(stderr, "XAllocNamedColor - failed to allocated 'green' color.\n");
         exit(1);
     }
-    eink = display_init(ACEP_5IN65_HEIGHT, ACEP_5IN65_WIDTH, 8, DISPLAY_ROTATE_0);
+    for (int c = 0; c < 16; c++)
+        palette[c] = color[c < TRANSPARENT ? c : WHITE].pixel;
+
+    eink = display_init(ACEP_5IN65_HEIGHT, ACEP_5IN65_WIDTH, 4, DISPLAY_ROTATE_0);
+    eink->fb = fb;
+    eink->fb_size = sizeof(fb);
     eink->write_pixel = write_pixel;
     eink->decompress = Decompress_Pixel;
 
@@ -413,7 +396,7 @@ int main(int argc, char* argv[])
     font_load_from_array(&f8x16, font8x16, font8x16_name);
 
     // map the GPS position
-    map_position = &current_position;
+    gps_position = &current_position;
 
     create_top_bar(eink);
     map_screen_create(eink);
@@ -421,8 +404,7 @@ int main(int argc, char* argv[])
     sd_indicator_label->onBeforeRender = statusRender;
 
     if (argc > 3) {
-        current_position.latitude = atof(argv[1]);
-        current_position.longitude = atof(argv[2]);
+        set_position(atof(argv[1]), atof(argv[2]));
     }
 
     if(argc == 4) {
@@ -434,7 +416,7 @@ int main(int argc, char* argv[])
         if (evt.xany.window == win) {
             if (evt.type == Expose) {
                 render();
-                XPutImage(dsp, win, gc, frame, 0, 0, 0, 0, ACEP_5IN65_HEIGHT*2, ACEP_5IN65_WIDTH*2);
+                commit_frame();
                 if (argc > 1 && strcmp(argv[1], "--screenshot") == 0) {
                     save_ximage_pnm(frame, "frame.pnm", 3);
                     exit(0);
@@ -447,16 +429,16 @@ int main(int argc, char* argv[])
                 // right - 114
                 switch (evt.xkey.keycode) {
                 case 113:
-                    map_position->longitude -= 0.0002;
+                    move_position(0, -0.0002);
                     break;
                 case 116:
-                    map_position->latitude -= 0.0002;
+                    move_position(-0.0002, 0);
                     break;
                 case 111:
-                    map_position->latitude += 0.0002;
+                    move_position(0.0002, 0);
                     break;
                 case 114:
-                    map_position->longitude += 0.0002;
+                    move_position(0, 0.0002);
                     break;
                 case 65: // spacebar
                     save_ximage_pnm(frame, "frame.pnm", 3);
@@ -469,7 +451,7 @@ int main(int argc, char* argv[])
                     printf("Unknown button: %d\n", evt.xkey.keycode);
                 }
                 render();
-                XPutImage(dsp, win, gc, frame, 0, 0, 0, 0, ACEP_5IN65_HEIGHT*2, ACEP_5IN65_WIDTH*2);
+                commit_frame();
             }
         }
     }
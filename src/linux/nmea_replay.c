@@ -0,0 +1,135 @@
+/*
+ * Replay a recorded NMEA log of the GPS receiver through the decoder
+ *
+ *   nmea_replay [-r] [-n rounds] [-o golden] [-c golden] log.nmea
+ *
+ * -r waits for the UTC time of the sentences instead of decoding at full
+ * speed, -o writes every fix as one line and -c compares the fixes with
+ * such a file. The statistics of the decoder are printed at the end.
+ *
+ * Copyright (c) 2023, Bastian Neumann <info@platinenmacher.tech>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "nmea_replay.h"
+#include "pmtk_parser.h"
+#include "pq_parser.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef struct {
+    FILE* output;
+    FILE* golden;
+    uint32_t fixes;
+    uint32_t mismatches;
+} replay_check_t;
+
+static const nmea_parser_plugin_t plugins[GPS_MAX_PARSER_PLUGINS] = {
+    { .detect = pmtk_detect, .parse = pmtk_parse },
+    { .detect = pq_detect, .parse = pq_parse },
+};
+
+static void check_fix(void* arg, const gps_t* gps)
+{
+    replay_check_t* check = arg;
+    char line[NMEA_REPLAY_LINE];
+    char expected[NMEA_REPLAY_LINE];
+    nmea_replay_format(gps, line, sizeof(line));
+    check->fixes++;
+    if (check->output)
+        fputs(line, check->output);
+    if (check->golden) {
+        if (!fgets(expected, sizeof(expected), check->golden))
+            expected[0] = '\0';
+        if (strcmp(line, expected) != 0 && check->mismatches++ == 0)
+            printf("fix %u differs\n  expected %s  decoded  %s", check->fixes, expected[0] ? expected : "nothing\n", line);
+    }
+}
+
+static char* read_log(const char* path, size_t* length)
+{
+    FILE* file = fopen(path, "rb");
+    if (!file)
+        return NULL;
+    fseek(file, 0, SEEK_END);
+    *length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char* log = malloc(*length);
+    if (log && fread(log, 1, *length, file) != *length) {
+        free(log);
+        log = NULL;
+    }
+    fclose(file);
+    return log;
+}
+
+int main(int argc, char** argv)
+{
+    nmea_replay_mode_t mode = NMEA_REPLAY_MAX_SPEED;
+    replay_check_t check = { 0 };
+    int rounds = 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "rn:o:c:")) != -1) {
+        switch (opt) {
+        case 'r':
+            mode = NMEA_REPLAY_REAL_TIME;
+            break;
+        case 'n':
+            rounds = atoi(optarg);
+            break;
+        case 'o':
+            check.output = fopen(optarg, "w");
+            if (!check.output) {
+                perror(optarg);
+                return 2;
+            }
+            break;
+        case 'c':
+            check.golden = fopen(optarg, "r");
+            if (!check.golden) {
+                perror(optarg);
+                return 2;
+            }
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-r] [-n rounds] [-o golden] [-c golden] log.nmea\n", argv[0]);
+            return 2;
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "usage: %s [-r] [-n rounds] [-o golden] [-c golden] log.nmea\n", argv[0]);
+        return 2;
+    }
+
+    size_t length;
+    char* log = read_log(argv[optind], &length);
+    if (!log) {
+        perror(argv[optind]);
+        return 2;
+    }
+
+    nmea_replay_t replay;
+    nmea_replay_init(&replay, mode, plugins, check_fix, &check);
+    for (int i = 0; i < rounds; i++) {
+        nmea_replay_run(&replay, log, length);
+        /* the golden output is one round */
+        if (i == 0) {
+            if (check.golden && fgetc(check.golden) != EOF && check.mismatches++ == 0)
+                printf("fix %u differs\n  expected more fixes\n", check.fixes + 1);
+            replay.update = NULL;
+        }
+    }
+    nmea_replay_report(&replay.stats, stdout);
+
+    if (check.golden)
+        printf("golden    %u fixes, %u differ\n", check.fixes, check.mismatches);
+    if (check.output)
+        fclose(check.output);
+    if (check.golden)
+        fclose(check.golden);
+    free(log);
+    return check.mismatches ? 1 : 0;
+}
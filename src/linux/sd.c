@@ -0,0 +1,56 @@
+/*
+ * SD card service for the Linux version
+ *
+ * There is no SD task, requests run directly on the calling thread one
+ * after the other. The card is the folder the simulator is started in.
+ *
+ * Copyright (c) 2022, Bastian Neumann <info@platinenmacher.tech>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "tasks.h"
+
+#include <pthread.h>
+
+extern uint8_t sd_status;
+storage_t* sd_storage;
+
+static pthread_mutex_t sd_lock;
+static pthread_once_t sd_once = PTHREAD_ONCE_INIT;
+
+static void sd_init()
+{
+    /* requests may run requests of their own, like on the SD task */
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&sd_lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    sd_storage = storage_posix_create(".");
+}
+
+error_code_t waitForSDInit()
+{
+    pthread_once(&sd_once, sd_init);
+    return sd_storage ? PM_OK : PM_FAIL;
+}
+
+error_code_t sd_submit(sd_request_t* req, sd_priority_t priority)
+{
+    if (waitForSDInit() != PM_OK || priority >= SD_PRIO_MAX)
+        return UNAVAILABLE;
+    pthread_mutex_lock(&sd_lock);
+    req->status = sd_status == PM_OK ? req->run(req->arg) : UNAVAILABLE;
+    if (req->done)
+        req->done(req);
+    pthread_mutex_unlock(&sd_lock);
+    return PM_OK;
+}
+
+error_code_t sd_call(sd_priority_t priority, error_code_t (*run)(void* arg), void* arg)
+{
+    sd_request_t req = { .run = run, .arg = arg };
+    error_code_t ret = sd_submit(&req, priority);
+    return ret == PM_OK ? req.status : ret;
+}
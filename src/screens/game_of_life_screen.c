@@ -7,6 +7,7 @@
  */
 
 #include "colors.h"
+#include "pixel.h"
 
 #include "gui.h"
 #include "tasks.h"
@@ -14,6 +15,8 @@
 #include "esp_log.h"
 #include "esp_random.h"
 
+#include <string.h>
+
 static const display_t* dsp;
 static image_t* world;
 static uint8_t* world_data;
@@ -31,69 +34,56 @@ static const char* TAG = "conway";
 #define WATER BLUE
 #define DIRT ORANGE
 
-static size_t get_offset(uint32_t x, uint32_t y)
-{
-    return y * world_width + x;
-}
+/* unpacked copies of the rows around the one being updated */
+static uint8_t* row_above;
+static uint8_t* row_current;
+static uint8_t* row_below;
+static uint8_t* row_next;
 
-static uint8_t get_pixel_from_offset(uint32_t x, uint32_t y)
+static uint8_t* row_data(size_t y)
 {
-    if (x >= world_width || y >= world_height)
-        return EMPTY;
-
-    size_t offset = get_offset(x, y);
-    if (offset & 0x01) {
-        return world_data[offset >> 1] & 0x0f;
-    } else {
-        return (world_data[offset >> 1] & 0xf0) >> 4;
-    }
+    return &world_data[(y * world_width) >> 1];
 }
 
-static void set_pixel_at_offset(uint32_t x, uint32_t y, uint8_t value)
+static uint8_t is_organism(const uint8_t* row, size_t x)
 {
-    if (x >= world_width || y >= world_height)
-        return;
-
-    size_t offset = get_offset(x, y);
-    size_t offset_shifted = offset >> 1;
-    if (offset & 0x01) {
-        world_data[offset_shifted] = (world_data[offset_shifted] & 0xf0) + (value & 0x0f);
-    } else {
-        world_data[offset_shifted] = (world_data[offset_shifted] & 0x0f) + ((value & 0x0f) << 4);
-    }
+    return row[x] == ORGANISM;
 }
 
 static error_code_t update_world(const display_t* dsp, void* image)
 {
     generation++;
     ESP_LOGI(TAG, "render generation %lu", generation);
-    for (size_t x = 1; x < world_width; x++) {
-        for (size_t y = 1; y < world_height; y++) {
+
+    /* rows are unpacked in bulk, updated and packed back, the row above is kept from before its update */
+    memset(row_above, EMPTY, world_width);
+    pixel_unpack_4bpp(row_current, row_data(0), world_width);
+    for (size_t y = 0; y < world_height; y++) {
+        if (y + 1 < world_height)
+            pixel_unpack_4bpp(row_below, row_data(y + 1), world_width);
+        else
+            memset(row_below, EMPTY, world_width);
+
+        for (size_t x = 0; x < world_width; x++) {
             uint8_t neighbours = 0;
-            if (get_pixel_from_offset(x - 1, y - 1) == ORGANISM)
-                neighbours++;
-            if (get_pixel_from_offset(x - 1, y) == ORGANISM)
-                neighbours++;
-            if (get_pixel_from_offset(x - 1, y + 1) == ORGANISM)
-                neighbours++;
-            if (get_pixel_from_offset(x, y - 1) == ORGANISM)
-                neighbours++;
-            if (get_pixel_from_offset(x, y + 1) == ORGANISM)
-                neighbours++;
-            if (get_pixel_from_offset(x + 1, y - 1) == ORGANISM)
-                neighbours++;
-            if (get_pixel_from_offset(x + 1, y) == ORGANISM)
-                neighbours++;
-            if (get_pixel_from_offset(x + 1, y + 1) == ORGANISM)
-                neighbours++;
-
-            if (get_pixel_from_offset(x, y) == ORGANISM && neighbours < 2)
-                set_pixel_at_offset(x, y, EMPTY);
-            else if (get_pixel_from_offset(x, y) == ORGANISM && neighbours > 3)
-                set_pixel_at_offset(x, y, EMPTY);
-            else if (get_pixel_from_offset(x, y) == EMPTY && neighbours == 3)
-                set_pixel_at_offset(x, y, ORGANISM);
+            if (x > 0)
+                neighbours += is_organism(row_above, x - 1) + is_organism(row_current, x - 1) + is_organism(row_below, x - 1);
+            neighbours += is_organism(row_above, x) + is_organism(row_below, x);
+            if (x + 1 < world_width)
+                neighbours += is_organism(row_above, x + 1) + is_organism(row_current, x + 1) + is_organism(row_below, x + 1);
+
+            row_next[x] = row_current[x];
+            if (row_current[x] == ORGANISM && (neighbours < 2 || neighbours > 3))
+                row_next[x] = EMPTY;
+            else if (row_current[x] == EMPTY && neighbours == 3)
+                row_next[x] = ORGANISM;
         }
+        pixel_pack_4bpp(row_data(y), row_next, world_width);
+
+        uint8_t* tmp = row_above;
+        row_above = row_current;
+        row_current = row_below;
+        row_below = tmp;
     }
     save_sprintf(label_text, "Generation %lu", generation);
 
@@ -103,13 +93,18 @@ static error_code_t update_world(const display_t* dsp, void* image)
 void conway_screen_create(const display_t* display)
 {
     dsp = display;
-    world_height = dsp->size.height;
-    world_width = dsp->size.width;
-    world_data = RTOS_Malloc((dsp->size.width-2) * (dsp->size.height-2) / 2);
-    world = image_create(world_data, 1, 1, world_width-2, world_height-2);
+    /* even width keeps every row byte aligned for the pixel kernels */
+    world_height = dsp->size.height - 2;
+    world_width = (dsp->size.width - 2) & ~1;
+    world_data = RTOS_Malloc(world_width * world_height / 2);
+    row_above = RTOS_Malloc(world_width);
+    row_current = RTOS_Malloc(world_width);
+    row_below = RTOS_Malloc(world_width);
+    row_next = RTOS_Malloc(world_width);
+    world = image_create(world_data, 1, 1, world_width, world_height);
     world->onBeforeRender = update_world;
 
-    for (size_t i = 0; i < (dsp->size.width-2) * (dsp->size.height-2) / 2; i++) {
+    for (size_t i = 0; i < world_width * world_height / 2; i++) {
         world_data[i] = esp_random() % 8 ? ORGANISM : EMPTY;
     }
 
@@ -129,5 +124,9 @@ void conway_screen_free()
 {
     free_all_render_pipelines();
     RTOS_Free(world_data);
+    RTOS_Free(row_above);
+    RTOS_Free(row_current);
+    RTOS_Free(row_below);
+    RTOS_Free(row_next);
 }
 
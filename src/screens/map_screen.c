@@ -9,8 +9,11 @@
 #include "gui/graph.h"
 #include "gui/label.h"
 #include "gui/map.h"
+#include "gui/tile_pipeline.h"
 
 #include "parser/gpx.h"
+#include "crc32.h"
+#include "track_cache.h"
 
 
 #include "gps.h"
@@ -39,6 +42,13 @@ static gpx_t* gpx_data;
 static waypoint_t* closest_wp;
 static int32_t dlat_min = INT32_MAX, dlon_min = INT32_MAX;
 
+/* taken once per frame, every part of the screen shows the same fix */
+static map_position_t position;
+#ifndef ESP_S3
+static tile_pipeline_t* tile_pipeline;
+#endif
+static uint32_t position_generation = UINT32_MAX;
+
 static uint8_t zoom_level_selected = 0;
 uint8_t zoom_level[] = { 16, 14 };
 uint8_t zoom_level_scaleBox_width[] = { 63, 77 };
@@ -56,23 +66,23 @@ static const char* TAG = "map_screen";
  */
 static error_code_t updateInfoText(const display_t* dsp, void* comp)
 {
-    if (!map_position)
+    if (!gps_position)
         return UNAVAILABLE;
 
     if (gpx_data && gpx_data->track_name) {
         strncpy(infoBox->text, gpx_data->track_name, INFOBOX_STRLEN);
         infoBox->backgroundColor = TRANSPARENT;
-    } else if (map_position->fix != GPS_FIX_INVALID) {
+    } else if (position.fix != GPS_FIX_INVALID) {
         char lat = 'N';
-        if (map_position->latitude < 0)
+        if (position.latitude < 0)
             lat = 'S';
 
         char lon = 'E';
-        if (map_position->longitude < 0)
+        if (position.longitude < 0)
             lon = 'W';
 
         save_snprintf(infoBox->text, (INFOBOX_STRLEN), "GPS: %f%c %f%c %.02fm (HDOP:%.01f)",
-            map_position->latitude, lat, map_position->longitude, lon, map_position->altitude, map_position->hdop);
+            position.latitude, lat, position.longitude, lon, position.altitude, position.hdop);
     } else {
         save_snprintf(infoBox->text, (INFOBOX_STRLEN), "No GPS Signal found!");
     }
@@ -81,13 +91,13 @@ static error_code_t updateInfoText(const display_t* dsp, void* comp)
 
 error_code_t render_position_marker(const display_t* dsp, void* comp)
 {
-    if (!map_position)
+    if (!gps_position)
         return UNAVAILABLE;
 
     label_t* label = (label_t*)comp;
-    uint8_t hdop = floor(map_position->hdop / 2);
+    uint8_t hdop = floor(position.hdop / 2);
     hdop += 8;
-    if (map_position->fix != GPS_FIX_INVALID) {
+    if (position.fix != GPS_FIX_INVALID) {
         label->box.left = -offset_x + map->pos_x - label->box.width / 2 + 256;
         label->box.top = -offset_y + map->pos_y - label->box.height / 2 + 256;
 
@@ -104,10 +114,10 @@ error_code_t render_position_marker(const display_t* dsp, void* comp)
 
 error_code_t updateSatsInView(const display_t* dsp, void* comp)
 {
-    save_sprintf(gps_indicator_label->text, "%d", map_position->satellites_in_view);
+    save_sprintf(gps_indicator_label->text, "%d", position.satellites_in_view);
     if (gps_indicator_label) {
         image_t* icon = gps_indicator_label->child;
-        if (map_position->fix != GPS_FIX_INVALID)
+        if (position.fix != GPS_FIX_INVALID)
             icon->data = GPS_lock;
         else
             icon->data = GPS;
@@ -119,8 +129,8 @@ void find_closest_waypoint(waypoint_t* wp)
 {
     // ignore inactive waypoints
     if (wp->active) {
-        int32_t dlat = abs((int)((wp->lat - map_position->latitude) * 1000000));
-        int32_t dlon = abs((int)((wp->lon - map_position->longitude) * 1000000));
+        int32_t dlat = abs((int)((wp->lat - position.latitude) * 1000000));
+        int32_t dlon = abs((int)((wp->lon - position.longitude) * 1000000));
         if (dlat < dlat_min && dlon < dlon_min) {
             dlat_min = dlat;
             dlon_min = dlon;
@@ -129,28 +139,28 @@ void find_closest_waypoint(waypoint_t* wp)
     }
 }
 
-void add_waypoints_to_renderer(waypoint_t* wp)
-{
-    if (wp->active)
-        add_to_render_pipeline(waypoint_render_marker, wp, RL_PATH);
-}
-
 static error_code_t map_pre_render_cb(const display_t* dsp, void* component)
 {
-    // Only modify map if we are GPS fixed
-    if (!map_position || map_position->fix == GPS_FIX_INVALID) {
+    if (!gps_position)
+        return NOT_NEEDED;
+
+    // Only modify map if there is a new position and we are GPS fixed
+    uint32_t generation = gps_position_read(gps_position, &position);
+    if (generation == position_generation || position.fix == GPS_FIX_INVALID) {
         return NOT_NEEDED;
     }
+    position_generation = generation;
 
     if (gps_indicator_label) {
         gps_indicator_label->onBeforeRender = updateSatsInView;
+        gps_indicator_label->dirty = 1;
+        ((image_t*)gps_indicator_label->child)->dirty = 1;
     }
-    map_update_position(map, map_position);
+    infoBox->dirty = 1;
+    positon_marker->dirty = 1;
+    map_update_position(map, &position);
     map_update_waypoint_path(map);
 
-    free_render_pipeline(RL_PATH);
-    map_run_on_waypoints(add_waypoints_to_renderer);
-
     dlat_min = INT32_MAX;
     dlon_min = INT32_MAX;
     closest_wp = NULL;
@@ -185,26 +195,101 @@ void populate_height_data_prepare_waypoints(waypoint_t* wp)
     wp->color = BLUE;
 }
 
+#if !defined(TESTING) && !defined(LINUX)
+typedef struct {
+    const char* filename;
+    uint32_t offset;
+    char* data;
+    size_t size;
+    size_t length;
+    uint32_t crc; /// of the file so far
+} gpx_chunk_t;
+
+typedef struct {
+    const char* filename;
+    char cache[STORAGE_PATH_LENGTH];
+    track_cache_header_t source;
+    track_cache_t* loaded;
+    gpx_t* gpx;
+} track_file_t;
+
+static error_code_t load_track_cache(void* arg)
+{
+    track_file_t* t = arg;
+    error_code_t ret = track_cache_source(sd_storage, t->filename, &t->source);
+    if (ret != PM_OK)
+        return ret;
+    return track_cache_load(sd_storage, t->cache, &t->source, &t->loaded);
+}
+
+static error_code_t save_track_cache(void* arg)
+{
+    track_file_t* t = arg;
+    return track_cache_save(sd_storage, t->cache, &t->source, t->gpx);
+}
+
+/* runs on the SD task, the file stays open from one chunk to the next */
+static error_code_t read_gpx_chunk_sd(void* arg)
+{
+    gpx_chunk_t* c = arg;
+    return sd_read_at(c->filename, c->offset, c->data, c->size, &c->length);
+}
+
+static error_code_t close_gpx_file(void* arg)
+{
+    storage_drop(sd_storage, arg);
+    return PM_OK;
+}
+
+/* the parser asks for the next chunk, tiles may be read in between */
+static error_code_t read_gpx_chunk(void* arg, char* data, size_t size, size_t* length)
+{
+    gpx_chunk_t* c = arg;
+    c->data = data;
+    c->size = size;
+    c->length = 0;
+    error_code_t ret = sd_call(SD_PRIO_PREFETCH, read_gpx_chunk_sd, c);
+    c->offset += c->length;
+    c->crc = crc32_update(c->crc, data, c->length);
+    *length = c->length;
+    return ret;
+}
+#endif
+
 void load_waypoint_file(char* filename)
 {
     #if !defined(TESTING) && !defined(LINUX)
     uint64_t start = esp_timer_get_time();
 
-    async_file_t wp_file;
-    wp_file.filename = filename;
-    wp_file.loaded = 0;
-    if (PM_OK == createFileBuffer(&wp_file))
-        loadFile(&wp_file);
+    /* the map skips missing tiles without asking the card */
+    map_tiles_index_track(SD_PRIO_PREFETCH);
+
+    /* the cache of the last parse unless the file changed since */
+    gpx_chunk_t chunk = { .filename = filename };
+    track_file_t track = { .filename = filename };
+    track_cache_path(track.cache, sizeof(track.cache), filename, "BIN");
+    uint8_t cached = sd_call(SD_PRIO_PREFETCH, load_track_cache, &track) == PM_OK;
+    if (cached) {
+        gpx_data = track_cache_gpx(track.loaded, map_add_waypoint);
+        track_cache_free(track.loaded);
+    } else {
+        /* the file is parsed in chunks, a long track does not have to fit in RAM */
+        gpx_data = gpx_parser_read(read_gpx_chunk, &chunk, map_add_waypoint);
+        sd_call(SD_PRIO_PREFETCH, close_gpx_file, filename);
+        if (gpx_data && gpx_data->waypoints && chunk.offset == track.source.source_size) {
+            track.source.source_crc = chunk.crc;
+            track.gpx = gpx_data;
+            sd_call(SD_PRIO_LOG, save_track_cache, &track);
+        }
+    }
 
-    if (wp_file.loaded == LOADED) {
-        gpx_data = gpx_parser(wp_file.dest, map_add_waypoint);
+    if (gpx_data && gpx_data->waypoints_num) {
         map_set_first_waypoint(gpx_data->waypoints);
-        RTOS_Free(wp_file.dest);
 
         // populate height data
         height_graph_data = RTOS_Malloc(sizeof(graph_point_t) * gpx_data->waypoints_num + 1);
         map_run_on_waypoints(populate_height_data_prepare_waypoints);
-        ESP_LOGI(TAG, "Load waypoint information done. Took: %lu ms", (uint32_t)(esp_timer_get_time() - start) / 1000);
+        ESP_LOGI(TAG, "Load waypoint information done%s. Took: %lu ms", cached ? " from cache" : "", (uint32_t)(esp_timer_get_time() - start) / 1000);
     } else {
         ESP_LOGI(TAG, "Load waypoint information failed. Took: %lu ms", (uint32_t)(esp_timer_get_time() - start) / 1000);
     }
@@ -216,31 +301,49 @@ void load_waypoint_file(char* filename)
 
 void toggleZoom()
 {
-    if (!map_position || !map || !scaleBox)
+    if (!gps_position || !map || !scaleBox)
         return;
 
     ESP_LOGI(TAG, "Zoom level was: %d", zoom_level[zoom_level_selected]);
     zoom_level_selected = !zoom_level_selected;
     ESP_LOGI(TAG, "Zoom level is: %d", zoom_level[zoom_level_selected]);
     map_update_zoom_level(map, zoom_level[zoom_level_selected]);
-    if (map_position->fix != GPS_FIX_INVALID)
-        map_update_position(map, map_position);
+    map_position_t current;
+    gps_position_read(gps_position, &current);
+    if (current.fix != GPS_FIX_INVALID)
+        map_update_position(map, &current);
 
     scaleBox->box.width = zoom_level_scaleBox_width[zoom_level_selected];
     scaleBox->text = zoom_level_scaleBox_text[zoom_level_selected];
+    scaleBox->dirty = 1;
 
-    trigger_rendering();
+    trigger_update();
+}
+
+/*
+ * Runs through free_screen when the map is hidden for another screen or for
+ * power down, the tile buffers are only held while the map is shown
+ */
+static void map_screen_free()
+{
+#ifndef ESP_S3
+    tile_pipeline_free(tile_pipeline);
+    tile_pipeline = NULL;
+#endif
 }
 
 void map_screen_create(const display_t* display)
 {
     dsp = display;
+    /* the new map is moved to the position with the first frame */
+    position_generation = UINT32_MAX;
     /* register pre_render callback */
     add_pre_render_callback(map_pre_render_cb);
 
     /* 3x3 tiles */
     map = map_create(-offset_x, -offset_y, 3, 3, 256, &f8x8);
     add_to_render_pipeline(map_render, map, RL_MAP);
+    add_to_render_pipeline(map_render_waypoints, NULL, RL_PATH);
 
     /* position marker */
     positon_marker = label_create("", &f8x16, 0, 0, 24, 24);
@@ -270,12 +373,20 @@ void map_screen_create(const display_t* display)
     map_update_zoom_level(map, zoom_level[zoom_level_selected]);
     // attach zoom_level event to short click
     set_short_press_event(toggleZoom);
+    set_screen_free_function(map_screen_free);
 
 #ifdef ESP_S3
+    /* the tiles stay loaded in PSRAM between frames, only the moved ones are read again */
     map_attach_onBeforeRender_callback(map, load_map_tiles_to_permanent_memory);
 #else
-    map_tile_attach_onBeforeRender_callback(map, load_map_tile_on_demand);
-    map_tile_attach_onAfterRender_callback(map, check_if_map_tile_is_loaded);
+    /* without PSRAM each frame streams the tiles through a few internal buffers */
+    tile_pipeline = tile_pipeline_create(read_map_tile);
+    if (tile_pipeline) {
+        map_attach_tile_pipeline(map, tile_pipeline);
+    } else {
+        map_tile_attach_onBeforeRender_callback(map, load_map_tile_on_demand);
+        map_tile_attach_onAfterRender_callback(map, check_if_map_tile_is_loaded);
+    }
 #endif // ESP_S3
 
     load_waypoint_file("//track.gpx");
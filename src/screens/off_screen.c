@@ -37,11 +37,13 @@ void off_screen_free()
     free_all_render_pipelines();
     
     RTOS_Free(infoText);
-    RTOS_Free(infoBox);
-    RTOS_Free(push_button);
-    RTOS_Free(qr_label);
+    label_free(infoBox);
+    label_free(push_button);
+    label_free(qr_label);
     RTOS_Free(splash_image_data);
-    RTOS_Free(wifi_indicator_image);
+    image_free(wifi_indicator_image);
+    push_button = NULL;
+    wifi_indicator_image = NULL;
     RTOS_Free(tempBuffer);
     RTOS_Free(qrcode);
     RTOS_Free(url);
@@ -97,19 +99,27 @@ error_code_t wifi_indicator_image_onBeforeRender(const display_t* dsp, void* ima
     return PM_OK;
 }
 
+/*
+ * Redraw the charging message and the WiFi symbol with the next update
+ */
+void off_screen_invalidate()
+{
+    if (push_button)
+        push_button->dirty = 1;
+    if (wifi_indicator_image)
+        wifi_indicator_image->dirty = 1;
+    trigger_update();
+}
+
 void turn_to_on()
 {
     gui_set_app_mode(APP_MODE_GPS_CREATE);
     vTaskDelete(wifiTask_h);
-    trigger_rendering();
+    trigger_update();
 }
 
 void off_screen_create(const display_t* display)
 {
-    FIL t_img;
-    uint32_t br;
-    FILINFO t_img_nfo;
-    FRESULT res = FR_NOT_READY;
     char fn[14];
     snprintf(fn, sizeof(fn), "//art%u.raw", (uint8_t)(esp_random() % RANDOM_IMG_NUM) + 1);
 
@@ -120,28 +130,13 @@ void off_screen_create(const display_t* display)
     xSemaphoreGive(print_semaphore);
 
     /* Create splash screen image component from splash.raw on SD card*/
-    waitForSDInit();
-    if (xSemaphoreTake(sd_semaphore, pdTICKS_TO_MS(1000))) {
-        // Check file info
-        res = f_stat((const TCHAR*)fn, &t_img_nfo);
-        ESP_LOGI(__func__, "Load image %s is: %d (%ld)", fn, res, t_img_nfo.fsize);
-        if (FR_OK == res) {
-            // Allocate file size
-            splash_image_data = RTOS_Malloc(t_img_nfo.fsize);
-        }
-        ESP_LOGI(__func__, "Load image to: %p", splash_image_data);
-        res = f_open(&t_img, (const TCHAR*)fn, FA_READ);
-        ESP_LOGI(__func__, "Image is opened %d: %p", res, splash_image_data);
-        if (FR_OK == res && splash_image_data != 0) {
-            res = f_read(&t_img,
-                splash_image_data, t_img_nfo.fsize,
-                (UINT*)&br);
-            f_close(&t_img);
-        } else {
-            ESP_LOGI(__func__, "Error from SD card: %d", res);
-        }
-        xSemaphoreGive(sd_semaphore);
+    async_file_t image_file = { .filename = fn };
+    if (PM_OK != loadFile(&image_file)) {
+        ESP_LOGI(__func__, "Cannot load image %s", image_file.filename);
+        RTOS_Free(image_file.dest);
+        image_file.dest = NULL;
     }
+    splash_image_data = (uint8_t*)image_file.dest;
 
     image_t* splash = image_create(splash_image_data, 0, 0, 448, 600);
 
@@ -18,7 +18,7 @@ image_t* splash;
 void picture_screen_free()
 {
     free_all_render_pipelines();
-    RTOS_Free(splash);
+    image_free(splash);
     RTOS_Free(splash_image_data);
 }
 
@@ -29,36 +29,17 @@ void picture_set_image_path(const char *path)
 
 void picture_screen_create(const display_t* display)
 {
-    FIL t_img;
-    uint32_t br;
-    FILINFO t_img_nfo;
-    FRESULT res = FR_NOT_READY;
     
     dsp = display;
 
     /* Create splash screen image component from splash.raw on SD card*/
-    waitForSDInit();
-    if (xSemaphoreTake(sd_semaphore, pdTICKS_TO_MS(1000))) {
-        // Check file info
-        res = f_stat((const TCHAR*)fn, &t_img_nfo);
-        ESP_LOGI(__func__, "Load image %s is: %d (%ld)", fn, res, t_img_nfo.fsize);
-        if (FR_OK == res) {
-            // Allocate file size
-            splash_image_data = RTOS_Malloc(t_img_nfo.fsize);
-        }
-        ESP_LOGI(__func__, "Load image to: %p", splash_image_data);
-        res = f_open(&t_img, (const TCHAR*)fn, FA_READ);
-        ESP_LOGI(__func__, "Image is opened %d: %p", res, splash_image_data);
-        if (FR_OK == res && splash_image_data != 0) {
-            res = f_read(&t_img,
-                splash_image_data, t_img_nfo.fsize,
-                (UINT*)&br);
-            f_close(&t_img);
-        } else {
-            ESP_LOGI(__func__, "Error from SD card: %d", res);
-        }
-        xSemaphoreGive(sd_semaphore);
+    async_file_t image_file = { .filename = (char*)fn };
+    if (PM_OK != loadFile(&image_file)) {
+        ESP_LOGI(__func__, "Cannot load image %s", image_file.filename);
+        RTOS_Free(image_file.dest);
+        image_file.dest = NULL;
     }
+    splash_image_data = (uint8_t*)image_file.dest;
 
     splash = image_create(splash_image_data, 0, 0, 448, 600);
 
@@ -26,6 +26,7 @@ static label_t* task_info_label;
 char task_info[1024];
 
 extern uint32_t gps_ticks;
+extern uint8_t sd_status;
 
 static label_t* sd_info_label;
 char sd_info[1024];
@@ -76,16 +77,18 @@ error_code_t update_gps_info_label(const display_t* dsp, void* comp)
 {
     gpio_t pwr = {};
     pwr.pin = GPS_VCC_nEN;
-    if (map_position && xSemaphoreTake(print_semaphore, 1000)) {
+    map_position_t position;
+    if (gps_position && xSemaphoreTake(print_semaphore, 1000)) {
+        gps_position_read(gps_position, &position);
         snprintf(gps_info, 1024, "GPS Info\n Power: %d\n Fix: %d HDOP:%f\n Lat: %f\n Lon:%f\n Ele:%f\n Sats in view/use %d/%d\n Ticks: %lu",
             !gpio_read(&pwr),
-            map_position->fix,
-            map_position->hdop,
-            map_position->latitude,
-            map_position->longitude,
-            map_position->altitude,
-            map_position->satellites_in_view,
-            map_position->satellites_in_use,
+            position.fix,
+            position.hdop,
+            position.latitude,
+            position.longitude,
+            position.altitude,
+            position.satellites_in_view,
+            position.satellites_in_use,
             gps_ticks);
 
         xSemaphoreGive(print_semaphore);
@@ -170,9 +173,9 @@ error_code_t update_sd_info_label(const display_t* dsp, void* comp)
     gpio_t pwr = {};
     pwr.pin = SD_VCC_nEN;
     if (xSemaphoreTake(print_semaphore, 1000)) {
-        snprintf(sd_info, 1024, "SD Info\n Power: %d\n Semaphore Count: %d",
+        snprintf(sd_info, 1024, "SD Info\n Power: %d\n Mounted: %d",
             !gpio_read(&pwr),
-            uxSemaphoreGetCount(sd_semaphore));
+            sd_status == PM_OK);
 
         xSemaphoreGive(print_semaphore);
     }
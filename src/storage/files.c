@@ -0,0 +1,292 @@
+/*
+ * File access of the firmware
+ *
+ * The same code for the SD card and the simulator. Every access goes
+ * through sd_call, so on the ESP32 it runs on the SD task and uses the
+ * FatFs storage, in the simulator it runs on the calling thread and uses
+ * the POSIX storage.
+ *
+ * Copyright (c) 2022, Bastian Neumann <info@platinenmacher.tech>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "tasks.h"
+
+static const char* TAG = "SD";
+
+static error_code_t load_file(void* arg)
+{
+    async_file_t* file = arg;
+    error_code_t ret = storage_load(sd_storage, file->filename, &file->dest, NULL);
+    if (PM_OK == ret)
+        file->loaded = LOADED;
+    return ret;
+}
+
+/*
+ * Load a whole file and wait until it is loaded
+ *
+ * Allocates memory if destination buffer is not initialized.
+ */
+error_code_t loadFile(async_file_t* file)
+{
+    ESP_LOGI(TAG, "Load %s ", file->filename);
+    return sd_call(file->priority, load_file, file);
+}
+
+static error_code_t file_exists(void* arg)
+{
+    async_file_t* file = arg;
+    uint32_t size;
+    return PM_OK == storage_stat(sd_storage, file->filename, &size) ? PM_OK : PM_FAIL;
+}
+
+error_code_t fileExists(async_file_t* file)
+{
+    return sd_call(file->priority, file_exists, file);
+}
+
+static error_code_t create_file_buffer(void* arg)
+{
+    async_file_t* file = arg;
+    uint32_t size;
+    if (PM_OK != storage_stat(sd_storage, file->filename, &size))
+        return PM_FAIL;
+    if (!(file->dest = RTOS_MallocIO(size + 1)))
+        return PM_FAIL;
+    file->dest[size] = 0;
+    return PM_OK;
+}
+
+error_code_t createFileBuffer(async_file_t* file)
+{
+    return sd_call(file->priority, create_file_buffer, file);
+}
+
+static error_code_t open_file_for_writing(void* arg)
+{
+    async_file_t* file = arg;
+    return storage_open_for_writing(sd_storage, file->filename, STORAGE_WRITE, &file->file);
+}
+
+/*
+ * Create or truncate a file, missing folders are created
+ */
+error_code_t openFileForWriting(async_file_t* file)
+{
+    return sd_call(file->priority, open_file_for_writing, file);
+}
+
+async_file_t* createPhysicalFile()
+{
+    return RTOS_Malloc(sizeof(async_file_t));
+}
+
+typedef struct {
+    async_file_t* file;
+    void* data;
+    uint32_t count;
+    uint32_t* written;
+} write_args_t;
+
+static error_code_t write_to_file(void* arg)
+{
+    write_args_t* w = arg;
+    size_t written;
+    error_code_t ret = storage_write(w->file->file, w->data, w->count, &written);
+    *w->written = written;
+    return ret;
+}
+
+/*
+ * Write to an open file, the data is only safe on the card after closeFile
+ *
+ * Use a write stream for many small writes.
+ */
+error_code_t writeToFile(async_file_t* file, void* in_data, uint32_t count, uint32_t* written)
+{
+    write_args_t w = { file, in_data, count, written };
+    *written = 0;
+    return sd_call(file->priority, write_to_file, &w);
+}
+
+static error_code_t close_file(void* arg)
+{
+    async_file_t* file = arg;
+    error_code_t ret = storage_close(file->file);
+    file->file = NULL;
+    return ret;
+}
+
+error_code_t closeFile(async_file_t* file)
+{
+    return sd_call(file->priority, close_file, file);
+}
+
+static error_code_t delete_file(void* arg)
+{
+    async_file_t* file = arg;
+    return storage_unlink(sd_storage, file->filename);
+}
+
+error_code_t deleteFile(async_file_t* file)
+{
+    return sd_call(file->priority, delete_file, file);
+}
+
+void closePhysicalFile(async_file_t* file)
+{
+    if (file) {
+        if (file->file)
+            ESP_LOGI(TAG, "File: %s is still open", file->filename);
+        if (file->dest) {
+            ESP_LOGI(TAG, "Free file->dest");
+            RTOS_Free(file->dest);
+        }
+        RTOS_Free(file);
+    }
+}
+
+/*
+ * Read from a file that is kept open
+ *
+ * Only call this from a request running on the SD task.
+ * returns UNAVAILABLE if the file does not exist
+ */
+error_code_t sd_read_at(const char* path, uint32_t offset, void* data, size_t size, size_t* length)
+{
+    return storage_read_at(sd_storage, path, offset, data, size, length);
+}
+
+/*
+ * Buffered write streams on the SD task
+ */
+struct sd_stream {
+    storage_stream_t* stream;
+    sd_priority_t priority;
+    sd_stream_t* next; /// in unclosed_streams
+};
+
+/* streams closed while the card was removed, the SD task releases them */
+static sd_stream_t* unclosed_streams;
+
+typedef struct {
+    sd_stream_t* stream;
+    const char* filename;
+    size_t buffer_size;
+    uint32_t preallocate;
+    const void* data;
+    size_t length;
+} stream_args_t;
+
+static error_code_t stream_open(void* arg)
+{
+    stream_args_t* a = arg;
+    a->stream->stream = storage_stream_open(sd_storage, a->filename, a->buffer_size, a->preallocate);
+    return a->stream->stream ? PM_OK : PM_FAIL;
+}
+
+static error_code_t stream_write(void* arg)
+{
+    stream_args_t* a = arg;
+    return storage_stream_write(a->stream->stream, a->data, a->length);
+}
+
+static error_code_t stream_sync(void* arg)
+{
+    sd_stream_t* s = arg;
+    return storage_stream_sync(s->stream);
+}
+
+static error_code_t stream_close(void* arg)
+{
+    sd_stream_t* s = arg;
+    error_code_t ret = storage_stream_close(s->stream);
+    s->stream = NULL;
+    return ret;
+}
+
+static error_code_t sync_all_streams(void* arg)
+{
+    return storage_sync_streams(sd_storage, 0);
+}
+
+/*
+ * Open a file for buffered writing
+ *
+ * buffer_size is rounded up to whole sectors, 0 selects
+ * STORAGE_STREAM_BUFFER_SIZE. If the final size is known, preallocate
+ * reserves it up front, the file is cut to the written length on close.
+ */
+sd_stream_t* sd_stream_open(const char* filename, sd_priority_t priority, size_t buffer_size, uint32_t preallocate)
+{
+    sd_stream_t* s = RTOS_Malloc(sizeof(sd_stream_t));
+    if (!s)
+        return NULL;
+    s->priority = priority;
+    stream_args_t a = { .stream = s, .filename = filename, .buffer_size = buffer_size, .preallocate = preallocate };
+    if (PM_OK != sd_call(priority, stream_open, &a)) {
+        ESP_LOGE(TAG, "cannot open stream %s", filename);
+        RTOS_Free(s);
+        return NULL;
+    }
+    return s;
+}
+
+error_code_t sd_stream_write(sd_stream_t* stream, const void* data, size_t length)
+{
+    stream_args_t a = { .stream = stream, .data = data, .length = length };
+    return sd_call(stream->priority, stream_write, &a);
+}
+
+/*
+ * Write staged data and update the directory entry
+ */
+error_code_t sd_stream_sync(sd_stream_t* stream)
+{
+    return sd_call(stream->priority, stream_sync, stream);
+}
+
+error_code_t sd_stream_close(sd_stream_t* stream)
+{
+    if (!stream)
+        return NOT_NEEDED;
+    error_code_t ret = sd_call(stream->priority, stream_close, stream);
+    if (stream->stream) {
+        /* the SD task did not run the close, it still owns buffer and file */
+        stream->next = __atomic_load_n(&unclosed_streams, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&unclosed_streams, &stream->next, stream, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            ;
+        return ret;
+    }
+    RTOS_Free(stream);
+    return ret;
+}
+
+/*
+ * Release the streams sd_stream_close could not close, runs on the SD task
+ *
+ * Their data is lost with the card, only the memory and the stream slot
+ * are freed.
+ */
+void sd_stream_release_unclosed()
+{
+    sd_stream_t* s = __atomic_exchange_n(&unclosed_streams, NULL, __ATOMIC_ACQUIRE);
+    while (s) {
+        sd_stream_t* next = s->next;
+        storage_stream_close(s->stream);
+        RTOS_Free(s);
+        s = next;
+    }
+}
+
+/*
+ * Sync every open stream, call before the card loses power
+ */
+error_code_t sd_stream_sync_all()
+{
+    if (!sd_storage)
+        return NOT_NEEDED;
+    return sd_call(SD_PRIO_INTERACTIVE, sync_all_streams, NULL);
+}
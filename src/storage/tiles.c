@@ -0,0 +1,282 @@
+/*
+ * Presence of the map tiles on the SD card
+ *
+ * The tilesets of the TRACK file are indexed once, afterwards the map and
+ * the downloader know if a tile exists without asking the card. A tile is
+ * either a file of its own or part of the pack of its tileset, a file wins
+ * so single tiles of a pack can be updated.
+ *
+ * Every write to the index runs on the SD task, so a tile that failed to
+ * load cannot overtake the download that stores it.
+ *
+ * Copyright (c) 2022, Bastian Neumann <info@platinenmacher.tech>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "tasks.h"
+#include "helper.h"
+#include "tile_index.h"
+#include "tile_pack.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define MAP_TILE_FOLDER "//MAPS"
+
+static const char* TAG = "tiles";
+static tile_index_t* map_tiles; /// created and written by the SD task
+static tile_pack_t* map_packs;  /// only the SD task adds packs
+
+typedef struct {
+    tile_range_t* range;
+    uint32_t x;
+} column_scan_t;
+
+typedef struct {
+    uint8_t zoom;
+    uint32_t x_min;
+    uint32_t x_max;
+    uint32_t y_min;
+    uint32_t y_max;
+    tile_range_t* range;
+} range_call_t;
+
+typedef struct {
+    uint8_t zoom;
+    uint32_t x;
+    uint32_t y;
+    uint8_t present;
+} tile_call_t;
+
+static error_code_t add_range(void* arg)
+{
+    range_call_t* c = arg;
+    if (!map_tiles) {
+        tile_index_t* index = tile_index_create();
+        if (!index)
+            return PM_FAIL;
+        __atomic_store_n(&map_tiles, index, __ATOMIC_RELEASE);
+    }
+    c->range = tile_index_add_range(map_tiles, c->zoom, c->x_min, c->x_max, c->y_min, c->y_max);
+    return c->range ? PM_OK : PM_FAIL;
+}
+
+static error_code_t set_tile(void* arg)
+{
+    tile_call_t* c = arg;
+    tile_index_set(map_tiles, c->zoom, c->x, c->y, c->present);
+    return PM_OK;
+}
+
+static error_code_t scan_column(void* arg)
+{
+    column_scan_t* s = arg;
+    return tile_index_scan_column(s->range, sd_storage, MAP_TILE_FOLDER, s->x);
+}
+
+typedef struct {
+    const char* path;
+    tile_pack_t* pack;
+} pack_call_t;
+
+/* reads find the pack from now on, its tiles are marked in the index afterwards */
+static error_code_t open_pack(void* arg)
+{
+    pack_call_t* c = arg;
+    for (c->pack = map_packs; c->pack; c->pack = c->pack->next)
+        if (!strcmp(c->pack->path, c->path))
+            return __atomic_load_n(&c->pack->ready, __ATOMIC_ACQUIRE) ? NOT_NEEDED : PM_OK;
+    tile_pack_t* pack;
+    error_code_t ret = tile_pack_open(sd_storage, c->path, &pack);
+    if (ret != PM_OK)
+        return ret;
+    pack->next = map_packs;
+    __atomic_store_n(&map_packs, pack, __ATOMIC_RELEASE);
+    c->pack = pack;
+    return PM_OK;
+}
+
+/* a pack whose index could not be read starts over with the next add */
+static error_code_t index_pack(void* arg)
+{
+    tile_pack_t* pack = arg;
+    error_code_t ret = tile_pack_index(sd_storage, pack, map_tiles);
+    if (ret != PM_OK && ret != DEFERRED) {
+        pack->indexed = 0;
+        pack->tiles = 0;
+    }
+    return ret;
+}
+
+/*
+ * The index of a pack is read a few entries per request, so tiles the
+ * screen waits for get in between.
+ */
+static error_code_t add_pack(sd_priority_t priority, const char* path)
+{
+    pack_call_t c = { .path = path };
+    error_code_t ret = sd_call(priority, open_pack, &c);
+    if (ret != PM_OK)
+        return ret == NOT_NEEDED ? PM_OK : ret;
+    while ((ret = sd_call(priority, index_pack, c.pack)) == DEFERRED)
+        ;
+    if (ret != PM_OK)
+        return ret;
+    __atomic_store_n(&c.pack->ready, 1, __ATOMIC_RELEASE);
+    ESP_LOGI(TAG, "%s with %lu tiles", path, (unsigned long)c.pack->tiles);
+    return PM_OK;
+}
+
+/* the range is used from now on */
+static error_code_t finish_range(void* arg)
+{
+    tile_range_t* range = arg;
+    __atomic_store_n(&range->ready, 1, __ATOMIC_RELEASE);
+    return PM_OK;
+}
+
+/**
+ * Index the tiles of one zoom level in a bounding box
+ *
+ * Every tile folder is listed in its own request, so tiles the screen
+ * waits for get in between.
+ */
+error_code_t map_tiles_index_range(sd_priority_t priority, uint8_t zoom, uint32_t x_min, uint32_t x_max, uint32_t y_min, uint32_t y_max)
+{
+    range_call_t c = { .zoom = zoom, .x_min = x_min, .x_max = x_max, .y_min = y_min, .y_max = y_max };
+    error_code_t ret = sd_call(priority, add_range, &c);
+    if (ret != PM_OK)
+        return ret;
+    tile_range_t* range = c.range;
+    if (__atomic_load_n(&range->ready, __ATOMIC_ACQUIRE))
+        return PM_OK;
+
+    int64_t start = RTOS_Micros();
+    for (uint32_t x = x_min; x <= x_max; x++) {
+        column_scan_t s = { range, x };
+        if ((ret = sd_call(priority, scan_column, &s)) != PM_OK)
+            return ret;
+    }
+    /* tiles of the pack are marked before the range is used */
+    char path[STORAGE_PATH_LENGTH];
+    map_tiles_pack_path(path, zoom, x_min, x_max, y_min, y_max, "TPK");
+    add_pack(priority, path);
+    sd_call(priority, finish_range, range);
+    ESP_LOGI(TAG, "zoom %u [%lu-%lu]/[%lu-%lu] indexed in %lu ms", zoom,
+        (unsigned long)x_min, (unsigned long)x_max, (unsigned long)y_min, (unsigned long)y_max,
+        (unsigned long)((RTOS_Micros() - start) / 1000));
+    return PM_OK;
+}
+
+/**
+ * Index every tileset of the TRACK file
+ *
+ * The file holds the download URL followed by blocks of zoom, folder_min,
+ * folder_max, file_min and file_max, a zoom of 0 ends the list.
+ */
+error_code_t map_tiles_index_track(sd_priority_t priority)
+{
+    async_file_t track = { .filename = "//TRACK", .priority = priority };
+    char line[50];
+    uint32_t values[4];
+    error_code_t ret = loadFile(&track);
+    if (ret != PM_OK)
+        return ret;
+
+    char* f = readline(track.dest, line); // download URL
+    while ((f = readline(f, line))) {
+        uint8_t zoom = atoi(line);
+        if (!zoom)
+            break;
+        for (uint8_t i = 0; i < 4 && f; i++) {
+            f = readline(f, line);
+            values[i] = atoi(line);
+        }
+        if (!f)
+            break;
+        if ((ret = map_tiles_index_range(priority, zoom, values[0], values[1], values[2], values[3])) != PM_OK)
+            break;
+    }
+    RTOS_Free(track.dest);
+    return ret;
+}
+
+enum TilePresence map_tiles_lookup(const map_tile_t* tile)
+{
+    return tile_index_lookup(__atomic_load_n(&map_tiles, __ATOMIC_ACQUIRE), tile->z, tile->x, tile->y);
+}
+
+/**
+ * Record a tile that was downloaded or turned out to be missing
+ *
+ * Runs on the SD task, call it from the request that found the tile
+ * missing so no write to the card can come in between.
+ */
+void map_tiles_set(uint8_t zoom, uint32_t x, uint32_t y, uint8_t present)
+{
+    tile_call_t c = { .zoom = zoom, .x = x, .y = y, .present = present };
+    sd_call(SD_PRIO_INTERACTIVE, set_tile, &c);
+}
+
+/**
+ * Path of the pack of a tileset on the card
+ */
+void map_tiles_pack_path(char* path, uint8_t zoom, uint32_t x_min, uint32_t x_max, uint32_t y_min, uint32_t y_max, const char* extension)
+{
+    tile_pack_path(path, STORAGE_PATH_LENGTH, MAP_TILE_FOLDER, zoom, x_min, x_max, y_min, y_max, extension);
+}
+
+/**
+ * Use a pack that was downloaded, its tiles are present afterwards
+ */
+error_code_t map_tiles_add_pack(sd_priority_t priority, const char* path)
+{
+    return add_pack(priority, path);
+}
+
+/**
+ * The tileset has a pack on the card
+ */
+uint8_t map_tiles_has_pack(uint8_t zoom, uint32_t x_min, uint32_t x_max, uint32_t y_min, uint32_t y_max)
+{
+    for (tile_pack_t* p = __atomic_load_n(&map_packs, __ATOMIC_ACQUIRE); p; p = p->next) {
+        tile_pack_header_t* h = &p->header;
+        if (h->zoom == zoom && h->x_min == x_min && h->x_max == x_max && h->y_min == y_min && h->y_max == y_max)
+            return __atomic_load_n(&p->ready, __ATOMIC_ACQUIRE);
+    }
+    return 0;
+}
+
+static tile_pack_t* find_pack(uint8_t zoom, uint32_t x, uint32_t y)
+{
+    for (tile_pack_t* p = map_packs; p; p = p->next) {
+        tile_pack_header_t* h = &p->header;
+        if (h->zoom == zoom && x >= h->x_min && x <= h->x_max && y >= h->y_min && y <= h->y_max)
+            return p;
+    }
+    return NULL;
+}
+
+/**
+ * Index entry of a packed tile, only on the SD task
+ *
+ * returns UNAVAILABLE if no pack has the tile
+ */
+error_code_t map_tiles_packed_entry(uint8_t zoom, uint32_t x, uint32_t y, tile_pack_entry_t* entry)
+{
+    tile_pack_t* p = find_pack(zoom, x, y);
+    return p ? tile_pack_lookup(sd_storage, p, x, y, entry) : UNAVAILABLE;
+}
+
+/**
+ * Read a packed tile, only on the SD task
+ *
+ * returns UNAVAILABLE if no pack has the tile
+ */
+error_code_t map_tiles_read_packed(const map_tile_t* tile, void* data, size_t size, size_t* length)
+{
+    tile_pack_t* p = find_pack(tile->z, tile->x, tile->y);
+    *length = 0;
+    return p ? tile_pack_read(sd_storage, p, tile->x, tile->y, data, size, length) : UNAVAILABLE;
+}
@@ -0,0 +1,412 @@
+#include <unity.h>
+
+#include "crc32.h"
+#include "downloader.h"
+#include "memory.h"
+
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define FILE_COUNT 100
+#define FILE_SIZE (16 * 1024)
+
+/* local HTTP server, answers GET /tiles/<n>.raw */
+typedef struct {
+    int fd;
+    uint16_t port;
+    pthread_t thread;
+    volatile int stop;
+    uint32_t latency_ms;  /// delay of the connection setup and of every response, like a round trip
+    uint8_t close_each;   /// answer with Connection: close
+    uint32_t drop_after;  /// close the connection without notice after this many responses
+    uint8_t missing;      /// every tenth file does not exist
+    uint8_t flaky;        /// some files fail once with 503
+    uint8_t garbled;      /// some files have a wrong byte the first time
+    uint8_t failed[FILE_COUNT];
+    uint32_t connections;
+    uint32_t requests;
+} server_t;
+
+/* what the client received */
+typedef struct {
+    uint32_t next;
+    uint32_t count;
+    uint8_t verify;
+    uint32_t length[FILE_COUNT];
+    uint8_t corrupt[FILE_COUNT];
+    int result[FILE_COUNT];
+} client_t;
+
+static server_t server;
+static client_t client;
+static transport_t* transport;
+
+static uint8_t file_byte(uint32_t n, uint32_t i)
+{
+    return (n * 7 + i) & 0xff;
+}
+
+static void send_all(int fd, const void* data, size_t length)
+{
+    while (length) {
+        ssize_t count = send(fd, data, length, MSG_NOSIGNAL);
+        if (count <= 0)
+            return;
+        data = (const uint8_t*)data + count;
+        length -= count;
+    }
+}
+
+static void respond(server_t* s, int fd, int n, uint8_t close_connection)
+{
+    char header[128];
+    const char* connection = close_connection ? "Connection: close\r\n" : "";
+    if (n < 0 || n >= FILE_COUNT || (s->missing && n % 10 == 9)) {
+        int length = snprintf(header, sizeof(header), "HTTP/1.1 404 Not Found\r\nContent-Length: 9\r\n%s\r\nnot found", connection);
+        send_all(fd, header, length);
+        return;
+    }
+    if (s->flaky && n % 7 == 3 && !s->failed[n]) {
+        s->failed[n] = 1;
+        int length = snprintf(header, sizeof(header), "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\n%s\r\n", connection);
+        send_all(fd, header, length);
+        return;
+    }
+    static char response[sizeof(header) + FILE_SIZE];
+    int length = snprintf(response, sizeof(header), "HTTP/1.1 200 OK\r\nContent-Length: %d\r\n%s\r\n", FILE_SIZE, connection);
+    for (uint32_t i = 0; i < FILE_SIZE; i++)
+        response[length + i] = file_byte(n, i);
+    if (s->garbled && n % 9 == 4 && !s->failed[n]) {
+        s->failed[n] = 1;
+        response[length + FILE_SIZE / 2] ^= 0x10;
+    }
+    send_all(fd, response, length + FILE_SIZE);
+}
+
+static int64_t now_ms()
+{
+    return RTOS_Micros() / 1000;
+}
+
+/* requests are answered latency_ms after they arrived, in order */
+static void serve(server_t* s, int fd)
+{
+    char buffer[4096];
+    size_t length = 0;
+    int files[64];
+    int64_t due[64];
+    int queued = 0;
+    uint32_t responses = 0;
+
+    RTOS_Delay(s->latency_ms);
+    while (!s->stop) {
+        char* end;
+        buffer[length] = 0;
+        while (queued < 64 && (end = strstr(buffer, "\r\n\r\n"))) {
+            files[queued] = -1;
+            sscanf(buffer, "GET /tiles/%d.raw", &files[queued]);
+            due[queued++] = now_ms() + s->latency_ms;
+            s->requests++;
+            length -= end + 4 - buffer;
+            memmove(buffer, end + 4, length + 1);
+        }
+        int timeout = 50;
+        if (queued) {
+            int64_t wait = due[0] - now_ms();
+            if (wait <= 0) {
+                uint8_t close_connection = s->close_each || (s->drop_after && responses + 1 == s->drop_after);
+                respond(s, fd, files[0], s->close_each);
+                responses++;
+                queued--;
+                memmove(files, files + 1, queued * sizeof(int));
+                memmove(due, due + 1, queued * sizeof(int64_t));
+                if (close_connection) {
+                    /* like a server closing an idle connection, requests already sent are dropped */
+                    shutdown(fd, SHUT_WR);
+                    while (recv(fd, buffer, sizeof(buffer), 0) > 0)
+                        ;
+                    break;
+                }
+                continue;
+            }
+            timeout = wait < timeout ? wait : timeout;
+        }
+        struct pollfd p = { .fd = fd, .events = POLLIN };
+        if (poll(&p, 1, timeout) <= 0)
+            continue;
+        ssize_t count = recv(fd, buffer + length, sizeof(buffer) - 1 - length, 0);
+        if (count <= 0)
+            break;
+        length += count;
+    }
+    close(fd);
+}
+
+static void* server_task(void* arg)
+{
+    server_t* s = arg;
+    while (!s->stop) {
+        struct pollfd p = { .fd = s->fd, .events = POLLIN };
+        if (poll(&p, 1, 50) <= 0)
+            continue;
+        int fd = accept(s->fd, NULL, NULL);
+        if (fd < 0)
+            continue;
+        s->connections++;
+        serve(s, fd);
+    }
+    return NULL;
+}
+
+static void server_start(uint16_t port)
+{
+    int one = 1;
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port), .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t size = sizeof(addr);
+    server.fd = socket(AF_INET, SOCK_STREAM, 0);
+    setsockopt(server.fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    TEST_ASSERT_EQUAL(0, bind(server.fd, (struct sockaddr*)&addr, sizeof(addr)));
+    TEST_ASSERT_EQUAL(0, listen(server.fd, 4));
+    getsockname(server.fd, (struct sockaddr*)&addr, &size);
+    server.port = ntohs(addr.sin_port);
+    server.stop = 0;
+    pthread_create(&server.thread, NULL, server_task, &server);
+}
+
+static void server_stop()
+{
+    server.stop = 1;
+    pthread_join(server.thread, NULL);
+    close(server.fd);
+}
+
+static error_code_t next_file(void* arg, download_t* d)
+{
+    client_t* c = arg;
+    if (c->next >= c->count)
+        return NOT_NEEDED;
+    d->key[0] = c->next++;
+    snprintf(d->path, sizeof(d->path), "/tiles/%lu.raw", (unsigned long)d->key[0]);
+    if (c->verify) {
+        d->verify = 1;
+        d->size = FILE_SIZE;
+        for (uint32_t i = 0; i < FILE_SIZE; i++) {
+            uint8_t b = file_byte(d->key[0], i);
+            d->crc = crc32_update(d->crc, &b, 1);
+        }
+    }
+    return PM_OK;
+}
+
+static error_code_t open_file(void* arg, download_t* d, uint32_t length)
+{
+    client_t* c = arg;
+    c->length[d->key[0]] = 0;
+    c->corrupt[d->key[0]] = length != FILE_SIZE;
+    return PM_OK;
+}
+
+static error_code_t write_file(void* arg, download_t* d, const uint8_t* data, size_t length)
+{
+    client_t* c = arg;
+    uint32_t n = d->key[0];
+    for (size_t i = 0; i < length; i++)
+        if (data[i] != file_byte(n, c->length[n] + i))
+            c->corrupt[n] = 1;
+    c->length[n] += length;
+    return PM_OK;
+}
+
+static void finish_file(void* arg, download_t* d, error_code_t result)
+{
+    client_t* c = arg;
+    c->result[d->key[0]] = result;
+}
+
+static const downloader_handler_t handler = {
+    .next = next_file,
+    .open = open_file,
+    .write = write_file,
+    .finish = finish_file,
+    .arg = &client,
+};
+
+static downloader_t* downloader(uint8_t in_flight)
+{
+    downloader_t* d = downloader_create(transport, "127.0.0.1", server.port, &handler);
+    d->max_in_flight = in_flight;
+    d->backoff_ms = 5;
+    d->backoff_max_ms = 20;
+    return d;
+}
+
+static void assert_all_downloaded(uint32_t count)
+{
+    for (uint32_t n = 0; n < count; n++) {
+        if (server.missing && n % 10 == 9) {
+            TEST_ASSERT_EQUAL(UNAVAILABLE, client.result[n]);
+            continue;
+        }
+        TEST_ASSERT_EQUAL(PM_OK, client.result[n]);
+        TEST_ASSERT_EQUAL_UINT32(FILE_SIZE, client.length[n]);
+        TEST_ASSERT_FALSE(client.corrupt[n]);
+    }
+}
+
+void setUp()
+{
+    memset(&server, 0, sizeof(server));
+    memset(&client, 0, sizeof(client));
+    for (int i = 0; i < FILE_COUNT; i++)
+        client.result[i] = -1;
+    client.count = FILE_COUNT;
+    transport = transport_socket_create(2000);
+    server_start(0);
+}
+
+void tearDown()
+{
+    server_stop();
+    transport_socket_free(transport);
+}
+
+void test_parse_url()
+{
+    char host[DOWNLOADER_HOST_LENGTH];
+    uint16_t port;
+    const char* path;
+    TEST_ASSERT_EQUAL(PM_OK, downloader_parse_url("http://platinenmacher.tech/indianavi/", host, sizeof(host), &port, &path));
+    TEST_ASSERT_EQUAL_STRING("platinenmacher.tech", host);
+    TEST_ASSERT_EQUAL_UINT16(80, port);
+    TEST_ASSERT_EQUAL_STRING("/indianavi/", path);
+    TEST_ASSERT_EQUAL(PM_OK, downloader_parse_url("HTTP://127.0.0.1:8080", host, sizeof(host), &port, &path));
+    TEST_ASSERT_EQUAL_STRING("127.0.0.1", host);
+    TEST_ASSERT_EQUAL_UINT16(8080, port);
+    TEST_ASSERT_EQUAL_STRING("", path);
+    TEST_ASSERT_EQUAL(PM_FAIL, downloader_parse_url("https://platinenmacher.tech/", host, sizeof(host), &port, &path));
+    TEST_ASSERT_EQUAL(PM_FAIL, downloader_parse_url("http://host:99999/", host, sizeof(host), &port, &path));
+}
+
+void test_files_share_one_connection()
+{
+    downloader_t* d = downloader(4);
+    TEST_ASSERT_EQUAL(PM_OK, downloader_run(d));
+    assert_all_downloaded(FILE_COUNT);
+    TEST_ASSERT_EQUAL_UINT32(1, d->stats.connections);
+    TEST_ASSERT_EQUAL_UINT32(FILE_COUNT, d->stats.files);
+    TEST_ASSERT_EQUAL_UINT64((uint64_t)FILE_COUNT * FILE_SIZE, d->stats.bytes);
+    downloader_free(d);
+}
+
+void test_missing_files_are_not_retried()
+{
+    server.missing = 1;
+    server.flaky = 1;
+    downloader_t* d = downloader(4);
+    TEST_ASSERT_EQUAL(PM_OK, downloader_run(d));
+    assert_all_downloaded(FILE_COUNT);
+    TEST_ASSERT_EQUAL_UINT32(FILE_COUNT / 10, d->stats.missing);
+    TEST_ASSERT_EQUAL_UINT32(0, d->stats.failed);
+    /* only the 503 answers are tried again */
+    uint32_t flaky = 0;
+    for (int n = 0; n < FILE_COUNT; n++)
+        flaky += server.failed[n];
+    TEST_ASSERT_EQUAL_UINT32(flaky, d->stats.retries);
+    TEST_ASSERT_EQUAL_UINT32(FILE_COUNT + flaky, server.requests);
+    downloader_free(d);
+}
+
+void test_corrupt_files_are_retried()
+{
+    server.garbled = 1;
+    client.verify = 1;
+    downloader_t* d = downloader(4);
+    TEST_ASSERT_EQUAL(PM_OK, downloader_run(d));
+    assert_all_downloaded(FILE_COUNT);
+    uint32_t garbled = 0;
+    for (int n = 0; n < FILE_COUNT; n++) {
+        TEST_ASSERT_EQUAL_UINT8(n % 9 == 4, server.failed[n]);
+        garbled += server.failed[n];
+    }
+    TEST_ASSERT_EQUAL_UINT32(garbled, d->stats.corrupt);
+    TEST_ASSERT_EQUAL_UINT32(garbled, d->stats.retries);
+    TEST_ASSERT_EQUAL_UINT32(FILE_COUNT, d->stats.files);
+    downloader_free(d);
+}
+
+void test_dropped_connections_are_resumed()
+{
+    server.drop_after = 7;
+    downloader_t* d = downloader(4);
+    TEST_ASSERT_EQUAL(PM_OK, downloader_run(d));
+    assert_all_downloaded(FILE_COUNT);
+    TEST_ASSERT_EQUAL_UINT32((FILE_COUNT + 6) / 7, d->stats.connections);
+    TEST_ASSERT_EQUAL_UINT32(0, d->stats.retries);
+    downloader_free(d);
+}
+
+void test_unreachable_server_keeps_files()
+{
+    uint16_t port = server.port;
+    server_stop();
+    downloader_t* d = downloader(4);
+    d->max_attempts = 3;
+    TEST_ASSERT_EQUAL(TIMEOUT, downloader_run(d));
+    TEST_ASSERT_EQUAL_UINT32(0, d->stats.files);
+
+    server_start(port);
+    TEST_ASSERT_EQUAL(PM_OK, downloader_run(d));
+    assert_all_downloaded(FILE_COUNT);
+    downloader_free(d);
+}
+
+void test_download_benchmark()
+{
+    const uint32_t latency = 2;
+    struct {
+        const char* name;
+        uint8_t in_flight;
+        uint8_t close_each;
+    } runs[] = {
+        { "per file", 1, 1 },
+        { "keep-alive", 1, 0 },
+        { "4 in flight", 4, 0 },
+        { "8 in flight", 8, 0 },
+    };
+    printf("downloads, %d files of %d bytes, %lu ms latency\n", FILE_COUNT, FILE_SIZE, (unsigned long)latency);
+    for (uint32_t i = 0; i < sizeof(runs) / sizeof(runs[0]); i++) {
+        tearDown();
+        setUp();
+        server.latency_ms = latency;
+        server.close_each = runs[i].close_each;
+        downloader_t* d = downloader(runs[i].in_flight);
+        int64_t start = RTOS_Micros();
+        TEST_ASSERT_EQUAL(PM_OK, downloader_run(d));
+        double seconds = (RTOS_Micros() - start) / 1e6;
+        assert_all_downloaded(FILE_COUNT);
+        printf("%-12s %8.1f files/s %6.1f MB/s %4lu connections\n", runs[i].name, FILE_COUNT / seconds,
+            FILE_COUNT * FILE_SIZE / seconds / (1024 * 1024), (unsigned long)d->stats.connections);
+        downloader_free(d);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    UNITY_BEGIN();
+
+    RUN_TEST(test_parse_url);
+    RUN_TEST(test_files_share_one_connection);
+    RUN_TEST(test_missing_files_are_not_retried);
+    RUN_TEST(test_corrupt_files_are_retried);
+    RUN_TEST(test_dropped_connections_are_resumed);
+    RUN_TEST(test_unreachable_server_keeps_files);
+    RUN_TEST(test_download_benchmark);
+
+    UNITY_END();
+}
@@ -0,0 +1,188 @@
+#include <unity.h>
+
+#include "gps_position.h"
+
+#include <pthread.h>
+#include <string.h>
+
+#define PUBLISHES 1000000
+#define READERS 3
+
+static gps_position_t shared;
+static volatile int writer_done;
+static pthread_barrier_t start;
+
+/* every field follows from n, a torn copy mixes two of them */
+static map_position_t make_position(uint32_t n)
+{
+    map_position_t p = {
+        .longitude = n * 0.5f,
+        .latitude = -(float)n,
+        .altitude = n * 2.0f,
+        .hdop = n % 100,
+        .fix = n % 3,
+        .satellites_in_view = n % 256,
+        .satellites_in_use = (n / 256) % 256,
+        .time = n,
+    };
+    return p;
+}
+
+static int is_position(const map_position_t* p, uint32_t n)
+{
+    map_position_t expected = make_position(n);
+    return memcmp(p, &expected, sizeof(map_position_t)) == 0;
+}
+
+void setUp()
+{
+    map_position_t start = make_position(0);
+    gps_position_init(&shared, &start);
+    writer_done = 0;
+}
+
+void tearDown()
+{
+}
+
+void test_initializer()
+{
+    static gps_position_t position = GPS_POSITION_INITIALIZER(.latitude = 49.626846, .fix = 1);
+    map_position_t p;
+    TEST_ASSERT_EQUAL_UINT32(0, gps_position_read(&position, &p));
+    TEST_ASSERT_EQUAL_FLOAT(49.626846, p.latitude);
+    TEST_ASSERT_EQUAL_UINT8(1, p.fix);
+}
+
+void test_generation_counts_publishes()
+{
+    map_position_t p;
+    TEST_ASSERT_EQUAL_UINT32(0, gps_position_generation(&shared));
+    for (uint32_t n = 1; n <= 5; n++) {
+        map_position_t next = make_position(n);
+        gps_position_publish(&shared, &next);
+        TEST_ASSERT_EQUAL_UINT32(n, gps_position_generation(&shared));
+        TEST_ASSERT_EQUAL_UINT32(n, gps_position_read(&shared, &p));
+        TEST_ASSERT_TRUE(is_position(&p, n));
+    }
+}
+
+void test_read_while_writer_is_interrupted()
+{
+    /* the writer stopped after the first half, as if the reader preempted it */
+    map_position_t next = make_position(1);
+    map_position_t p;
+    shared.sequence = 1;
+    memset(&shared.slot[0], 0xAA, sizeof(map_position_t));
+    TEST_ASSERT_EQUAL_UINT32(0, gps_position_read(&shared, &p));
+    TEST_ASSERT_TRUE(is_position(&p, 0));
+
+    /* and after the second half */
+    shared.slot[0] = next;
+    shared.sequence = 2;
+    memset(&shared.slot[1], 0xAA, sizeof(map_position_t));
+    TEST_ASSERT_EQUAL_UINT32(1, gps_position_read(&shared, &p));
+    TEST_ASSERT_TRUE(is_position(&p, 1));
+}
+
+static void* writer(void* arg)
+{
+    pthread_barrier_wait(&start);
+    for (uint32_t n = 1; n <= PUBLISHES; n++) {
+        map_position_t next = make_position(n);
+        gps_position_publish(&shared, &next);
+    }
+    __atomic_store_n(&writer_done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static void* reader(void* arg)
+{
+    uint32_t* torn = arg;
+    uint32_t last = 0;
+    map_position_t p;
+    pthread_barrier_wait(&start);
+    while (!__atomic_load_n(&writer_done, __ATOMIC_ACQUIRE)) {
+        uint32_t generation = gps_position_read(&shared, &p);
+        if (!is_position(&p, generation) || generation < last)
+            (*torn)++;
+        last = generation;
+    }
+    return NULL;
+}
+
+void test_concurrent_readers_get_whole_fixes()
+{
+    pthread_t writer_thread, reader_threads[READERS];
+    uint32_t torn[READERS] = { 0 };
+    pthread_barrier_init(&start, NULL, READERS + 1);
+    for (int i = 0; i < READERS; i++)
+        pthread_create(&reader_threads[i], NULL, reader, &torn[i]);
+    pthread_create(&writer_thread, NULL, writer, NULL);
+
+    pthread_join(writer_thread, NULL);
+    for (int i = 0; i < READERS; i++) {
+        pthread_join(reader_threads[i], NULL);
+        TEST_ASSERT_EQUAL_UINT32(0, torn[i]);
+    }
+    TEST_ASSERT_EQUAL_UINT32(PUBLISHES, gps_position_generation(&shared));
+    pthread_barrier_destroy(&start);
+}
+
+/*
+ * A slot must not change while the sequence sends readers to it. The
+ * checker waits inside each half of a publish and copies the slot of the
+ * sequence again and again until the sequence moves on.
+ */
+static void* slot_checker(void* arg)
+{
+    uint32_t* broken = arg;
+    uint32_t windows = 0;
+    map_position_t p;
+    pthread_barrier_wait(&start);
+    while (!__atomic_load_n(&writer_done, __ATOMIC_ACQUIRE)) {
+        uint32_t sequence = __atomic_load_n(&shared.sequence, __ATOMIC_ACQUIRE);
+        for (;;) {
+            p = shared.slot[sequence & 1];
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&shared.sequence, __ATOMIC_RELAXED) != sequence)
+                break;
+            /* odd: slot 1 still has the last position, even: slot 0 has the new one */
+            if (!is_position(&p, sequence >> 1))
+                (*broken)++;
+            windows += sequence & 1;
+        }
+    }
+    /* the odd half of a publish was seen at all */
+    if (!windows)
+        (*broken)++;
+    return NULL;
+}
+
+void test_slots_are_written_after_the_sequence()
+{
+    pthread_t writer_thread, checker_threads[READERS];
+    uint32_t broken[READERS] = { 0 };
+    pthread_barrier_init(&start, NULL, READERS + 1);
+    for (int i = 0; i < READERS; i++)
+        pthread_create(&checker_threads[i], NULL, slot_checker, &broken[i]);
+    pthread_create(&writer_thread, NULL, writer, NULL);
+
+    pthread_join(writer_thread, NULL);
+    for (int i = 0; i < READERS; i++) {
+        pthread_join(checker_threads[i], NULL);
+        TEST_ASSERT_EQUAL_UINT32(0, broken[i]);
+    }
+    pthread_barrier_destroy(&start);
+}
+
+int main(int argc, char** argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_initializer);
+    RUN_TEST(test_generation_counts_publishes);
+    RUN_TEST(test_read_while_writer_is_interrupted);
+    RUN_TEST(test_concurrent_readers_get_whole_fixes);
+    RUN_TEST(test_slots_are_written_after_the_sequence);
+    UNITY_END();
+}
@@ -1,5 +1,9 @@
 #include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
 #include <unity.h>
 
 #include "parser/gpx.h"
@@ -97,11 +101,188 @@ void test_gpx_parsing_error()
     TEST_ASSERT_EQUAL_UINT16(0, gpx->waypoints_num);
 }
 
+typedef struct {
+    FILE* file;
+    size_t chunk;
+} chunked_file_t;
+
+static error_code_t read_chunk(void* arg, char* data, size_t size, size_t* length)
+{
+    chunked_file_t* f = arg;
+    *length = fread(data, 1, size < f->chunk ? size : f->chunk, f->file);
+    return PM_OK;
+}
+
+void test_gpx_parsing_in_chunks()
+{
+    size_t chunks[] = { 1, 7, 64, 1000, GPX_BUFFER_SIZE };
+    for (uint8_t i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++) {
+        chunked_file_t f = { fopen("test/host/Platinenmacher/test_gpx/test.gpx", "rb"), chunks[i] };
+        assert(f.file != NULL);
+        num_wp = 0;
+        gpx_t* gpx = gpx_parser_read(read_chunk, &f, modify_waypoint);
+        fclose(f.file);
+
+        TEST_ASSERT_EQUAL_STRING_LEN("Teststrecke", gpx->track_name, 12);
+        TEST_ASSERT_EQUAL_UINT16(17, num_wp);
+        TEST_ASSERT_EQUAL_UINT16(17, gpx->waypoints_num);
+        TEST_ASSERT_EQUAL_FLOAT(49.622274, gpx->waypoints->lat);
+        TEST_ASSERT_EQUAL_FLOAT(8.587822, gpx->waypoints->lon);
+    }
+}
+
+/* a track far larger than the parser buffer, generated while it is read */
+typedef struct {
+    uint32_t points;
+    uint32_t written;
+    char line[128];
+    size_t length;
+    size_t position;
+} generated_gpx_t;
+
+static error_code_t read_generated(void* arg, char* data, size_t size, size_t* length)
+{
+    generated_gpx_t* g = arg;
+    *length = 0;
+    while (*length < size) {
+        if (g->position == g->length) {
+            if (g->written > g->points + 1)
+                break;
+            if (g->written == 0)
+                g->length = sprintf(g->line, "<?xml version=\"1.0\"?>\n<gpx><trk><name>Long</name><trkseg>\n");
+            else if (g->written <= g->points)
+                g->length = sprintf(g->line, "<trkpt lat=\"49.%06u\" lon=\"8.%06u\"><ele>%u</ele></trkpt>\n",
+                    g->written, g->written, g->written % 1000);
+            else
+                g->length = sprintf(g->line, "</trkseg></trk></gpx>\n");
+            g->written++;
+            g->position = 0;
+        }
+        size_t n = g->length - g->position;
+        if (n > size - *length)
+            n = size - *length;
+        memcpy(data + *length, g->line + g->position, n);
+        g->position += n;
+        *length += n;
+    }
+    return PM_OK;
+}
+
+void test_gpx_parsing_large_file()
+{
+    generated_gpx_t g = { .points = 20000 };
+    gpx_t* gpx = gpx_parser_read(read_generated, &g, modify_waypoint);
+    TEST_ASSERT_EQUAL_STRING("Long", gpx->track_name);
+    TEST_ASSERT_EQUAL_UINT16(20000, num_wp);
+    TEST_ASSERT_EQUAL_FLOAT(49.000001, gpx->waypoints->lat);
+    TEST_ASSERT_EQUAL_FLOAT(1, gpx->waypoints->ele);
+}
+
+void test_gpx_token_longer_than_buffer()
+{
+    char* data = malloc(2 * GPX_BUFFER_SIZE);
+    int length = sprintf(data, "<gpx><trk><name>Long</name><trkseg><trkpt lat=\"1\" lon=\"2\"></trkpt><!--");
+    memset(data + length, 'x', GPX_BUFFER_SIZE);
+    strcpy(data + length + GPX_BUFFER_SIZE, "--><trkpt lat=\"3\" lon=\"4\"></trkpt></trkseg></trk></gpx>");
+
+    gpx_t* gpx = gpx_parser(data, modify_waypoint);
+    free(data);
+    TEST_ASSERT_EQUAL_UINT16(1, gpx->waypoints_num);
+}
+
+void test_gpx_decimal()
+{
+    TEST_ASSERT_EQUAL_FLOAT(49.622274f, gpx_decimal("49.622274", 9));
+    TEST_ASSERT_EQUAL_FLOAT(-8.587822f, gpx_decimal("\n  -8.587822\n", 14));
+    TEST_ASSERT_EQUAL_FLOAT(96.0f, gpx_decimal("+96", 3));
+    TEST_ASSERT_EQUAL_FLOAT(0.5f, gpx_decimal(".5", 2));
+    TEST_ASSERT_EQUAL_FLOAT(0.000001f, gpx_decimal("0.0000010000", 12));
+    TEST_ASSERT_EQUAL_FLOAT(1234567890123.0f, gpx_decimal("1234567890123.45", 16));
+    TEST_ASSERT_EQUAL_FLOAT(12.3f, gpx_decimal("12.34", 4)); // only the span counts
+    TEST_ASSERT_EQUAL_FLOAT(0.0f, gpx_decimal("", 0));
+
+    /* an overlong integer part keeps its magnitude */
+    char digits[200];
+    memset(digits, '0', sizeof(digits));
+    memcpy(digits, "1234567890", 10);
+    TEST_ASSERT_FLOAT_WITHIN(1e18f, 1.23456789e24f, gpx_decimal(digits, 25));
+    TEST_ASSERT_TRUE(isinf(gpx_decimal(digits, sizeof(digits))));
+    digits[0] = '-';
+    TEST_ASSERT_TRUE(isinf(gpx_decimal(digits, sizeof(digits))) && gpx_decimal(digits, sizeof(digits)) < 0);
+
+    char text[32];
+    srand(1);
+    for (int i = 0; i < 10000; i++) {
+        int length = sprintf(text, "%d.%06d", rand() % 361 - 180, rand() % 1000000);
+        TEST_ASSERT_FLOAT_WITHIN(fabsf((float)atof(text)) * 2e-7f, (float)atof(text), gpx_decimal(text, length));
+    }
+}
+
+static double now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static uint32_t free_waypoint(waypoint_t* wp)
+{
+    RTOS_Free(wp);
+    return ++num_wp;
+}
+
+#define BENCH_POINTS 50000
+
+void test_gpx_benchmark()
+{
+    generated_gpx_t g = { .points = BENCH_POINTS };
+    size_t size = 128 * (BENCH_POINTS + 2);
+    char* data = malloc(size);
+    size_t length = 0, n;
+    while (read_generated(&g, data + length, size - 1 - length, &n) == PM_OK && n)
+        length += n;
+    data[length] = 0;
+    char* copy = malloc(length);
+
+    double start = now_us();
+    memcpy(copy, data, length);
+    double io = now_us() - start;
+    start = now_us();
+    gpx_t* gpx = gpx_parser(data, free_waypoint);
+    double parse = now_us() - start;
+    TEST_ASSERT_EQUAL_UINT16(BENCH_POINTS, gpx->waypoints_num);
+
+    float sum = 0;
+    const char* numbers[] = { "49.622274", "8.587822", "96.014564", "-33.918861" };
+    start = now_us();
+    for (int i = 0; i < 1000000; i++)
+        sum += (float)atof(numbers[i & 3]);
+    double ref = now_us() - start;
+    start = now_us();
+    for (int i = 0; i < 1000000; i++)
+        sum += gpx_decimal(numbers[i & 3], 9);
+    double fixed = now_us() - start;
+
+    printf("gpx parser, %zu bytes, %d points\n", length, BENCH_POINTS);
+    printf("%-10s %10.1f MB/s\n", "parse", length / parse);
+    printf("%-10s %10.1f MB/s\n", "memcpy", length / io);
+    printf("numbers, ns per value: atof %.1f, gpx_decimal %.1f (%.0f)\n", ref / 1000, fixed / 1000, sum);
+    RTOS_Free(gpx->track_name);
+    RTOS_Free(gpx);
+    free(copy);
+    free(data);
+}
+
 int main(int argc, char** argv)
 {
     UNITY_BEGIN();
     RUN_TEST(test_gpx_parsing);
     RUN_TEST(test_gpx_parsing_incomplete);
     RUN_TEST(test_gpx_parsing_error);
+    RUN_TEST(test_gpx_parsing_in_chunks);
+    RUN_TEST(test_gpx_parsing_large_file);
+    RUN_TEST(test_gpx_token_longer_than_buffer);
+    RUN_TEST(test_gpx_decimal);
+    RUN_TEST(test_gpx_benchmark);
     UNITY_END();
 }
\ No newline at end of file
@@ -27,6 +27,7 @@ void setUp()
 
 void tearDown()
 {
+    free(dsp->fb);
     free(dsp);
 }
 
@@ -169,6 +170,39 @@ void test_image_render_at_negative_position()
     TEST_ASSERT_EQUAL_INT16(-10, img->box.left);
 }
 
+void test_label_pool_reset()
+{
+    label_pool_reset();
+    label_t *first = label_create("a", &f8x8, 0, 0, 8, 8);
+    for (int i = 1; i < LABEL_POOL_SIZE; i++)
+        label_create("a", &f8x8, 0, 0, 8, 8);
+
+    /* pool is exhausted, labels come from the heap */
+    label_t *extra = label_create("b", &f8x8, 0, 0, 8, 8);
+    TEST_ASSERT_NOT_NULL(extra);
+    TEST_ASSERT_EQUAL_STRING("b", extra->text);
+    label_free(extra);
+
+    label_pool_reset();
+    TEST_ASSERT_EQUAL_PTR(first, label_create("c", &f8x8, 0, 0, 8, 8));
+    TEST_ASSERT_EQUAL_UINT16(0, first->borderWidth);
+}
+
+void test_label_pool_reset_frees_heap()
+{
+    label_pool_reset();
+    for (int i = 0; i < LABEL_POOL_SIZE; i++)
+        label_create("a", &f8x8, 0, 0, 8, 8);
+
+    /* the leak check of the sanitizer finds them if the reset does not */
+    for (int i = 0; i < 3; i++)
+        TEST_ASSERT_NOT_NULL(label_create("b", &f8x8, 0, 0, 8, 8));
+    label_t *extra = label_create("c", &f8x8, 0, 0, 8, 8);
+    TEST_ASSERT_EQUAL_UINT16(0, extra->borderWidth);
+    label_free(extra);
+    label_pool_reset();
+}
+
 
 int main(int argc, char **argv)
 {
@@ -184,6 +218,8 @@ int main(int argc, char **argv)
     RUN_TEST(test_label_textalign);
     RUN_TEST(test_image_render);
     RUN_TEST(test_image_render_at_negative_position);
+    RUN_TEST(test_label_pool_reset);
+    RUN_TEST(test_label_pool_reset_frees_heap);
 
     UNITY_END();
 }
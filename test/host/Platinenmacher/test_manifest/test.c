@@ -0,0 +1,276 @@
+#include <unity.h>
+
+#include "crc32.h"
+#include "memory.h"
+#include "storage.h"
+#include "tile_manifest.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TILE_SIZE 1000
+
+static char root[] = "/tmp/manifestXXXXXX";
+static storage_t* st;
+static tile_manifest_t* m;
+static char text[4096];
+
+typedef struct {
+    uint8_t zoom;
+    uint32_t x;
+    uint32_t y;
+    uint8_t version;
+} tile_t;
+
+/* 3x3 tiles in the range and two outside of it */
+static tile_t server[] = {
+    { .zoom = 14, .x = 100, .y = 200 }, { .zoom = 14, .x = 100, .y = 201 }, { .zoom = 14, .x = 100, .y = 202 },
+    { .zoom = 14, .x = 101, .y = 200 }, { .zoom = 14, .x = 101, .y = 201 }, { .zoom = 14, .x = 101, .y = 202 },
+    { .zoom = 14, .x = 102, .y = 200 }, { .zoom = 14, .x = 102, .y = 201 }, { .zoom = 14, .x = 102, .y = 202 },
+    { .zoom = 14, .x = 200, .y = 300 }, { .zoom = 15, .x = 1, .y = 1 },
+};
+#define SERVER_TILES (sizeof(server) / sizeof(server[0]))
+
+static void tile_content(const tile_t* t, uint8_t* data)
+{
+    for (uint32_t i = 0; i < TILE_SIZE; i++)
+        data[i] = (t->x * 3 + t->y * 5 + t->version * 11 + i) & 0xff;
+}
+
+static uint32_t tile_crc(const tile_t* t)
+{
+    uint8_t data[TILE_SIZE];
+    tile_content(t, data);
+    return crc32_update(0, data, TILE_SIZE);
+}
+
+static void write_tile(const tile_t* t)
+{
+    char path[STORAGE_PATH_LENGTH];
+    uint8_t data[TILE_SIZE];
+    storage_file_t* file;
+    size_t written = 0;
+    tile_content(t, data);
+    tile_manifest_tile_path(m, t->zoom, t->x, t->y, path, sizeof(path));
+    TEST_ASSERT_EQUAL(PM_OK, storage_open_for_writing(st, path, STORAGE_WRITE, &file));
+    TEST_ASSERT_EQUAL(PM_OK, storage_write(file, data, TILE_SIZE, &written));
+    storage_close(file);
+}
+
+static uint8_t tile_exists(const tile_t* t)
+{
+    char path[STORAGE_PATH_LENGTH];
+    uint32_t size;
+    tile_manifest_tile_path(m, t->zoom, t->x, t->y, path, sizeof(path));
+    return storage_stat(st, path, &size) == PM_OK;
+}
+
+static const char* manifest_text()
+{
+    size_t length = snprintf(text, sizeof(text), "# zoom/x/y size crc\n");
+    for (uint32_t i = 0; i < SERVER_TILES; i++)
+        length += snprintf(text + length, sizeof(text) - length, "%u/%lu/%lu %d %08lx\r\n", server[i].zoom,
+            (unsigned long)server[i].x, (unsigned long)server[i].y, TILE_SIZE, (unsigned long)tile_crc(&server[i]));
+    return text;
+}
+
+static void open_manifest()
+{
+    m = tile_manifest_create(st, "//MAPS");
+    TEST_ASSERT_NOT_NULL(m);
+    TEST_ASSERT_EQUAL(PM_OK, tile_manifest_add_range(m, 14, 100, 102, 200, 202));
+}
+
+/* download the manifest in pieces of chunk bytes */
+static void load_manifest(size_t chunk)
+{
+    const char* t = manifest_text();
+    size_t length = strlen(t);
+    TEST_ASSERT_EQUAL(PM_OK, tile_manifest_begin(m));
+    for (size_t i = 0; i < length; i += chunk)
+        TEST_ASSERT_EQUAL(PM_OK, tile_manifest_feed(m, t + i, i + chunk < length ? chunk : length - i));
+    TEST_ASSERT_EQUAL(PM_OK, tile_manifest_end(m));
+}
+
+static uint32_t stale_tiles()
+{
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < SERVER_TILES; i++)
+        count += tile_manifest_stale(m, server[i].zoom, server[i].x, server[i].y);
+    return count;
+}
+
+/* the whole map was downloaded once */
+static void complete_update()
+{
+    load_manifest(sizeof(text));
+    for (uint32_t i = 0; i < SERVER_TILES; i++) {
+        write_tile(&server[i]);
+        TEST_ASSERT_EQUAL(PM_OK, tile_manifest_done(m, server[i].zoom, server[i].x, server[i].y));
+    }
+    TEST_ASSERT_EQUAL(PM_OK, tile_manifest_commit(m));
+    tile_manifest_free(m);
+    open_manifest();
+}
+
+void setUp()
+{
+    TEST_ASSERT_NOT_NULL(mkdtemp(root));
+    st = storage_posix_create(root);
+    for (uint32_t i = 0; i < SERVER_TILES; i++)
+        server[i].version = 0;
+    open_manifest();
+}
+
+void tearDown()
+{
+    tile_manifest_free(m);
+    storage_drop(st, "//MAPS/MANIFEST.NEW");
+    RTOS_Free(st);
+    char cmd[64];
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", root);
+    TEST_ASSERT_EQUAL(0, system(cmd));
+    strcpy(root, "/tmp/manifestXXXXXX");
+}
+
+void test_crc32()
+{
+    TEST_ASSERT_EQUAL_HEX32(0, crc32_update(0, "", 0));
+    TEST_ASSERT_EQUAL_HEX32(0xCBF43926, crc32_update(0, "123456789", 9));
+    TEST_ASSERT_EQUAL_HEX32(0xCBF43926, crc32_update(crc32_update(0, "1234", 4), "56789", 5));
+}
+
+void test_first_manifest_marks_every_tile_stale()
+{
+    tile_manifest_entry_t e;
+    load_manifest(sizeof(text));
+    TEST_ASSERT_EQUAL_UINT32(SERVER_TILES, m->entries);
+    TEST_ASSERT_EQUAL_UINT32(SERVER_TILES, m->changed);
+    /* only the range is tracked */
+    TEST_ASSERT_EQUAL_UINT32(9, stale_tiles());
+    TEST_ASSERT_EQUAL_UINT32(crc32_update(0, text, strlen(text)), m->generation);
+
+    for (uint32_t i = 0; i < SERVER_TILES; i++) {
+        TEST_ASSERT_EQUAL(PM_OK, tile_manifest_lookup(m, server[i].zoom, server[i].x, server[i].y, &e));
+        TEST_ASSERT_EQUAL_UINT32(server[i].x, e.x);
+        TEST_ASSERT_EQUAL_UINT32(server[i].y, e.y);
+        TEST_ASSERT_EQUAL_UINT32(TILE_SIZE, e.size);
+        TEST_ASSERT_EQUAL_HEX32(tile_crc(&server[i]), e.crc);
+    }
+    TEST_ASSERT_EQUAL(UNAVAILABLE, tile_manifest_lookup(m, 14, 100, 203, &e));
+    TEST_ASSERT_EQUAL(UNAVAILABLE, tile_manifest_lookup(m, 13, 0, 0, &e));
+    TEST_ASSERT_EQUAL(UNAVAILABLE, tile_manifest_lookup(m, 16, 0, 0, &e));
+}
+
+void test_tiles_on_the_card_are_checked()
+{
+    tile_manifest_entry_t e;
+    load_manifest(sizeof(text));
+    TEST_ASSERT_EQUAL(PM_OK, tile_manifest_lookup(m, 14, 101, 201, &e));
+    TEST_ASSERT_EQUAL(UNAVAILABLE, tile_manifest_check_file(m, &e));
+    write_tile(&server[4]);
+    TEST_ASSERT_EQUAL(PM_OK, tile_manifest_check_file(m, &e));
+    server[4].version = 1;
+    write_tile(&server[4]);
+    TEST_ASSERT_EQUAL(PM_FAIL, tile_manifest_check_file(m, &e));
+}
+
+void test_only_changed_tiles_are_stale()
+{
+    complete_update();
+    load_manifest(sizeof(text));
+    TEST_ASSERT_EQUAL_UINT32(0, m->changed);
+    TEST_ASSERT_EQUAL_UINT32(0, stale_tiles());
+    TEST_ASSERT_EQUAL(PM_OK, tile_manifest_commit(m));
+
+    /* one tile in the range and one outside change */
+    server[4].version = 1;
+    server[9].version = 1;
+    load_manifest(sizeof(text));
+    TEST_ASSERT_EQUAL_UINT32(2, m->changed);
+    TEST_ASSERT_EQUAL_UINT32(1, stale_tiles());
+    TEST_ASSERT_TRUE(tile_manifest_stale(m, 14, 101, 201));
+    /* the one outside is fetched when it is needed again */
+    TEST_ASSERT_TRUE(tile_exists(&server[4]));
+    TEST_ASSERT_FALSE(tile_exists(&server[9]));
+    TEST_ASSERT_TRUE(tile_exists(&server[10]));
+}
+
+void test_interrupted_update_resumes()
+{
+    complete_update();
+    for (uint32_t i = 0; i < 9; i++)
+        server[i].version = 2;
+    load_manifest(sizeof(text));
+    TEST_ASSERT_EQUAL_UINT32(9, stale_tiles());
+    for (uint32_t i = 0; i < 4; i++)
+        TEST_ASSERT_EQUAL(PM_OK, tile_manifest_done(m, server[i].zoom, server[i].x, server[i].y));
+    /* power is lost while a record is written */
+    tile_manifest_free(m);
+    storage_file_t* journal;
+    size_t written = 0;
+    TEST_ASSERT_EQUAL(PM_OK, storage_open(st, "//MAPS/JOURNAL", STORAGE_WRITE | STORAGE_APPEND, &journal));
+    TEST_ASSERT_EQUAL(PM_OK, storage_write(journal, "\x0e\x55\x00", 3, &written));
+    storage_close(journal);
+
+    /* the same manifest again, in small pieces */
+    open_manifest();
+    load_manifest(7);
+    TEST_ASSERT_EQUAL_UINT32(9, m->changed);
+    TEST_ASSERT_EQUAL_UINT32(4, m->resumed);
+    TEST_ASSERT_EQUAL_UINT32(5, stale_tiles());
+    for (uint32_t i = 0; i < 9; i++)
+        TEST_ASSERT_EQUAL(i >= 4, tile_manifest_stale(m, server[i].zoom, server[i].x, server[i].y));
+
+    /* the torn record is gone, new records follow the valid ones */
+    TEST_ASSERT_EQUAL(PM_OK, tile_manifest_done(m, server[4].zoom, server[4].x, server[4].y));
+    tile_manifest_free(m);
+    open_manifest();
+    load_manifest(sizeof(text));
+    TEST_ASSERT_EQUAL_UINT32(5, m->resumed);
+    TEST_ASSERT_EQUAL_UINT32(4, stale_tiles());
+
+    /* a newer manifest starts over */
+    server[0].version = 3;
+    tile_manifest_free(m);
+    open_manifest();
+    load_manifest(sizeof(text));
+    TEST_ASSERT_EQUAL_UINT32(0, m->resumed);
+    TEST_ASSERT_EQUAL_UINT32(9, stale_tiles());
+}
+
+void test_broken_manifest_is_dropped()
+{
+    uint32_t size;
+    complete_update();
+    const char* broken[] = {
+        "14/100/201 1000 12345678\n14/100/200 1000 12345678\n", // not sorted
+        "14/100 1000 12345678\n",
+        "14/100/200 1000\n",
+    };
+    for (uint8_t i = 0; i < sizeof(broken) / sizeof(broken[0]); i++) {
+        TEST_ASSERT_EQUAL(PM_OK, tile_manifest_begin(m));
+        TEST_ASSERT_EQUAL(PM_FAIL, tile_manifest_feed(m, broken[i], strlen(broken[i])));
+        TEST_ASSERT_EQUAL(PM_FAIL, tile_manifest_end(m));
+        TEST_ASSERT_EQUAL(UNAVAILABLE, storage_stat(st, "//MAPS/MANIFEST.NEW", &size));
+        TEST_ASSERT_EQUAL(PM_FAIL, tile_manifest_commit(m));
+    }
+    /* the last complete one is kept */
+    TEST_ASSERT_EQUAL(PM_OK, storage_stat(st, "//MAPS/MANIFEST", &size));
+    TEST_ASSERT_EQUAL_UINT32(SERVER_TILES * sizeof(tile_manifest_entry_t), size);
+}
+
+int main(int argc, char** argv)
+{
+    UNITY_BEGIN();
+
+    RUN_TEST(test_crc32);
+    RUN_TEST(test_first_manifest_marks_every_tile_stale);
+    RUN_TEST(test_tiles_on_the_card_are_checked);
+    RUN_TEST(test_only_changed_tiles_are_stale);
+    RUN_TEST(test_interrupted_update_resumes);
+    RUN_TEST(test_broken_manifest_is_dropped);
+
+    UNITY_END();
+}
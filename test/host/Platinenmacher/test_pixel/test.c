@@ -0,0 +1,180 @@
+#include <unity.h>
+#include "pixel.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MAX_PIXELS 1543
+#define BENCH_PIXELS (600 * 448)
+#define BENCH_ROUNDS 20
+
+static const uint32_t palette[16] = {
+    0xff000000, 0xffffffff, 0xff00ff00, 0xff0000ff,
+    0xffff0000, 0xffffff00, 0xffff8000, 0x00000000,
+    0x11111111, 0x22222222, 0x33333333, 0x44444444,
+    0x55555555, 0x66666666, 0x77777777, 0x88888888,
+};
+
+/* lengths that hit every block size and tail of every variant */
+static const size_t lengths[] = { 0, 1, 2, 3, 7, 8, 9, 15, 16, 31, 32, 33, 63, 64, 65, 127, 128, 129, 1023, 1024, 1025, MAX_PIXELS };
+
+static uint8_t packed[MAX_PIXELS];
+static uint8_t unpacked[MAX_PIXELS + 16];
+static uint8_t ref8[MAX_PIXELS + 16];
+static uint8_t out8[MAX_PIXELS + 16];
+static uint32_t ref32[MAX_PIXELS + 16];
+static uint32_t out32[MAX_PIXELS + 16];
+
+void setUp()
+{
+    srand(42);
+    for (size_t i = 0; i < sizeof(packed); i++)
+        packed[i] = rand();
+    for (size_t i = 0; i < sizeof(unpacked); i++)
+        unpacked[i] = rand() & 0x07;
+}
+
+void tearDown()
+{
+}
+
+static double now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+void test_pixel_scalar_unpack_layout()
+{
+    uint8_t src[] = { 0x12, 0x34, 0x56 };
+    uint8_t dst[5];
+    pixel_kernels_scalar.unpack_4bpp(dst, src, 5);
+    uint8_t expected[] = { 1, 2, 3, 4, 5 };
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(expected, dst, 5);
+}
+
+void test_pixel_scalar_pack_keeps_odd_tail()
+{
+    uint8_t src[] = { 1, 2, 3, 4, 5 };
+    uint8_t dst[] = { 0, 0, 0x0f };
+    pixel_kernels_scalar.pack_4bpp(dst, src, 5);
+    uint8_t expected[] = { 0x12, 0x34, 0x5f };
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(expected, dst, 3);
+}
+
+void test_pixel_scalar_merge()
+{
+    uint8_t src[] = { 1, 7, 2, 7 };
+    uint8_t dst[] = { 5, 5, 5, 5 };
+    pixel_kernels_scalar.merge_keyed(dst, src, 4, 7);
+    uint8_t expected[] = { 1, 5, 2, 5 };
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(expected, dst, 4);
+}
+
+void test_pixel_variants_match_scalar()
+{
+    for (int v = PIXEL_KERNEL_SWAR; v < PIXEL_KERNEL_MAX; v++) {
+        const pixel_kernels_t* k = pixel_kernels_get(v);
+        if (!k)
+            continue;
+        for (size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++) {
+            size_t n = lengths[l];
+            char msg[64];
+            snprintf(msg, sizeof(msg), "%s, %zu pixels", k->name, n);
+
+            memset(ref8, 0xaa, sizeof(ref8));
+            memset(out8, 0xaa, sizeof(out8));
+            pixel_kernels_scalar.unpack_4bpp(ref8, packed, n);
+            k->unpack_4bpp(out8, packed, n);
+            TEST_ASSERT_EQUAL_UINT8_ARRAY_MESSAGE(ref8, out8, sizeof(ref8), msg);
+
+            memset(ref8, 0x5a, sizeof(ref8));
+            memset(out8, 0x5a, sizeof(out8));
+            pixel_kernels_scalar.pack_4bpp(ref8, unpacked, n);
+            k->pack_4bpp(out8, unpacked, n);
+            TEST_ASSERT_EQUAL_UINT8_ARRAY_MESSAGE(ref8, out8, sizeof(ref8), msg);
+
+            memset(ref32, 0xaa, sizeof(ref32));
+            memset(out32, 0xaa, sizeof(out32));
+            pixel_kernels_scalar.expand_4bpp_rgba32(ref32, packed, n, palette);
+            k->expand_4bpp_rgba32(out32, packed, n, palette);
+            TEST_ASSERT_EQUAL_UINT32_ARRAY_MESSAGE(ref32, out32, MAX_PIXELS + 16, msg);
+
+            for (size_t i = 0; i < sizeof(ref8); i++)
+                ref8[i] = out8[i] = i;
+            pixel_kernels_scalar.merge_keyed(ref8, unpacked, n, 7);
+            k->merge_keyed(out8, unpacked, n, 7);
+            TEST_ASSERT_EQUAL_UINT8_ARRAY_MESSAGE(ref8, out8, sizeof(ref8), msg);
+        }
+    }
+}
+
+void test_pixel_pack_unpack_roundtrip()
+{
+    const pixel_kernels_t* k = pixel_kernels_best();
+    TEST_ASSERT_NOT_NULL(k);
+    k->unpack_4bpp(out8, packed, 2 * 700);
+    memset(ref8, 0, sizeof(ref8));
+    k->pack_4bpp(ref8, out8, 2 * 700);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(packed, ref8, 700);
+}
+
+void test_pixel_benchmark()
+{
+    uint8_t* src4 = malloc(BENCH_PIXELS / 2);
+    uint8_t* buf8 = malloc(BENCH_PIXELS);
+    uint8_t* key8 = malloc(BENCH_PIXELS);
+    uint32_t* buf32 = malloc(BENCH_PIXELS * sizeof(uint32_t));
+    for (size_t i = 0; i < BENCH_PIXELS / 2; i++)
+        src4[i] = rand();
+    for (size_t i = 0; i < BENCH_PIXELS; i++)
+        key8[i] = rand() & 0x07;
+
+    printf("pixel kernels, %d pixels, us per frame\n", BENCH_PIXELS);
+    printf("%-8s %8s %8s %8s %8s\n", "variant", "unpack", "pack", "rgba32", "merge");
+    for (int v = PIXEL_KERNEL_SCALAR; v < PIXEL_KERNEL_MAX; v++) {
+        const pixel_kernels_t* k = pixel_kernels_get(v);
+        if (!k)
+            continue;
+        double t[4] = { 0 };
+        double start;
+        for (int r = 0; r < BENCH_ROUNDS; r++) {
+            start = now_us();
+            k->unpack_4bpp(buf8, src4, BENCH_PIXELS);
+            t[0] += now_us() - start;
+            start = now_us();
+            k->pack_4bpp(src4, buf8, BENCH_PIXELS);
+            t[1] += now_us() - start;
+            start = now_us();
+            k->expand_4bpp_rgba32(buf32, src4, BENCH_PIXELS, palette);
+            t[2] += now_us() - start;
+            start = now_us();
+            k->merge_keyed(buf8, key8, BENCH_PIXELS, 7);
+            t[3] += now_us() - start;
+        }
+        printf("%-8s %8.1f %8.1f %8.1f %8.1f\n", k->name,
+            t[0] / BENCH_ROUNDS, t[1] / BENCH_ROUNDS, t[2] / BENCH_ROUNDS, t[3] / BENCH_ROUNDS);
+    }
+
+    free(src4);
+    free(buf8);
+    free(key8);
+    free(buf32);
+}
+
+int main(int argc, char** argv)
+{
+    UNITY_BEGIN();
+
+    RUN_TEST(test_pixel_scalar_unpack_layout);
+    RUN_TEST(test_pixel_scalar_pack_keeps_odd_tail);
+    RUN_TEST(test_pixel_scalar_merge);
+    RUN_TEST(test_pixel_variants_match_scalar);
+    RUN_TEST(test_pixel_pack_unpack_roundtrip);
+    RUN_TEST(test_pixel_benchmark);
+
+    UNITY_END();
+}
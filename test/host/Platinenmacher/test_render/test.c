@@ -0,0 +1,297 @@
+#include <unity.h>
+
+#include "display.h"
+#include "gui/image.h"
+#include "gui/label.h"
+#include "gui/render.h"
+
+#include <fonts/font8x8.h>
+
+#define DISPLAY_WIDTH 64
+#define DISPLAY_HEIGHT 32
+
+font_t f8x8;
+display_t* dsp;
+uint32_t pixels_written;
+uint32_t image_renders;
+char clock_text[6];
+
+error_code_t write_pixel(const display_t* dsp, int16_t x, int16_t y,
+    uint8_t color)
+{
+    dsp->fb[((y * DISPLAY_WIDTH) + x)] = color;
+    pixels_written++;
+    return PM_OK;
+}
+
+uint8_t decompress(rect_t* size, int16_t x, int16_t y, const uint8_t* data)
+{
+    return BLACK;
+}
+
+error_code_t count_image_render(const display_t* dsp, void* image)
+{
+    image_renders++;
+    return PM_OK;
+}
+
+volatile uint8_t restart;
+label_t* changed_label;
+
+error_code_t interrupt_frame(const display_t* dsp, void* image)
+{
+    image_renders++;
+    restart = 1;
+    return PM_OK;
+}
+
+error_code_t change_label(const display_t* dsp, void* image)
+{
+    image_renders++;
+    changed_label->dirty = 1;
+    return PM_OK;
+}
+
+error_code_t untyped_render(const display_t* dsp, void* comp)
+{
+    image_renders++;
+    return PM_OK;
+}
+
+void setUp()
+{
+    dsp = display_init(DISPLAY_WIDTH, DISPLAY_HEIGHT, 8, DISPLAY_ROTATE_0);
+    dsp->fb_size = DISPLAY_HEIGHT * DISPLAY_WIDTH;
+    dsp->fb = malloc(dsp->fb_size);
+    dsp->write_pixel = write_pixel;
+    dsp->decompress = decompress;
+    font_load_from_array(&f8x8, font8x8, font8x8_name);
+    pixels_written = 0;
+    image_renders = 0;
+    restart = 0;
+    render_pipeline_invalidate();
+}
+
+void tearDown()
+{
+    free_all_render_pipelines();
+    free(dsp->fb);
+    free(dsp);
+}
+
+void test_display_clip()
+{
+    rect_t clip = { 2, 2, 4, 4 };
+    display_set_clip(dsp, &clip);
+    TEST_ASSERT_TRUE(OUT_OF_BOUNDS == display_pixel_draw(dsp, 1, 2, BLACK));
+    TEST_ASSERT_TRUE(PM_OK == display_pixel_draw(dsp, 2, 2, BLACK));
+    TEST_ASSERT_TRUE(OUT_OF_BOUNDS == display_pixel_draw(dsp, 6, 5, BLACK));
+    pixels_written = 0;
+    display_fill(dsp, WHITE);
+    TEST_ASSERT_EQUAL_UINT32(16, pixels_written);
+    pixels_written = 0;
+    display_rect_fill(dsp, 0, 0, 4, 4, BLACK);
+    TEST_ASSERT_EQUAL_UINT32(4, pixels_written);
+    display_reset_clip(dsp);
+    TEST_ASSERT_TRUE(PM_OK == display_pixel_draw(dsp, 1, 2, BLACK));
+}
+
+void test_full_render_clears_damage()
+{
+    label_t* label = label_create("ab", &f8x8, 0, 0, 20, 10);
+    add_to_render_pipeline(label_render, label, RL_GUI_ELEMENTS);
+    rect_t damage;
+    TEST_ASSERT_TRUE(render_pipeline_get_damage(dsp, &damage));
+    TEST_ASSERT_TRUE(PM_OK == render_pipeline_render(dsp, NULL));
+    TEST_ASSERT_GREATER_OR_EQUAL(DISPLAY_WIDTH * DISPLAY_HEIGHT, pixels_written);
+    TEST_ASSERT_FALSE(label->dirty);
+    TEST_ASSERT_FALSE(render_pipeline_get_damage(dsp, &damage));
+    TEST_ASSERT_TRUE(NOT_NEEDED == render_pipeline_render_damage(dsp, NULL));
+}
+
+void test_transparent_label_damages_text_only()
+{
+    strcpy(clock_text, "12:00");
+    label_t* clock = label_create(clock_text, &f8x8, 0, 0, DISPLAY_WIDTH, 20);
+    clock->alignHorizontal = CENTER;
+    clock->alignVertical = MIDDLE;
+    add_to_render_pipeline(label_render, clock, RL_GUI_ELEMENTS);
+    render_pipeline_render(dsp, NULL);
+
+    strcpy(clock_text, "12:01");
+    clock->dirty = 1;
+    rect_t damage;
+    TEST_ASSERT_TRUE(render_pipeline_get_damage(dsp, &damage));
+    TEST_ASSERT_EQUAL_INT16(1 + (DISPLAY_WIDTH - 40) / 2, damage.left);
+    TEST_ASSERT_EQUAL_INT16(1 + (20 - 8) / 2, damage.top);
+    TEST_ASSERT_EQUAL_UINT16(40, damage.width);
+    TEST_ASSERT_EQUAL_UINT16(8, damage.height);
+
+    pixels_written = 0;
+    TEST_ASSERT_TRUE(PM_OK == render_pipeline_render_damage(dsp, NULL));
+    TEST_ASSERT_LESS_OR_EQUAL(2 * 40 * 8, pixels_written);
+    TEST_ASSERT_FALSE(clock->dirty);
+}
+
+void test_damage_redraws_intersecting_components_in_order()
+{
+    image_t* below = image_create((uint8_t*)"", 0, 0, 8, 8);
+    below->onBeforeRender = count_image_render;
+    image_t* away = image_create((uint8_t*)"", 40, 20, 8, 8);
+    away->onBeforeRender = count_image_render;
+    label_t* label = label_create("a", &f8x8, 0, 0, 8, 8);
+    add_to_render_pipeline(image_render, below, RL_MAP);
+    add_to_render_pipeline(image_render, away, RL_MAP);
+    add_to_render_pipeline(label_render, label, RL_TOP);
+    render_pipeline_render(dsp, NULL);
+    TEST_ASSERT_EQUAL_UINT32(2, image_renders);
+
+    image_renders = 0;
+    label->dirty = 1;
+    TEST_ASSERT_TRUE(PM_OK == render_pipeline_render_damage(dsp, NULL));
+    TEST_ASSERT_EQUAL_UINT32(1, image_renders);
+    /* the image below is drawn first, text goes on top of it */
+    TEST_ASSERT_EQUAL_UINT8(BLACK, dsp->fb[7 * DISPLAY_WIDTH + 7]);
+}
+
+void test_opaque_component_hides_lower_layers()
+{
+    image_t* below = image_create((uint8_t*)"", 0, 0, 32, 16);
+    below->onBeforeRender = count_image_render;
+    label_t* bar = label_create("", &f8x8, 0, 0, 32, 16);
+    bar->backgroundColor = WHITE;
+    label_t* text = label_create("x", &f8x8, 0, 0, 32, 16);
+    add_to_render_pipeline(image_render, below, RL_MAP);
+    add_to_render_pipeline(label_render, bar, RL_GUI_BACKGROUND);
+    add_to_render_pipeline(label_render, text, RL_GUI_ELEMENTS);
+    render_pipeline_render(dsp, NULL);
+
+    image_renders = 0;
+    text->dirty = 1;
+    TEST_ASSERT_TRUE(PM_OK == render_pipeline_render_damage(dsp, NULL));
+    TEST_ASSERT_EQUAL_UINT32(0, image_renders);
+}
+
+void test_render_restart()
+{
+    restart = 1;
+    label_t* label = label_create("a", &f8x8, 0, 0, 8, 8);
+    add_to_render_pipeline(label_render, label, RL_TOP);
+    TEST_ASSERT_TRUE(DEFERRED == render_pipeline_render(dsp, &restart));
+    TEST_ASSERT_TRUE(label->dirty);
+    TEST_ASSERT_TRUE(render_pipeline_in_progress());
+}
+
+void test_render_resumes_interrupted_frame()
+{
+    image_t* first = image_create((uint8_t*)"", 0, 0, 8, 8);
+    first->onBeforeRender = interrupt_frame;
+    image_t* second = image_create((uint8_t*)"", 40, 20, 8, 8);
+    second->onBeforeRender = count_image_render;
+    add_to_render_pipeline(image_render, first, RL_MAP);
+    add_to_render_pipeline(image_render, second, RL_TOP);
+
+    TEST_ASSERT_TRUE(DEFERRED == render_pipeline_render(dsp, &restart));
+    TEST_ASSERT_EQUAL_UINT32(1, image_renders);
+
+    /* the frame continues with the second image, nothing is cleared or drawn twice */
+    restart = 0;
+    pixels_written = 0;
+    TEST_ASSERT_TRUE(PM_OK == render_pipeline_render_damage(dsp, &restart));
+    TEST_ASSERT_EQUAL_UINT32(2, image_renders);
+    TEST_ASSERT_LESS_THAN(DISPLAY_WIDTH * DISPLAY_HEIGHT, pixels_written);
+    TEST_ASSERT_FALSE(render_pipeline_in_progress());
+    TEST_ASSERT_TRUE(NOT_NEEDED == render_pipeline_render_damage(dsp, &restart));
+}
+
+void test_render_repairs_component_changed_after_draw()
+{
+    changed_label = label_create("a", &f8x8, 0, 0, 8, 8);
+    image_t* later = image_create((uint8_t*)"", 40, 20, 8, 8);
+    later->onBeforeRender = change_label;
+    add_to_render_pipeline(label_render, changed_label, RL_MAP);
+    add_to_render_pipeline(image_render, later, RL_TOP);
+    TEST_ASSERT_TRUE(PM_OK == render_pipeline_render(dsp, NULL));
+
+    /* the label changed after it was drawn, only the label gets repaired */
+    TEST_ASSERT_TRUE(changed_label->dirty);
+    rect_t damage;
+    TEST_ASSERT_TRUE(render_pipeline_get_damage(dsp, &damage));
+    rect_t bounds;
+    label_get_bounds(changed_label, &bounds);
+    TEST_ASSERT_TRUE(rect_contains(&bounds, &damage));
+    image_renders = 0;
+    TEST_ASSERT_TRUE(PM_OK == render_pipeline_render_damage(dsp, NULL));
+    TEST_ASSERT_EQUAL_UINT32(0, image_renders);
+}
+
+void test_render_node_added_behind_cursor_damages_screen()
+{
+    image_t* first = image_create((uint8_t*)"", 0, 0, 8, 8);
+    first->onBeforeRender = interrupt_frame;
+    label_t* label = label_create("a", &f8x8, 0, 0, 8, 8);
+    add_to_render_pipeline(image_render, first, RL_GUI_ELEMENTS);
+    add_to_render_pipeline(label_render, label, RL_TOP);
+    TEST_ASSERT_TRUE(DEFERRED == render_pipeline_render(dsp, &restart));
+
+    /* the cursor already passed the path layer */
+    add_to_render_pipeline(untyped_render, NULL, RL_PATH);
+    restart = 0;
+    image_renders = 0;
+    TEST_ASSERT_TRUE(PM_OK == render_pipeline_render(dsp, &restart));
+    TEST_ASSERT_EQUAL_UINT32(0, image_renders);
+
+    rect_t damage;
+    TEST_ASSERT_TRUE(render_pipeline_get_damage(dsp, &damage));
+    TEST_ASSERT_EQUAL_UINT16(DISPLAY_WIDTH, damage.width);
+    TEST_ASSERT_EQUAL_UINT16(DISPLAY_HEIGHT, damage.height);
+}
+
+void test_render_update_runs_pre_render_callbacks()
+{
+    label_t* label = label_create("a", &f8x8, 0, 0, 8, 8);
+    add_pre_render_callback(untyped_render);
+    add_to_render_pipeline(label_render, label, RL_TOP);
+    render_pipeline_render(dsp, NULL);
+    TEST_ASSERT_EQUAL_UINT32(1, image_renders);
+
+    TEST_ASSERT_TRUE(NOT_NEEDED == render_pipeline_render_damage(dsp, NULL));
+    TEST_ASSERT_EQUAL_UINT32(1, image_renders);
+    render_pipeline_request_update();
+    TEST_ASSERT_TRUE(render_pipeline_pending(dsp));
+    TEST_ASSERT_TRUE(NOT_NEEDED == render_pipeline_render_damage(dsp, NULL));
+    TEST_ASSERT_EQUAL_UINT32(2, image_renders);
+}
+
+void test_render_layer_grows_beyond_capacity()
+{
+    for (int i = 0; i < RENDER_LAYER_CAPACITY * 2 + 1; i++)
+        TEST_ASSERT_NOT_NULL(add_to_render_pipeline(untyped_render, NULL, RL_GUI_ELEMENTS));
+    TEST_ASSERT_TRUE(PM_OK == render_pipeline_render(dsp, NULL));
+    TEST_ASSERT_EQUAL_UINT32(RENDER_LAYER_CAPACITY * 2 + 1, image_renders);
+
+    /* freeing keeps the memory, the layer is empty afterwards */
+    free_render_pipeline(RL_GUI_ELEMENTS);
+    image_renders = 0;
+    render_pipeline_render(dsp, NULL);
+    TEST_ASSERT_EQUAL_UINT32(0, image_renders);
+}
+
+int main(int argc, char** argv)
+{
+    UNITY_BEGIN();
+
+    RUN_TEST(test_display_clip);
+    RUN_TEST(test_full_render_clears_damage);
+    RUN_TEST(test_transparent_label_damages_text_only);
+    RUN_TEST(test_damage_redraws_intersecting_components_in_order);
+    RUN_TEST(test_opaque_component_hides_lower_layers);
+    RUN_TEST(test_render_restart);
+    RUN_TEST(test_render_resumes_interrupted_frame);
+    RUN_TEST(test_render_repairs_component_changed_after_draw);
+    RUN_TEST(test_render_node_added_behind_cursor_damages_screen);
+    RUN_TEST(test_render_update_runs_pre_render_callbacks);
+    RUN_TEST(test_render_layer_grows_beyond_capacity);
+
+    UNITY_END();
+}
@@ -0,0 +1,314 @@
+#include <unity.h>
+
+#include "memory.h"
+#include "storage.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TILE_SIZE (256 * 256 / 2)
+
+static char root[] = "/tmp/storage_rootXXXXXX";
+static storage_t* st;
+
+void setUp()
+{
+    TEST_ASSERT_NOT_NULL(mkdtemp(root));
+    st = storage_posix_create(root);
+}
+
+void tearDown()
+{
+    storage_drop(st, NULL);
+    RTOS_Free(st);
+    char cmd[64];
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", root);
+    TEST_ASSERT_EQUAL(0, system(cmd));
+    strcpy(root, "/tmp/storage_rootXXXXXX");
+}
+
+static uint32_t file_size(const char* name)
+{
+    uint32_t size = 0;
+    storage_stat(st, name, &size);
+    return size;
+}
+
+static double now_us()
+{
+    return RTOS_Micros();
+}
+
+void test_io_buffers_are_aligned()
+{
+    size_t sizes[] = { 1, 63, 64, 65, 512, TILE_SIZE };
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        uint8_t* buf = RTOS_MallocIO(sizes[i]);
+        TEST_ASSERT_NOT_NULL(buf);
+        TEST_ASSERT_EQUAL_UINT32(0, (uintptr_t)buf % RTOS_IO_ALIGN);
+        memset(buf, 0xa5, sizes[i]);
+        RTOS_Free(buf);
+    }
+}
+
+void test_missing_files_are_unavailable()
+{
+    uint32_t size;
+    char* dest = NULL;
+    TEST_ASSERT_EQUAL(UNAVAILABLE, storage_stat(st, "//missing.txt", &size));
+    TEST_ASSERT_EQUAL(UNAVAILABLE, storage_load(st, "//missing.txt", &dest, NULL));
+    TEST_ASSERT_NULL(dest);
+}
+
+void test_writing_creates_folders()
+{
+    storage_file_t* file;
+    size_t written;
+    TEST_ASSERT_EQUAL(PM_OK, storage_open_for_writing(st, "//MAPS/16/10/20.RAW", STORAGE_WRITE, &file));
+    TEST_ASSERT_EQUAL(PM_OK, storage_write(file, "tile", 4, &written));
+    TEST_ASSERT_EQUAL(4, written);
+    TEST_ASSERT_EQUAL(PM_OK, storage_close(file));
+
+    char* dest = NULL;
+    uint32_t size;
+    TEST_ASSERT_EQUAL(PM_OK, storage_load(st, "//MAPS/16/10/20.RAW", &dest, &size));
+    TEST_ASSERT_EQUAL_UINT32(4, size);
+    TEST_ASSERT_EQUAL_STRING("tile", dest);
+    RTOS_Free(dest);
+}
+
+void test_append_keeps_content()
+{
+    storage_file_t* file;
+    size_t written;
+    storage_open_for_writing(st, "//log.txt", STORAGE_WRITE, &file);
+    storage_write(file, "abc", 3, &written);
+    storage_close(file);
+    TEST_ASSERT_EQUAL(PM_OK, storage_open_for_writing(st, "//log.txt", STORAGE_APPEND, &file));
+    TEST_ASSERT_EQUAL_UINT32(3, file->position);
+    storage_write(file, "def", 3, &written);
+    storage_close(file);
+
+    char buf[8] = { 0 };
+    size_t length;
+    TEST_ASSERT_EQUAL(PM_OK, storage_read_file(st, "//log.txt", buf, sizeof(buf), &length));
+    TEST_ASSERT_EQUAL(6, length);
+    TEST_ASSERT_EQUAL_STRING("abcdef", buf);
+}
+
+static void write_text(const char* path, const char* text)
+{
+    storage_file_t* file;
+    size_t written;
+    TEST_ASSERT_EQUAL(PM_OK, storage_open_for_writing(st, path, STORAGE_WRITE, &file));
+    TEST_ASSERT_EQUAL(PM_OK, storage_write(file, text, strlen(text), &written));
+    storage_close(file);
+}
+
+static void assert_text(const char* path, const char* text)
+{
+    char* dest = NULL;
+    TEST_ASSERT_EQUAL(PM_OK, storage_load(st, path, &dest, NULL));
+    TEST_ASSERT_EQUAL_STRING(text, dest);
+    RTOS_Free(dest);
+}
+
+static uint8_t exists(const char* path)
+{
+    uint32_t size;
+    return storage_stat(st, path, &size) == PM_OK;
+}
+
+static error_code_t (*posix_rename)(storage_t* st, const char* from, const char* to);
+
+/* like f_rename, the target must not exist */
+static error_code_t fat_rename(storage_t* st, const char* from, const char* to)
+{
+    if (exists(to))
+        return PM_FAIL;
+    return posix_rename(st, from, to);
+}
+
+static void use_fat_rename()
+{
+    posix_rename = st->rename;
+    st->rename = fat_rename;
+    st->rename_replaces = 0;
+}
+
+void test_rename_replaces()
+{
+    for (int fat = 0; fat < 2; fat++) {
+        if (fat)
+            use_fat_rename();
+        write_text("//TRACK.GPX", "old");
+        write_text("//TRACK.TMP", "new");
+        TEST_ASSERT_EQUAL(PM_OK, storage_rename(st, "//TRACK.TMP", "//TRACK.GPX"));
+        assert_text("//TRACK.GPX", "new");
+        TEST_ASSERT_FALSE(exists("//TRACK.TMP"));
+        TEST_ASSERT_FALSE(exists(STORAGE_REPLACE_ASIDE));
+        TEST_ASSERT_FALSE(exists(STORAGE_REPLACE_JOURNAL));
+    }
+    TEST_ASSERT_EQUAL(PM_OK, storage_rename(st, "//TRACK.GPX", "//TRACK.OLD"));
+    assert_text("//TRACK.OLD", "new");
+    TEST_ASSERT_EQUAL(NOT_NEEDED, storage_recover(st));
+}
+
+void test_recover_cut_off_replace()
+{
+    const char* journal = "//TRACK.TMP\n//TRACK.GPX\n";
+    use_fat_rename();
+
+    /* reset after the old file was moved aside */
+    write_text(STORAGE_REPLACE_JOURNAL, journal);
+    write_text(STORAGE_REPLACE_ASIDE, "old");
+    write_text("//TRACK.TMP", "new");
+    TEST_ASSERT_EQUAL(PM_OK, storage_recover(st));
+    assert_text("//TRACK.GPX", "new");
+    TEST_ASSERT_FALSE(exists("//TRACK.TMP"));
+    TEST_ASSERT_FALSE(exists(STORAGE_REPLACE_ASIDE));
+    TEST_ASSERT_FALSE(exists(STORAGE_REPLACE_JOURNAL));
+
+    /* reset before the old file was deleted */
+    write_text(STORAGE_REPLACE_JOURNAL, journal);
+    write_text(STORAGE_REPLACE_ASIDE, "old");
+    TEST_ASSERT_EQUAL(PM_OK, storage_recover(st));
+    assert_text("//TRACK.GPX", "new");
+    TEST_ASSERT_FALSE(exists(STORAGE_REPLACE_ASIDE));
+
+    /* the new file is gone, the old one comes back */
+    storage_unlink(st, "//TRACK.GPX");
+    write_text(STORAGE_REPLACE_JOURNAL, journal);
+    write_text(STORAGE_REPLACE_ASIDE, "old");
+    TEST_ASSERT_EQUAL(PM_OK, storage_recover(st));
+    assert_text("//TRACK.GPX", "old");
+
+    /* reset while the journal was written */
+    write_text(STORAGE_REPLACE_JOURNAL, "//TRACK.TMP\n//TRA");
+    write_text("//TRACK.TMP", "new");
+    TEST_ASSERT_EQUAL(PM_OK, storage_recover(st));
+    assert_text("//TRACK.GPX", "old");
+    TEST_ASSERT_FALSE(exists(STORAGE_REPLACE_JOURNAL));
+
+    /* the next replace is not blocked by a left over journal */
+    write_text(STORAGE_REPLACE_JOURNAL, journal);
+    TEST_ASSERT_EQUAL(PM_OK, storage_rename(st, "//TRACK.TMP", "//TRACK.GPX"));
+    assert_text("//TRACK.GPX", "new");
+    TEST_ASSERT_FALSE(exists(STORAGE_REPLACE_JOURNAL));
+}
+
+void test_read_at_keeps_files_open()
+{
+    storage_file_t* file;
+    size_t written, length;
+    const char* names[] = { "//a.bin", "//b.bin", "//c.bin", "//d.bin" };
+    uint8_t data[256];
+    for (int i = 0; i < 256; i++)
+        data[i] = i;
+    for (int i = 0; i < 4; i++) {
+        storage_open_for_writing(st, names[i], STORAGE_WRITE, &file);
+        storage_write(file, data, sizeof(data), &written);
+        storage_close(file);
+    }
+
+    uint8_t buf[4];
+    TEST_ASSERT_EQUAL(PM_OK, storage_read_at(st, names[0], 100, buf, sizeof(buf), &length));
+    TEST_ASSERT_EQUAL(4, length);
+    TEST_ASSERT_EQUAL_UINT8(100, buf[0]);
+    storage_file_t* pooled = st->pool[0].file;
+    TEST_ASSERT_EQUAL(PM_OK, storage_read_at(st, names[0], 10, buf, sizeof(buf), &length));
+    TEST_ASSERT_EQUAL_UINT8(10, buf[0]);
+    TEST_ASSERT_EQUAL_PTR(pooled, st->pool[0].file);
+
+    /* the least recently used file makes room */
+    for (int i = 1; i < 4; i++)
+        TEST_ASSERT_EQUAL(PM_OK, storage_read_at(st, names[i], 255, buf, sizeof(buf), &length));
+    TEST_ASSERT_EQUAL(1, length);
+    for (int i = 0; i < STORAGE_POOL_SIZE; i++)
+        TEST_ASSERT_NOT_EQUAL(0, strcmp(names[0], st->pool[i].path));
+
+    /* writing closes the pooled handle */
+    storage_open_for_writing(st, names[3], STORAGE_WRITE, &file);
+    for (int i = 0; i < STORAGE_POOL_SIZE; i++)
+        TEST_ASSERT_NOT_EQUAL(0, strcmp(names[3], st->pool[i].path));
+    storage_close(file);
+    TEST_ASSERT_EQUAL(PM_OK, storage_read_at(st, names[3], 0, buf, sizeof(buf), &length));
+    TEST_ASSERT_EQUAL(0, length);
+    TEST_ASSERT_EQUAL(UNAVAILABLE, storage_read_at(st, "//missing.bin", 0, buf, sizeof(buf), &length));
+}
+
+void test_stream_writes_whole_sectors()
+{
+    storage_stream_t* s = storage_stream_open(st, "//GPX/log.gpx", 0, 0);
+    TEST_ASSERT_NOT_NULL(s);
+    char line[100];
+    memset(line, 'x', sizeof(line));
+    for (int i = 0; i < 50; i++)
+        TEST_ASSERT_EQUAL(PM_OK, storage_stream_write(s, line, sizeof(line)));
+    /* only the full buffer reached the file */
+    TEST_ASSERT_EQUAL_UINT32(STORAGE_STREAM_BUFFER_SIZE, file_size("//GPX/log.gpx"));
+    TEST_ASSERT_EQUAL(PM_OK, storage_sync_streams(st, 0));
+    TEST_ASSERT_EQUAL_UINT32(5000, file_size("//GPX/log.gpx"));
+    TEST_ASSERT_EQUAL(PM_OK, storage_stream_close(s));
+    TEST_ASSERT_NULL(st->streams[0]);
+}
+
+void test_preallocated_stream_is_cut_on_close()
+{
+    storage_stream_t* s = storage_stream_open(st, "//download.raw", 0, 64 * 1024);
+    TEST_ASSERT_NOT_NULL(s);
+    uint8_t data[5000] = { 0 };
+    TEST_ASSERT_EQUAL(PM_OK, storage_stream_write(s, data, sizeof(data)));
+    TEST_ASSERT_EQUAL(PM_OK, storage_stream_close(s));
+    TEST_ASSERT_EQUAL_UINT32(sizeof(data), file_size("//download.raw"));
+}
+
+/* the GPX logger writes one short track point per fix */
+void test_log_write_benchmark()
+{
+    const char* trkpt = "<trkpt lat=\"47.737665\" lon=\"12.665907\"><ele>512.3</ele><time>2022-06-01T10:00:00Z</time></trkpt>\n";
+    size_t length = strlen(trkpt);
+    size_t written;
+    int points = 20000;
+
+    storage_file_t* file;
+    storage_open_for_writing(st, "//direct.gpx", STORAGE_WRITE, &file);
+    double start = now_us();
+    for (int i = 0; i < points; i++)
+        storage_write(file, trkpt, length, &written);
+    storage_close(file);
+    double direct = now_us() - start;
+
+    storage_stream_t* s = storage_stream_open(st, "//stream.gpx", 0, 0);
+    start = now_us();
+    for (int i = 0; i < points; i++)
+        storage_stream_write(s, trkpt, length);
+    storage_stream_close(s);
+    double stream = now_us() - start;
+
+    TEST_ASSERT_EQUAL_UINT32(points * length, file_size("//direct.gpx"));
+    TEST_ASSERT_EQUAL_UINT32(points * length, file_size("//stream.gpx"));
+    printf("track log, %d points\n", points);
+    printf("%-14s %8.1f us/point\n", "storage_write", direct / points);
+    printf("%-14s %8.1f us/point\n", "stream", stream / points);
+}
+
+int main(int argc, char** argv)
+{
+    UNITY_BEGIN();
+
+    RUN_TEST(test_io_buffers_are_aligned);
+    RUN_TEST(test_missing_files_are_unavailable);
+    RUN_TEST(test_writing_creates_folders);
+    RUN_TEST(test_append_keeps_content);
+    RUN_TEST(test_rename_replaces);
+    RUN_TEST(test_recover_cut_off_replace);
+    RUN_TEST(test_read_at_keeps_files_open);
+    RUN_TEST(test_stream_writes_whole_sectors);
+    RUN_TEST(test_preallocated_stream_is_cut_on_close);
+    RUN_TEST(test_log_write_benchmark);
+
+    UNITY_END();
+}
@@ -0,0 +1,137 @@
+#include <unity.h>
+
+#include "memory.h"
+#include "storage.h"
+#include "tile_index.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static char root[] = "/tmp/tile_indexXXXXXX";
+static storage_t* st;
+static tile_index_t* tiles;
+
+static void touch(const char* path)
+{
+    storage_file_t* file;
+    TEST_ASSERT_EQUAL(PM_OK, storage_open_for_writing(st, path, STORAGE_WRITE, &file));
+    storage_close(file);
+}
+
+static void scan(tile_range_t* range)
+{
+    for (uint32_t x = range->x_min; x <= range->x_max; x++)
+        TEST_ASSERT_EQUAL(PM_OK, tile_index_scan_column(range, st, "//MAPS", x));
+    range->ready = 1;
+}
+
+void setUp()
+{
+    TEST_ASSERT_NOT_NULL(mkdtemp(root));
+    st = storage_posix_create(root);
+    tiles = tile_index_create();
+}
+
+void tearDown()
+{
+    tile_index_free(tiles);
+    RTOS_Free(st);
+    char cmd[64];
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", root);
+    TEST_ASSERT_EQUAL(0, system(cmd));
+    strcpy(root, "/tmp/tile_indexXXXXXX");
+}
+
+void test_lookup_outside_ranges_is_unknown()
+{
+    TEST_ASSERT_EQUAL(TILE_UNKNOWN, tile_index_lookup(NULL, 16, 1, 1));
+    TEST_ASSERT_EQUAL(TILE_UNKNOWN, tile_index_lookup(tiles, 16, 1, 1));
+    tile_range_t* r = tile_index_add_range(tiles, 16, 10, 12, 20, 25);
+    TEST_ASSERT_NOT_NULL(r);
+    /* not scanned yet */
+    TEST_ASSERT_EQUAL(TILE_UNKNOWN, tile_index_lookup(tiles, 16, 10, 20));
+    r->ready = 1;
+    TEST_ASSERT_EQUAL(TILE_MISSING, tile_index_lookup(tiles, 16, 10, 20));
+    TEST_ASSERT_EQUAL(TILE_UNKNOWN, tile_index_lookup(tiles, 16, 13, 20));
+    TEST_ASSERT_EQUAL(TILE_UNKNOWN, tile_index_lookup(tiles, 16, 10, 26));
+    TEST_ASSERT_EQUAL(TILE_UNKNOWN, tile_index_lookup(tiles, 14, 10, 20));
+}
+
+void test_scan_finds_tiles()
+{
+    touch("//MAPS/16/10/20.raw");
+    touch("//MAPS/16/10/25.RAW");
+    touch("//MAPS/16/12/22.raw");
+    touch("//MAPS/16/12/23.raw.tmp");
+    touch("//MAPS/16/12/99.raw"); // outside of the range
+    touch("//MAPS/14/11/21.raw"); // other zoom
+    tile_range_t* r = tile_index_add_range(tiles, 16, 10, 12, 20, 25);
+    scan(r);
+
+    for (uint32_t x = 10; x <= 12; x++) {
+        for (uint32_t y = 20; y <= 25; y++) {
+            uint8_t present = (x == 10 && (y == 20 || y == 25)) || (x == 12 && y == 22);
+            TEST_ASSERT_EQUAL(present ? TILE_PRESENT : TILE_MISSING, tile_index_lookup(tiles, 16, x, y));
+        }
+    }
+}
+
+void test_set_updates_tiles()
+{
+    tile_range_t* r = tile_index_add_range(tiles, 16, 10, 12, 20, 25);
+    scan(r);
+    tile_index_set(tiles, 16, 11, 21, 1);
+    TEST_ASSERT_EQUAL(TILE_PRESENT, tile_index_lookup(tiles, 16, 11, 21));
+    TEST_ASSERT_EQUAL(TILE_MISSING, tile_index_lookup(tiles, 16, 11, 22));
+    tile_index_set(tiles, 16, 11, 21, 0);
+    TEST_ASSERT_EQUAL(TILE_MISSING, tile_index_lookup(tiles, 16, 11, 21));
+    /* outside of the tiles */
+    tile_index_set(tiles, 16, 50, 50, 1);
+    TEST_ASSERT_EQUAL(TILE_UNKNOWN, tile_index_lookup(tiles, 16, 50, 50));
+}
+
+void test_set_during_scan_is_kept()
+{
+    touch("//MAPS/16/10/20.raw");
+    touch("//MAPS/16/12/22.raw");
+    tile_range_t* r = tile_index_add_range(tiles, 16, 10, 12, 20, 25);
+    TEST_ASSERT_EQUAL(PM_OK, tile_index_scan_column(r, st, "//MAPS", 10));
+    /* a download lands while the other columns are scanned */
+    tile_index_set(tiles, 16, 10, 21, 1);
+    tile_index_set(tiles, 16, 11, 23, 1);
+    tile_index_set(tiles, 16, 12, 24, 1);
+    TEST_ASSERT_EQUAL(TILE_UNKNOWN, tile_index_lookup(tiles, 16, 11, 23));
+    TEST_ASSERT_EQUAL(PM_OK, tile_index_scan_column(r, st, "//MAPS", 11));
+    TEST_ASSERT_EQUAL(PM_OK, tile_index_scan_column(r, st, "//MAPS", 12));
+    r->ready = 1;
+
+    TEST_ASSERT_EQUAL(TILE_PRESENT, tile_index_lookup(tiles, 16, 10, 20));
+    TEST_ASSERT_EQUAL(TILE_PRESENT, tile_index_lookup(tiles, 16, 10, 21));
+    TEST_ASSERT_EQUAL(TILE_PRESENT, tile_index_lookup(tiles, 16, 11, 23));
+    TEST_ASSERT_EQUAL(TILE_PRESENT, tile_index_lookup(tiles, 16, 12, 22));
+    TEST_ASSERT_EQUAL(TILE_PRESENT, tile_index_lookup(tiles, 16, 12, 24));
+    TEST_ASSERT_EQUAL(TILE_MISSING, tile_index_lookup(tiles, 16, 11, 22));
+}
+
+void test_ranges_are_added_once()
+{
+    tile_range_t* r = tile_index_add_range(tiles, 16, 10, 12, 20, 25);
+    TEST_ASSERT_EQUAL_PTR(r, tile_index_add_range(tiles, 16, 10, 12, 20, 25));
+    TEST_ASSERT_NOT_EQUAL(r, tile_index_add_range(tiles, 14, 10, 12, 20, 25));
+    TEST_ASSERT_NULL(tile_index_add_range(tiles, 16, 12, 10, 20, 25));
+    TEST_ASSERT_NULL(tile_index_add_range(tiles, 10, 0, 1023, 0, 1023));
+}
+
+int main(int argc, char** argv)
+{
+    UNITY_BEGIN();
+
+    RUN_TEST(test_lookup_outside_ranges_is_unknown);
+    RUN_TEST(test_scan_finds_tiles);
+    RUN_TEST(test_set_updates_tiles);
+    RUN_TEST(test_set_during_scan_is_kept);
+    RUN_TEST(test_ranges_are_added_once);
+
+    UNITY_END();
+}
@@ -0,0 +1,245 @@
+#include <unity.h>
+
+#include "crc32.h"
+#include "memory.h"
+#include "storage.h"
+#include "tile_pack.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ZOOM 14
+#define X_MIN 100
+#define X_MAX 103
+#define Y_MIN 200
+#define Y_MAX 212
+#define TILES ((X_MAX - X_MIN + 1) * (Y_MAX - Y_MIN + 1))
+
+static char root[] = "/tmp/tile_packXXXXXX";
+static storage_t* st;
+static tile_index_t* tiles;
+static uint8_t pack[256 * 1024];
+static size_t pack_length;
+
+static uint8_t in_pack(uint32_t x, uint32_t y)
+{
+    return (x + y) % 4 != 0;
+}
+
+static uint32_t tile_length(uint32_t x, uint32_t y)
+{
+    return 500 + x * 7 + y * 3;
+}
+
+static uint8_t tile_byte(uint32_t x, uint32_t y, uint32_t i)
+{
+    return (x * 13 + y * 29 + i) & 0xff;
+}
+
+/* what the server sends */
+static void build_pack()
+{
+    tile_pack_header_t h = { TILE_PACK_MAGIC, ZOOM, { 0 }, X_MIN, X_MAX, Y_MIN, Y_MAX };
+    tile_pack_entry_t* index = (tile_pack_entry_t*)(pack + sizeof(h));
+    memcpy(pack, &h, sizeof(h));
+    pack_length = sizeof(h) + TILES * sizeof(tile_pack_entry_t);
+    uint32_t i = 0;
+    for (uint32_t x = X_MIN; x <= X_MAX; x++) {
+        for (uint32_t y = Y_MIN; y <= Y_MAX; y++, i++) {
+            memset(&index[i], 0, sizeof(tile_pack_entry_t));
+            if (!in_pack(x, y))
+                continue;
+            tile_pack_record_t r = { .x = x, .y = y, .length = tile_length(x, y) };
+            uint8_t* data = pack + pack_length + sizeof(r);
+            for (uint32_t b = 0; b < r.length; b++)
+                data[b] = tile_byte(x, y, b);
+            r.crc = crc32_update(0, data, r.length);
+            memcpy(pack + pack_length, &r, sizeof(r));
+            index[i].offset = pack_length + sizeof(r);
+            index[i].length = r.length;
+            index[i].crc = r.crc;
+            pack_length += sizeof(r) + r.length;
+        }
+    }
+}
+
+static error_code_t check_pack(size_t chunk)
+{
+    tile_pack_check_t c;
+    tile_pack_check_begin(&c, ZOOM, X_MIN, X_MAX, Y_MIN, Y_MAX);
+    for (size_t i = 0; i < pack_length; i += chunk)
+        if (tile_pack_check(&c, pack + i, i + chunk < pack_length ? chunk : pack_length - i) != PM_OK)
+            return PM_FAIL;
+    return tile_pack_check_end(&c);
+}
+
+void setUp()
+{
+    TEST_ASSERT_NOT_NULL(mkdtemp(root));
+    st = storage_posix_create(root);
+    tiles = tile_index_create();
+    build_pack();
+}
+
+void tearDown()
+{
+    storage_drop(st, NULL);
+    tile_index_free(tiles);
+    RTOS_Free(st);
+    char cmd[64];
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", root);
+    TEST_ASSERT_EQUAL(0, system(cmd));
+    strcpy(root, "/tmp/tile_packXXXXXX");
+}
+
+void test_pack_path_is_8_3()
+{
+    char path[STORAGE_PATH_LENGTH], other[STORAGE_PATH_LENGTH];
+    tile_pack_path(path, sizeof(path), "//MAPS", ZOOM, X_MIN, X_MAX, Y_MIN, Y_MAX, "TPK");
+    TEST_ASSERT_EQUAL(0, strncmp(path, "//MAPS/14/", 10));
+    TEST_ASSERT_EQUAL(12, strlen(path + 10));
+    TEST_ASSERT_EQUAL_STRING(".TPK", path + 18);
+    tile_pack_path(other, sizeof(other), "//MAPS", ZOOM, X_MIN, X_MAX, Y_MIN, Y_MAX + 1, "TPK");
+    TEST_ASSERT_NOT_EQUAL(0, strcmp(path, other));
+}
+
+void test_pack_is_checked_in_any_chunks()
+{
+    size_t chunks[] = { 1, 7, 12, 16, 100, 2048, sizeof(pack) };
+    for (uint8_t i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++)
+        TEST_ASSERT_EQUAL(PM_OK, check_pack(chunks[i]));
+}
+
+void test_broken_packs_are_refused()
+{
+    tile_pack_check_t c;
+    /* the box of an other tileset */
+    tile_pack_check_begin(&c, ZOOM, X_MIN, X_MAX, Y_MIN, Y_MAX + 1);
+    TEST_ASSERT_EQUAL(PM_FAIL, tile_pack_check(&c, pack, pack_length));
+
+    /* cut off */
+    tile_pack_check_begin(&c, ZOOM, X_MIN, X_MAX, Y_MIN, Y_MAX);
+    TEST_ASSERT_EQUAL(PM_OK, tile_pack_check(&c, pack, pack_length - 1));
+    TEST_ASSERT_EQUAL(PM_FAIL, tile_pack_check_end(&c));
+
+    /* more than the last tile */
+    tile_pack_check_begin(&c, ZOOM, X_MIN, X_MAX, Y_MIN, Y_MAX);
+    pack[pack_length++] = 0;
+    TEST_ASSERT_EQUAL(PM_FAIL, tile_pack_check(&c, pack, pack_length));
+    pack_length--;
+
+    /* a flipped bit in a tile */
+    pack[pack_length - 100] ^= 0x04;
+    TEST_ASSERT_EQUAL(PM_FAIL, check_pack(512));
+    pack[pack_length - 100] ^= 0x04;
+
+    /* an index entry that does not match its record */
+    tile_pack_entry_t* index = (tile_pack_entry_t*)(pack + sizeof(tile_pack_header_t));
+    index[1].crc ^= 1;
+    TEST_ASSERT_EQUAL(PM_FAIL, check_pack(512));
+    index[1].crc ^= 1;
+
+    /* a record with other coordinates */
+    tile_pack_record_t* r = (tile_pack_record_t*)(pack + index[1].offset - sizeof(tile_pack_record_t));
+    r->y++;
+    TEST_ASSERT_EQUAL(PM_FAIL, check_pack(512));
+    r->y--;
+
+    /* a record that lies about its tile fails before the tile arrives */
+    r->crc ^= 1;
+    size_t end = (uint8_t*)(r + 1) - pack;
+    tile_pack_check_begin(&c, ZOOM, X_MIN, X_MAX, Y_MIN, Y_MAX);
+    TEST_ASSERT_EQUAL(PM_FAIL, tile_pack_check(&c, pack, end));
+    TEST_ASSERT_EQUAL_UINT32(end, c.position);
+    tile_pack_check_end(&c);
+    r->crc ^= 1;
+
+    /* a gap in front of a tile */
+    index[1].offset++;
+    TEST_ASSERT_EQUAL(PM_FAIL, check_pack(512));
+    index[1].offset--;
+    TEST_ASSERT_EQUAL(PM_OK, check_pack(512));
+}
+
+void test_tiles_are_read_from_the_pack()
+{
+    char path[STORAGE_PATH_LENGTH];
+    storage_file_t* file;
+    size_t length = 0;
+    tile_pack_t* p;
+    uint8_t data[2048];
+
+    tile_pack_path(path, sizeof(path), "//MAPS", ZOOM, X_MIN, X_MAX, Y_MIN, Y_MAX, "TPK");
+    TEST_ASSERT_EQUAL(UNAVAILABLE, tile_pack_open(st, path, &p));
+    TEST_ASSERT_EQUAL(PM_OK, storage_open_for_writing(st, path, STORAGE_WRITE, &file));
+    TEST_ASSERT_EQUAL(PM_OK, storage_write(file, pack, pack_length, &length));
+    storage_close(file);
+
+    tile_range_t* range = tile_index_add_range(tiles, ZOOM, X_MIN, X_MAX, Y_MIN, Y_MAX);
+    range->ready = 1;
+    TEST_ASSERT_EQUAL(PM_OK, tile_pack_open(st, path, &p));
+    /* the index is read a few entries per call */
+    uint32_t calls = 1;
+    while (tile_pack_index(st, p, tiles) == DEFERRED)
+        calls++;
+    TEST_ASSERT_EQUAL_UINT32((TILES + TILE_PACK_READ_AHEAD - 1) / TILE_PACK_READ_AHEAD, calls);
+    TEST_ASSERT_EQUAL(PM_OK, tile_pack_index(st, p, tiles));
+    uint32_t count = 0;
+    for (uint32_t x = X_MIN; x <= X_MAX; x++) {
+        for (uint32_t y = Y_MIN; y <= Y_MAX; y++) {
+            TEST_ASSERT_EQUAL(in_pack(x, y) ? TILE_PRESENT : TILE_MISSING, tile_index_lookup(tiles, ZOOM, x, y));
+            error_code_t ret = tile_pack_read(st, p, x, y, data, sizeof(data), &length);
+            if (!in_pack(x, y)) {
+                TEST_ASSERT_EQUAL(UNAVAILABLE, ret);
+                continue;
+            }
+            count++;
+            TEST_ASSERT_EQUAL(PM_OK, ret);
+            TEST_ASSERT_EQUAL_UINT32(tile_length(x, y), length);
+            for (uint32_t b = 0; b < length; b++)
+                TEST_ASSERT_EQUAL_UINT8(tile_byte(x, y, b), data[b]);
+        }
+    }
+    TEST_ASSERT_EQUAL_UINT32(count, p->tiles);
+
+    /* a short buffer gets the start of the tile */
+    TEST_ASSERT_EQUAL(PM_OK, tile_pack_read(st, p, X_MIN, Y_MIN + 1, data, 16, &length));
+    TEST_ASSERT_EQUAL_UINT32(16, length);
+    TEST_ASSERT_EQUAL(UNAVAILABLE, tile_pack_read(st, p, X_MAX + 1, Y_MIN, data, sizeof(data), &length));
+    RTOS_Free(p);
+}
+
+void test_cut_off_index_fails()
+{
+    char path[STORAGE_PATH_LENGTH];
+    storage_file_t* file;
+    size_t length;
+    tile_pack_t* p;
+    error_code_t ret;
+
+    tile_pack_path(path, sizeof(path), "//MAPS", ZOOM, X_MIN, X_MAX, Y_MIN, Y_MAX, "TPK");
+    TEST_ASSERT_EQUAL(PM_OK, storage_open_for_writing(st, path, STORAGE_WRITE, &file));
+    storage_write(file, pack, sizeof(tile_pack_header_t) + TILE_PACK_READ_AHEAD * sizeof(tile_pack_entry_t), &length);
+    storage_close(file);
+
+    TEST_ASSERT_EQUAL(PM_OK, tile_pack_open(st, path, &p));
+    TEST_ASSERT_EQUAL(DEFERRED, tile_pack_index(st, p, tiles));
+    while ((ret = tile_pack_index(st, p, tiles)) == DEFERRED)
+        ;
+    TEST_ASSERT_EQUAL(PM_FAIL, ret);
+    RTOS_Free(p);
+}
+
+int main(int argc, char** argv)
+{
+    UNITY_BEGIN();
+
+    RUN_TEST(test_pack_path_is_8_3);
+    RUN_TEST(test_pack_is_checked_in_any_chunks);
+    RUN_TEST(test_broken_packs_are_refused);
+    RUN_TEST(test_tiles_are_read_from_the_pack);
+    RUN_TEST(test_cut_off_index_fails);
+
+    UNITY_END();
+}
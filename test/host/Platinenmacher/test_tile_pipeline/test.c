@@ -0,0 +1,215 @@
+#include <unity.h>
+
+#include "display.h"
+#include "gui/map.h"
+#include "gui/tile_pipeline.h"
+
+#include <fonts/font8x8.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define DISPLAY_WIDTH 768
+#define DISPLAY_HEIGHT 768
+#define STAGE_DELAY_US 5000
+
+static font_t f8x8;
+static display_t* dsp;
+static map_t* map;
+static tile_pipeline_t* pipeline;
+static uint8_t fb[DISPLAY_WIDTH * DISPLAY_HEIGHT];
+
+/* reader thread state */
+static uint32_t read_order[16];
+static uint32_t reads;
+static uint32_t missing_x = UINT32_MAX;
+static uint32_t read_delay_us;
+static uint32_t blit_delay_us;
+
+error_code_t write_pixel(const display_t* dsp, int16_t x, int16_t y, uint8_t color)
+{
+    /* once per tile, they start at multiples of 256 */
+    if (!(x & 0xff) && !(y & 0xff))
+        usleep(blit_delay_us);
+    dsp->fb[y * dsp->size.width + x] = color;
+    return PM_OK;
+}
+
+uint8_t decompress(rect_t* size, int16_t x, int16_t y, const uint8_t* data)
+{
+    uint32_t pos = y * size->width + x;
+    return (pos & 0x1 ? data[pos >> 1] : data[pos >> 1] >> 4) & 0x0f;
+}
+
+static uint8_t tile_color(uint32_t x, uint32_t y)
+{
+    return (x + y) & 0x1 ? WHITE : BLACK;
+}
+
+static error_code_t read_tile(const map_tile_t* tile, uint8_t* data, size_t size, size_t* length)
+{
+    read_order[reads++] = tile->x * 100 + tile->y;
+    usleep(read_delay_us);
+    if (tile->x == missing_x)
+        return UNAVAILABLE;
+    uint8_t c = tile_color(tile->x, tile->y);
+    memset(data, c << 4 | c, size);
+    *length = size;
+    return PM_OK;
+}
+
+static void set_tiles()
+{
+    for (uint32_t i = 0; i < map->tile_count; i++) {
+        map->tiles[i]->x = 10 + i / map->height;
+        map->tiles[i]->y = 20 + i % map->height;
+        map->tiles[i]->z = 16;
+    }
+}
+
+static void assert_tile_drawn(const map_tile_t* tile)
+{
+    int16_t x = tile->image->box.left + 2;
+    int16_t y = tile->image->box.top + 2;
+    TEST_ASSERT_EQUAL_UINT8(tile_color(tile->x, tile->y), fb[y * DISPLAY_WIDTH + x]);
+}
+
+void setUp()
+{
+    font_load_from_array(&f8x8, font8x8, font8x8_name);
+    dsp = display_init(DISPLAY_WIDTH, DISPLAY_HEIGHT, 8, DISPLAY_ROTATE_0);
+    dsp->fb = fb;
+    dsp->fb_size = sizeof(fb);
+    dsp->write_pixel = write_pixel;
+    dsp->decompress = decompress;
+    memset(fb, 0xaa, sizeof(fb));
+    map = map_create(0, 0, 3, 3, 256, &f8x8);
+    set_tiles();
+    reads = 0;
+    missing_x = UINT32_MAX;
+    read_delay_us = 0;
+    blit_delay_us = 0;
+    pipeline = NULL;
+}
+
+void tearDown()
+{
+    tile_pipeline_free(pipeline);
+    label_pool_reset();
+    image_pool_reset();
+    free(dsp);
+}
+
+void test_tiles_are_drawn_in_map_order()
+{
+    pipeline = tile_pipeline_create(read_tile);
+    TEST_ASSERT_NOT_NULL(pipeline);
+    map_attach_tile_pipeline(map, pipeline);
+
+    TEST_ASSERT_EQUAL(PM_OK, map_render(dsp, map));
+
+    TEST_ASSERT_EQUAL_UINT32(map->tile_count, reads);
+    for (uint32_t i = 0; i < map->tile_count; i++) {
+        TEST_ASSERT_EQUAL_UINT32(map->tiles[i]->x * 100 + map->tiles[i]->y, read_order[i]);
+        assert_tile_drawn(map->tiles[i]);
+        TEST_ASSERT_NULL(map->tiles[i]->image->data);
+    }
+    TEST_ASSERT_EQUAL_UINT32(map->tile_count, tile_pipeline_get_stats(pipeline)->tiles);
+    TEST_ASSERT_EQUAL_UINT32(0, tile_pipeline_get_stats(pipeline)->failed);
+}
+
+void test_missing_tiles_are_labeled()
+{
+    pipeline = tile_pipeline_create(read_tile);
+    map_attach_tile_pipeline(map, pipeline);
+    missing_x = 11;
+
+    map_render(dsp, map);
+
+    for (uint32_t i = 0; i < map->tile_count; i++) {
+        map_tile_t* tile = map->tiles[i];
+        if (tile->x == missing_x) {
+            TEST_ASSERT_EQUAL_STRING("Not Found", tile->label->text);
+            TEST_ASSERT_EQUAL_UINT8(0xaa, fb[(tile->image->box.top + 2) * DISPLAY_WIDTH + tile->image->box.left + 2]);
+        } else {
+            TEST_ASSERT_EQUAL_STRING("", tile->label->text);
+            assert_tile_drawn(tile);
+        }
+    }
+    TEST_ASSERT_EQUAL_UINT32(3, tile_pipeline_get_stats(pipeline)->failed);
+}
+
+void test_clipped_tiles_are_not_read()
+{
+    pipeline = tile_pipeline_create(read_tile);
+    map_attach_tile_pipeline(map, pipeline);
+    rect_t clip = { 300, 300, 10, 10 };
+    dsp->clip = clip;
+
+    map_render(dsp, map);
+
+    TEST_ASSERT_EQUAL_UINT32(1, reads);
+    TEST_ASSERT_EQUAL_UINT32(map->tiles[4]->x * 100 + map->tiles[4]->y, read_order[0]);
+}
+
+void test_buffers_are_kept_between_renders()
+{
+    pipeline = tile_pipeline_create(read_tile);
+    map_attach_tile_pipeline(map, pipeline);
+
+    for (int i = 0; i < 3; i++) {
+        memset(fb, 0xaa, sizeof(fb));
+        reads = 0;
+        TEST_ASSERT_EQUAL(PM_OK, map_render(dsp, map));
+        TEST_ASSERT_EQUAL_UINT32(map->tile_count, reads);
+        for (uint32_t t = 0; t < map->tile_count; t++)
+            assert_tile_drawn(map->tiles[t]);
+    }
+}
+
+void test_free_releases_everything()
+{
+    /* the leak check of the sanitizer sees queues, tasks and buffers */
+    for (int i = 0; i < 20; i++) {
+        tile_pipeline_t* p = tile_pipeline_create(read_tile);
+        TEST_ASSERT_NOT_NULL(p);
+        tile_pipeline_free(p);
+    }
+}
+
+void test_stages_overlap()
+{
+    /* a slow reader in front of a slow blitter */
+    pipeline = tile_pipeline_create(read_tile);
+    map_attach_tile_pipeline(map, pipeline);
+    read_delay_us = STAGE_DELAY_US;
+    blit_delay_us = STAGE_DELAY_US;
+
+    map_render(dsp, map);
+
+    const tile_pipeline_stats_t* stats = tile_pipeline_get_stats(pipeline);
+    printf("%u tiles in %lld us: read %lld us, blit %lld us, stalled %lld us\n",
+        stats->tiles, (long long)stats->total_us, (long long)stats->read_us,
+        (long long)stats->blit_us, (long long)stats->stall_us);
+    for (uint32_t i = 0; i < map->tile_count; i++)
+        assert_tile_drawn(map->tiles[i]);
+    TEST_ASSERT_TRUE(stats->read_us >= map->tile_count * STAGE_DELAY_US);
+    /* one stage after the other takes the sum of all stages */
+    TEST_ASSERT_TRUE(stats->total_us < stats->read_us + stats->blit_us);
+}
+
+int main(int argc, char** argv)
+{
+    UNITY_BEGIN();
+
+    RUN_TEST(test_tiles_are_drawn_in_map_order);
+    RUN_TEST(test_missing_tiles_are_labeled);
+    RUN_TEST(test_clipped_tiles_are_not_read);
+    RUN_TEST(test_buffers_are_kept_between_renders);
+    RUN_TEST(test_free_releases_everything);
+    RUN_TEST(test_stages_overlap);
+
+    UNITY_END();
+}
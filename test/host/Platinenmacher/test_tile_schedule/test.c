@@ -0,0 +1,192 @@
+#include <unity.h>
+
+#include "tile_schedule.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_TILES 4096
+
+/* from the Chiemsee to the Kampenwand */
+static const track_point_t route[] = {
+    { 47.8570, 12.3600 },
+    { 47.8300, 12.4200 },
+    { 47.8000, 12.3900 },
+    { 47.7530, 12.3530 },
+};
+
+typedef struct {
+    uint8_t zoom;
+    uint32_t x;
+    uint32_t y;
+} tile_t;
+
+static tile_t tiles[MAX_TILES];
+static uint32_t count;
+static uint32_t route_tiles; /// handed out in the route phase
+
+static uint32_t tile_x(float lon, uint8_t zoom)
+{
+    return (uint32_t)floor((lon + 180) / 360 * pow(2, zoom));
+}
+
+static uint32_t tile_y(float lat, uint8_t zoom)
+{
+    double l = lat * M_PI / 180;
+    return (uint32_t)floor((1 - log(tan(l) + 1 / cos(l)) / M_PI) / 2 * pow(2, zoom));
+}
+
+static void drain(tile_schedule_t* s)
+{
+    count = 0;
+    route_tiles = 0;
+    while (count < MAX_TILES && tile_schedule_next(s, &tiles[count].zoom, &tiles[count].x, &tiles[count].y) == PM_OK) {
+        if (s->phase == TILE_SCHEDULE_ROUTE)
+            route_tiles++;
+        count++;
+    }
+}
+
+static void assert_each_tile_once(uint8_t zoom, uint32_t x_min, uint32_t x_max, uint32_t y_min, uint32_t y_max)
+{
+    uint32_t width = y_max - y_min + 1;
+    uint32_t area = (x_max - x_min + 1) * width;
+    uint8_t* seen = calloc(area, 1);
+    uint32_t found = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (tiles[i].zoom != zoom)
+            continue;
+        TEST_ASSERT_TRUE(tiles[i].x >= x_min && tiles[i].x <= x_max);
+        TEST_ASSERT_TRUE(tiles[i].y >= y_min && tiles[i].y <= y_max);
+        uint32_t bit = (tiles[i].x - x_min) * width + tiles[i].y - y_min;
+        TEST_ASSERT_FALSE(seen[bit]);
+        seen[bit] = 1;
+        found++;
+    }
+    TEST_ASSERT_EQUAL_UINT32(area, found);
+    free(seen);
+}
+
+/* Chebyshev distance of tile i to the closest route tile of its zoom */
+static uint32_t distance_to_route(uint32_t i)
+{
+    uint32_t best = UINT32_MAX;
+    for (uint32_t r = 0; r < route_tiles; r++) {
+        if (tiles[r].zoom != tiles[i].zoom)
+            continue;
+        uint32_t dx = abs((int)tiles[r].x - (int)tiles[i].x);
+        uint32_t dy = abs((int)tiles[r].y - (int)tiles[i].y);
+        uint32_t d = dx > dy ? dx : dy;
+        if (d < best)
+            best = d;
+    }
+    return best;
+}
+
+void setUp() { }
+
+void tearDown() { }
+
+void test_without_track_in_folder_order()
+{
+    tile_schedule_t* s = tile_schedule_create(NULL, 0, 1);
+    TEST_ASSERT_EQUAL(PM_OK, tile_schedule_add(s, 10, 100, 104, 200, 202));
+    drain(s);
+    TEST_ASSERT_EQUAL_UINT32(15, count);
+    TEST_ASSERT_EQUAL_UINT32(15, s->tiles);
+    TEST_ASSERT_EQUAL_UINT32(0, route_tiles);
+    for (uint32_t i = 0; i < count; i++) {
+        TEST_ASSERT_EQUAL_UINT32(100 + i / 3, tiles[i].x);
+        TEST_ASSERT_EQUAL_UINT32(200 + i % 3, tiles[i].y);
+    }
+    tile_schedule_free(s);
+}
+
+void test_route_first_then_rings()
+{
+    uint8_t zoom = 14;
+    uint32_t x_min = tile_x(12.30, zoom), x_max = tile_x(12.48, zoom);
+    uint32_t y_min = tile_y(47.90, zoom), y_max = tile_y(47.70, zoom);
+    tile_schedule_t* s = tile_schedule_create(route, sizeof(route) / sizeof(route[0]), 1);
+    TEST_ASSERT_EQUAL(PM_OK, tile_schedule_add(s, zoom, x_min, x_max, y_min, y_max));
+    drain(s);
+    assert_each_tile_once(zoom, x_min, x_max, y_min, y_max);
+    TEST_ASSERT_TRUE(route_tiles > 0 && route_tiles < count);
+
+    /* the route starts at the first track point */
+    TEST_ASSERT_TRUE(abs((int)tile_x(route[0].lon, zoom) - (int)tiles[0].x) <= 1);
+    TEST_ASSERT_TRUE(abs((int)tile_y(route[0].lat, zoom) - (int)tiles[0].y) <= 1);
+    /* every track point is covered with its neighbours */
+    for (uint32_t p = 0; p < sizeof(route) / sizeof(route[0]); p++) {
+        uint32_t found = 0;
+        for (uint32_t i = 0; i < route_tiles; i++)
+            found += tiles[i].x == tile_x(route[p].lon, zoom) && tiles[i].y == tile_y(route[p].lat, zoom);
+        TEST_ASSERT_EQUAL_UINT32(1, found);
+    }
+    /* the rest moves away from the route */
+    uint32_t last = 1;
+    for (uint32_t i = route_tiles; i < count; i++) {
+        uint32_t d = distance_to_route(i);
+        TEST_ASSERT_TRUE(d >= last);
+        last = d;
+    }
+    printf("zoom %u: %lu route tiles of %lu\n", zoom, (unsigned long)route_tiles, (unsigned long)count);
+    tile_schedule_free(s);
+}
+
+void test_route_of_every_zoom_first()
+{
+    tile_schedule_t* s = tile_schedule_create(route, sizeof(route) / sizeof(route[0]), 0);
+    for (uint8_t zoom = 12; zoom <= 14; zoom++)
+        TEST_ASSERT_EQUAL(PM_OK, tile_schedule_add(s, zoom, tile_x(12.30, zoom), tile_x(12.48, zoom), tile_y(47.90, zoom), tile_y(47.70, zoom)));
+    drain(s);
+    for (uint8_t zoom = 12; zoom <= 14; zoom++)
+        assert_each_tile_once(zoom, tile_x(12.30, zoom), tile_x(12.48, zoom), tile_y(47.90, zoom), tile_y(47.70, zoom));
+    /* zoom 14 route tiles come before the rest of zoom 12 */
+    uint8_t route_zoom = 0;
+    for (uint32_t i = 0; i < route_tiles; i++) {
+        TEST_ASSERT_TRUE(tiles[i].zoom >= route_zoom);
+        route_zoom = tiles[i].zoom;
+    }
+    TEST_ASSERT_EQUAL_UINT8(14, route_zoom);
+    TEST_ASSERT_EQUAL_UINT8(12, tiles[route_tiles].zoom);
+    tile_schedule_free(s);
+}
+
+void test_route_outside_of_area()
+{
+    tile_schedule_t* s = tile_schedule_create(route, sizeof(route) / sizeof(route[0]), 1);
+    TEST_ASSERT_EQUAL(PM_OK, tile_schedule_add(s, 14, 100, 103, 200, 203));
+    drain(s);
+    TEST_ASSERT_EQUAL_UINT32(0, route_tiles);
+    assert_each_tile_once(14, 100, 103, 200, 203);
+    tile_schedule_free(s);
+}
+
+void test_invalid_areas()
+{
+    tile_schedule_t* s = tile_schedule_create(NULL, 0, 1);
+    for (uint8_t i = 0; i < TILE_SCHEDULE_MAX_AREAS; i++)
+        TEST_ASSERT_EQUAL(PM_OK, tile_schedule_add(s, 10 + i, 0, 1, 0, 1));
+    TEST_ASSERT_EQUAL(PM_FAIL, tile_schedule_add(s, 18, 0, 1, 0, 1));
+    tile_schedule_free(s);
+
+    s = tile_schedule_create(NULL, 0, 1);
+    TEST_ASSERT_EQUAL(PM_FAIL, tile_schedule_add(s, 18, 2, 1, 0, 1));
+    tile_schedule_free(s);
+}
+
+int main(int argc, char** argv)
+{
+    UNITY_BEGIN();
+
+    RUN_TEST(test_without_track_in_folder_order);
+    RUN_TEST(test_route_first_then_rings);
+    RUN_TEST(test_route_of_every_zoom_first);
+    RUN_TEST(test_route_outside_of_area);
+    RUN_TEST(test_invalid_areas);
+
+    UNITY_END();
+}
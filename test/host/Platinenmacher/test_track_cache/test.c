@@ -0,0 +1,183 @@
+#include <unity.h>
+
+#include "memory.h"
+#include "storage.h"
+#include "track_cache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define POINTS 1000
+
+static char root[] = "/tmp/track_cacheXXXXXX";
+static storage_t* st;
+static gpx_t gpx;
+static waypoint_t waypoints[POINTS];
+static waypoint_t* last;
+static uint32_t added;
+
+static uint32_t link_waypoint(waypoint_t* wp)
+{
+    if (last)
+        last->next = wp;
+    last = wp;
+    return ++added;
+}
+
+static void write_gpx(const char* text)
+{
+    storage_file_t* file;
+    size_t written;
+    TEST_ASSERT_EQUAL(PM_OK, storage_open_for_writing(st, "//track.gpx", STORAGE_WRITE, &file));
+    TEST_ASSERT_EQUAL(PM_OK, storage_write(file, text, strlen(text), &written));
+    storage_close(file);
+}
+
+static void free_track(gpx_t* g)
+{
+    waypoint_t* wp = g->waypoints;
+    while (wp) {
+        waypoint_t* next = wp->next;
+        RTOS_Free(wp);
+        wp = next;
+    }
+    RTOS_Free(g->track_name);
+    RTOS_Free(g);
+}
+
+void setUp()
+{
+    TEST_ASSERT_NOT_NULL(mkdtemp(root));
+    st = storage_posix_create(root);
+    memset(waypoints, 0, sizeof(waypoints));
+    for (uint32_t i = 0; i < POINTS; i++) {
+        waypoints[i].lat = 49.0f + i * 0.0001f;
+        waypoints[i].lon = 8.5f - i * 0.0002f;
+        waypoints[i].ele = 100.0f + i % 37;
+        waypoints[i].next = i + 1 < POINTS ? &waypoints[i + 1] : NULL;
+    }
+    gpx.waypoints = waypoints;
+    gpx.waypoints_num = POINTS;
+    gpx.track_name = "Teststrecke";
+    last = NULL;
+    added = 0;
+    write_gpx("<gpx></gpx>");
+}
+
+void tearDown()
+{
+    RTOS_Free(st);
+    char cmd[64];
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", root);
+    TEST_ASSERT_EQUAL(0, system(cmd));
+    strcpy(root, "/tmp/track_cacheXXXXXX");
+}
+
+void test_cache_is_next_to_the_gpx()
+{
+    char path[STORAGE_PATH_LENGTH];
+    track_cache_path(path, sizeof(path), "//track.gpx", "bin");
+    TEST_ASSERT_EQUAL_STRING("//track.bin", path);
+    track_cache_path(path, sizeof(path), "//TRACK", "bin");
+    TEST_ASSERT_EQUAL_STRING("//TRACK.bin", path);
+    track_cache_path(path, sizeof(path), "//a.b/track", "bin");
+    TEST_ASSERT_EQUAL_STRING("//a.b/track.bin", path);
+}
+
+void test_track_comes_back_from_the_cache()
+{
+    track_cache_header_t source = { .source_crc = 0x12345678 };
+    track_cache_t* cache;
+    TEST_ASSERT_EQUAL(PM_OK, track_cache_source(st, "//track.gpx", &source));
+    TEST_ASSERT_EQUAL_UINT32(11, source.source_size);
+    TEST_ASSERT_EQUAL(UNAVAILABLE, track_cache_load(st, "//track.bin", &source, &cache));
+    TEST_ASSERT_EQUAL(PM_OK, track_cache_save(st, "//track.bin", &source, &gpx));
+
+    uint32_t size;
+    TEST_ASSERT_EQUAL(UNAVAILABLE, storage_stat(st, "//track.TMP", &size));
+    TEST_ASSERT_EQUAL(PM_OK, track_cache_load(st, "//track.bin", &source, &cache));
+    TEST_ASSERT_EQUAL_UINT32(POINTS, cache->header.points);
+    TEST_ASSERT_EQUAL_HEX32(0x12345678, cache->header.source_crc);
+    TEST_ASSERT_EQUAL_STRING("Teststrecke", cache->name);
+    for (uint32_t i = 0; i < POINTS; i++) {
+        TEST_ASSERT_EQUAL_FLOAT(waypoints[i].lat, cache->lat[i]);
+        TEST_ASSERT_EQUAL_FLOAT(waypoints[i].lon, cache->lon[i]);
+        TEST_ASSERT_EQUAL_FLOAT(waypoints[i].ele, cache->ele[i]);
+    }
+
+    gpx_t* g = track_cache_gpx(cache, link_waypoint);
+    track_cache_free(cache);
+    TEST_ASSERT_EQUAL_STRING("Teststrecke", g->track_name);
+    TEST_ASSERT_EQUAL_UINT16(POINTS, g->waypoints_num);
+    uint32_t i = 0;
+    for (waypoint_t* wp = g->waypoints; wp; wp = wp->next, i++)
+        TEST_ASSERT_EQUAL_FLOAT(waypoints[i].lat, wp->lat);
+    TEST_ASSERT_EQUAL_UINT32(POINTS, i);
+    free_track(g);
+}
+
+void test_track_without_name()
+{
+    track_cache_header_t source = { 0 };
+    track_cache_t* cache;
+    gpx.track_name = NULL;
+    gpx.waypoints = NULL;
+    TEST_ASSERT_EQUAL(PM_OK, track_cache_source(st, "//track.gpx", &source));
+    TEST_ASSERT_EQUAL(PM_OK, track_cache_save(st, "//track.bin", &source, &gpx));
+    TEST_ASSERT_EQUAL(PM_OK, track_cache_load(st, "//track.bin", &source, &cache));
+    TEST_ASSERT_NULL(cache->name);
+    TEST_ASSERT_EQUAL_UINT32(0, cache->header.points);
+    gpx_t* g = track_cache_gpx(cache, link_waypoint);
+    TEST_ASSERT_NULL(g->track_name);
+    TEST_ASSERT_NULL(g->waypoints);
+    track_cache_free(cache);
+    free_track(g);
+}
+
+void test_changed_gpx_is_parsed_again()
+{
+    track_cache_header_t source = { 0 };
+    track_cache_t* cache;
+    TEST_ASSERT_EQUAL(PM_OK, track_cache_source(st, "//track.gpx", &source));
+    TEST_ASSERT_EQUAL(PM_OK, track_cache_save(st, "//track.bin", &source, &gpx));
+
+    write_gpx("<gpx><trk></trk></gpx>");
+    TEST_ASSERT_EQUAL(PM_OK, track_cache_source(st, "//track.gpx", &source));
+    TEST_ASSERT_EQUAL(PM_FAIL, track_cache_load(st, "//track.bin", &source, &cache));
+    TEST_ASSERT_NULL(cache);
+
+    /* same size, other time */
+    TEST_ASSERT_EQUAL(PM_OK, track_cache_save(st, "//track.bin", &source, &gpx));
+    source.source_modified++;
+    TEST_ASSERT_EQUAL(PM_FAIL, track_cache_load(st, "//track.bin", &source, &cache));
+}
+
+void test_corrupt_cache_is_refused()
+{
+    track_cache_header_t source = { 0 };
+    track_cache_t* cache;
+    storage_file_t* file;
+    size_t length;
+    TEST_ASSERT_EQUAL(PM_OK, track_cache_source(st, "//track.gpx", &source));
+    TEST_ASSERT_EQUAL(PM_OK, track_cache_save(st, "//track.bin", &source, &gpx));
+
+    TEST_ASSERT_EQUAL(PM_OK, storage_open(st, "//track.bin", STORAGE_WRITE | STORAGE_APPEND, &file));
+    TEST_ASSERT_EQUAL(PM_OK, storage_seek(file, 100));
+    TEST_ASSERT_EQUAL(PM_OK, storage_write(file, "x", 1, &length));
+    storage_close(file);
+    TEST_ASSERT_EQUAL(PM_FAIL, track_cache_load(st, "//track.bin", &source, &cache));
+}
+
+int main(int argc, char** argv)
+{
+    UNITY_BEGIN();
+
+    RUN_TEST(test_cache_is_next_to_the_gpx);
+    RUN_TEST(test_track_comes_back_from_the_cache);
+    RUN_TEST(test_track_without_name);
+    RUN_TEST(test_changed_gpx_is_parsed_again);
+    RUN_TEST(test_corrupt_cache_is_refused);
+
+    UNITY_END();
+}
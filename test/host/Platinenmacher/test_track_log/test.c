@@ -0,0 +1,328 @@
+#include <unity.h>
+
+#include "gpx_writer.h"
+#include "memory.h"
+#include "storage.h"
+#include "track_log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LOG_PATH "//GPSLOG.BIN"
+#define GPX_PATH "//log.gpx"
+#define START 1664656960 // 2022-10-01T20:42:40Z
+
+static char root[] = "/tmp/track_logXXXXXX";
+static storage_t* st;
+static track_ring_t ring;
+static track_fix_t decoded[2048];
+static uint32_t decoded_count;
+
+static track_fix_t make_fix(uint32_t i)
+{
+    track_fix_t f = {
+        .time = START + i,
+        .lat = 496268460 + (int32_t)(i * 37) - (int32_t)(i % 7) * 300,
+        .lon = 85818750 - (int32_t)(i * 53),
+        .ele = 960 + (int32_t)(i % 50) - 25,
+    };
+    return f;
+}
+
+static void collect(void* arg, const track_fix_t* fix)
+{
+    decoded[decoded_count++] = *fix;
+}
+
+static void push_fixes(uint32_t from, uint32_t to)
+{
+    for (uint32_t i = from; i < to; i++) {
+        track_fix_t f = make_fix(i);
+        TEST_ASSERT_TRUE(track_ring_push(&ring, &f));
+    }
+}
+
+/* every block of the log in order */
+static uint32_t decode_log(uint16_t* sessions)
+{
+    uint8_t data[TRACK_LOG_BLOCK_SIZE];
+    track_block_header_t h;
+    size_t length;
+    uint32_t size, blocks = 0;
+    decoded_count = 0;
+    TEST_ASSERT_EQUAL(PM_OK, storage_stat(st, LOG_PATH, &size));
+    TEST_ASSERT_EQUAL_UINT32(0, size % TRACK_LOG_BLOCK_SIZE);
+    for (uint32_t offset = 0; offset < size; offset += TRACK_LOG_BLOCK_SIZE, blocks++) {
+        TEST_ASSERT_EQUAL(PM_OK, storage_read_at(st, LOG_PATH, offset, data, sizeof(data), &length));
+        TEST_ASSERT_EQUAL(PM_OK, track_block_decode(data, &h, collect, NULL));
+        TEST_ASSERT_EQUAL_UINT32(blocks, h.sequence);
+        if (sessions)
+            sessions[blocks] = h.session;
+    }
+    storage_drop(st, LOG_PATH);
+    return blocks;
+}
+
+static error_code_t to_string(void* arg, const void* data, size_t length)
+{
+    strncat(arg, data, length);
+    return PM_OK;
+}
+
+void setUp()
+{
+    TEST_ASSERT_NOT_NULL(mkdtemp(root));
+    st = storage_posix_create(root);
+    memset(&ring, 0xa5, sizeof(ring));
+    track_ring_init(&ring);
+}
+
+void tearDown()
+{
+    storage_drop(st, NULL);
+    RTOS_Free(st);
+    char cmd[64];
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", root);
+    TEST_ASSERT_EQUAL(0, system(cmd));
+    strcpy(root, "/tmp/track_logXXXXXX");
+}
+
+void test_ring_keeps_fixes_until_released()
+{
+    track_fix_t f;
+    TEST_ASSERT_EQUAL_UINT32(0, track_ring_count(&ring));
+    push_fixes(0, TRACK_RING_SIZE);
+    f = make_fix(TRACK_RING_SIZE);
+    TEST_ASSERT_FALSE(track_ring_push(&ring, &f));
+    TEST_ASSERT_EQUAL_UINT32(1, ring.dropped);
+
+    TEST_ASSERT_TRUE(track_ring_peek(&ring, 5, &f));
+    TEST_ASSERT_EQUAL_UINT32(START + 5, f.time);
+    TEST_ASSERT_FALSE(track_ring_peek(&ring, TRACK_RING_SIZE, &f));
+    track_ring_release(&ring, 10);
+    TEST_ASSERT_TRUE(track_ring_peek(&ring, 0, &f));
+    TEST_ASSERT_EQUAL_UINT32(START + 10, f.time);
+
+    /* the ring wraps, a wake up keeps what is left */
+    push_fixes(TRACK_RING_SIZE, TRACK_RING_SIZE + 10);
+    track_ring_init(&ring);
+    TEST_ASSERT_EQUAL_UINT32(TRACK_RING_SIZE, track_ring_count(&ring));
+    TEST_ASSERT_TRUE(track_ring_peek(&ring, TRACK_RING_SIZE - 1, &f));
+    TEST_ASSERT_EQUAL_UINT32(START + TRACK_RING_SIZE + 9, f.time);
+}
+
+void test_block_round_trip()
+{
+    track_block_t b;
+    track_block_header_t h;
+    track_fix_t jumps[] = {
+        { START, 900000000, 1799999999, -4000 },
+        { START + 1, -900000000, -1799999999, 88480 },
+        { START - 3600, 0, 0, 0 },
+        { UINT32_MAX, INT32_MAX, INT32_MIN, INT32_MIN },
+    };
+    track_block_begin(&b, 3, 7);
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < sizeof(jumps) / sizeof(jumps[0]); i++, count++)
+        TEST_ASSERT_TRUE(track_block_add(&b, &jumps[i]));
+    while (track_block_add(&b, &(track_fix_t) { START + count, count, -count, count }))
+        count++;
+    /* slowly moving fixes take a few bytes */
+    TEST_ASSERT_GREATER_THAN(80, count);
+    track_block_finish(&b);
+
+    decoded_count = 0;
+    TEST_ASSERT_EQUAL(PM_OK, track_block_decode(b.data, &h, collect, NULL));
+    TEST_ASSERT_EQUAL_UINT16(3, h.session);
+    TEST_ASSERT_EQUAL_UINT32(7, h.sequence);
+    TEST_ASSERT_EQUAL_UINT32(count, decoded_count);
+    TEST_ASSERT_EQUAL_MEMORY(jumps, decoded, sizeof(jumps));
+    TEST_ASSERT_EQUAL_INT32(-(int32_t)(count - 1), decoded[count - 1].lon);
+
+    /* a flipped bit anywhere is noticed */
+    b.data[100] ^= 0x10;
+    decoded_count = 0;
+    TEST_ASSERT_EQUAL(PM_FAIL, track_block_decode(b.data, &h, collect, NULL));
+    TEST_ASSERT_EQUAL_UINT32(0, decoded_count);
+}
+
+void test_log_keeps_every_fix()
+{
+    uint16_t sessions[64];
+    track_log_t* log = track_log_open(st, LOG_PATH);
+    TEST_ASSERT_NOT_NULL(log);
+    TEST_ASSERT_EQUAL(NOT_NEEDED, track_log_flush(log, &ring));
+
+    /* a partial block is written again as it fills up */
+    push_fixes(0, 20);
+    TEST_ASSERT_EQUAL(PM_OK, track_log_flush(log, &ring));
+    TEST_ASSERT_EQUAL_UINT32(0, track_ring_count(&ring));
+    TEST_ASSERT_EQUAL_UINT32(1, decode_log(NULL));
+    TEST_ASSERT_EQUAL_UINT32(20, decoded_count);
+    uint32_t pushed = 20;
+    for (uint32_t i = 0; i < 10; i++, pushed += 100) {
+        push_fixes(pushed, pushed + 100);
+        TEST_ASSERT_EQUAL(PM_OK, track_log_flush(log, &ring));
+    }
+    uint32_t blocks = decode_log(NULL);
+    TEST_ASSERT_GREATER_THAN(5, blocks);
+    TEST_ASSERT_EQUAL_UINT32(pushed, decoded_count);
+    for (uint32_t i = 0; i < pushed; i++) {
+        track_fix_t f = make_fix(i);
+        TEST_ASSERT_EQUAL_MEMORY(&f, &decoded[i], sizeof(track_fix_t));
+    }
+    track_log_close(log);
+
+    /* the next recording starts a new session in a new block */
+    log = track_log_open(st, LOG_PATH);
+    push_fixes(pushed, pushed + 5);
+    TEST_ASSERT_EQUAL(PM_OK, track_log_flush(log, &ring));
+    track_log_close(log);
+    TEST_ASSERT_EQUAL_UINT32(blocks + 1, decode_log(sessions));
+    TEST_ASSERT_EQUAL_UINT32(pushed + 5, decoded_count);
+    TEST_ASSERT_EQUAL_UINT16(0, sessions[blocks - 1]);
+    TEST_ASSERT_EQUAL_UINT16(1, sessions[blocks]);
+}
+
+void test_gpx_writer_output()
+{
+    static char text[2048];
+    gpx_writer_t w;
+    text[0] = 0;
+    gpx_writer_begin(&w, to_string, text, "Tour <1> & 2", START);
+    gpx_writer_point(&w, 496268460, 85818750, 960, START);
+    gpx_writer_point(&w, -5, -1799999999, -35, gpx_time(2024, 2, 29, 23, 59, 59));
+    gpx_writer_segment(&w);
+    gpx_writer_point(&w, 0, 0, 0, 0);
+    TEST_ASSERT_EQUAL(PM_OK, gpx_writer_end(&w));
+
+    TEST_ASSERT_NOT_NULL(strstr(text, "<time>2022-10-01T20:42:40Z</time>\n"));
+    TEST_ASSERT_NOT_NULL(strstr(text, "<name>Tour &lt;1&gt; &amp; 2</name>"));
+    TEST_ASSERT_NOT_NULL(strstr(text, "<trkseg>\n<trkpt lat=\"49.6268460\" lon=\"8.5818750\"><ele>96.0</ele><time>2022-10-01T20:42:40Z</time></trkpt>\n"));
+    TEST_ASSERT_NOT_NULL(strstr(text, "<trkpt lat=\"-0.0000005\" lon=\"-179.9999999\"><ele>-3.5</ele><time>2024-02-29T23:59:59Z</time></trkpt>\n</trkseg>\n<trkseg>\n"));
+    TEST_ASSERT_NOT_NULL(strstr(text, "<trkpt lat=\"0.0000000\" lon=\"0.0000000\"><ele>0.0</ele><time>1970-01-01T00:00:00Z</time></trkpt>\n</trkseg>\n</trk>\n</gpx>\n"));
+    TEST_ASSERT_EQUAL_UINT32(START, gpx_time(2022, 10, 1, 20, 42, 40));
+}
+
+void test_export_skips_torn_blocks()
+{
+    track_log_t* log = track_log_open(st, LOG_PATH);
+    push_fixes(0, 100);
+    TEST_ASSERT_EQUAL(PM_OK, track_log_flush(log, &ring));
+    track_log_close(log);
+    log = track_log_open(st, LOG_PATH);
+    push_fixes(100, 110);
+    TEST_ASSERT_EQUAL(PM_OK, track_log_flush(log, &ring));
+    track_log_close(log);
+    TEST_ASSERT_EQUAL_UINT32(3, decode_log(NULL));
+
+    /* power was lost while the second block was written */
+    storage_file_t* file;
+    size_t written;
+    TEST_ASSERT_EQUAL(PM_OK, storage_open(st, LOG_PATH, STORAGE_WRITE | STORAGE_APPEND, &file));
+    TEST_ASSERT_EQUAL(PM_OK, storage_seek(file, TRACK_LOG_BLOCK_SIZE + 200));
+    TEST_ASSERT_EQUAL(PM_OK, storage_write(file, "\xff\xff\xff\xff", 4, &written));
+    storage_close(file);
+
+    track_export_t* e = track_export_begin(st, LOG_PATH, GPX_PATH, "IndiaNavi GPS Log", START, NULL);
+    TEST_ASSERT_NOT_NULL(e);
+    uint32_t steps = 0;
+    error_code_t ret;
+    while ((ret = track_export_step(e)) == PM_OK)
+        steps++;
+    TEST_ASSERT_EQUAL(NOT_NEEDED, ret);
+    TEST_ASSERT_EQUAL_UINT32(3, steps);
+    uint32_t points = e->points;
+    TEST_ASSERT_EQUAL(PM_OK, track_export_end(e));
+    TEST_ASSERT_LESS_THAN(110, points);
+    TEST_ASSERT_GREATER_THAN(100, points);
+
+    char* gpx;
+    uint32_t size;
+    TEST_ASSERT_EQUAL(PM_OK, storage_load(st, GPX_PATH, &gpx, &size));
+    TEST_ASSERT_EQUAL(UNAVAILABLE, storage_stat(st, "//log.TMP", &size));
+    uint32_t trkpt = 0, trkseg = 0;
+    for (char* p = gpx; (p = strstr(p, "<trkpt ")); p++)
+        trkpt++;
+    for (char* p = gpx; (p = strstr(p, "<trkseg>")); p++)
+        trkseg++;
+    TEST_ASSERT_EQUAL_UINT32(points, trkpt);
+    TEST_ASSERT_EQUAL_UINT32(2, trkseg);
+    TEST_ASSERT_NOT_NULL(strstr(gpx, "</trkseg>\n</trk>\n</gpx>\n"));
+    RTOS_Free(gpx);
+}
+
+static error_code_t export_log(const char* gpx, track_export_mark_t* mark, uint8_t resumed)
+{
+    track_export_t* e = track_export_begin(st, LOG_PATH, gpx, "IndiaNavi GPS Log", START, mark);
+    TEST_ASSERT_NOT_NULL(e);
+    TEST_ASSERT_EQUAL_UINT8(resumed, e->file != NULL);
+    while (track_export_step(e) == PM_OK)
+        ;
+    return track_export_end(e);
+}
+
+/* an export that continues the last one writes the same file as a full one */
+static void assert_same_as_full_export(track_export_mark_t* mark, uint8_t continued)
+{
+    char *full = NULL, *resumed = NULL;
+    uint32_t full_size, resumed_size;
+    TEST_ASSERT_EQUAL(PM_OK, export_log(GPX_PATH, mark, continued));
+    TEST_ASSERT_EQUAL(PM_OK, export_log("//full.gpx", NULL, 0));
+    TEST_ASSERT_EQUAL(PM_OK, storage_load(st, GPX_PATH, &resumed, &resumed_size));
+    TEST_ASSERT_EQUAL(PM_OK, storage_load(st, "//full.gpx", &full, &full_size));
+    TEST_ASSERT_EQUAL_UINT32(full_size, resumed_size);
+    TEST_ASSERT_EQUAL_UINT32(full_size, mark->size);
+    TEST_ASSERT_EQUAL_STRING(full, resumed);
+    RTOS_Free(full);
+    RTOS_Free(resumed);
+}
+
+void test_export_continues_the_last_one()
+{
+    track_export_mark_t mark = { 0 };
+    track_log_t* log = track_log_open(st, LOG_PATH);
+    push_fixes(0, 20);
+    TEST_ASSERT_EQUAL(PM_OK, track_log_flush(log, &ring));
+    assert_same_as_full_export(&mark, 0);
+    TEST_ASSERT_EQUAL_UINT32(20, mark.points);
+
+    /* the partial block grew and more blocks followed */
+    push_fixes(20, 100);
+    TEST_ASSERT_EQUAL(PM_OK, track_log_flush(log, &ring));
+    assert_same_as_full_export(&mark, 1);
+    TEST_ASSERT_GREATER_THAN(0, mark.sequence);
+    track_log_close(log);
+
+    /* a new recording starts a new segment */
+    log = track_log_open(st, LOG_PATH);
+    push_fixes(100, 110);
+    TEST_ASSERT_EQUAL(PM_OK, track_log_flush(log, &ring));
+    assert_same_as_full_export(&mark, 1);
+    TEST_ASSERT_EQUAL_UINT32(110, mark.points);
+    track_log_close(log);
+
+    /* a file that changed on the card is written again */
+    storage_file_t* file;
+    size_t written;
+    TEST_ASSERT_EQUAL(PM_OK, storage_open(st, GPX_PATH, STORAGE_WRITE | STORAGE_APPEND, &file));
+    TEST_ASSERT_EQUAL(PM_OK, storage_write(file, "\n", 1, &written));
+    storage_close(file);
+    storage_drop(st, GPX_PATH);
+    assert_same_as_full_export(&mark, 0);
+}
+
+int main(int argc, char** argv)
+{
+    UNITY_BEGIN();
+
+    RUN_TEST(test_ring_keeps_fixes_until_released);
+    RUN_TEST(test_block_round_trip);
+    RUN_TEST(test_log_keeps_every_fix);
+    RUN_TEST(test_gpx_writer_output);
+    RUN_TEST(test_export_skips_torn_blocks);
+    RUN_TEST(test_export_continues_the_last_one);
+
+    UNITY_END();
+}
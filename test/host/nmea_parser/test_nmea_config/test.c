@@ -0,0 +1,167 @@
+#include <unity.h>
+#include "nmea_config.h"
+#include "pmtk_parser.h"
+#include "pq_parser.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define GGA "$GNGGA,101500.000,4916.4500,N,00842.3350,E,1,08,0.94,112.3,M,47.8,M,,*78\r\n"
+#define RMC "$GNRMC,101500.000,A,4916.4500,N,00842.3350,E,0.00,0.00,120523,,,A*72\r\n"
+#define VTG "$GPVTG,0.00,T,,M,0.00,N,0.00,K,A*3D\r\n"
+
+static const nmea_parser_plugin_t plugins[GPS_MAX_PARSER_PLUGINS] = {
+    { .detect = pmtk_detect, .parse = pmtk_parse },
+    { .detect = pq_detect, .parse = pq_parse },
+};
+
+static const nmea_config_t map_config = {
+    .every = { [STATEMENT_RMC] = 1, [STATEMENT_GGA] = 1, [STATEMENT_GSV] = 5 },
+    .fix_interval = 1000,
+};
+
+static nmea_decoder_t decoder;
+static char command[NMEA_CONFIG_COMMAND];
+
+static nmea_result_t decode(const char* line)
+{
+    return nmea_decode(&decoder, line, strlen(line));
+}
+
+/* the receiver answers a command with PMTK001,<packet type>,<flag> */
+static nmea_result_t acknowledge(uint16_t packet_type, uint8_t flag)
+{
+    char body[32], line[40];
+    int length = snprintf(body, sizeof(body), "PMTK001,%u,%u", packet_type, flag);
+    uint8_t crc = 0;
+    for (int i = 0; i < length; i++)
+        crc ^= body[i];
+    snprintf(line, sizeof(line), "$%s*%02X\r\n", body, crc);
+    return decode(line);
+}
+
+void setUp()
+{
+    nmea_decoder_init(&decoder, nmea_decoder_statements(), plugins);
+}
+
+void tearDown()
+{
+}
+
+void test_output_command()
+{
+    /* the default output of the receiver */
+    nmea_config_t config = {
+        .every = { [STATEMENT_GLL] = 1, [STATEMENT_RMC] = 1, [STATEMENT_VTG] = 1, [STATEMENT_GGA] = 1, [STATEMENT_GSA] = 1, [STATEMENT_GSV] = 5 },
+    };
+    TEST_ASSERT_EQUAL(51, nmea_config_output(&config, command, sizeof(command)));
+    TEST_ASSERT_EQUAL_STRING("$PMTK314,1,1,1,1,1,5,0,0,0,0,0,0,0,0,0,0,0,0,0*2C\r\n", command);
+
+    config = (nmea_config_t) { .every = { [STATEMENT_RMC] = 1, [STATEMENT_GGA] = 1 } };
+    nmea_config_output(&config, command, sizeof(command));
+    TEST_ASSERT_EQUAL_STRING("$PMTK314,0,1,0,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0*28\r\n", command);
+
+    /* the receiver only counts up to 5 */
+    config = (nmea_config_t) { .every = { [STATEMENT_GSV] = 9 } };
+    nmea_config_output(&config, command, sizeof(command));
+    TEST_ASSERT_EQUAL_STRING("$PMTK314,0,0,0,0,0,5,0,0,0,0,0,0,0,0,0,0,0,0,0*2D\r\n", command);
+}
+
+void test_fix_interval_command()
+{
+    nmea_config_t config = { .fix_interval = 1000 };
+    TEST_ASSERT_EQUAL(18, nmea_config_fix_interval(&config, command, sizeof(command)));
+    TEST_ASSERT_EQUAL_STRING("$PMTK220,1000*1F\r\n", command);
+
+    config.fix_interval = 200;
+    nmea_config_fix_interval(&config, command, sizeof(command));
+    TEST_ASSERT_EQUAL_STRING("$PMTK220,200*2C\r\n", command);
+
+    config.fix_interval = 0;
+    nmea_config_fix_interval(&config, command, sizeof(command));
+    TEST_ASSERT_EQUAL_STRING("$PMTK220,100*2F\r\n", command);
+}
+
+void test_baud_rate_command()
+{
+    nmea_config_t config = { .baud_rate = 115200 };
+    nmea_config_baud_rate(&config, command, sizeof(command));
+    TEST_ASSERT_EQUAL_STRING("$PMTK251,115200*1F\r\n", command);
+
+    config.baud_rate = 9600;
+    nmea_config_baud_rate(&config, command, sizeof(command));
+    TEST_ASSERT_EQUAL_STRING("$PMTK251,9600*17\r\n", command);
+
+    config.baud_rate = 12345;
+    TEST_ASSERT_EQUAL(0, nmea_config_baud_rate(&config, command, sizeof(command)));
+}
+
+void test_command_does_not_fit()
+{
+    nmea_config_t config = { .fix_interval = 1000 };
+    char small[19];
+    TEST_ASSERT_EQUAL(0, nmea_config_fix_interval(&config, small, sizeof(small) - 1));
+    TEST_ASSERT_EQUAL(18, nmea_config_fix_interval(&config, small, sizeof(small)));
+}
+
+void test_statements_sent_with_every_fix()
+{
+    TEST_ASSERT_EQUAL_HEX32(1 << STATEMENT_RMC | 1 << STATEMENT_GGA, nmea_config_statements(&map_config));
+}
+
+void test_completion_follows_acknowledged_output()
+{
+    /* the receiver still sends everything until it acknowledged */
+    nmea_decoder_expect(&decoder, nmea_config_statements(&map_config));
+    TEST_ASSERT_EQUAL(NMEA_PARSED, decode(GGA));
+    TEST_ASSERT_EQUAL(NMEA_UPDATE, decode(RMC));
+    TEST_ASSERT_EQUAL(NMEA_PARSED, decode(VTG));
+
+    TEST_ASSERT_EQUAL(NMEA_PARSED, acknowledge(314, 3));
+    TEST_ASSERT_EQUAL_HEX32(1 << STATEMENT_RMC | 1 << STATEMENT_GGA, decoder.all_statements);
+    TEST_ASSERT_EQUAL(NMEA_PARSED, decode(GGA));
+    TEST_ASSERT_EQUAL(NMEA_UPDATE, decode(RMC));
+}
+
+void test_more_statements_after_acknowledge()
+{
+    nmea_decoder_init(&decoder, 1 << STATEMENT_RMC, plugins);
+    nmea_decoder_expect(&decoder, 1 << STATEMENT_RMC | 1 << STATEMENT_GGA);
+    /* GGA is not sent before the receiver switched */
+    TEST_ASSERT_EQUAL(NMEA_UPDATE, decode(RMC));
+
+    acknowledge(314, 3);
+    TEST_ASSERT_EQUAL(NMEA_PARSED, decode(RMC));
+    TEST_ASSERT_EQUAL(NMEA_UPDATE, decode(GGA));
+}
+
+void test_failed_output_keeps_statements()
+{
+    nmea_decoder_init(&decoder, 1 << STATEMENT_RMC | 1 << STATEMENT_VTG, plugins);
+    nmea_decoder_expect(&decoder, 1 << STATEMENT_GGA);
+    /* nothing in common, the old statements would never come */
+    TEST_ASSERT_EQUAL_HEX32(1 << STATEMENT_GGA, decoder.all_statements);
+
+    nmea_decoder_init(&decoder, nmea_decoder_statements(), plugins);
+    nmea_decoder_expect(&decoder, 1 << STATEMENT_GGA | 1 << STATEMENT_GSV);
+    TEST_ASSERT_EQUAL(NMEA_PARSED, acknowledge(314, 2));
+    TEST_ASSERT_EQUAL(NMEA_PARSED, acknowledge(220, 3));
+    TEST_ASSERT_EQUAL_HEX32(1 << STATEMENT_GGA | 1 << STATEMENT_GSV, decoder.all_statements);
+    TEST_ASSERT_EQUAL(NMEA_PARSED, acknowledge(314, 3));
+    TEST_ASSERT_EQUAL_HEX32(1 << STATEMENT_GGA | 1 << STATEMENT_GSV, decoder.all_statements);
+}
+
+int main(int argc, char** argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_output_command);
+    RUN_TEST(test_fix_interval_command);
+    RUN_TEST(test_baud_rate_command);
+    RUN_TEST(test_command_does_not_fit);
+    RUN_TEST(test_statements_sent_with_every_fix);
+    RUN_TEST(test_completion_follows_acknowledged_output);
+    RUN_TEST(test_more_statements_after_acknowledge);
+    RUN_TEST(test_failed_output_keeps_statements);
+    UNITY_END();
+}
@@ -0,0 +1,521 @@
+#include <unity.h>
+#include "nmea_decoder.h"
+#include "pmtk_parser.h"
+#include "pq_parser.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_ROUNDS 5000
+#define BENCH_RUNS 8
+
+#define ALL_STATEMENTS ((1 << STATEMENT_GGA) | (1 << STATEMENT_GSA) | (1 << STATEMENT_RMC) | (1 << STATEMENT_GSV) | (1 << STATEMENT_VTG))
+
+/* one second of output of the L96 */
+static const char* epoch[] = {
+    "GNGGA,101530.000,4916.4500,N,00842.3350,E,1,09,0.95,187.3,M,47.9,M,,",
+    "GNGSA,A,3,10,12,15,18,24,25,32,,,,,,1.67,0.95,1.37",
+    "GPGSV,3,1,10,10,63,137,32,12,23,314,27,15,37,050,40,18,58,096,38",
+    "GPGSV,3,2,10,23,05,220,,24,46,257,30,25,20,302,22,29,03,040,",
+    "GPGSV,3,3,10,32,30,179,35,44,32,184,",
+    "GNRMC,101530.000,A,4916.4500,N,00842.3350,E,1.20,231.80,120523,,,A",
+    "GNVTG,231.80,T,,M,1.20,N,2.22,K,A",
+};
+
+static char lines[sizeof(epoch) / sizeof(epoch[0])][96];
+
+/* $body*CS\r\n */
+static size_t nmea_line(char* line, const char* body)
+{
+    uint8_t crc = 0;
+    for (const char* c = body; *c; c++)
+        crc ^= (uint8_t)*c;
+    return sprintf(line, "$%s*%02X\r\n", body, crc);
+}
+
+static nmea_decoder_t decoder;
+
+static const nmea_parser_plugin_t plugins[GPS_MAX_PARSER_PLUGINS] = {
+    { .detect = pmtk_detect, .parse = pmtk_parse },
+    { .detect = pq_detect, .parse = pq_parse },
+};
+
+void setUp()
+{
+    for (size_t i = 0; i < sizeof(epoch) / sizeof(epoch[0]); i++)
+        nmea_line(lines[i], epoch[i]);
+    nmea_decoder_init(&decoder, ALL_STATEMENTS, plugins);
+}
+
+void tearDown()
+{
+}
+
+static nmea_result_t decode(const char* body)
+{
+    char line[128];
+    size_t length = nmea_line(line, body);
+    return nmea_decode(&decoder, line, length);
+}
+
+/*
+ * The decoder this replaced: every character is copied into item_str, the
+ * statement is found with strstr and the numbers are read with strtof.
+ */
+typedef struct {
+    gps_t parent;
+    uint8_t item_pos;
+    uint8_t item_num;
+    uint8_t asterisk;
+    uint8_t crc;
+    uint8_t cur_statement;
+    uint8_t sat_num;
+    uint8_t sat_count;
+    uint32_t parsed_statement;
+    uint32_t all_statements;
+    char item_str[16];
+} old_gps_t;
+
+static float old_lat_long(old_gps_t* g)
+{
+    float ll = strtof(g->item_str, NULL);
+    int deg = ((int)ll) / 100;
+    float min = ll - (deg * 100);
+    return deg + min / 60.0f;
+}
+
+static uint8_t old_two_digits(const char* c)
+{
+    return 10 * (c[0] - '0') + (c[1] - '0');
+}
+
+static void old_utc_time(old_gps_t* g)
+{
+    g->parent.tim.hour = old_two_digits(g->item_str + 0);
+    g->parent.tim.minute = old_two_digits(g->item_str + 2);
+    g->parent.tim.second = old_two_digits(g->item_str + 4);
+    if (g->item_str[6] == '.') {
+        uint16_t tmp = 0;
+        for (uint8_t i = 7; g->item_str[i]; i++)
+            tmp = 10 * tmp + g->item_str[i] - '0';
+        g->parent.tim.thousand = tmp;
+    }
+}
+
+static void old_parse_item(old_gps_t* g)
+{
+    if (g->item_num == 0 && g->item_str[0] == '$') {
+        if (strstr(g->item_str, "GGA"))
+            g->cur_statement = STATEMENT_GGA;
+        else if (strstr(g->item_str, "GSA"))
+            g->cur_statement = STATEMENT_GSA;
+        else if (strstr(g->item_str, "RMC"))
+            g->cur_statement = STATEMENT_RMC;
+        else if (strstr(g->item_str, "GSV"))
+            g->cur_statement = STATEMENT_GSV;
+        else if (strstr(g->item_str, "VTG"))
+            g->cur_statement = STATEMENT_VTG;
+        else
+            g->cur_statement = STATEMENT_UNKNOWN;
+        return;
+    }
+    switch (g->cur_statement) {
+    case STATEMENT_GGA:
+        switch (g->item_num) {
+        case 1:
+            old_utc_time(g);
+            break;
+        case 2:
+            g->parent.latitude = old_lat_long(g);
+            break;
+        case 3:
+            if (g->item_str[0] == 'S')
+                g->parent.latitude *= -1;
+            break;
+        case 4:
+            g->parent.longitude = old_lat_long(g);
+            break;
+        case 5:
+            if (g->item_str[0] == 'W')
+                g->parent.longitude *= -1;
+            break;
+        case 6:
+            g->parent.fix = (gps_fix_t)strtol(g->item_str, NULL, 10);
+            break;
+        case 7:
+            g->parent.sats_in_use = (uint8_t)strtol(g->item_str, NULL, 10);
+            break;
+        case 8:
+            g->parent.dop_h = strtof(g->item_str, NULL);
+            break;
+        case 9:
+            g->parent.altitude = strtof(g->item_str, NULL);
+            break;
+        case 11:
+            g->parent.altitude += strtof(g->item_str, NULL);
+            break;
+        }
+        break;
+    case STATEMENT_GSA:
+        switch (g->item_num) {
+        case 2:
+            g->parent.fix_mode = (gps_fix_mode_t)strtol(g->item_str, NULL, 10);
+            break;
+        case 15:
+            g->parent.dop_p = strtof(g->item_str, NULL);
+            break;
+        case 16:
+            g->parent.dop_h = strtof(g->item_str, NULL);
+            break;
+        case 17:
+            g->parent.dop_v = strtof(g->item_str, NULL);
+            break;
+        default:
+            if (g->item_num >= 3 && g->item_num <= 14)
+                g->parent.sats_id_in_use[g->item_num - 3] = (uint8_t)strtol(g->item_str, NULL, 10);
+        }
+        break;
+    case STATEMENT_GSV:
+        switch (g->item_num) {
+        case 1:
+            g->sat_count = (uint8_t)strtol(g->item_str, NULL, 10);
+            break;
+        case 2:
+            g->sat_num = (uint8_t)strtol(g->item_str, NULL, 10);
+            break;
+        case 3:
+            g->parent.sats_in_view = (uint8_t)strtol(g->item_str, NULL, 10);
+            break;
+        default:
+            if (g->item_num >= 4 && g->item_num <= 19) {
+                uint8_t item_num = g->item_num - 4;
+                uint8_t index = 4 * (g->sat_num - 1) + item_num / 4;
+                if (index < GPS_MAX_SATELLITES_IN_VIEW) {
+                    uint32_t value = strtol(g->item_str, NULL, 10);
+                    switch (item_num % 4) {
+                    case 0:
+                        g->parent.sats_desc_in_view[index].num = (uint8_t)value;
+                        break;
+                    case 1:
+                        g->parent.sats_desc_in_view[index].elevation = (uint8_t)value;
+                        break;
+                    case 2:
+                        g->parent.sats_desc_in_view[index].azimuth = (uint16_t)value;
+                        break;
+                    case 3:
+                        g->parent.sats_desc_in_view[index].snr = (uint8_t)value;
+                        break;
+                    }
+                }
+            }
+        }
+        break;
+    case STATEMENT_RMC:
+        switch (g->item_num) {
+        case 1:
+            old_utc_time(g);
+            break;
+        case 2:
+            g->parent.valid = (g->item_str[0] == 'A');
+            break;
+        case 3:
+            g->parent.latitude = old_lat_long(g);
+            break;
+        case 4:
+            if (g->item_str[0] == 'S')
+                g->parent.latitude *= -1;
+            break;
+        case 5:
+            g->parent.longitude = old_lat_long(g);
+            break;
+        case 6:
+            if (g->item_str[0] == 'W')
+                g->parent.longitude *= -1;
+            break;
+        case 7:
+            g->parent.speed = strtof(g->item_str, NULL) * 1.852;
+            break;
+        case 8:
+            g->parent.cog = strtof(g->item_str, NULL);
+            break;
+        case 9:
+            g->parent.date.day = old_two_digits(g->item_str + 0);
+            g->parent.date.month = old_two_digits(g->item_str + 2);
+            g->parent.date.year = old_two_digits(g->item_str + 4);
+            break;
+        case 10:
+            g->parent.variation = strtof(g->item_str, NULL);
+            break;
+        }
+        break;
+    case STATEMENT_VTG:
+        switch (g->item_num) {
+        case 1:
+            g->parent.cog = strtof(g->item_str, NULL);
+            break;
+        case 3:
+            g->parent.variation = strtof(g->item_str, NULL);
+            break;
+        case 5:
+            g->parent.speed = strtof(g->item_str, NULL) * 1.852;
+            break;
+        case 7:
+            g->parent.speed = strtof(g->item_str, NULL) / 3.6;
+            break;
+        }
+        break;
+    }
+}
+
+static int old_decode(old_gps_t* g, const char* d)
+{
+    int updates = 0;
+    for (; *d; d++) {
+        if (*d == '$') {
+            g->asterisk = 0;
+            g->item_num = 0;
+            g->item_pos = 0;
+            g->cur_statement = 0;
+            g->crc = 0;
+            g->sat_count = 0;
+            g->sat_num = 0;
+            g->item_str[g->item_pos++] = *d;
+            g->item_str[g->item_pos] = '\0';
+        } else if (*d == ',') {
+            old_parse_item(g);
+            g->crc ^= (uint8_t)(*d);
+            g->item_pos = 0;
+            g->item_str[0] = '\0';
+            g->item_num++;
+        } else if (*d == '*') {
+            old_parse_item(g);
+            g->asterisk = 1;
+            g->item_pos = 0;
+            g->item_str[0] = '\0';
+            g->item_num++;
+        } else if (*d == '\r') {
+            if (g->crc == (uint8_t)strtol(g->item_str, NULL, 16) && g->cur_statement != STATEMENT_UNKNOWN) {
+                if (g->cur_statement != STATEMENT_GSV || g->sat_num == g->sat_count)
+                    g->parsed_statement |= 1 << g->cur_statement;
+                if ((g->parsed_statement & g->all_statements) == g->all_statements) {
+                    g->parsed_statement = 0;
+                    updates++;
+                }
+            }
+        } else {
+            if (!g->asterisk)
+                g->crc ^= (uint8_t)(*d);
+            g->item_str[g->item_pos++] = *d;
+            g->item_str[g->item_pos] = '\0';
+        }
+    }
+    return updates;
+}
+
+void test_nmea_decoder_gga()
+{
+    TEST_ASSERT_EQUAL(NMEA_PARSED, decode(epoch[0]));
+    TEST_ASSERT_EQUAL(STATEMENT_GGA, decoder.cur_statement);
+    TEST_ASSERT_EQUAL_UINT8(10, decoder.parent.tim.hour);
+    TEST_ASSERT_EQUAL_UINT8(15, decoder.parent.tim.minute);
+    TEST_ASSERT_EQUAL_UINT8(30, decoder.parent.tim.second);
+    TEST_ASSERT_FLOAT_WITHIN(1e-5f, 49.274167f, decoder.parent.latitude);
+    TEST_ASSERT_FLOAT_WITHIN(1e-5f, 8.705583f, decoder.parent.longitude);
+    TEST_ASSERT_EQUAL(GPS_FIX_GPS, decoder.parent.fix);
+    TEST_ASSERT_EQUAL_UINT8(9, decoder.parent.sats_in_use);
+    TEST_ASSERT_FLOAT_WITHIN(1e-5f, 0.95f, decoder.parent.dop_h);
+    TEST_ASSERT_FLOAT_WITHIN(1e-4f, 187.3f + 47.9f, decoder.parent.altitude);
+}
+
+void test_nmea_decoder_south_west()
+{
+    decode("GPGLL,3351.0200,S,15112.6500,W,235959.250,A,A");
+    TEST_ASSERT_EQUAL(STATEMENT_GLL, decoder.cur_statement);
+    TEST_ASSERT_FLOAT_WITHIN(1e-5f, -33.850333f, decoder.parent.latitude);
+    TEST_ASSERT_FLOAT_WITHIN(1e-4f, -151.210833f, decoder.parent.longitude);
+    TEST_ASSERT_EQUAL_UINT8(23, decoder.parent.tim.hour);
+    TEST_ASSERT_EQUAL_UINT16(250, decoder.parent.tim.thousand);
+    TEST_ASSERT_TRUE(decoder.parent.valid);
+}
+
+void test_nmea_decoder_rmc_vtg()
+{
+    decode(epoch[5]);
+    TEST_ASSERT_TRUE(decoder.parent.valid);
+    TEST_ASSERT_EQUAL_UINT8(12, decoder.parent.date.day);
+    TEST_ASSERT_EQUAL_UINT8(5, decoder.parent.date.month);
+    TEST_ASSERT_EQUAL_UINT16(23, decoder.parent.date.year);
+    TEST_ASSERT_FLOAT_WITHIN(1e-4f, 1.2f * 1.852f, decoder.parent.speed);
+    TEST_ASSERT_FLOAT_WITHIN(1e-4f, 231.8f, decoder.parent.cog);
+
+    decode(epoch[6]);
+    TEST_ASSERT_FLOAT_WITHIN(1e-4f, 2.22f / 3.6f, decoder.parent.speed);
+
+    decode("GNRMC,101531.000,V,,,,,,,120523,,,N");
+    TEST_ASSERT_FALSE(decoder.parent.valid);
+    TEST_ASSERT_EQUAL_FLOAT(0, decoder.parent.latitude);
+}
+
+void test_nmea_decoder_gsa_gsv()
+{
+    decode(epoch[1]);
+    TEST_ASSERT_EQUAL(GPS_MODE_3D, decoder.parent.fix_mode);
+    uint8_t in_use[GPS_MAX_SATELLITES_IN_USE] = { 10, 12, 15, 18, 24, 25, 32 };
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(in_use, decoder.parent.sats_id_in_use, GPS_MAX_SATELLITES_IN_USE);
+    TEST_ASSERT_FLOAT_WITHIN(1e-5f, 1.67f, decoder.parent.dop_p);
+    TEST_ASSERT_FLOAT_WITHIN(1e-5f, 1.37f, decoder.parent.dop_v);
+
+    for (int i = 2; i < 5; i++)
+        decode(epoch[i]);
+    TEST_ASSERT_EQUAL_UINT8(10, decoder.parent.sats_in_view);
+    TEST_ASSERT_EQUAL_UINT8(23, decoder.parent.sats_desc_in_view[4].num);
+    TEST_ASSERT_EQUAL_UINT8(5, decoder.parent.sats_desc_in_view[4].elevation);
+    TEST_ASSERT_EQUAL_UINT16(220, decoder.parent.sats_desc_in_view[4].azimuth);
+    TEST_ASSERT_EQUAL_UINT8(0, decoder.parent.sats_desc_in_view[4].snr);
+    TEST_ASSERT_EQUAL_UINT8(44, decoder.parent.sats_desc_in_view[9].num);
+    TEST_ASSERT_EQUAL_UINT16(184, decoder.parent.sats_desc_in_view[9].azimuth);
+}
+
+void test_nmea_decoder_update_after_all_statements()
+{
+    size_t count = sizeof(epoch) / sizeof(epoch[0]);
+    for (int round = 0; round < 2; round++) {
+        for (size_t i = 0; i < count; i++) {
+            nmea_result_t result = nmea_decode(&decoder, lines[i], strlen(lines[i]));
+            TEST_ASSERT_EQUAL(i == count - 1 ? NMEA_UPDATE : NMEA_PARSED, result);
+        }
+    }
+}
+
+void test_nmea_decoder_rejects_bad_checksum()
+{
+    char line[96];
+    strcpy(line, lines[0]);
+    line[20] = '7';
+    TEST_ASSERT_EQUAL(NMEA_INVALID, nmea_decode(&decoder, line, strlen(line)));
+    TEST_ASSERT_EQUAL_FLOAT(0, decoder.parent.latitude);
+    TEST_ASSERT_EQUAL_UINT8(0, decoder.parent.tim.hour);
+
+    /* truncated, no checksum */
+    TEST_ASSERT_EQUAL(NMEA_INVALID, nmea_decode(&decoder, lines[0], 40));
+    TEST_ASSERT_EQUAL(NMEA_INVALID, nmea_decode(&decoder, "GNGGA,,,", 8));
+    /* too few items */
+    TEST_ASSERT_EQUAL(NMEA_INVALID, decode("GNGGA,101530.000,4916.4500,N"));
+    TEST_ASSERT_EQUAL_FLOAT(0, decoder.parent.latitude);
+}
+
+void test_nmea_decoder_unknown_and_plugins()
+{
+    TEST_ASSERT_EQUAL(NMEA_UNKNOWN, decode("GPTXT,01,01,02,ANTSTATUS=OPEN"));
+    TEST_ASSERT_EQUAL(NMEA_UNKNOWN, decode("PXYZ,1,2"));
+
+    TEST_ASSERT_EQUAL(NMEA_PARSED, decode("PMTK001,353,3,1,1,0,0,0,15"));
+    TEST_ASSERT_EQUAL(STATEMENT_PLUGIN, decoder.cur_statement);
+    TEST_ASSERT_EQUAL(NMEA_PARSED, decode("PMTK010,001"));
+    TEST_ASSERT_EQUAL(NMEA_PARSED, decode("PMTK010,9"));
+    TEST_ASSERT_EQUAL(NMEA_PARSED, decode("PQGLP,W,1,1"));
+    TEST_ASSERT_EQUAL(STATEMENT_PLUGIN + 1, decoder.cur_statement);
+}
+
+void test_nmea_decoder_numbers()
+{
+    TEST_ASSERT_EQUAL_UINT32(0, nmea_uint((nmea_field_t) { "", 0 }));
+    TEST_ASSERT_EQUAL_UINT32(353, nmea_uint((nmea_field_t) { "3531", 3 }));
+    TEST_ASSERT_EQUAL_FLOAT(0, nmea_float((nmea_field_t) { "", 0 }));
+    TEST_ASSERT_FLOAT_WITHIN(1e-6f, -12.5f, nmea_float((nmea_field_t) { "-12.5", 5 }));
+    /* 9 significant digits */
+    TEST_ASSERT_FLOAT_WITHIN(1e-9f, 1e-9f, nmea_float((nmea_field_t) { "0.0000000010001", 15 }));
+    TEST_ASSERT_FLOAT_WITHIN(0.125f, 1234567.89f, nmea_float((nmea_field_t) { "1234567.891", 11 }));
+
+    srand(42);
+    for (int i = 0; i < 1000; i++) {
+        char text[32];
+        int length = sprintf(text, "%d.%0*d", rand() % 10000, 1 + rand() % 5, rand() % 10000);
+        float expected = strtof(text, NULL);
+        TEST_ASSERT_FLOAT_WITHIN(expected * 2e-7f + 1e-7f, expected, nmea_float((nmea_field_t) { text, length }));
+    }
+}
+
+void test_nmea_decoder_matches_old_decoder()
+{
+    old_gps_t old = { .all_statements = ALL_STATEMENTS };
+    for (size_t i = 0; i < sizeof(epoch) / sizeof(epoch[0]); i++) {
+        old_decode(&old, lines[i]);
+        nmea_decode(&decoder, lines[i], strlen(lines[i]));
+    }
+    /* the old one rounded ddmm.mmmm to a float before splitting off the degrees */
+    TEST_ASSERT_FLOAT_WITHIN(1e-5f, old.parent.latitude, decoder.parent.latitude);
+    TEST_ASSERT_FLOAT_WITHIN(1e-5f, old.parent.longitude, decoder.parent.longitude);
+    TEST_ASSERT_FLOAT_WITHIN(1e-4f, old.parent.altitude, decoder.parent.altitude);
+    TEST_ASSERT_FLOAT_WITHIN(1e-6f, old.parent.dop_h, decoder.parent.dop_h);
+    TEST_ASSERT_FLOAT_WITHIN(1e-6f, old.parent.speed, decoder.parent.speed);
+    TEST_ASSERT_EQUAL_MEMORY(&old.parent.tim, &decoder.parent.tim, sizeof(gps_time_t));
+    TEST_ASSERT_EQUAL_MEMORY(&old.parent.date, &decoder.parent.date, sizeof(gps_date_t));
+    TEST_ASSERT_EQUAL_MEMORY(old.parent.sats_id_in_use, decoder.parent.sats_id_in_use, sizeof(old.parent.sats_id_in_use));
+    TEST_ASSERT_EQUAL_MEMORY(old.parent.sats_desc_in_view, decoder.parent.sats_desc_in_view, sizeof(old.parent.sats_desc_in_view));
+}
+
+static double now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+void test_nmea_decoder_benchmark()
+{
+    size_t count = sizeof(epoch) / sizeof(epoch[0]);
+    size_t lengths[sizeof(epoch) / sizeof(epoch[0])];
+    size_t bytes = 0;
+    for (size_t i = 0; i < count; i++) {
+        lengths[i] = strlen(lines[i]);
+        bytes += lengths[i];
+    }
+
+    /* best of a few runs, the host is shared */
+    old_gps_t old = { .all_statements = ALL_STATEMENTS };
+    int old_updates = 0, updates = 0;
+    double ref = 1e9, table = 1e9;
+    for (int run = 0; run < BENCH_RUNS; run++) {
+        double start = now_us();
+        for (int r = 0; r < BENCH_ROUNDS; r++)
+            for (size_t i = 0; i < count; i++)
+                old_updates += old_decode(&old, lines[i]);
+        double time = now_us() - start;
+        if (time < ref)
+            ref = time;
+
+        start = now_us();
+        for (int r = 0; r < BENCH_ROUNDS; r++)
+            for (size_t i = 0; i < count; i++)
+                updates += nmea_decode(&decoder, lines[i], lengths[i]) == NMEA_UPDATE;
+        time = now_us() - start;
+        if (time < table)
+            table = time;
+    }
+
+    TEST_ASSERT_EQUAL(BENCH_RUNS * BENCH_ROUNDS, old_updates);
+    TEST_ASSERT_EQUAL(BENCH_RUNS * BENCH_ROUNDS, updates);
+    printf("nmea decoder, best of %d runs of %d epochs with %zu sentences, %zu bytes\n", BENCH_RUNS, BENCH_ROUNDS, count, bytes);
+    printf("%-10s %10.1f ns/sentence %8.1f MB/s\n", "old", ref * 1000 / (BENCH_ROUNDS * count), bytes * BENCH_ROUNDS / ref);
+    printf("%-10s %10.1f ns/sentence %8.1f MB/s\n", "table", table * 1000 / (BENCH_ROUNDS * count), bytes * BENCH_ROUNDS / table);
+    printf("speedup %.1fx\n", ref / table);
+}
+
+int main(int argc, char** argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_nmea_decoder_gga);
+    RUN_TEST(test_nmea_decoder_south_west);
+    RUN_TEST(test_nmea_decoder_rmc_vtg);
+    RUN_TEST(test_nmea_decoder_gsa_gsv);
+    RUN_TEST(test_nmea_decoder_update_after_all_statements);
+    RUN_TEST(test_nmea_decoder_rejects_bad_checksum);
+    RUN_TEST(test_nmea_decoder_unknown_and_plugins);
+    RUN_TEST(test_nmea_decoder_numbers);
+    RUN_TEST(test_nmea_decoder_matches_old_decoder);
+    RUN_TEST(test_nmea_decoder_benchmark);
+    UNITY_END();
+}
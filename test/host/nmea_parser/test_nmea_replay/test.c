@@ -0,0 +1,147 @@
+#include <unity.h>
+#include "nmea_replay.h"
+#include "pmtk_parser.h"
+#include "pq_parser.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LOG_PATH "test/host/nmea_parser/test_nmea_replay/l96.nmea"
+#define GOLDEN_PATH "test/host/nmea_parser/test_nmea_replay/l96.golden"
+
+static const nmea_parser_plugin_t plugins[GPS_MAX_PARSER_PLUGINS] = {
+    { .detect = pmtk_detect, .parse = pmtk_parse },
+    { .detect = pq_detect, .parse = pq_parse },
+};
+
+typedef struct {
+    FILE* golden;
+    uint32_t fixes;
+    uint32_t mismatches;
+    char first_expected[NMEA_REPLAY_LINE];
+    char first_decoded[NMEA_REPLAY_LINE];
+} golden_check_t;
+
+static char* log_data;
+static size_t log_length;
+static nmea_replay_t replay;
+
+static void check_fix(void* arg, const gps_t* gps)
+{
+    golden_check_t* check = arg;
+    char line[NMEA_REPLAY_LINE];
+    char expected[NMEA_REPLAY_LINE];
+    nmea_replay_format(gps, line, sizeof(line));
+    if (!fgets(expected, sizeof(expected), check->golden))
+        expected[0] = '\0';
+    if (strcmp(line, expected) != 0 && check->mismatches++ == 0) {
+        strcpy(check->first_expected, expected);
+        strcpy(check->first_decoded, line);
+    }
+    check->fixes++;
+}
+
+static void count_fix(void* arg, const gps_t* gps)
+{
+    (*(uint32_t*)arg)++;
+}
+
+void setUp()
+{
+    FILE* file = fopen(LOG_PATH, "rb");
+    TEST_ASSERT_NOT_NULL(file);
+    fseek(file, 0, SEEK_END);
+    log_length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    log_data = malloc(log_length);
+    TEST_ASSERT_EQUAL(log_length, fread(log_data, 1, log_length, file));
+    fclose(file);
+}
+
+void tearDown()
+{
+    free(log_data);
+}
+
+void test_replay_matches_golden_output()
+{
+    golden_check_t check = { .golden = fopen(GOLDEN_PATH, "r") };
+    TEST_ASSERT_NOT_NULL(check.golden);
+    nmea_replay_init(&replay, NMEA_REPLAY_MAX_SPEED, plugins, check_fix, &check);
+    nmea_replay_run(&replay, log_data, log_length);
+
+    TEST_ASSERT_EQUAL_STRING(check.first_expected, check.first_decoded);
+    TEST_ASSERT_EQUAL(0, check.mismatches);
+    TEST_ASSERT_EQUAL(EOF, fgetc(check.golden));
+    fclose(check.golden);
+
+    /* 23 epochs, one lost its GGA to a flipped bit */
+    TEST_ASSERT_EQUAL_UINT32(185, replay.stats.sentences);
+    TEST_ASSERT_EQUAL_UINT32(22, replay.stats.updates);
+    TEST_ASSERT_EQUAL_UINT32(22, check.fixes);
+    /* $GPTXT */
+    TEST_ASSERT_EQUAL_UINT32(1, replay.stats.unknown);
+    /* the flipped bit and a cut off $GPGSV */
+    TEST_ASSERT_EQUAL_UINT32(2, replay.stats.invalid);
+    TEST_ASSERT_EQUAL_UINT64(log_length, replay.stats.bytes);
+}
+
+void test_replay_latency_statistics()
+{
+    nmea_replay_init(&replay, NMEA_REPLAY_MAX_SPEED, plugins, NULL, NULL);
+    for (int i = 0; i < 10; i++)
+        nmea_replay_run(&replay, log_data, log_length);
+
+    nmea_replay_stats_t* stats = &replay.stats;
+    TEST_ASSERT_EQUAL_UINT32(1850, stats->sentences);
+    uint32_t histogram = 0;
+    for (int i = 0; i < NMEA_REPLAY_BUCKETS; i++)
+        histogram += stats->histogram[i];
+    TEST_ASSERT_EQUAL_UINT32(stats->sentences, histogram);
+    TEST_ASSERT_TRUE(stats->min_ns <= stats->max_ns);
+    TEST_ASSERT_TRUE(stats->decode_ns <= stats->wall_ns);
+    TEST_ASSERT_TRUE(nmea_replay_percentile(stats, 50) <= nmea_replay_percentile(stats, 99));
+    TEST_ASSERT_TRUE(nmea_replay_percentile(stats, 100) >= stats->max_ns);
+    nmea_replay_report(stats, stdout);
+}
+
+void test_replay_line_endings()
+{
+    /* LF only, blank lines, noise and no newline at the end */
+    const char log[] = "\n"
+                       "$GNRMC,101500.000,A,4916.4500,N,00842.3350,E,0.00,0.00,120523,,,A*72\n"
+                       "garbage without a sentence\r\n"
+                       "\r\n"
+                       "$GNRMC,101501.000,A,4916.4500,N,00842.3350,E,0.00,0.00,120523,,,A*73";
+    nmea_replay_init(&replay, NMEA_REPLAY_MAX_SPEED, plugins, NULL, NULL);
+    nmea_replay_run(&replay, log, sizeof(log) - 1);
+    TEST_ASSERT_EQUAL_UINT32(2, replay.stats.sentences);
+    TEST_ASSERT_EQUAL_UINT32(0, replay.stats.invalid);
+    TEST_ASSERT_EQUAL_UINT8(1, replay.decoder.parent.tim.second);
+}
+
+void test_replay_in_real_time()
+{
+    const char log[] = "$GNRMC,101500.000,A,4916.4500,N,00842.3350,E,0.00,0.00,120523,,,A*72\r\n"
+                       "$GNRMC,101500.200,A,4916.4500,N,00842.3350,E,0.00,0.00,120523,,,A*70\r\n"
+                       "$GNRMC,101500.400,A,4916.4500,N,00842.3350,E,0.00,0.00,120523,,,A*76\r\n";
+    uint32_t fixes = 0;
+    nmea_replay_init(&replay, NMEA_REPLAY_REAL_TIME, plugins, count_fix, &fixes);
+    replay.decoder.all_statements = 1 << STATEMENT_RMC;
+    nmea_replay_run(&replay, log, sizeof(log) - 1);
+    TEST_ASSERT_EQUAL_UINT32(3, fixes);
+    TEST_ASSERT_EQUAL_UINT32(0, replay.stats.invalid);
+    TEST_ASSERT_TRUE(replay.stats.wall_ns >= 400000000);
+    TEST_ASSERT_TRUE(replay.stats.wall_ns < 1000000000);
+}
+
+int main(int argc, char** argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_replay_matches_golden_output);
+    RUN_TEST(test_replay_latency_statistics);
+    RUN_TEST(test_replay_line_endings);
+    RUN_TEST(test_replay_in_real_time);
+    UNITY_END();
+}
@@ -0,0 +1,352 @@
+#include <unity.h>
+#include "pmtk_aiding.h"
+#include "pmtk_parser.h"
+#include "pq_parser.h"
+#include "memory.h"
+#include "queue.h"
+
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define UTC 1683886500 // 2023-05-12T10:15:00Z
+#define GPS_HOUR 379978
+#define MAX_COMMANDS 160
+
+static const nmea_parser_plugin_t plugins[GPS_MAX_PARSER_PLUGINS] = {
+    { .detect = pmtk_detect, .parse = pmtk_parse },
+    { .detect = pq_detect, .parse = pq_parse },
+};
+
+/* stands in for the L96 on the other end of the UART, a socket pair */
+typedef struct {
+    int fd;
+    char commands[MAX_COMMANDS][PMTK_AIDING_COMMAND];
+    uint16_t count;
+    int16_t fail;        /// answer this command with flag 2
+    int16_t drop;        /// do not answer this command
+    uint16_t unsupported; /// packet type answered with flag 1
+    uint16_t broken;      /// commands without a valid checksum
+} receiver_t;
+
+static int master, slave;
+static volatile int running;
+static int started;
+static pthread_t receiver_thread, parser_thread;
+static receiver_t receiver;
+static queue_t* acks;
+static nmea_decoder_t decoder;
+
+static uint8_t checksum(const char* text, size_t length)
+{
+    uint8_t crc = 0;
+    for (size_t i = 0; i < length; i++)
+        crc ^= text[i];
+    return crc;
+}
+
+static void answer(int fd, const char* body)
+{
+    char line[128];
+    int length = snprintf(line, sizeof(line), "$%s*%02X\r\n", body, checksum(body, strlen(body)));
+    if (write(fd, line, length) != length)
+        receiver.broken++;
+}
+
+/* lines of a file descriptor, NULL once running is cleared */
+static char* read_line(int fd, char* line, size_t size, size_t* length)
+{
+    while (running) {
+        char* eol = memchr(line, '\n', *length);
+        if (eol) {
+            *eol = '\0';
+            return line;
+        }
+        struct pollfd p = { .fd = fd, .events = POLLIN };
+        if (poll(&p, 1, 20) <= 0)
+            continue;
+        ssize_t n = read(fd, line + *length, size - *length - 1);
+        if (n > 0)
+            *length += n;
+    }
+    return NULL;
+}
+
+static void next_line(char* line, size_t* length)
+{
+    size_t used = strlen(line) + 1;
+    memmove(line, line + used, *length - used);
+    *length -= used;
+}
+
+static void* run_receiver(void* arg)
+{
+    receiver_t* r = arg;
+    char line[512];
+    size_t length = 0;
+    while (read_line(r->fd, line, sizeof(line), &length)) {
+        /* "$PMTKnnn,...*hh\r" */
+        char* star = strrchr(line, '*');
+        if (line[0] != '$' || !star || strtoul(star + 1, NULL, 16) != checksum(line + 1, star - line - 1))
+            r->broken++;
+        uint16_t n = r->count++;
+        strncpy(r->commands[n % MAX_COMMANDS], line, PMTK_AIDING_COMMAND - 1);
+        unsigned packet_type = strtoul(line + 5, NULL, 10);
+        next_line(line, &length);
+
+        /* the receiver goes on with its sentences in between */
+        answer(r->fd, "GNRMC,101500.000,A,4916.4500,N,00842.3350,E,0.00,0.00,120523,,,A");
+        answer(r->fd, "PMTK001,353,3,1,1,1,0,0,15");
+        if (n == r->drop)
+            continue;
+        char body[32];
+        snprintf(body, sizeof(body), "PMTK001,%u,%u", packet_type, packet_type == r->unsupported ? 1 : n == r->fail ? 2 : 3);
+        answer(r->fd, body);
+    }
+    return NULL;
+}
+
+/* like the parser task of the firmware */
+static void* run_parser(void* arg)
+{
+    char line[512];
+    size_t length = 0;
+    while (read_line(slave, line, sizeof(line), &length)) {
+        nmea_decode(&decoder, line, strlen(line));
+        next_line(line, &length);
+    }
+    return NULL;
+}
+
+static void queue_ack(void* arg, const pmtk_ack_t* ack)
+{
+    queue_send(arg, ack, 0);
+}
+
+static esp_err_t send_command(void* arg, const char* command)
+{
+    size_t length = strlen(command);
+    return write(slave, command, length) == (ssize_t)length ? ESP_OK : ESP_FAIL;
+}
+
+static int wait_ack(void* arg, uint16_t packet_type, uint32_t timeout_ms)
+{
+    pmtk_ack_t ack;
+    while (queue_receive(arg, &ack, timeout_ms) == PM_OK)
+        if (ack.packet_type == packet_type)
+            return ack.flag;
+    return -1;
+}
+
+static pmtk_link_t uart = { .send = send_command, .wait_ack = wait_ack };
+
+void setUp()
+{
+    int fds[2];
+    TEST_ASSERT_EQUAL(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    master = fds[0];
+    slave = fds[1];
+
+    memset(&receiver, 0, sizeof(receiver));
+    receiver.fd = master;
+    receiver.fail = -1;
+    receiver.drop = -1;
+    acks = queue_create(8, sizeof(pmtk_ack_t));
+    uart.arg = acks;
+    nmea_decoder_init(&decoder, nmea_decoder_statements(), plugins);
+    pmtk_set_ack_handler(queue_ack, acks);
+}
+
+static void start()
+{
+    running = 1;
+    started = 1;
+    pthread_create(&receiver_thread, NULL, run_receiver, &receiver);
+    pthread_create(&parser_thread, NULL, run_parser, NULL);
+}
+
+void tearDown()
+{
+    running = 0;
+    if (started) {
+        pthread_join(receiver_thread, NULL);
+        pthread_join(parser_thread, NULL);
+        started = 0;
+    }
+    pmtk_set_ack_handler(NULL, NULL);
+    close(slave);
+    close(master);
+    queue_delete(acks);
+    TEST_ASSERT_EQUAL(0, receiver.broken);
+}
+
+void test_aiding_commands()
+{
+    char command[PMTK_AIDING_COMMAND];
+    TEST_ASSERT_EQUAL(33, pmtk_time_aiding(UTC, command, sizeof(command)));
+    TEST_ASSERT_EQUAL_STRING("$PMTK740,2023,05,12,10,15,00*31\r\n", command);
+
+    pmtk_position_aiding(492741666, 87055833, 1123, UTC, command, sizeof(command));
+    TEST_ASSERT_EQUAL_STRING("$PMTK741,49.274167,8.705583,112,2023,05,12,10,15,00*16\r\n", command);
+
+    pmtk_position_aiding(-338567840, -1512152970, -35, UTC, command, sizeof(command));
+    TEST_ASSERT_EQUAL_STRING("$PMTK741,-33.856784,-151.215297,-3,2023,05,12,10,15,00*3D\r\n", command);
+
+    TEST_ASSERT_EQUAL_UINT32(GPS_HOUR, pmtk_gps_hour(UTC));
+    TEST_ASSERT_EQUAL_UINT32(0, pmtk_gps_hour(0));
+}
+
+void test_epo_command()
+{
+    uint8_t record[PMTK_EPO_RECORD];
+    char command[PMTK_AIDING_COMMAND];
+    for (uint8_t i = 0; i < PMTK_EPO_RECORD; i++)
+        record[i] = i;
+    size_t length = pmtk_epo_command(32, record, command, sizeof(command));
+    TEST_ASSERT_EQUAL(strlen(command), length);
+    TEST_ASSERT_EQUAL_STRING_LEN("$PMTK721,32,03020100,07060504,0B0A0908,", command, 39);
+    TEST_ASSERT_EQUAL_STRING_LEN(",47464544*", command + length - 14, 10);
+    TEST_ASSERT_EQUAL_UINT32(0x020100, pmtk_epo_hour(record));
+}
+
+void test_aid_over_uart()
+{
+    start();
+    TEST_ASSERT_EQUAL(ESP_OK, pmtk_aid(&uart, 492741666, 87055833, 1123, UTC));
+    TEST_ASSERT_EQUAL(2, receiver.count);
+    TEST_ASSERT_EQUAL_STRING("$PMTK740,2023,05,12,10,15,00*31\r", receiver.commands[0]);
+    TEST_ASSERT_EQUAL_STRING("$PMTK741,49.274167,8.705583,112,2023,05,12,10,15,00*16\r", receiver.commands[1]);
+}
+
+void test_command_is_sent_again()
+{
+    /* the first try fails, the acknowledge of the second is lost */
+    receiver.fail = 0;
+    receiver.drop = 1;
+    start();
+    TEST_ASSERT_EQUAL(ESP_OK, pmtk_aid(&uart, 492741666, 87055833, 1123, UTC));
+    TEST_ASSERT_EQUAL(4, receiver.count);
+    TEST_ASSERT_EQUAL_STRING(receiver.commands[0], receiver.commands[1]);
+    TEST_ASSERT_EQUAL_STRING(receiver.commands[0], receiver.commands[2]);
+    TEST_ASSERT_EQUAL_STRING_LEN("$PMTK741,", receiver.commands[3], 9);
+}
+
+void test_unsupported_command_is_not_repeated()
+{
+    receiver.unsupported = 741;
+    start();
+    TEST_ASSERT_EQUAL(ESP_ERR_NOT_SUPPORTED, pmtk_aid(&uart, 492741666, 87055833, 1123, UTC));
+    TEST_ASSERT_EQUAL(2, receiver.count);
+}
+
+/* six segments, starting two before the one that is valid now */
+#define EPO_SEGMENTS 6
+#define EPO_FIRST_HOUR (GPS_HOUR - GPS_HOUR % PMTK_EPO_SEGMENT_HOURS - 2 * PMTK_EPO_SEGMENT_HOURS)
+static uint8_t epo[EPO_SEGMENTS * PMTK_EPO_SEGMENT];
+static size_t epo_size;
+
+static void make_epo()
+{
+    for (uint32_t i = 0; i < sizeof(epo); i++)
+        epo[i] = i * 7 + i / 251;
+    for (uint8_t s = 0; s < EPO_SEGMENTS; s++) {
+        for (uint8_t satellite = 0; satellite < PMTK_EPO_SATELLITES; satellite++) {
+            uint8_t* record = &epo[s * PMTK_EPO_SEGMENT + satellite * PMTK_EPO_RECORD];
+            uint32_t hour = EPO_FIRST_HOUR + s * PMTK_EPO_SEGMENT_HOURS;
+            /* no orbit for PRN 5 */
+            if (satellite == 4)
+                memset(record, 0, PMTK_EPO_RECORD);
+            else
+                memcpy(record, &hour, 3);
+        }
+    }
+    epo_size = sizeof(epo);
+}
+
+static size_t read_epo(void* arg, uint32_t offset, uint8_t* data, size_t length)
+{
+    if (offset >= epo_size)
+        return 0;
+    if (length > epo_size - offset)
+        length = epo_size - offset;
+    memcpy(data, &epo[offset], length);
+    return length;
+}
+
+void test_epo_upload()
+{
+    char command[PMTK_AIDING_COMMAND];
+    make_epo();
+    start();
+    TEST_ASSERT_EQUAL(ESP_OK, pmtk_epo_upload(&uart, read_epo, NULL, UTC));
+
+    /* the old orbits are cleared, then a day from the current segment on */
+    TEST_ASSERT_EQUAL(1 + 4 * (PMTK_EPO_SATELLITES - 1), receiver.count);
+    TEST_ASSERT_EQUAL_STRING("$PMTK127*36\r", receiver.commands[0]);
+    uint16_t n = 1;
+    for (uint8_t s = 2; s < 2 + PMTK_EPO_SEGMENTS; s++)
+        for (uint8_t satellite = 0; satellite < PMTK_EPO_SATELLITES; satellite++) {
+            if (satellite == 4)
+                continue;
+            size_t length = pmtk_epo_command(satellite + 1, &epo[s * PMTK_EPO_SEGMENT + satellite * PMTK_EPO_RECORD], command, sizeof(command));
+            command[length - 1] = '\0';
+            TEST_ASSERT_EQUAL_STRING(command, receiver.commands[n++]);
+        }
+}
+
+void test_epo_upload_until_end_of_file()
+{
+    make_epo();
+    /* the current segment and one more */
+    epo_size = 4 * PMTK_EPO_SEGMENT;
+    start();
+    TEST_ASSERT_EQUAL(ESP_OK, pmtk_epo_upload(&uart, read_epo, NULL, UTC));
+    TEST_ASSERT_EQUAL(1 + 2 * (PMTK_EPO_SATELLITES - 1), receiver.count);
+}
+
+void test_epo_upload_in_steps()
+{
+    pmtk_epo_upload_t upload;
+    make_epo();
+    start();
+    TEST_ASSERT_EQUAL(ESP_OK, pmtk_epo_begin(&upload, &uart, read_epo, NULL, UTC));
+    TEST_ASSERT_EQUAL(1, receiver.count);
+    uint16_t steps = 1;
+    while (pmtk_epo_step(&upload, &uart, 10) == ESP_ERR_NOT_FINISHED) {
+        TEST_ASSERT_EQUAL(1 + 10 * steps, receiver.count);
+        steps++;
+    }
+    TEST_ASSERT_EQUAL(1 + 4 * (PMTK_EPO_SATELLITES - 1), receiver.count);
+    TEST_ASSERT_EQUAL(4 * (PMTK_EPO_SATELLITES - 1), upload.records);
+    TEST_ASSERT_EQUAL(13, steps);
+}
+
+void test_epo_without_current_orbits()
+{
+    make_epo();
+    start();
+    TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND, pmtk_epo_upload(&uart, read_epo, NULL, UTC - 3 * 86400));
+    TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND, pmtk_epo_upload(&uart, read_epo, NULL, UTC + 3 * 86400));
+    epo_size = 0;
+    TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND, pmtk_epo_upload(&uart, read_epo, NULL, UTC));
+    TEST_ASSERT_EQUAL(0, receiver.count);
+}
+
+int main(int argc, char** argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_aiding_commands);
+    RUN_TEST(test_epo_command);
+    RUN_TEST(test_aid_over_uart);
+    RUN_TEST(test_command_is_sent_again);
+    RUN_TEST(test_unsupported_command_is_not_repeated);
+    RUN_TEST(test_epo_upload);
+    RUN_TEST(test_epo_upload_until_end_of_file);
+    RUN_TEST(test_epo_upload_in_steps);
+    RUN_TEST(test_epo_without_current_orbits);
+    UNITY_END();
+}